@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "message_log.h"
+
+#define ACK_BATCH_MAX LOG_GROUP_COMMIT_MAX			// publisher ACKs held for one group commit
+
+/**
+ * ack_batch_commit_cb - make every record appended so far durable
+ *
+ * Return: 0 on success, -1 on failure
+ */
+typedef int (*ack_batch_commit_cb)(void);
+
+/**
+ * ack_batch_send_cb - send one publisher ACK released by a commit
+ */
+typedef void (*ack_batch_send_cb)(uint32_t session, uint8_t qos, uint32_t msg_id, void* ctx);
+
+/**
+ * ack_batch_init - start with an empty batch
+ *
+ * Publisher ACKs of logged records are held until one commit covers them all
+ * (group commit). While commits fail they stay held, and once ACK_BATCH_MAX
+ * are waiting further ACKs are dropped so their publishers retransmit.
+ *
+ * @commit: makes appended records durable
+ * @send: sends a released ACK
+ * @ctx: passed to @send
+ */
+void ack_batch_init(ack_batch_commit_cb commit, ack_batch_send_cb send, void* ctx);
+
+/**
+ * ack_batch_defer - hold an ACK until the next commit, committing a full batch first
+ *
+ * Return: true if the ACK is held, false if it was dropped because the batch
+ *         is full and the commit emptying it failed
+ */
+bool ack_batch_defer(uint32_t session, uint8_t qos, uint32_t msg_id);
+
+/**
+ * ack_batch_flush - commit, then send every held ACK
+ *
+ * Return: 0 on success, -1 if the commit failed and the ACKs are still held
+ */
+int ack_batch_flush(void);
+
+/**
+ * ack_batch_forget - drop the held ACKs of sessions for which @gone returns true
+ */
+void ack_batch_forget(bool (*gone)(uint32_t session, void* ctx), void* ctx);
+
+/**
+ * ack_batch_count - number of held ACKs
+ */
+size_t ack_batch_count(void);
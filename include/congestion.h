@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CC_INITIAL_WINDOW 4							// publishes in flight before the first ACK
+#define CC_MIN_RTO_US 5000							// retransmit timeout floor once RTT is measured
+#define CC_DELAY_ALPHA 2								// delay mode grows while fewer publishes queue
+#define CC_DELAY_BETA 4									// delay mode shrinks while more publishes queue
+
+typedef enum {
+	CC_OFF   = 0,										// no window beyond the in-flight table
+	CC_AIMD  = 1,										// slow start, +1 per window of ACKs, halve on loss
+	CC_DELAY = 2										// AIMD on loss, steered by queueing delay in between
+} cc_mode_t;
+
+/**
+ * cc_state_t - congestion window of one client's reliable publishes
+ *
+ * Loss is a publish whose ACK did not come back within the retransmit
+ * timeout. One loss per round trip halves @cwnd; the losses of the same
+ * window that follow are counted but not acted on again.
+ *
+ * In CC_DELAY mode the window is also adjusted once per round trip,
+ * before any loss, by the number of publishes queued at the bottleneck:
+ * cwnd * (srtt - min_rtt) / srtt, kept between CC_DELAY_ALPHA and
+ * CC_DELAY_BETA (Vegas).
+ */
+typedef struct {
+	cc_mode_t mode;
+	uint32_t cwnd;										// publishes allowed in flight
+	uint32_t ssthresh;								// slow start ends here
+	uint32_t max_window;							// the user's cap on @cwnd
+	uint32_t in_flight;
+	uint32_t acked;										// ACKs towards the next window increase
+	uint32_t srtt_us;									// smoothed round trip time, 0 = not measured
+	uint32_t rttvar_us;
+	uint32_t min_rtt_us;
+	uint64_t recovery_until_us;				// losses before this belong to the last decrease
+	uint64_t losses;
+} cc_state_t;
+
+/**
+ * cc_init - start a congestion window
+ *
+ * @max_window: upper bound of the window, at least 1
+ */
+void cc_init(cc_state_t* cc, cc_mode_t mode, uint32_t max_window);
+
+/**
+ * cc_window - publishes currently allowed in flight
+ */
+uint32_t cc_window(const cc_state_t* cc);
+
+/**
+ * cc_on_ack - a publish was acknowledged
+ *
+ * @rtt_us: time from its only transmission to the ACK, 0 if it was
+ *          retransmitted and the sample is ambiguous (Karn)
+ */
+void cc_on_ack(cc_state_t* cc, uint32_t rtt_us);
+
+/**
+ * cc_on_loss - a publish timed out and is retransmitted
+ */
+void cc_on_loss(cc_state_t* cc, uint64_t now_us);
+
+/**
+ * cc_rto_ms - retransmit timeout from the measured round trip time
+ *
+ * @max_ms: the user's retry timeout, used until the RTT is known and never exceeded
+ *
+ * Return: srtt + 4 * rttvar in milliseconds, between CC_MIN_RTO_US and @max_ms
+ */
+int cc_rto_ms(const cc_state_t* cc, int max_ms);
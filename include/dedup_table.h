@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "timer_wheel.h"
+#include "hash_table.h"
+
+#define DEDUP_WINDOW_SIZE 256						// recent QoS 1 msg_ids remembered per publisher
+
+/**
+ * dedup_publisher_t - QoS 1 msg_ids recently accepted from one publisher
+ *
+ * Bit i of @seen stands for msg_id (base + i). The window slides forward as
+ * newer msg_ids arrive. Ids that fall behind it are forgotten, so a very late
+ * retransmit is forwarded again rather than risk dropping a new message.
+ */
+typedef struct dedup_publisher {
+	uint32_t session;									// broker session id of the publisher
+	uint32_t base;										// oldest msg_id inside the window
+	uint64_t seen[DEDUP_WINDOW_SIZE / 64];
+	timer_node_t expiry;							// re-armed on every accepted publish
+	struct dedup_publisher* lru_prev;	// least recently active first
+	struct dedup_publisher* lru_next;	// also links the free list
+} dedup_publisher_t;
+
+/**
+ * dedup_table_init - allocate the QoS 1 duplicate filter
+ *
+ * Publisher records come from one pool sized to @memory_budget. When it is
+ * exhausted, the least recently active publisher is evicted.
+ *
+ * @wheel: timer wheel driven by the broker loop
+ * @memory_budget: bytes available for publisher records and their index
+ * @expiry_ms: idle time after which a publisher's window is dropped
+ *
+ * Return: 0 on success, -1 on allocation failure or a budget below one record
+ */
+int dedup_table_init(timer_wheel_t* wheel, size_t memory_budget, uint32_t expiry_ms);
+
+void dedup_table_destroy(void);
+
+/**
+ * dedup_table_check_and_mark - record a QoS 1 publish, report whether it is a retransmit
+ *
+ * @session: broker session id of the publisher
+ * @msg_id: publisher-assigned msg_id
+ *
+ * Return: true if the publish was already accepted and must not be forwarded again
+ */
+bool dedup_table_check_and_mark(uint32_t session, uint32_t msg_id);
+
+/**
+ * dedup_table_forget - drop the window of a session that went away
+ *
+ * Session ids are reused, so a new session must not inherit the old window.
+ */
+void dedup_table_forget(uint32_t session);
+
+/**
+ * dedup_table_count - number of publishers currently tracked
+ */
+size_t dedup_table_count(void);
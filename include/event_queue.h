@@ -9,6 +9,7 @@
 
 typedef struct {
 	uint8_t msg_type;
+	uint32_t session_id;			// session the event belongs to, 0 for the client itself
 	uint32_t msg_id;
 	char topic[MAX_TOPIC_LEN];
 	uint8_t* data;
@@ -23,6 +24,8 @@ typedef struct {
 
 	pthread_mutex_t lock;
 	pthread_cond_t not_empty;
+
+	int event_fd;		// eventfd, readable while the queue is non-empty (-1 if unavailable)
 } slimmq_event_queue_t;
 
 /*
@@ -54,6 +57,14 @@ void event_queue_destroy(slimmq_event_queue_t* q);
 int event_queue_push(slimmq_event_queue_t* q, uint8_t msg_type, uint32_t msg_id,
 										const char* topic, const void* data, size_t len);
 
+/*
+ * event_queue_push_session: event_queue_push() for an event of a multiplexed session
+ *
+ * @session_id: session the event is addressed to
+ */
+int event_queue_push_session(slimmq_event_queue_t* q, uint32_t session_id, uint8_t msg_type,
+															uint32_t msg_id, const char* topic, const void* data, size_t len);
+
 /*
  * event_queue_pop: 
  *
@@ -64,6 +75,25 @@ int event_queue_push(slimmq_event_queue_t* q, uint8_t msg_type, uint32_t msg_id,
  */
 int event_queue_pop(slimmq_event_queue_t* q, slimmq_event_t* out_event);
 
+/*
+ * event_queue_pop_batch: pop up to @max_events events under one lock acquisition
+ *
+ * @q: queue to pop
+ * @out_events: array where popped events go out (caller frees each data)
+ * @max_events: capacity of @out_events
+ * @timeout_ms: -1 to block until an event arrives, 0 for non-blocking,
+ *              otherwise the maximum time to wait in milliseconds
+ *
+ * Return: number of popped events, 0 on timeout/empty queue, -1 on invalid args
+ */
+int event_queue_pop_batch(slimmq_event_queue_t* q, slimmq_event_t* out_events,
+													size_t max_events, int timeout_ms);
+
+/*
+ * event_queue_free_slots: number of events the queue can still accept
+ */
+size_t event_queue_free_slots(slimmq_event_queue_t* q);
+
 /**
  * event_queue_wait_ack - 
  */
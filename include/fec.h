@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "slim_msg.h"
+
+#define FEC_MAX_BLOCK 16								// data packets per block at most (K)
+#define FEC_MAX_PARITY 4								// parity packets per block at most (M)
+#define FEC_WINDOW (2 * FEC_MAX_BLOCK)	// received packets a decoder keeps for repair
+
+// CONTROL_FEC data: [uint16_t stream][uint32_t first][uint8_t k][uint8_t m][uint8_t index][uint16_t len_xor][parity]
+#define FEC_PARITY_HEADER_SIZE 11
+#define FEC_MAX_BODY (2048 - sizeof(slim_msg_header_t) - 1 - FEC_PARITY_HEADER_SIZE)
+
+/**
+ * fec_encoder_t - parity of the block of QoS 0 deliveries being sent
+ *
+ * A block is @k consecutive sequence numbers starting at @first. Parity
+ * @index is the XOR of the bodies (everything after the header) of the
+ * block's packets first + index, first + index + m, ..., so the receiver
+ * rebuilds one lost packet per parity, and any burst of up to @m consecutive
+ * losses. Shorter bodies count as zero-padded; their lengths are XORed too.
+ */
+typedef struct {
+	uint8_t k;
+	uint8_t m;
+	uint32_t first;										// sequence number of the block's first packet
+	uint8_t filled;										// packets folded into the block so far
+	bool oversized;										// a body beyond FEC_MAX_BODY, the block is not protected
+	uint16_t len_xor[FEC_MAX_PARITY];
+	uint16_t parity_len[FEC_MAX_PARITY];
+	uint8_t parity[FEC_MAX_PARITY][FEC_MAX_BODY];
+} fec_encoder_t;
+
+/**
+ * fec_slot_t - one packet body a decoder received or rebuilt
+ */
+typedef struct {
+	uint32_t seq;
+	bool present;
+	uint16_t len;
+	uint8_t* body;
+	size_t capacity;									// allocated size of @body, reused by later packets
+} fec_slot_t;
+
+/**
+ * fec_decoder_t - recent packets of one protected stream, indexed by seq % FEC_WINDOW
+ */
+typedef struct {
+	fec_slot_t slots[FEC_WINDOW];
+} fec_decoder_t;
+
+/**
+ * fec_encoder_init - start encoding blocks of @k packets with @m parity packets each
+ *
+ * Return: 0 on success, -1 if @k or @m is out of range (m must not exceed k)
+ */
+int fec_encoder_init(fec_encoder_t* e, uint8_t k, uint8_t m);
+
+/**
+ * fec_encoder_add - fold the body of the next packet into the current block
+ *
+ * Return: true when the packet completed the block and its parity can be sent
+ */
+bool fec_encoder_add(fec_encoder_t* e, uint32_t seq, const uint8_t* body, size_t len);
+
+/**
+ * fec_encoder_parity - serialize CONTROL_FEC data for parity @index of a completed block
+ *
+ * @stream: stream id the block belongs to
+ * @out: output buffer
+ * @size: size of @out
+ *
+ * Return: length written, 0 if the block is not protected or @out is too small
+ */
+size_t fec_encoder_parity(const fec_encoder_t* e, uint16_t stream, uint8_t index,
+													uint8_t* out, size_t size);
+
+/**
+ * fec_encoder_next_block - clear the parity of a completed block
+ */
+void fec_encoder_next_block(fec_encoder_t* e);
+
+/**
+ * fec_decoder_store - remember a received packet body for later repair
+ *
+ * A body that cannot be kept is not delivered either: @seq stays missing, so
+ * a parity can still rebuild it instead of handing it on twice.
+ *
+ * Return: false if @seq was already received or rebuilt (a duplicate), or
+ *         its body could not be stored
+ */
+bool fec_decoder_store(fec_decoder_t* d, uint32_t seq, const uint8_t* body, size_t len);
+
+/**
+ * fec_decoder_repair - rebuild the packet a parity covers, if exactly one is missing
+ *
+ * The rebuilt body is not stored; deliver it through fec_decoder_store() like
+ * a received one, so the original arriving late is dropped as a duplicate.
+ *
+ * @data: CONTROL_FEC data
+ * @len: length of @data
+ * @seq: output sequence number of the rebuilt packet
+ * @out: output buffer for the rebuilt body
+ * @size: size of @out
+ *
+ * Return: length of the rebuilt body, 0 if nothing could be rebuilt (nothing
+ *         or several packets missing, or the block left the window)
+ */
+size_t fec_decoder_repair(fec_decoder_t* d, const uint8_t* data, size_t len,
+													uint32_t* seq, uint8_t* out, size_t size);
+
+void fec_decoder_free(fec_decoder_t* d);
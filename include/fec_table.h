@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "fec.h"
+
+#define FEC_MAX_RULES 32
+#define FEC_MAX_STREAMS 256							// protected topics tracked at once
+
+/**
+ * fec_rule_t - topics whose QoS 0 deliveries carry @m parity packets per @k
+ */
+typedef struct {
+	char filter[256];
+	uint8_t k;
+	uint8_t m;
+} fec_rule_t;
+
+/**
+ * fec_stream_t - numbering and parity of one protected topic
+ *
+ * QoS 0 deliveries of the topic carry the stream id in topic_id and their
+ * sequence number (from 1) in msg_id, so receivers can tell which packet of a
+ * block a parity is missing.
+ */
+typedef struct {
+	uint16_t id;											// never 0
+	uint32_t next_seq;
+	fec_encoder_t encoder;
+} fec_stream_t;
+
+/**
+ * fec_rule_add - protect QoS 0 traffic of topics matching @filter
+ *
+ * @k: data packets per block
+ * @m: parity packets per block, the overhead is m/k
+ *
+ * Return: 0 on success, -1 if the table is full or @k/@m are out of range
+ */
+int fec_rule_add(const char* filter, uint8_t k, uint8_t m);
+
+/**
+ * fec_stream_for - stream of a published topic, created on first use
+ *
+ * Return: stream, or NULL if no rule covers the topic or it cannot be tracked
+ */
+fec_stream_t* fec_stream_for(const char* topic);
+
+/**
+ * fec_stream_stamp - number a QoS 0 delivery and fold it into the current block
+ *
+ * @packet: serialized delivery, topic_id and msg_id are rewritten
+ * @len: length of @packet
+ *
+ * Return: true when the delivery completed a block, whose parity is then sent
+ *         with fec_encoder_parity() before fec_encoder_next_block()
+ */
+bool fec_stream_stamp(fec_stream_t* s, uint8_t* packet, size_t len);
+
+size_t fec_stream_count(void);
+
+/**
+ * fec_table_destroy - drop every stream and rule
+ */
+void fec_table_destroy(void);
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define HASH_TABLE_MIN_CAPACITY 16
+#define HASH_TABLE_MAX_LOAD_PCT 80					// grow when the table is this full
+#define HASH_TABLE_MIGRATE_STEP 8						// old slots moved per operation while resizing
+
+/**
+ * hash_slot_t - one open-addressing slot, keys and values stored inline
+ *
+ * @dist is the probe distance from the key's home slot plus one (0 = empty).
+ */
+typedef struct {
+	uint64_t key;
+	uint64_t value;
+	uint32_t dist;
+} hash_slot_t;
+
+typedef struct {
+	hash_slot_t* slots;
+	size_t capacity;									// power of two
+	size_t count;
+} hash_array_t;
+
+/**
+ * hash_table_t - Robin Hood hash table with incremental resizing
+ *
+ * Lookups walk a short, contiguous probe sequence and stop as soon as they
+ * reach a slot that is closer to its home than the probe is. Deletion uses
+ * backward shifting, so there are no tombstones.
+ *
+ * Growing allocates a table twice as large and moves HASH_TABLE_MIGRATE_STEP
+ * old slots per subsequent operation, so no single call pays for a full rehash.
+ * Until migration finishes, lookups check both tables.
+ *
+ * A zeroed (or destroyed) table is a valid empty table.
+ */
+typedef struct {
+	hash_array_t cur;									// receives every insert
+	hash_array_t old;									// being drained into @cur, empty otherwise
+	size_t migrate_pos;								// next slot of @old to migrate
+} hash_table_t;
+
+/**
+ * hash_table_init - create an empty table with room for @capacity entries
+ *
+ * Return: 0 on success, -1 on allocation failure
+ */
+int hash_table_init(hash_table_t* t, size_t capacity);
+
+void hash_table_destroy(hash_table_t* t);
+
+/**
+ * hash_table_find - look up @key
+ *
+ * Return: pointer to the stored value (valid until the next insert or
+ *         removal), or NULL if @key is absent
+ */
+uint64_t* hash_table_find(hash_table_t* t, uint64_t key);
+
+/**
+ * hash_table_put - insert @key or overwrite its value
+ *
+ * Return: 0 on success, -1 on allocation failure
+ */
+int hash_table_put(hash_table_t* t, uint64_t key, uint64_t value);
+
+/**
+ * hash_table_remove - delete @key
+ *
+ * @out_value: output value that was stored, or NULL
+ *
+ * Return: true if @key was present
+ */
+bool hash_table_remove(hash_table_t* t, uint64_t key, uint64_t* out_value);
+
+size_t hash_table_count(const hash_table_t* t);
+
+/**
+ * hash_table_foreach - call @fn for every entry (the table must not be modified)
+ */
+void hash_table_foreach(hash_table_t* t,
+												void (*fn)(uint64_t key, uint64_t* value, void* ctx), void* ctx);
+
+/**
+ * hash_table_remove_if - delete every entry for which @pred returns true
+ *
+ * Finishes a pending resize first. @pred may see an entry twice when a
+ * deletion shifts it across the end of the table.
+ *
+ * Return: number of entries removed
+ */
+size_t hash_table_remove_if(hash_table_t* t,
+														bool (*pred)(uint64_t key, uint64_t value, void* ctx), void* ctx);
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define INFLIGHT_TABLE_SIZE 1024				// max QoS 1 publishes awaiting an ACK per client
+
+/**
+ * inflight_slot_t - one publish awaiting its ACK, indexed by msg_id % INFLIGHT_TABLE_SIZE
+ *
+ * @state packs (msg_id << 1 | acked) so an ACK can only complete the publish
+ * it names, never one that reclaimed the slot in between. 0 means free.
+ */
+typedef struct {
+	_Atomic uint64_t state;
+} inflight_slot_t;
+
+/**
+ * inflight_table_t - QoS 1 publishes of one client that are still waiting for an ACK
+ *
+ * Publishing threads claim and release slots, and the listener completes them,
+ * all with atomic operations. @wake_lock and @acked are only used to park
+ * publishers that have to wait. The listener touches them only while a waiter
+ * is registered.
+ */
+typedef struct {
+	inflight_slot_t slots[INFLIGHT_TABLE_SIZE];
+	atomic_int waiters;
+	pthread_mutex_t wake_lock;
+	pthread_cond_t acked;
+} inflight_table_t;
+
+void inflight_table_init(inflight_table_t* t);
+
+void inflight_table_destroy(inflight_table_t* t);
+
+/**
+ * inflight_claim - reserve the slot of a new publish before it is sent
+ *
+ * @t: client's in-flight table
+ * @msg_id: non-zero msg_id of the publish
+ *
+ * Return: 0 on success, -1 if the slot still belongs to an older publish
+ */
+int inflight_claim(inflight_table_t* t, uint32_t msg_id);
+
+/**
+ * inflight_ack - mark a publish acknowledged (listener thread)
+ *
+ * Return: true if @msg_id was in flight
+ */
+bool inflight_ack(inflight_table_t* t, uint32_t msg_id);
+
+/**
+ * inflight_ack_sack - mark every publish of a CONTROL_SACK frame acknowledged (listener thread)
+ *
+ * @first: first msg_id of the frame
+ * @bitmap: bit i acknowledges first + 1 + i
+ *
+ * Waiting publishers are woken once for the whole frame.
+ *
+ * Return: number of the frame's msg_ids that were in flight
+ */
+size_t inflight_ack_sack(inflight_table_t* t, uint32_t first, uint64_t bitmap);
+
+/**
+ * inflight_wait - block until @msg_id is acknowledged or @timeout_ms passes
+ *
+ * Return: true if the publish was acknowledged
+ */
+bool inflight_wait(inflight_table_t* t, uint32_t msg_id, int timeout_ms);
+
+/**
+ * inflight_release - free the slot of a finished (or abandoned) publish
+ */
+void inflight_release(inflight_table_t* t, uint32_t msg_id);
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define LOG_SEGMENT_SIZE (16 * 1024 * 1024)	// bytes per segment file
+#define LOG_GROUP_COMMIT_MAX 64							// max records appended per msync batch
+#define LOG_RECORD_MAGIC 0x534c4d51					// "SLMQ"
+#define LOG_CONSUMER_NAME_MAX 48						// bytes per consumer name, including NUL
+#define LOG_MAX_CONSUMERS 128								// named consumers with a committed offset
+
+/**
+ * log_record_header_t - on-disk layout of one record: [header][topic][data]
+ *
+ * @pending counts reliable deliveries still in flight. It is updated in place
+ * through the mapping, so records still pending after a restart are redelivered.
+ */
+#pragma pack(push, 1)
+typedef struct {
+	uint32_t magic;
+	uint32_t record_len;			// header + topic + data, padded to 8 bytes
+	uint64_t offset;					// log-wide record sequence number
+	uint64_t timestamp_ms;		// wall clock time of append
+	uint16_t pending;					// outstanding reliable deliveries
+	uint8_t qos;
+	uint8_t topic_len;
+	uint32_t data_len;
+} log_record_header_t;
+#pragma pack(pop)
+
+struct log_segment;
+
+/**
+ * log_ref_t - handle of a record, held by deliveries that reference it
+ *
+ * Also used as a read cursor, positioned before the record at @pos.
+ */
+typedef struct {
+	struct log_segment* segment;
+	uint32_t pos;
+} log_ref_t;
+
+/**
+ * log_record_cb - called for each record during recovery or a scan
+ */
+typedef void (*log_record_cb)(const log_ref_t* ref, const log_record_header_t* rec,
+															const char* topic, const void* data, void* ctx);
+
+/**
+ * message_log_open - open (or create) the durable log in @dir
+ *
+ * Existing segments are mapped and scanned so appends continue after the last
+ * valid record. A background compactor thread is started.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int message_log_open(const char* dir);
+
+/**
+ * message_log_close - commit, unmap every segment and stop the compactor
+ */
+void message_log_close(void);
+
+/**
+ * message_log_enabled - check whether a durable log is open
+ */
+bool message_log_enabled(void);
+
+/**
+ * message_log_append - append a message record (not yet durable until committed)
+ *
+ * @topic: topic string
+ * @qos: QoS the message was published with
+ * @data: message body
+ * @len: length of the message body
+ * @out_ref: output handle of the appended record
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int message_log_append(const char* topic, uint8_t qos, const void* data, size_t len,
+												log_ref_t* out_ref);
+
+/**
+ * message_log_hold/message_log_release - track a delivery that references a record
+ *
+ * A segment can be reclaimed once every record in it has no pending delivery.
+ */
+void message_log_hold(const log_ref_t* ref);
+void message_log_release(const log_ref_t* ref);
+
+/**
+ * message_log_dirty - check whether appended records are waiting for a commit
+ */
+bool message_log_dirty(void);
+
+/**
+ * message_log_commit - make every appended record durable with a single msync
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int message_log_commit(void);
+
+/**
+ * message_log_compact - hand reclaimable sealed segments to the compactor
+ *
+ * A sealed segment is reclaimable when none of its records has a pending
+ * delivery and every record is below @keep_from and below the committed offset
+ * of every named consumer.
+ *
+ * @keep_from: lowest offset still needed by an active reader (UINT64_MAX if none)
+ */
+void message_log_compact(uint64_t keep_from);
+
+/**
+ * message_log_seek_offset - position a cursor at the first record with offset >= @offset
+ *
+ * Offsets older than the oldest retained record resolve to that record.
+ *
+ * Return: 0 on success, -1 if the log is not open
+ */
+int message_log_seek_offset(uint64_t offset, log_ref_t* cursor);
+
+/**
+ * message_log_seek_time - position a cursor at the first record appended at or after @timestamp_ms
+ *
+ * Return: 0 on success, -1 if the log is not open
+ */
+int message_log_seek_time(uint64_t timestamp_ms, log_ref_t* cursor);
+
+/**
+ * message_log_read - pass the record under @cursor to @cb and advance past it
+ *
+ * Return: true if a record was read, false if the cursor is at the end of the log
+ */
+bool message_log_read(log_ref_t* cursor, log_record_cb cb, void* ctx);
+
+/**
+ * message_log_cursor_offset - offset of the next record a cursor will read
+ */
+uint64_t message_log_cursor_offset(const log_ref_t* cursor);
+
+/**
+ * message_log_record_offset - offset of the record a handle refers to
+ */
+uint64_t message_log_record_offset(const log_ref_t* ref);
+
+/**
+ * message_log_consumer_offset - look up the committed offset of a named consumer
+ *
+ * Return: 0 and the offset of the next record to deliver in @out, -1 if unknown
+ */
+int message_log_consumer_offset(const char* name, uint64_t* out);
+
+/**
+ * message_log_consumer_commit - record that @name consumed every record below @next_offset
+ *
+ * Committed offsets only move forward and are made durable by the next commit.
+ *
+ * Return: 0 on success, -1 if the name is too long or the consumer table is full
+ */
+int message_log_consumer_commit(const char* name, uint64_t next_offset);
+
+/**
+ * message_log_for_each_pending - visit records that still had pending deliveries at open
+ *
+ * The pending count of each visited record is reset to 0 before @cb runs, so
+ * the callback can take fresh holds for its redeliveries.
+ */
+void message_log_for_each_pending(log_record_cb cb, void* ctx);
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+
+#define MULTICAST_MAX_ROUTES 32						// one bit per route in broker_session_t
+
+/**
+ * multicast_route_t - a topic filter whose QoS 0 traffic is also sent to a multicast group
+ *
+ * Subscribers whose subscription covers @filter are offered the group. Those
+ * that join get the filter's QoS 0 messages from one multicast datagram
+ * instead of a unicast copy each; the others keep receiving unicast.
+ */
+typedef struct {
+	char filter[256];
+	struct sockaddr_in group;
+} multicast_route_t;
+
+/**
+ * multicast_route_add - send QoS 0 messages of topics matching @filter to @group
+ *
+ * Return: route index on success, -1 if the table is full
+ */
+int multicast_route_add(const char* filter, const struct sockaddr_in* group);
+
+/**
+ * multicast_route_for_topic - route of a published topic (latest matching route wins)
+ *
+ * Return: route index, or -1 if the topic is not sent by multicast
+ */
+int multicast_route_for_topic(const char* topic);
+
+/**
+ * multicast_route_for_group - route sending to @group
+ *
+ * Return: route index, or -1 if no route uses the group
+ */
+int multicast_route_for_group(const struct sockaddr_in* group);
+
+/**
+ * multicast_route_get - route by index, NULL if out of range
+ */
+const multicast_route_t* multicast_route_get(int idx);
+
+size_t multicast_route_count(void);
+
+void multicast_routes_clear(void);
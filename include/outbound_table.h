@@ -0,0 +1,232 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+#include "message_log.h"
+#include "timer_wheel.h"
+
+#define OUTBOUND_WINDOW_SIZE 64				// max unacknowledged deliveries per subscriber
+#define OUTBOUND_QUEUE_MAX 1024				// max deliveries queued behind a full window
+#define OUTBOUND_RETRY_TIMEOUT_MS 500
+#define OUTBOUND_MAX_RETRIES 5
+
+typedef enum {
+	OUTBOUND_WAIT_ACK = 0,						// QoS 1: PUBLISH sent, waiting for MSG_ACK
+	OUTBOUND_WAIT_RECEIVED,						// QoS 2: PUBLISH sent, waiting for CONTROL_RECEIVED
+	OUTBOUND_WAIT_COMPLETE,						// QoS 2: CONTROL_RELEASE sent, waiting for CONTROL_COMPLETE
+} outbound_state_t;
+
+/**
+ * outbound_entry_t - one reliable delivery awaiting the subscriber's ACK
+ *
+ * Entries live inside their subscriber's window (no per-message malloc besides
+ * the packet copy). Every sent entry has a retransmit timer on the broker's
+ * timer wheel, armed OUTBOUND_RETRY_TIMEOUT_MS ahead.
+ */
+typedef struct outbound_entry {
+	uint32_t msg_id;
+	bool in_use;
+	uint8_t state;										// outbound_state_t
+	bool held;												// not sent yet, waiting for subscriber credit
+	uint8_t retries;
+	timer_node_t retry_timer;
+	const struct sockaddr_in* dest;		// owning session's address
+	uint8_t* packet;									// datagram to retransmit (PUBLISH, later RELEASE)
+	size_t packet_len;
+	log_ref_t log_ref;								// durable record held by this delivery
+	struct outbound_entry* prev;			// held list links
+	struct outbound_entry* next;
+} outbound_entry_t;
+
+typedef struct {
+	outbound_entry_t* head;
+	outbound_entry_t* tail;
+} outbound_list_t;
+
+/**
+ * outbound_queued_t - reliable delivery waiting for a free window slot
+ *
+ * It gets its msg_id only when it enters the window, so the ids in flight to
+ * a subscriber always fit its QoS 2 dedup window.
+ */
+typedef struct outbound_queued {
+	struct outbound_queued* prev;
+	struct outbound_queued* next;
+	uint8_t qos;
+	log_ref_t log_ref;								// durable record held while queued
+	uint64_t low_offset;							// lowest log offset from here to the tail, UINT64_MAX if none
+	size_t packet_len;
+	uint8_t packet[];
+} outbound_queued_t;
+
+/**
+ * outbound_window_t - per-subscriber in-flight table indexed by msg_id
+ */
+typedef struct {
+	outbound_entry_t slots[OUTBOUND_WINDOW_SIZE];
+	outbound_list_t held;							// tracked deliveries not yet sent, oldest first
+	size_t inflight;
+	outbound_queued_t* queue_head;		// deliveries that found the window full, oldest first
+	outbound_queued_t* queue_tail;
+	size_t queued;
+	uint32_t dropped;									// deliveries given up after OUTBOUND_MAX_RETRIES
+	bool lost_logged;									// a logged delivery was given up on or never sent
+	uint64_t lost_offset;							// lowest log offset of those, valid if @lost_logged
+} outbound_window_t;
+
+/**
+ * outbound_init - set where retransmit timers live and which socket they resend on
+ *
+ * @timers: broker timer wheel
+ * @sockfd: broker socket
+ */
+void outbound_init(timer_wheel_t* timers, int sockfd);
+
+/**
+ * outbound_window_clear - release every in-flight and queued delivery of a window
+ *
+ * @w: window to clear
+ */
+void outbound_window_clear(outbound_window_t* w);
+
+/**
+ * outbound_track - register a delivery so it is retransmitted until ACKed
+ *
+ * With @send_now false the entry is parked on the window's held list until
+ * outbound_release_held() sends it; the caller sends it otherwise.
+ *
+ * @w: subscriber's window
+ * @msg_id: broker-assigned msg_id of the delivery
+ * @qos: delivery QoS (1 or 2), selects the handshake to run
+ * @dest: subscriber address (must outlive the entry)
+ * @packet: serialized datagram
+ * @len: length of @packet
+ * @now_ms: current monotonic time in milliseconds
+ * @send_now: whether the caller transmits @packet right away
+ * @log_ref: durable record to hold until the delivery completes, or NULL
+ *
+ * Return: 0 on success, -1 if the window slot is still occupied (window full),
+ *         -2 on allocation failure
+ */
+int outbound_track(outbound_window_t* w, uint32_t msg_id, uint8_t qos,
+									const struct sockaddr_in* dest,
+									const uint8_t* packet, size_t len, uint64_t now_ms,
+									bool send_now, const log_ref_t* log_ref);
+
+/**
+ * outbound_enqueue - park a delivery until the window has room for it
+ *
+ * Used instead of outbound_track() while the slot of the next msg_id is taken
+ * or older deliveries are still queued, so deliveries enter the window in order.
+ * Past OUTBOUND_QUEUE_MAX queued deliveries the delivery is dropped, a logged
+ * one is noted with outbound_mark_lost().
+ *
+ * @w: subscriber's window
+ * @qos: delivery QoS (1 or 2)
+ * @packet: serialized datagram, its msg_id is filled in by outbound_dequeue()
+ * @len: length of @packet
+ * @log_ref: durable record to hold until the delivery completes, or NULL
+ *
+ * Return: 0 on success, -1 if the queue is full, -2 on allocation failure
+ */
+int outbound_enqueue(outbound_window_t* w, uint8_t qos, const uint8_t* packet, size_t len,
+											const log_ref_t* log_ref);
+
+/**
+ * outbound_dequeue - move the oldest queued delivery into the window as @msg_id
+ *
+ * The caller checks outbound_slot_free() for @msg_id first. As with
+ * outbound_track(), a delivery tracked with @send_now is sent by the caller.
+ *
+ * @w: subscriber's window
+ * @msg_id: broker-assigned msg_id of the delivery
+ * @dest: subscriber address (must outlive the entry)
+ * @now_ms: current monotonic time in milliseconds
+ * @send_now: whether the caller transmits the delivery right away
+ *
+ * Return: the tracked entry, its packet stamped with @msg_id, or NULL if
+ *         nothing is queued or the slot is taken
+ */
+const outbound_entry_t* outbound_dequeue(outbound_window_t* w, uint32_t msg_id,
+																					const struct sockaddr_in* dest,
+																					uint64_t now_ms, bool send_now);
+
+/**
+ * outbound_release_held - send held deliveries of a window, oldest first
+ *
+ * @w: subscriber's window
+ * @sockfd: broker socket
+ * @max: maximum number of deliveries to send
+ * @now_ms: current monotonic time in milliseconds
+ *
+ * Return: number of deliveries sent
+ */
+size_t outbound_release_held(outbound_window_t* w, int sockfd, size_t max, uint64_t now_ms);
+
+/**
+ * outbound_mark_lost - note a logged delivery that will never be acknowledged
+ *
+ * Called for deliveries the broker had to drop; deliveries given up after
+ * OUTBOUND_MAX_RETRIES are noted by the window itself.
+ */
+void outbound_mark_lost(outbound_window_t* w, const log_ref_t* log_ref);
+
+/**
+ * outbound_clear_lost - forget lost deliveries once the subscriber is replayed past them
+ */
+void outbound_clear_lost(outbound_window_t* w);
+
+/**
+ * outbound_low_offset - lowest log offset the subscriber has not acknowledged
+ *
+ * Covers logged deliveries in flight, held, queued, and lost.
+ *
+ * @out: output offset
+ *
+ * Return: true if any such delivery exists
+ */
+bool outbound_low_offset(const outbound_window_t* w, uint64_t* out);
+
+/**
+ * outbound_slot_free - check whether a delivery with @msg_id can be tracked now
+ */
+bool outbound_slot_free(const outbound_window_t* w, uint32_t msg_id);
+
+/**
+ * outbound_ack - retire a QoS 1 delivery acknowledged by the subscriber
+ *
+ * @w: subscriber's window
+ * @msg_id: msg_id of the delivery
+ * @retired_ref: output log record the delivery held, or NULL
+ *
+ * Return: true if a matching in-flight entry was retired
+ */
+bool outbound_ack(outbound_window_t* w, uint32_t msg_id, log_ref_t* retired_ref);
+
+/**
+ * outbound_received - advance a QoS 2 delivery after the subscriber's CONTROL_RECEIVED
+ *
+ * The retransmitted datagram becomes @release; duplicates of RECEIVED for an
+ * entry already waiting for COMPLETE are accepted so RELEASE can be resent.
+ *
+ * @w: subscriber's window
+ * @msg_id: msg_id of the delivery
+ * @release: serialized CONTROL_RELEASE for @msg_id
+ * @len: length of @release (must not exceed the original PUBLISH)
+ * @now_ms: current monotonic time in milliseconds
+ *
+ * Return: true if CONTROL_RELEASE should be sent now
+ */
+bool outbound_received(outbound_window_t* w, uint32_t msg_id,
+												const uint8_t* release, size_t len, uint64_t now_ms);
+
+/**
+ * outbound_complete - retire a QoS 2 delivery after the subscriber's CONTROL_COMPLETE
+ *
+ * @retired_ref: output log record the delivery held, or NULL
+ *
+ * Return: true if a matching in-flight entry was retired
+ */
+bool outbound_complete(outbound_window_t* w, uint32_t msg_id, log_ref_t* retired_ref);
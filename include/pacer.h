@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+
+#define PACER_QUEUE_MAX 65536						// datagrams waiting for tokens at most
+#define PACER_DEFAULT_BURST 32					// datagrams sent back to back after an idle period
+
+/**
+ * pacer_t - token bucket spreading the broker's fan-out over time
+ *
+ * Tokens accrue at @rate datagrams per second up to @burst. A datagram that
+ * finds the bucket empty, or others already waiting, is copied to the FIFO
+ * and sent by pacer_drain() once tokens are available, so one publish with
+ * thousands of subscribers leaves as a steady stream instead of a burst.
+ * When the queue is full, further datagrams are dropped and counted.
+ */
+typedef struct pacer_packet {
+	struct pacer_packet* next;
+	struct sockaddr_in dest;
+	size_t len;
+	uint8_t data[];
+} pacer_packet_t;
+
+typedef struct {
+	uint32_t rate;										// datagrams per second, 0 = pacing off
+	uint32_t burst;
+	uint64_t credit;									// tokens in millionths, up to burst * 1000000
+	uint64_t last_us;									// when @credit was last topped up
+	pacer_packet_t* head;
+	pacer_packet_t* tail;
+	size_t queued;
+	uint64_t delayed;									// datagrams that had to wait
+	uint64_t dropped;									// datagrams dropped on a full queue
+} pacer_t;
+
+/**
+ * pacer_init - start pacing at @rate datagrams per second
+ *
+ * @burst: datagrams allowed back to back, 0 for PACER_DEFAULT_BURST
+ */
+void pacer_init(pacer_t* p, uint32_t rate, uint32_t burst, uint64_t now_us);
+
+/**
+ * pacer_send - send a datagram now if a token is free, else queue a copy
+ *
+ * Return: 0 if sent or queued, -1 if the queue is full or out of memory
+ */
+int pacer_send(pacer_t* p, int sockfd, const struct sockaddr_in* dest,
+							const uint8_t* buffer, size_t len, uint64_t now_us);
+
+/**
+ * pacer_drain - send queued datagrams for as long as tokens last
+ *
+ * Return: number of datagrams sent
+ */
+size_t pacer_drain(pacer_t* p, int sockfd, uint64_t now_us);
+
+/**
+ * pacer_next_timeout_ms - how long the caller may sleep before pacer_drain() has work
+ *
+ * Return: milliseconds until the next queued datagram may be sent, -1 if none is queued
+ */
+int pacer_next_timeout_ms(const pacer_t* p, uint64_t now_us);
+
+/**
+ * pacer_destroy - drop every queued datagram
+ */
+void pacer_destroy(pacer_t* p);
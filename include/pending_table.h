@@ -1,9 +1,10 @@
 #pragma once
 
 #include <stdint.h>
-#include <netinet/in.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <time.h>
+#include "timer_wheel.h"
 
 typedef enum {
 	QOS2_STATE_RECEIVED,
@@ -12,23 +13,71 @@ typedef enum {
 	QOS2_STATE_COMPLETED,
 } qos2_state_t;
 
-typedef struct pending_entry {
-	struct sockaddr_in addr;
-	uint32_t msg_id;
-	qos2_state_t state;
-	time_t timestamp;
-	struct pending_entry* next;
-} pending_entry_t;
+#define PENDING_CLIENT_TABLE_INITIAL_CAPACITY 1024
+#define PENDING_WINDOW_SIZE 256						// recent msg_ids tracked per client
+
+/**
+ * pending_client_t - QoS 2 state of the recent msg_ids of one publisher
+ *
+ * States live in a window of PENDING_WINDOW_SIZE msg_ids starting at @base,
+ * 4 bits per msg_id (0 = unknown, otherwise qos2_state_t + 1), indexed by
+ * msg_id % PENDING_WINDOW_SIZE. The window slides forward as newer msg_ids
+ * arrive; msg_ids up to PENDING_WINDOW_SIZE behind it count as completed.
+ * A msg_id further behind means the publisher numbers from scratch (e.g.
+ * after a restart) and is new, the window starts over around it.
+ */
+typedef struct pending_client {
+	uint32_t session;									// broker session id of the publisher
+	uint32_t base;										// oldest msg_id inside the window
+	time_t timestamp;									// last update
+	timer_node_t expiry;							// armed when pending_table_set_expiry() is used
+	uint8_t states[PENDING_WINDOW_SIZE / 2];
+} pending_client_t;
 
 void pending_table_init(void);
 
 void pending_table_destroy(void);
 
-void pending_table_update(const struct sockaddr_in* addr, uint32_t msg_id, qos2_state_t state);
+/**
+ * pending_table_set_expiry - drop a client's state @expiry_ms after its last update
+ *
+ * Each client gets a timer on @wheel, re-armed whenever its state is updated,
+ * so expiry costs O(1) per client instead of a periodic scan of the table.
+ *
+ * @wheel: timer wheel driven by the caller's loop
+ * @expiry_ms: idle time after which a client's state is removed
+ */
+void pending_table_set_expiry(timer_wheel_t* wheel, uint32_t expiry_ms);
+
+void pending_table_update(uint32_t session, uint32_t msg_id, qos2_state_t state);
 
-bool pending_table_get(const struct sockaddr_in* addr, uint32_t msg_id, qos2_state_t* out_state);
+bool pending_table_get(uint32_t session, uint32_t msg_id, qos2_state_t* out_state);
 
-void pending_table_remove(const struct sockaddr_in* addr, uint32_t msg_id);
+void pending_table_remove(uint32_t session, uint32_t msg_id);
 
 void pending_table_cleanup_expired(time_t expiration_sec);
 
+/**
+ * pending_table_forget - drop every QoS 2 state of a session that went away
+ *
+ * Session ids are reused, so a new session must not inherit the old states.
+ */
+void pending_table_forget(uint32_t session);
+
+/**
+ * pending_table_snapshot_write - serialize every client into a flat snapshot image
+ *
+ * @image: output buffer, or NULL to query the required size
+ *
+ * Return: size of the image in bytes
+ */
+size_t pending_table_snapshot_write(uint8_t* image);
+
+/**
+ * pending_table_snapshot_adopt - replace the table with clients of a snapshot image
+ *
+ * Clients are linked in place, so @image must be writable and outlive the table.
+ *
+ * Return: 0 on success, -1 if the image is malformed
+ */
+int pending_table_snapshot_adopt(uint8_t* image, size_t len);
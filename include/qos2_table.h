@@ -2,9 +2,11 @@
 
 #include <stdbool.h>
 #include <stdint.h>
-#include <time.h>
+#include <pthread.h>
+#include "hash_table.h"
 
-#define QOS2_TABLE_SIZE 256
+#define QOS2_TABLE_INITIAL_CAPACITY 256
+#define QOS2_DEDUP_WINDOW 64		// must cover the broker's per-subscriber OUTBOUND_WINDOW_SIZE
 
 typedef enum {
 	QOS2_CLIENT_STATE_NONE = 0,
@@ -13,22 +15,81 @@ typedef enum {
 	QOS2_CLIENT_STATE_COMPLETED
 } qos2_client_state_t;
 
-typedef struct qos2_entry {
-	uint32_t msg_id;
-	qos2_client_state_t state;
-	time_t timestamp;
-	struct qos2_entry* next;
-} qos2_entry_t;
+/**
+ * qos2_dedup_window_t - subscriber-side record of QoS 2 deliveries already handed to the app
+ *
+ * Bit i of @seen stands for msg_id (base + i). The broker never has more than
+ * QOS2_DEDUP_WINDOW deliveries in flight to one subscriber, so ids that slid
+ * out below @base are finished and a copy of one up to QOS2_DEDUP_WINDOW
+ * below is a late duplicate. An id further behind means the broker numbers
+ * deliveries afresh (restart, snapshot restore, expired session recreated),
+ * and the window starts over from it, as it does from the first delivery.
+ */
+typedef struct {
+	uint32_t base;
+	uint64_t seen;
+} qos2_dedup_window_t;
 
-void qos2_table_init(void);
+void qos2_dedup_init(qos2_dedup_window_t* w);
 
-void qos2_table_destroy(void);
+/**
+ * qos2_dedup_is_duplicate - check whether a QoS 2 delivery was already accepted
+ */
+bool qos2_dedup_is_duplicate(const qos2_dedup_window_t* w, uint32_t msg_id);
 
-void qos2_table_set(uint32_t msg_id, qos2_client_state_t state);
+/**
+ * qos2_dedup_mark - record a QoS 2 delivery as accepted, sliding or restarting the window if needed
+ */
+void qos2_dedup_mark(qos2_dedup_window_t* w, uint32_t msg_id);
 
-qos2_client_state_t qos2_table_get_state(uint32_t msg_id);
+/**
+ * qos2_table_t - publisher-side QoS 2 handshake state of one client
+ *
+ * Written by the client's listener thread as CONTROL_RECEIVED/COMPLETE arrive
+ * and read by every thread publishing on that client. @lock guards @entries;
+ * @changed is broadcast on every update so publishers block instead of polling.
+ * Only publishers add entries and each removes its own when it is done, so
+ * stray control frames from the broker never grow the table.
+ */
+typedef struct {
+	hash_table_t entries;						// msg_id -> qos2_client_state_t
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+} qos2_table_t;
 
-void qos2_table_remove(uint32_t msg_id);
+void qos2_table_init(qos2_table_t* t);
 
-void qos2_table_cleanup_expired(time_t expiration_sec);
+void qos2_table_destroy(qos2_table_t* t);
 
+/**
+ * qos2_table_begin - start tracking the handshake of a QoS 2 publish
+ *
+ * Called before the PUBLISH is first sent, so the broker's answer always
+ * finds the entry. The publisher removes it with qos2_table_remove().
+ *
+ * Return: 0 on success, -1 on allocation failure
+ */
+int qos2_table_begin(qos2_table_t* t, uint32_t msg_id);
+
+/**
+ * qos2_table_set - advance the handshake of a publish in flight
+ *
+ * Return: true if @msg_id is tracked, false if no publish waits for it
+ */
+bool qos2_table_set(qos2_table_t* t, uint32_t msg_id, qos2_client_state_t state);
+
+qos2_client_state_t qos2_table_get_state(qos2_table_t* t, uint32_t msg_id);
+
+/**
+ * qos2_table_wait_state - block until @msg_id reaches @state
+ *
+ * @t: client's QoS 2 table
+ * @msg_id: msg_id of the publish
+ * @state: state to wait for
+ * @timeout_ms: maximum wait in milliseconds
+ *
+ * Return: true if @msg_id is in @state, false on timeout
+ */
+bool qos2_table_wait_state(qos2_table_t* t, uint32_t msg_id, qos2_client_state_t state, int timeout_ms);
+
+void qos2_table_remove(qos2_table_t* t, uint32_t msg_id);
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+#include "outbound_table.h"
+
+#define SESSION_TABLE_INITIAL_CAPACITY 1024
+#define SESSION_ID_MAX (1u << 24)						// ids from this on are never handed out
+#define SESSION_GENERATION_SHIFT 24					// wire ids carry the generation above the id
+#define SESSION_KEEPALIVE_TIMEOUT_SEC 30			// default silence after which a session expires
+#define SESSION_SWEEP_INTERVAL_MS 1000				// how often silent sessions are looked for
+
+/**
+ * broker_session_t - broker-side state kept per client session
+ *
+ * Every session has a dense numeric id indexing the session table, and the
+ * rest of the broker (subscriptions, QoS 2 and QoS 1 duplicate state) refers
+ * to it by that id. A session opened with CONTROL_CONNECT is @connected: its
+ * wire id (the id with the slot's @generation in the top bits) travels in
+ * every header, so the client keeps its state when its address changes (NAT
+ * rebinding) and several sessions can share one socket. The generation
+ * changes every time an id is handed out again, so a client still holding
+ * the wire id of an expired session never reaches the session reusing its id.
+ * The session only moves to a new address through a CONNECT proving the
+ * random @token handed out with the id, so a sender guessing ids can neither
+ * take a session over nor point its deliveries at somebody else. Clients
+ * that never connect are identified by their address instead.
+ *
+ * Any datagram of a session counts as a sign of life; idle clients send
+ * CONTROL_HEARTBEAT. Sessions silent for too long are expired together by
+ * session_table_expire() and their ids are handed out again.
+ */
+typedef struct broker_session {
+	uint32_t id;											// index in the session table, never 0
+	bool connected;										// id handed out by CONTROL_CONNECT
+	uint8_t generation;								// bumped each time the id is handed out
+	uint64_t token;										// random secret of a connected session, see session_resume()
+	struct sockaddr_in addr;					// current address of the client
+	uint64_t last_seen_ms;						// monotonic time of the last datagram, 0 = not yet
+	bool expiring;										// being removed by session_table_expire()
+	uint32_t next_msg_id;							// msg_id generator for deliveries to this client, starts at random
+	outbound_window_t outbound;				// reliable deliveries awaiting ACK
+	bool backlogged;									// deliveries wait in @outbound's queue
+	struct broker_session* backlog_next;
+	bool flow_control;								// client advertises receive credits
+	uint32_t credits;									// deliveries the client can still accept
+	uint32_t throttled;								// QoS 0 deliveries dropped for lack of credit
+	uint32_t multicast_joined;				// bit i: receives multicast route i instead of unicast
+	bool sequenced;										// QoS 1 deliveries are sequenced and repaired on NACK
+	bool coalesced_acks;							// QoS 1 publishes are ACKed with CONTROL_SACK frames
+	char consumer[LOG_CONSUMER_NAME_MAX];	// durable consumer name, empty if anonymous
+	uint64_t consumer_end;						// one past the highest log offset delivered to the consumer
+	bool replaying;										// catching up from the log before live delivery
+	log_ref_t replay_cursor;
+	char replay_filter[256];
+	uint8_t replay_qos;
+	struct broker_session* replay_next;
+} broker_session_t;
+
+/**
+ * session_expire_cb - called once per sweep with every session about to be freed
+ *
+ * The sessions are already marked @expiring and still valid during the call.
+ */
+typedef void (*session_expire_cb)(broker_session_t** expired, size_t count, void* ctx);
+
+/**
+ * session_record_t - identity of a session as stored in a snapshot
+ */
+typedef struct {
+	uint32_t id;
+	uint32_t connected;
+	uint32_t generation;
+	uint64_t token;
+	struct sockaddr_in addr;
+} session_record_t;
+
+void session_table_init(void);
+
+void session_table_destroy(void);
+
+/**
+ * session_get - look up a session by id
+ *
+ * Return: session, or NULL if no session has @id
+ */
+broker_session_t* session_get(uint32_t id);
+
+/**
+ * session_get_wire - look up a connected session by the id a client sent
+ *
+ * Return: session, or NULL if no connected session has @wire_id, including
+ * one whose id was handed out again since the client got it
+ */
+broker_session_t* session_get_wire(uint32_t wire_id);
+
+/**
+ * session_find - look up the session of a client identified by its address
+ *
+ * Connected sessions are never returned, they are looked up by id.
+ *
+ * Return: session, or NULL if the address has no session
+ */
+broker_session_t* session_find(const struct sockaddr_in* addr);
+
+/**
+ * session_get_or_create - look up the session of a client by address, creating it if needed
+ *
+ * Return: session, or NULL on allocation failure
+ */
+broker_session_t* session_get_or_create(const struct sockaddr_in* addr);
+
+/**
+ * session_connect - open a new connected session for a client at @addr
+ *
+ * Return: session, or NULL on allocation failure
+ */
+broker_session_t* session_connect(const struct sockaddr_in* addr);
+
+/**
+ * session_resume - look up a connected session a client asks to resume from another address
+ *
+ * @wire_id: session id the client sent
+ * @token: data of the client's CONNECT, the token it got with the id
+ * @len: length of @token
+ *
+ * Return: session, or NULL if @wire_id is unknown or @token does not match
+ */
+broker_session_t* session_resume(uint32_t wire_id, const void* token, size_t len);
+
+/**
+ * session_rebind - move a connected session to the address it was last heard from
+ */
+void session_rebind(broker_session_t* session, const struct sockaddr_in* addr);
+
+/**
+ * session_wire_id - session id to put in headers sent to the client
+ *
+ * Return: the wire id of a connected session, 0 for an address-identified one
+ */
+uint32_t session_wire_id(const broker_session_t* session);
+
+/**
+ * session_table_expire - free every session silent for longer than @timeout_ms
+ *
+ * Sessions that have not been heard from since they were restored from a
+ * snapshot get a full @timeout_ms from the first sweep. Their ids are reused
+ * by sessions created later, under a new generation.
+ *
+ * @now_ms: current monotonic time in milliseconds
+ * @timeout_ms: allowed silence
+ * @cb: called with the expired sessions before they are freed, or NULL
+ * @ctx: passed to @cb
+ *
+ * Return: number of sessions expired
+ */
+size_t session_table_expire(uint64_t now_ms, uint64_t timeout_ms, session_expire_cb cb, void* ctx);
+
+/**
+ * session_table_count - number of live sessions
+ */
+size_t session_table_count(void);
+
+/**
+ * session_table_snapshot_write - serialize the identity of every session
+ *
+ * @image: output buffer, or NULL to query the required size
+ *
+ * Return: size of the image in bytes
+ */
+size_t session_table_snapshot_write(uint8_t* image);
+
+/**
+ * session_table_snapshot_adopt - recreate the sessions of a snapshot image
+ *
+ * Sessions keep their ids, so subscriptions and QoS state of the same
+ * snapshot still refer to them. Delivery state starts out empty.
+ *
+ * Return: 0 on success, -1 if the image is malformed or allocation fails
+ */
+int session_table_snapshot_adopt(const uint8_t* image, size_t len);
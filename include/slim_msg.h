@@ -14,9 +14,43 @@
 typedef enum {
 	CONTROL_RECEIVED = 0x01, // QoS 2 Step 1 (PUBREC)
 	CONTROL_RELEASE  = 0x02, // QoS 2 Step 2 (PUBREL)
-	CONTROL_COMPLETE = 0x03  // QoS 2 Step 3 (PUBCOMP)
+	CONTROL_COMPLETE = 0x03, // QoS 2 Step 3 (PUBCOMP)
+	CONTROL_CREDIT   = 0x04, // subscriber receive credits (payload: uint32_t free slots)
+	CONTROL_CONNECT  = 0x05, // open (session_id 0) or resume a session (data: its token); the reply carries id and token
+	CONTROL_HEARTBEAT = 0x06, // keepalive of an otherwise silent client
+	CONTROL_MULTICAST = 0x07, // multicast group offered by the broker, echoed by a client that joined
+	CONTROL_SEQUENCED = 0x08, // subscriber asks for sequenced QoS 1 deliveries (payload: uint8_t enable)
+	CONTROL_NACK      = 0x09, // subscriber names sequenced deliveries it missed
+	CONTROL_FEC       = 0x0A, // parity of a block of QoS 0 deliveries (data layout in fec.h)
+	CONTROL_SACK      = 0x0B, // coalesced QoS 1 ACKs: publisher opt-in (payload: uint8_t enable), broker frames
+	CONTROL_UNKNOWN_SESSION = 0x0C  // broker does not take the header's session from this sender, the client connects again
 } control_type_t;
 
+// CONTROL_CONNECT data: the random token of the session, in the reply and in a resuming request
+#define SESSION_TOKEN_SIZE 8
+
+// CONTROL_MULTICAST data: [uint32_t group address][uint16_t port], both in network byte order
+#define MULTICAST_SPEC_SIZE 6
+
+// CONTROL_NACK data: [uint16_t stream] then up to NACK_MAX_RANGES of [uint32_t first][uint32_t last]
+#define NACK_MAX_RANGES 16
+#define NACK_RANGE_SIZE 8
+
+// CONTROL_SACK data from the broker: [uint32_t first][uint64_t bitmap], acknowledging
+// first and first + 1 + i for every bit i set
+#define SACK_SPEC_SIZE 12
+#define SACK_BITMAP_BITS 64
+
+// SUBSCRIBE data: [uint8_t mode][uint64_t value][consumer name], empty for live only
+typedef enum {
+	REPLAY_NONE           = 0x00,
+	REPLAY_FROM_OFFSET    = 0x01, // value: first log offset to deliver
+	REPLAY_FROM_TIME      = 0x02, // value: wall clock time in milliseconds
+	REPLAY_FROM_COMMITTED = 0x03  // resume from the consumer's committed offset, else value
+} replay_mode_t;
+
+#define REPLAY_SPEC_SIZE 9
+
 #pragma pack(push, 1)
 typedef struct {
 	uint8_t version;
@@ -29,6 +63,7 @@ typedef struct {
 	uint8_t batch_size;
 	uint16_t payload_length;
 	uint8_t client_node_count;
+	uint32_t session_id;			// broker-assigned session from CONTROL_CONNECT, 0 = identified by address
 } slim_msg_header_t;
 #pragma pack(pop)
 
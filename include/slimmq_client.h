@@ -4,23 +4,132 @@
 #include <stddef.h>
 #include <netinet/in.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include "event_queue.h"
+#include "qos2_table.h"
+#include "inflight_table.h"
+#include "hash_table.h"
+#include "slim_msg.h"
+#include "fec.h"
+#include "congestion.h"
+
+#define SLIMMQ_CONNECT_TIMEOUT_MS 500			// wait for the broker's CONNECT reply per attempt
+#define SLIMMQ_CONNECT_ATTEMPTS 3
+#define SLIMMQ_KEEPALIVE_INTERVAL_MS 10000		// heartbeat period, well inside the broker's expiry timeout
+#define SLIMMQ_MULTICAST_MAX 8								// multicast groups one client joins at most
+#define SLIMMQ_SEQ_WINDOW 256									// sequence numbers tracked per sequenced stream
+#define SLIMMQ_NACK_INTERVAL_MS 100						// wait before NACKing a gap again
+#define SLIMMQ_NACK_RETRIES 5									// NACKs sent for a gap before giving up on it
+
+struct slimmq_session;
 
 /**
  * slimMQ client context structure
+ *
+ * slimmq_publish() may be called from several threads sharing one client:
+ * msg_ids are allocated atomically and each publish waits on its own slot of
+ * @inflight (QoS 1) or @qos2_outbound (QoS 2).
+ *
+ * Sessions opened with slimmq_session_open() share the socket, the listener
+ * thread and the event queue; their events carry the session id. The client
+ * itself never connects and is identified by its address.
+ *
+ * The listener sends a heartbeat for the client and each session every
+ * @keepalive_interval_ms, so the broker does not expire quiet subscribers.
+ *
+ * When the broker offers a multicast group for a subscription, the listener
+ * joins it and receives that traffic on a group socket; if joining fails the
+ * broker keeps sending unicast copies.
+ *
+ * With slimmq_set_sequenced() the broker numbers QoS 1 deliveries per topic
+ * instead of waiting for ACKs; the listener tracks each stream and NACKs the
+ * gaps it sees.
+ *
+ * QoS 0 deliveries of topics the broker protects with FEC are numbered too;
+ * the listener rebuilds lost ones from the parity packets that follow each
+ * block, without a round trip.
+ *
+ * With slimmq_set_ack_coalescing() the broker ACKs several QoS 1 publishes
+ * per CONTROL_SACK frame, and the listener retires all of them at once.
+ *
+ * Concurrent QoS 1/2 publishes are admitted through the congestion window
+ * @cc, which slimmq_set_congestion_control() sizes from ACK timing and loss.
  */
-typedef struct {
+typedef struct slimmq_client {
 	int sockfd;												// internal UDP socket
 	struct sockaddr_in broker_addr;		// destination broker address
-	uint32_t next_msg_id;							// incremental message ID generator
+	atomic_uint next_msg_id;					// incremental message ID generator
 	slimmq_event_queue_t event_queue;	// event queue
 	pthread_t listener_thread;				// thread for incomming messages
-	int running;											// flag for thread loop control
+	atomic_int running;								// flag for thread loop control
 	int qos_level;										// QoS level for publish
 	int retry_timeout_ms;							// time out millisecond for qos 1/2
 	int max_retries;									// max retry num for qos 1/2
+	qos2_dedup_window_t qos2_inbound;	// QoS 2 deliveries already queued (listener thread only)
+	qos2_table_t qos2_outbound;				// QoS 2 publish handshakes, shared with the listener
+	inflight_table_t inflight;				// QoS 1 publishes awaiting an ACK, completed by the listener
+	cc_state_t cc;										// congestion window of QoS 1/2 publishes, guarded by @cc_lock
+	pthread_mutex_t cc_lock;
+	pthread_cond_t cc_open;						// signalled when the window has room again
+	int credit_interval_ms;						// receive credit advertisement period, 0 = off
+	uint64_t last_credit_ms;					// when credits were last advertised
+	int keepalive_interval_ms;				// heartbeat period, 0 = off
+	uint64_t last_keepalive_ms;				// when heartbeats were last sent
+	int multicast_fds[SLIMMQ_MULTICAST_MAX];	// joined group sockets (listener thread only)
+	struct sockaddr_in multicast_groups[SLIMMQ_MULTICAST_MAX];
+	size_t multicast_count;
+	int sequenced;										// ask for sequenced QoS 1 deliveries
+	hash_table_t seq_streams;					// (session id << 16 | stream id) -> slimmq_seq_stream_t* (listener thread only)
+	size_t seq_gaps;									// streams that may miss deliveries (listener thread only)
+	hash_table_t fec_streams;					// (session id << 16 | stream id) -> fec_decoder_t* (listener thread only)
+	atomic_uint fec_recovered;				// QoS 0 deliveries rebuilt from parity
+	int coalesced_acks;								// ask for coalesced QoS 1 publish ACKs
+	atomic_uint sack_frames;					// CONTROL_SACK frames received
+	atomic_uint sack_acks;						// publishes retired by those frames
+	atomic_uint stray_acks;						// ACKs matching no publish in flight (late or duplicate)
+	hash_table_t sessions;						// session id -> slimmq_session_t*
+	hash_table_t connecting;					// CONNECT msg_id -> slimmq_session_t* awaiting its id
+	pthread_mutex_t session_lock;			// guards @sessions and @connecting
+	pthread_cond_t session_connected;	// signalled when a CONNECT reply assigns an id
 } slimmq_client_t;
 
+/**
+ * slimmq_seq_stream_t - receive window of one sequenced stream
+ *
+ * Bit (seq % SLIMMQ_SEQ_WINDOW) of @seen tells whether sequence number seq,
+ * one of the SLIMMQ_SEQ_WINDOW up to @highest, was received. Sequence numbers
+ * before the first delivery count as received.
+ */
+typedef struct {
+	uint32_t highest;									// newest sequence number received
+	uint64_t seen[SLIMMQ_SEQ_WINDOW / 64];
+	uint64_t last_nack_ms;						// when the current gaps were last NACKed
+	uint8_t nack_retries;
+} slimmq_seq_stream_t;
+
+/**
+ * slimmq_session_t - logical client multiplexed over another client's socket
+ *
+ * The broker keeps separate subscriptions, QoS state and flow of deliveries
+ * per session, while the application side costs a few dozen bytes. The id is
+ * assigned by the broker, so the session survives a change of the socket's
+ * address (e.g. NAT rebinding): when the broker reports the session unknown
+ * the listener CONNECTs again with the session's id and token. The broker
+ * resumes the session if it still has it, or else (it expired, or the broker
+ * restarted without it) hands out a new id, which the session is subscribed
+ * again to its topic filters under.
+ */
+typedef struct slimmq_session {
+	slimmq_client_t* client;					// client whose socket carries the session
+	uint32_t id;											// broker-assigned id sent in every header, guarded by client->session_lock
+	uint8_t token[SESSION_TOKEN_SIZE];	// broker-assigned proof of the id, guarded by client->session_lock
+	uint8_t qos_level;								// QoS level for publish
+	qos2_dedup_window_t qos2_inbound;	// QoS 2 deliveries already queued (listener thread only)
+	struct slimmq_session_sub* subscriptions;	// filters subscribed again after reconnecting, guarded by client->session_lock
+	uint32_t reconnect_msg_id;				// msg_id of the CONNECT resuming or replacing the session, 0 = none
+	uint64_t reconnect_sent_ms;				// when that CONNECT was last sent (listener thread only)
+} slimmq_session_t;
+
 /**
  * slimmq_connect - Create and initialize a UDP client connection to broker
  *
@@ -36,11 +145,75 @@ slimmq_client_t* slimmq_connect(const char* broker_ip, uint16_t port);
  */
 void slimmq_close(slimmq_client_t* client);
 
+/**
+ * slimmq_session_open - open a logical session on @client's socket
+ *
+ * Runs the CONNECT exchange with the broker, which assigns the session id
+ * (up to SLIMMQ_CONNECT_ATTEMPTS tries of SLIMMQ_CONNECT_TIMEOUT_MS each).
+ * Deliveries to the session arrive in @client's event queue with
+ * slimmq_event_t.session_id set to the session's id, which changes if the
+ * session has to reconnect.
+ *
+ * @client: client whose socket and listener thread are shared
+ *
+ * Return: new session, or NULL if allocation fails or the broker does not answer
+ */
+slimmq_session_t* slimmq_session_open(slimmq_client_t* client);
+
+/**
+ * slimmq_session_close - stop accepting deliveries for a session and free it
+ *
+ * Deliveries still addressed to the session are dropped unacknowledged.
+ */
+void slimmq_session_close(slimmq_session_t* session);
+
+/**
+ * slimmq_session_set_qos - set the QoS level of a session's publishes and subscriptions
+ */
+void slimmq_session_set_qos(slimmq_session_t* session, uint8_t qos_level);
+
+/**
+ * slimmq_session_subscribe - subscribe a session to a topic filter
+ *
+ * Return: bytes sent, -1 on error
+ */
+int slimmq_session_subscribe(slimmq_session_t* session, const char* topic);
+
+/**
+ * slimmq_session_publish - publish a message as a session
+ *
+ * Safe to call concurrently with other sessions of the same client.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int slimmq_session_publish(slimmq_session_t* session, const char* topic,
+														const void* data, size_t data_len);
+
 /**
  * slimmq_subscribe - Send a SUBSCRIBE request to broker for a topic
  */
 int slimmq_subscribe(slimmq_client_t* client, const char* topic);
 
+/**
+ * slimmq_subscribe_from - subscribe after replaying history from the broker's log
+ *
+ * Matching records are delivered from the requested position at full speed,
+ * then the subscription switches to live delivery. The broker commits the
+ * offset of every record @consumer acknowledges, so REPLAY_FROM_COMMITTED
+ * resumes where a previous run stopped. Requires a broker started with -l.
+ *
+ * @client: slimMQ client
+ * @topic: topic filter
+ * @mode: REPLAY_FROM_OFFSET, REPLAY_FROM_TIME or REPLAY_FROM_COMMITTED
+ * @value: log offset, wall clock time in milliseconds, or the fallback offset
+ *         of REPLAY_FROM_COMMITTED for an unknown consumer
+ * @consumer: durable consumer name, or NULL/"" for an anonymous replay
+ *
+ * Return: bytes sent, -1 on error
+ */
+int slimmq_subscribe_from(slimmq_client_t* client, const char* topic,
+													replay_mode_t mode, uint64_t value, const char* consumer);
+
 /**
  * slimmq_publish - Publish a message to a given topic
  */
@@ -80,6 +253,36 @@ int slimmq_start_listener(slimmq_client_t* client);
  */
 int slimmq_next_event(slimmq_client_t* client, char* out_topic, size_t topic_buf_size, void** out_data, size_t* out_data_len);
 
+/**
+ * slimmq_next_events - pop a batch of messages from event queue
+ *
+ * Drains up to @max_events queued events with a single queue lock acquisition.
+ * Ownership of each events[i].data passes to the caller (free() after use).
+ *
+ * @client: slimMQ client
+ * @events: output array of events
+ * @max_events: capacity of @events
+ * @timeout_ms: -1 to block until at least one event, 0 for non-blocking,
+ *              otherwise the maximum wait in milliseconds
+ *
+ * Return: number of events written to @events (0 on timeout), -1 on error
+ */
+int slimmq_next_events(slimmq_client_t* client, slimmq_event_t* events, size_t max_events, int timeout_ms);
+
+/**
+ * slimmq_get_fd - get a pollable readiness descriptor for the client
+ *
+ * The returned eventfd is readable (POLLIN/EPOLLIN) while the client's event
+ * queue holds at least one event, so many clients can be multiplexed in one
+ * poll/epoll loop. Drain with slimmq_next_events(..., 0) when it fires; do not
+ * read() or close() the descriptor yourself.
+ *
+ * @client: slimMQ client
+ *
+ * Return: file descriptor, or -1 if readiness notification is unavailable
+ */
+int slimmq_get_fd(slimmq_client_t* client);
+
 /**
  * slimmq_set_qos - set QoS level in given client
  *
@@ -88,6 +291,122 @@ int slimmq_next_event(slimmq_client_t* client, char* out_topic, size_t topic_buf
  */
 void slimmq_set_qos(slimmq_client_t* client, uint8_t qos_level);
 
+/**
+ * slimmq_set_flow_control - advertise receive credits to the broker
+ *
+ * Every @interval_ms the listener reports the free event queue slots to the
+ * broker, which holds reliable deliveries and drops QoS 0 deliveries beyond
+ * that credit instead of overrunning the client.
+ *
+ * @client: slimMQ client
+ * @interval_ms: advertisement period in milliseconds, 0 to stop advertising
+ *
+ * Return: 0 on success, -1 on error
+ */
+int slimmq_set_flow_control(slimmq_client_t* client, int interval_ms);
+
+/**
+ * slimmq_set_keepalive - set how often the listener tells the broker the client is alive
+ *
+ * The broker expires sessions it has not heard from for a while (30 seconds
+ * by default) together with their subscriptions. Any message counts, so
+ * heartbeats only matter for clients that otherwise stay silent.
+ *
+ * @client: slimMQ client
+ * @interval_ms: heartbeat period in milliseconds, 0 to stop sending heartbeats
+ *
+ * Return: 0 on success, -1 on error
+ */
+int slimmq_set_keepalive(slimmq_client_t* client, int interval_ms);
+
+/**
+ * slimmq_set_sequenced - trade per-message ACKs for sequence numbers and NACKs
+ *
+ * The broker stamps QoS 1 deliveries with a per-topic sequence number and
+ * keeps the last few for repair. Deliveries are not ACKed; a gap is NACKed
+ * right away and again every SLIMMQ_NACK_INTERVAL_MS, up to
+ * SLIMMQ_NACK_RETRIES times. Loss of the newest deliveries of a topic is only
+ * noticed when the next one arrives. Applies to the client and its sessions;
+ * the request is repeated with every keepalive.
+ *
+ * @client: slimMQ client
+ * @enable: non-zero to ask for sequenced deliveries
+ *
+ * Return: 0 on success, -1 on error
+ */
+int slimmq_set_sequenced(slimmq_client_t* client, int enable);
+
+/**
+ * slimmq_set_ack_coalescing - take ACKs of QoS 1 publishes in coalesced frames
+ *
+ * The broker holds the ACKs of a receive batch (or of its -a window) and
+ * sends one CONTROL_SACK frame naming up to 65 msg_ids, so pipelined
+ * publishers get far fewer ACK datagrams. A publish whose frame is lost is
+ * retried like one whose MSG_ACK is lost. Applies to the client and its
+ * sessions; the request is repeated with every keepalive.
+ *
+ * @client: slimMQ client
+ * @enable: non-zero to ask for coalesced ACKs
+ *
+ * Return: 0 on success, -1 on error
+ */
+int slimmq_set_ack_coalescing(slimmq_client_t* client, int enable);
+
+/**
+ * slimmq_sack_stats - CONTROL_SACK frames received so far and the publishes they retired
+ *
+ * @frames: output frame count, may be NULL
+ * @acks: output count of msg_ids the frames acknowledged, may be NULL
+ */
+void slimmq_sack_stats(slimmq_client_t* client, uint64_t* frames, uint64_t* acks);
+
+/**
+ * slimmq_stray_acks - ACKs received for publishes no longer in flight
+ *
+ * Late ACKs of retransmitted or timed-out publishes and duplicated ACKs are
+ * dropped and only counted here.
+ */
+uint64_t slimmq_stray_acks(slimmq_client_t* client);
+
+/**
+ * slimmq_fec_recovered - number of lost QoS 0 deliveries rebuilt from FEC parity so far
+ */
+uint64_t slimmq_fec_recovered(slimmq_client_t* client);
+
+/**
+ * slimmq_cc_stats_t - state of a client's congestion window
+ */
+typedef struct {
+	uint32_t window;									// QoS 1/2 publishes allowed in flight
+	uint32_t in_flight;
+	uint32_t srtt_us;									// smoothed round trip time, 0 = not measured yet
+	uint32_t min_rtt_us;
+	uint64_t losses;									// publishes that timed out and were retransmitted
+} slimmq_cc_stats_t;
+
+/**
+ * slimmq_set_congestion_control - bound concurrent QoS 1/2 publishes by a congestion window
+ *
+ * Publishing threads beyond the window wait for a slot before their first
+ * send. CC_AIMD grows the window by one per window of ACKs and halves it on
+ * a retransmit timeout; CC_DELAY also shrinks it as ACKs slow down, before
+ * loss. With either, retransmit timeouts follow the measured round trip
+ * time (doubling per retry) and the retry policy's timeout becomes their
+ * upper bound. CC_OFF only applies @max_window.
+ *
+ * @client: slimMQ client
+ * @mode: CC_OFF, CC_AIMD or CC_DELAY
+ * @max_window: the window never grows beyond this, 0 for INFLIGHT_TABLE_SIZE
+ *
+ * Return: 0 on success, -1 on error
+ */
+int slimmq_set_congestion_control(slimmq_client_t* client, cc_mode_t mode, int max_window);
+
+/**
+ * slimmq_congestion_stats - current congestion window, round trip time and loss count
+ */
+void slimmq_congestion_stats(slimmq_client_t* client, slimmq_cc_stats_t* out);
+
 /**
  * slimmq_set_retry_policy - set retry policies for QoS 1/2
  */
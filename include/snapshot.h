@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SNAPSHOT_MAGIC 0x534c4d53				// "SLMS"
+#define SNAPSHOT_VERSION 5
+#define SNAPSHOT_INTERVAL_MS 10000
+
+/**
+ * snapshot_header_t - start of a snapshot file, followed by the section images
+ *
+ * Images hold raw structs with offsets in place of pointers, so a snapshot is
+ * only accepted by a build with the same struct layout (@layout).
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t layout;									// pointer width and struct sizes of the writer
+	uint64_t topic_off;
+	uint64_t topic_len;
+	uint64_t pending_off;
+	uint64_t pending_len;
+	uint64_t session_off;
+	uint64_t session_len;
+} snapshot_header_t;
+
+/**
+ * snapshot_save - write the sessions, topic trie and pending table to @path atomically
+ *
+ * The image is written to a temporary file, synced, then renamed over @path.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int snapshot_save(const char* path);
+
+/**
+ * snapshot_load - restore the sessions, topic trie and pending table from @path
+ *
+ * The file is mapped privately with a single mmap and the offsets of the trie
+ * and pending table are fixed up into pointers in place; only the session
+ * identities are copied out. The mapping stays alive until snapshot_release().
+ *
+ * Return: 0 on success, -1 if there is no usable snapshot
+ */
+int snapshot_load(const char* path);
+
+/**
+ * snapshot_release - unmap the loaded snapshot (after the trie and pending table are freed)
+ */
+void snapshot_release(void);
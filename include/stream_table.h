@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define STREAM_MAX 1024									// sequenced topics tracked at once
+#define STREAM_RING_SIZE 128						// recent deliveries kept per topic for NACK repair
+
+/**
+ * stream_slot_t - one delivery kept for repair, as sent with session_id 0
+ */
+typedef struct {
+	uint32_t seq;
+	uint8_t* packet;
+	size_t len;
+	size_t capacity;									// allocated size of @packet, reused by later deliveries
+} stream_slot_t;
+
+/**
+ * stream_t - per-topic sequence of deliveries to sequenced subscribers
+ *
+ * Every delivery of the topic gets the next sequence number, starting at 1,
+ * and is kept in slot (seq % STREAM_RING_SIZE) until it is overwritten, so a
+ * NACK can be repaired for the last STREAM_RING_SIZE deliveries.
+ */
+typedef struct {
+	uint16_t id;											// carried in topic_id of deliveries, never 0
+	uint32_t next_seq;
+	stream_slot_t ring[STREAM_RING_SIZE];
+} stream_t;
+
+void stream_table_init(void);
+
+void stream_table_destroy(void);
+
+/**
+ * stream_table_stamp - give a delivery the next sequence number of its topic
+ *
+ * The header of @packet is rewritten to a sequenced QoS 1 delivery: topic_id
+ * names the stream, msg_id is the sequence number and session_id is 0. A copy
+ * is kept for repair.
+ *
+ * @topic: published topic
+ * @packet: serialized delivery
+ * @len: length of @packet
+ *
+ * Return: 0 on success, -1 if the topic cannot be sequenced (table full, hash
+ *         collision with another topic, allocation failure)
+ */
+int stream_table_stamp(const char* topic, uint8_t* packet, size_t len);
+
+/**
+ * stream_table_lookup - find a delivery still kept for repair
+ *
+ * @id: stream id from the NACK
+ * @seq: sequence number asked for
+ * @len: output length of the delivery
+ *
+ * Return: delivery as sent with session_id 0, or NULL if it left the ring
+ */
+const uint8_t* stream_table_lookup(uint16_t id, uint32_t seq, size_t* len);
+
+/**
+ * stream_table_count - number of sequenced topics
+ */
+size_t stream_table_count(void);
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define TIMER_WHEEL_TICK_MS 10					// resolution of every timer
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)	// slots per level
+
+struct timer_node;
+
+/**
+ * timer_fn - called once when a timer expires (the timer is already disarmed)
+ */
+typedef void (*timer_fn)(struct timer_node* timer);
+
+/**
+ * timer_node_t - intrusive timer, embedded in the object it times out
+ */
+typedef struct timer_node {
+	uint64_t expires_tick;
+	timer_fn fn;
+	bool armed;
+	struct timer_node** slot;					// slot list the timer is linked into
+	struct timer_node* prev;
+	struct timer_node* next;
+} timer_node_t;
+
+/**
+ * timer_wheel_t - hierarchical timer wheel
+ *
+ * Level L holds timers expiring within 64^(L+1) ticks; when level 0 wraps,
+ * the next slot of the level above is cascaded down. Adding, cancelling and
+ * expiring a timer are O(1); each timer is cascaded at most once per level.
+ */
+typedef struct {
+	uint64_t now_tick;								// every tick before this one has been processed
+	size_t count;											// armed timers
+	timer_node_t* slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} timer_wheel_t;
+
+/**
+ * timer_wheel_init - reset a wheel to an empty state at @now_ms
+ */
+void timer_wheel_init(timer_wheel_t* w, uint64_t now_ms);
+
+/**
+ * timer_wheel_add - arm (or re-arm) a timer to fire at @expires_ms
+ *
+ * @w: timer wheel
+ * @t: timer to arm, cancelled first if already armed
+ * @expires_ms: absolute monotonic expiry time in milliseconds
+ * @fn: expiry callback
+ */
+void timer_wheel_add(timer_wheel_t* w, timer_node_t* t, uint64_t expires_ms, timer_fn fn);
+
+/**
+ * timer_wheel_cancel - disarm a timer (no-op if it is not armed)
+ */
+void timer_wheel_cancel(timer_wheel_t* w, timer_node_t* t);
+
+/**
+ * timer_wheel_advance - run the callbacks of every timer due at @now_ms
+ *
+ * Callbacks may add or cancel timers, including re-arming themselves.
+ */
+void timer_wheel_advance(timer_wheel_t* w, uint64_t now_ms);
+
+/**
+ * timer_wheel_next_timeout_ms - time until the wheel next needs advancing
+ *
+ * Scans at most one level-0 revolution, so the result is exact for timers
+ * due within TIMER_WHEEL_SLOTS ticks and a safe lower bound otherwise.
+ *
+ * Return: milliseconds to wait (0 if something is due), or -1 if no timer is armed
+ */
+int timer_wheel_next_timeout_ms(const timer_wheel_t* w, uint64_t now_ms);
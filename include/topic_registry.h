@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "hash_table.h"
+
+/**
+ * topic_registry_entry_t - one registered topic and its owner's stream
+ */
+typedef struct {
+	char* topic;
+	void* value;
+} topic_registry_entry_t;
+
+/**
+ * topic_registry_t - topics numbered from 1 in the order they were registered
+ *
+ * Ids go into the 16-bit topic_id of deliveries. Topics are found by their
+ * FNV-1a hash; a topic whose hash another topic already took is never
+ * registered. A zeroed registry with @max set is valid and empty, its entries
+ * are allocated on first use.
+ */
+typedef struct {
+	uint16_t max;											// ids handed out at most
+	uint16_t count;
+	topic_registry_entry_t* entries;	// id -> entry, slot 0 is never used
+	hash_table_t by_topic;						// FNV-1a of the topic -> id
+} topic_registry_t;
+
+/**
+ * topic_registry_find - stream registered for @topic
+ *
+ * Return: value passed to topic_registry_add(), or NULL if @topic is not registered
+ */
+void* topic_registry_find(topic_registry_t* r, const char* topic);
+
+/**
+ * topic_registry_add - register @topic under the next id
+ *
+ * @value: owner's stream, returned by topic_registry_find() and topic_registry_get()
+ *
+ * Return: id of @topic, 0 if the registry is full, another topic has the
+ *         same hash, or on allocation failure
+ */
+uint16_t topic_registry_add(topic_registry_t* r, const char* topic, void* value);
+
+/**
+ * topic_registry_get - stream registered under @id
+ *
+ * Return: value, or NULL if no topic has @id
+ */
+void* topic_registry_get(const topic_registry_t* r, uint16_t id);
+
+/**
+ * topic_registry_clear - forget every topic, the owner frees its streams first
+ */
+void topic_registry_clear(topic_registry_t* r);
@@ -1,31 +1,89 @@
 #pragma once
 
-#include <netinet/in.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
 
+/**
+ * Subscriber - one routing target: a broker session id and the QoS granted to it
+ */
 typedef struct Subscriber {
-	struct sockaddr_in addr;
-	struct Subscriber* next;
+	uint32_t session;				// broker session id (see session_table.h)
+	uint8_t qos;						// highest QoS granted among matching subscriptions
+	bool shared;						// routed to only as a member of a shared group
 } Subscriber;
 
+/**
+ * SubscriberList - routing result of a published topic, one entry per session
+ */
 typedef struct SubscriberList {
-	Subscriber* head;
+	Subscriber* items;
 	size_t count;
+	size_t capacity;
 } SubscriberList;
 
 
+#define RETAIN_DEFAULT_BUDGET (1024 * 1024)	// bytes of retained messages (and their topic nodes) kept broker-wide
+#define SHARE_PREFIX "$share/"						// shared subscription: "$share/<group>/<filter>"
+#define SHARE_PREFIX_LEN 7
+
+/**
+ * share_policy_t - how a shared subscription picks the member receiving a message
+ */
+typedef enum {
+	SHARE_ROUND_ROBIN = 0,						// members in turn
+	SHARE_LEAST_LOADED,								// member with the least outstanding work
+	SHARE_KEY_HASH,										// fixed member per topic, keeps each topic in order
+} share_policy_t;
+
+/**
+ * share_load_cb - outstanding work of a session, used by SHARE_LEAST_LOADED
+ */
+typedef size_t (*share_load_cb)(uint32_t session, void* ctx);
+
+/**
+ * retained_cb - called for every retained message replayed to a new subscription
+ */
+typedef void (*retained_cb)(const char* topic, uint8_t qos, const void* data, size_t len, void* ctx);
+
+/**
+ * session_match_cb - selects sessions for topic_table_remove_sessions()
+ */
+typedef bool (*session_match_cb)(uint32_t session, void* ctx);
+
 // initialize/destroy topic table
 void init_topic_table(void);
 void free_topic_table(void);
 
 // add/delete subscriber
-int subscribe_topic(const char* topic_str, const struct sockaddr_in* subscriber);
-int unsubscribe_topic(const char* topic_str, const struct sockaddr_in* subscriber);
+int subscribe_topic(const char* topic_str, uint32_t session);
+int subscribe_topic_qos(const char* topic_str, uint32_t session, uint8_t qos);
+int unsubscribe_topic(const char* topic_str, uint32_t session);
+size_t topic_table_remove_sessions(session_match_cb match, void* ctx);
 
 // get subscriber list of given topic
 SubscriberList* get_matching_subscribers(const char* topic_str);
 
+// retained messages: keep the last N messages of topics matching configured filters
+int topic_retain_configure(const char* filter, size_t depth);
+void topic_retain_set_budget(size_t max_bytes);
+void topic_retain_store(const char* topic_str, uint8_t qos, const void* data, size_t len);
+void topic_retain_replay(const char* filter, retained_cb cb, void* ctx);
+size_t topic_retain_usage(void);
+
+// shared subscriptions: each message goes to one member of a group
+bool topic_is_shared(const char* filter);
+int topic_share_configure(const char* group, share_policy_t policy);
+void topic_share_set_load_probe(share_load_cb cb, void* ctx);
+
+// check if a published topic matches a subscription filter
+bool topic_matches_filter(const char* filter, const char* topic);
+bool topic_filter_covers(const char* outer, const char* inner);
+
+// snapshot support: relocatable image of the subscription trie
+size_t topic_table_snapshot_write(uint8_t* image);
+int topic_table_snapshot_adopt(uint8_t* image, size_t len);
+
 // for utilities
 void print_topic_tree(void); // for debugging
 void free_subscriber_list(SubscriberList* list); // free list
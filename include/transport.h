@@ -11,5 +11,11 @@ int send_bytes(int sockfd, const struct sockaddr* dest_addr, socklen_t addrlen,
 
 int recv_bytes(int sockfd, uint8_t* buffer, size_t max_len, struct sockaddr* from_addr, socklen_t* from_len);
 
+int join_multicast(const struct sockaddr_in* group, struct in_addr iface);
+
+int set_multicast_interface(int sockfd, struct in_addr iface);
+
+int set_pacing_rate(int sockfd, uint64_t bytes_per_sec);
+
 void enable_transport_debug(bool enable);
 
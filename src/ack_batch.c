@@ -0,0 +1,54 @@
+#include "../include/ack_batch.h"
+
+typedef struct {
+	uint32_t session;
+	uint32_t msg_id;
+	uint8_t qos;
+} deferred_ack_t;
+
+static deferred_ack_t deferred_acks[ACK_BATCH_MAX];
+static size_t deferred_count = 0;
+static ack_batch_commit_cb commit_cb = NULL;
+static ack_batch_send_cb send_cb = NULL;
+static void* send_ctx = NULL;
+
+void ack_batch_init(ack_batch_commit_cb commit, ack_batch_send_cb send, void* ctx) {
+	deferred_count = 0;
+	commit_cb = commit;
+	send_cb = send;
+	send_ctx = ctx;
+}
+
+int ack_batch_flush(void) {
+	if (commit_cb() != 0) return -1;
+
+	for (size_t i = 0; i < deferred_count; ++i) {
+		send_cb(deferred_acks[i].session, deferred_acks[i].qos, deferred_acks[i].msg_id, send_ctx);
+	}
+	deferred_count = 0;
+	return 0;
+}
+
+bool ack_batch_defer(uint32_t session, uint8_t qos, uint32_t msg_id) {
+	if (deferred_count == ACK_BATCH_MAX) ack_batch_flush();
+	// still full: the commit failed, the publisher retransmits instead
+	if (deferred_count == ACK_BATCH_MAX) return false;
+
+	deferred_acks[deferred_count].session = session;
+	deferred_acks[deferred_count].msg_id = msg_id;
+	deferred_acks[deferred_count].qos = qos;
+	deferred_count++;
+	return true;
+}
+
+void ack_batch_forget(bool (*gone)(uint32_t session, void* ctx), void* ctx) {
+	size_t kept = 0;
+	for (size_t i = 0; i < deferred_count; ++i) {
+		if (!gone(deferred_acks[i].session, ctx)) deferred_acks[kept++] = deferred_acks[i];
+	}
+	deferred_count = kept;
+}
+
+size_t ack_batch_count(void) {
+	return deferred_count;
+}
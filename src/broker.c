@@ -1,20 +1,69 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <arpa/inet.h>
 #include <time.h>
+#include <poll.h>
 #include "../include/transport.h"
 #include "../include/slim_msg.h"
 #include "../include/packet_handler.h"
 #include "../include/topic_table.h"
 #include "../include/pending_table.h"
+#include "../include/session_table.h"
+#include "../include/message_log.h"
+#include "../include/snapshot.h"
+#include "../include/timer_wheel.h"
+#include "../include/dedup_table.h"
+#include "../include/multicast_table.h"
+#include "../include/stream_table.h"
+#include "../include/fec_table.h"
+#include "../include/pacer.h"
+#include "../include/ack_batch.h"
 
 #define BROKER_PORT 9000
-#define DEDUP_TABLE_SIZE 1024
+#define DEDUP_MEMORY_BUDGET (1024 * 1024)	// default bytes for QoS 1 duplicate tracking
 #define DEDUP_EXPIRATION_SEC 10
+#define LOG_REDELIVER_DELAY_MS 3000	// grace period for subscribers to return after a restart
+#define SACK_MAX_FRAMES 64	// publishers with held ACKs, the frames are sent early once full
 
 static bool debug_mode = false;
+static const char* snapshot_path = NULL;
+static uint64_t keepalive_timeout_ms = SESSION_KEEPALIVE_TIMEOUT_SEC * 1000;
+static const char* multicast_iface = NULL;
+static uint64_t kernel_pacing_rate = 0;		// bytes per second for SO_MAX_PACING_RATE, 0 = off
+
+// fan-out deliveries leave through this token bucket, pacing is off until -P sets a rate
+static pacer_t fanout_pacer;
+
+// every broker timeout (retransmits, QoS 2 expiry, redelivery, snapshots, session expiry) runs on one wheel
+static timer_wheel_t broker_timers;
+
+/**
+ * now_ms - monotonic clock in milliseconds, used for broker timers
+ */
+static uint64_t now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * send_fanout - send one datagram of a publish's fan-out, through the pacer
+ */
+static void send_fanout(int sockfd, const struct sockaddr_in* dest, const uint8_t* buffer, size_t len) {
+	if (pacer_send(&fanout_pacer, sockfd, dest, buffer, len, now_us()) != 0 && debug_mode) {
+		printf("[BROKER] Pacing queue full, dropped a delivery to %s:%d\n",
+						inet_ntoa(dest->sin_addr), ntohs(dest->sin_port));
+	}
+}
 
 /**
  * init_broker_socket - create and bind a UDP socket for broker
@@ -107,265 +156,1693 @@ int echo_to_client(int sockfd, const struct sockaddr_in* client_addr,
 }
 
 /**
- * handle_subscribe - handles a subscription request
+ * take_credit - consume one receive credit of a flow-controlled session
  *
- * @topic_str: topic to subscribe to
- * @client_addr: address of subscribing client
+ * Return: true if a delivery may be sent now
  */
-void handle_subscribe(const char* topic_str, const struct sockaddr_in* client_addr) {
-	subscribe_topic(topic_str, client_addr);
-	if (debug_mode) {
-		printf("[BROKER] Subscribed: %s\n", topic_str);
-	}
+static bool take_credit(broker_session_t* session) {
+	if (!session || !session->flow_control) return true;
+	if (session->credits == 0) return false;
+
+	session->credits--;
+	return true;
 }
 
-void publish_to_subscribers(int sockfd, const slim_msg_header_t* header, const char* topic_str, const void* payload, size_t payload_length) {
-	SubscriberList* targets = get_matching_subscribers(topic_str);
-	if (!targets) return;
+// sessions with deliveries queued behind a full outbound window, advanced by the main loop
+static broker_session_t* backlogged_sessions = NULL;
+
+// sessions catching up from the log, advanced by the main loop
+static broker_session_t* replaying_sessions = NULL;
+
+/**
+ * rewind_consumer - replay a named consumer again from the oldest delivery it lost
+ *
+ * A live consumer goes back to catching up from the log, so the lost record
+ * and everything after it is delivered again (at least once) and the commit
+ * moves past it instead of staying pinned there, along with compaction. Its
+ * live subscription stays registered but is skipped until the replay catches
+ * up. A replaying consumer just moves its cursor back.
+ */
+static void rewind_consumer(broker_session_t* session) {
+	if (!session->outbound.lost_logged || session->expiring) return;
+
+	uint64_t lost = session->outbound.lost_offset;
+	outbound_clear_lost(&session->outbound);
+
+	if (session->replaying) {
+		if (lost < message_log_cursor_offset(&session->replay_cursor)) {
+			message_log_seek_offset(lost, &session->replay_cursor);
+		}
+	} else {
+		message_log_seek_offset(lost, &session->replay_cursor);
+		session->replaying = true;
+		session->replay_next = replaying_sessions;
+		replaying_sessions = session;
+	}
 
 	if (debug_mode) {
-		printf("[BROKER] PUBLISH to %zu subscribers: %s\n", targets->count, topic_str);
+		printf("[BROKER] Consumer '%s' lost offset %llu, replaying from there\n",
+						session->consumer, (unsigned long long)lost);
 	}
+}
 
-	for (Subscriber* s = targets->head; s != NULL; s = s->next) {
-		uint8_t buffer[2048];
+/**
+ * deliver_reliable - send a delivery that is retransmitted until the subscriber ACKs it
+ *
+ * The broker assigns its own per-subscriber msg_id so ACKs from different
+ * publishers' messages never collide in the subscriber's window. QoS 2
+ * deliveries then run the RECEIVED/RELEASE/COMPLETE handshake per subscriber.
+ * Without credit the delivery is held in the window until the subscriber
+ * advertises more. When the window is full it is queued behind it and gets
+ * its msg_id once ACKs free a slot (see advance_backlogs()), since the
+ * publisher was already ACKed.
+ *
+ * @sockfd: broker socket
+ * @qos: delivery QoS (QOS_AT_LEAST_ONCE or QOS_EXACTLY_ONCE)
+ * @header: header of the serialized delivery in @buffer (rewritten in place)
+ * @buffer: serialized delivery
+ * @len: length of @buffer
+ * @session: subscriber session
+ * @log_ref: durable record held until the delivery completes, or NULL
+ */
+static void deliver_reliable(int sockfd, uint8_t qos, const slim_msg_header_t* header,
+															uint8_t* buffer, size_t len,
+															broker_session_t* session,
+															const log_ref_t* log_ref) {
+	slim_msg_header_t out_hdr = *header;
+	out_hdr.qos_level = qos;
+	out_hdr.msg_id = session->next_msg_id;
+	out_hdr.session_id = session_wire_id(session);
+	memcpy(buffer, &out_hdr, sizeof(out_hdr));
 
-		int len = serialize_message(header, topic_str, payload,
-																payload_length, buffer,
-																sizeof(buffer));
-		if (len > 0){
-			send_bytes(sockfd, (const struct sockaddr*)&s->addr,
-									sizeof(s->addr), buffer, len);
+	if (session->outbound.queued > 0 || !outbound_slot_free(&session->outbound, out_hdr.msg_id)) {
+		int rc = outbound_enqueue(&session->outbound, qos, buffer, len, log_ref);
+		if (rc == -1) {
+			if (debug_mode) {
+				printf("[BROKER] Backlog of session %u full, dropped a delivery\n", session->id);
+			}
+			if (session->consumer[0] != '\0') rewind_consumer(session);
+			return;
 		}
+		if (rc != 0) {
+			fprintf(stderr, "[BROKER] Out of memory, lost a delivery to session %u\n", session->id);
+			return;
+		}
+		if (!session->backlogged) {
+			session->backlogged = true;
+			session->backlog_next = backlogged_sessions;
+			backlogged_sessions = session;
+		}
+		return;
 	}
 
-	free_subscriber_list(targets);
+	bool send_now = take_credit(session);
+
+	if (outbound_track(&session->outbound, out_hdr.msg_id, qos, &session->addr,
+										buffer, len, now_ms(), send_now, log_ref) != 0) {
+		if (send_now && session->flow_control) session->credits++;
+		fprintf(stderr, "[BROKER] Out of memory, lost a delivery to session %u\n", session->id);
+		return;
+	}
+	session->next_msg_id++;
+
+	if (send_now) send_fanout(sockfd, &session->addr, buffer, len);
 }
 
 /**
- * handle_publish - handles a publish request and forwards it to matching subscribers
+ * advance_backlogs - move queued deliveries into the windows ACKs have freed
  *
- * @sockfd: UDP socket to send message
- * @header: original message header from the publisher
- * @topic_str: published topic string (used as payload here, for testing)
+ * A session leaves the backlog list once its queue is empty.
  */
-void handle_publish(int sockfd, const slim_msg_header_t* header,
-										const char* topic_str, const void* payload,
-										size_t payload_length, const struct sockaddr_in* client_addr,
-										socklen_t addrlen) {
-	if (header->qos_level == QOS_EXACTLY_ONCE) {
-		qos2_state_t state;
-		if (pending_table_get(client_addr, header->msg_id, &state)) {
-			if (state == QOS2_STATE_COMPLETED) {
-				if (debug_mode) printf("[BROKER] QoS2 msg already completed, skiping\n");
-				return;
+static void advance_backlogs(int sockfd) {
+	broker_session_t** link = &backlogged_sessions;
+
+	while (*link) {
+		broker_session_t* session = *link;
+		outbound_window_t* w = &session->outbound;
+
+		while (w->queued > 0 && outbound_slot_free(w, session->next_msg_id)) {
+			bool send_now = take_credit(session);
+			const outbound_entry_t* e = outbound_dequeue(w, session->next_msg_id, &session->addr,
+																										now_ms(), send_now);
+			if (!e) {
+				if (send_now && session->flow_control) session->credits++;
+				break;
 			}
-		} else {
-			pending_table_update(client_addr, header->msg_id, QOS2_STATE_RECEIVED);
+			session->next_msg_id++;
+			if (send_now) send_fanout(sockfd, &session->addr, e->packet, e->packet_len);
+		}
 
-			publish_to_subscribers(sockfd, header, topic_str, payload, payload_length);
+		if (w->queued > 0) {
+			link = &session->backlog_next;
+			continue;
 		}
+		*link = session->backlog_next;
+		session->backlogged = false;
+	}
+}
+
+/**
+ * deliver_best_effort - send a QoS 0 delivery unless the subscriber is out of credit
+ *
+ * Return: true if the delivery was sent
+ */
+static bool deliver_best_effort(int sockfd, const uint8_t* buffer, size_t len,
+																broker_session_t* session) {
+	if (!take_credit(session)) {
+		session->throttled++;
+		return false;
+	}
 
-		slim_msg_header_t ctrl_hdr = {
+	send_fanout(sockfd, &session->addr, buffer, len);
+	return true;
+}
+
+/**
+ * consumer_advance - commit a named consumer's progress after a log record was delivered
+ *
+ * The committed offset is the lowest one the subscriber has not acknowledged:
+ * reliable deliveries still in flight or queued and deliveries that were
+ * dropped stay ahead of it. Dropped ones are replayed (see rewind_consumer()),
+ * so the commit moves on once they get through.
+ *
+ * @log_ref: record that was ACKed, or sent at QoS 0
+ */
+static void consumer_advance(broker_session_t* session, const log_ref_t* log_ref) {
+	if (!session || session->consumer[0] == '\0' || !log_ref || !log_ref->segment) return;
+	rewind_consumer(session);
+
+	uint64_t end = message_log_record_offset(log_ref) + 1;
+	if (end > session->consumer_end) session->consumer_end = end;
+
+	uint64_t commit = session->consumer_end;
+	uint64_t unacked;
+	if (outbound_low_offset(&session->outbound, &unacked) && unacked < commit) commit = unacked;
+
+	message_log_consumer_commit(session->consumer, commit);
+}
+
+/**
+ * deliver_logged_best_effort - send a QoS 0 delivery of a log record and commit it
+ *
+ * A delivery dropped for lack of credit holds the consumer's commit back.
+ */
+static void deliver_logged_best_effort(int sockfd, const uint8_t* buffer, size_t len,
+																				broker_session_t* session, const log_ref_t* log_ref) {
+	if (deliver_best_effort(sockfd, buffer, len, session)) {
+		consumer_advance(session, log_ref);
+	} else if (session->consumer[0] != '\0') {
+		outbound_mark_lost(&session->outbound, log_ref);
+		rewind_consumer(session);
+	}
+}
+
+/**
+ * deliver_to_subscriber - send one message to one subscriber at the negotiated QoS
+ *
+ * @sockfd: broker socket
+ * @header: header of the serialized QoS 0 delivery in @buffer
+ * @buffer: serialized delivery (header rewritten in place for reliable QoS)
+ * @len: length of @buffer
+ * @session: subscriber session
+ * @qos: delivery QoS, the lower of the publish QoS and the subscription QoS
+ * @log_ref: durable record of the message, or NULL
+ */
+static void deliver_to_subscriber(int sockfd, const slim_msg_header_t* header,
+																	uint8_t* buffer, size_t len,
+																	broker_session_t* session, uint8_t qos,
+																	const log_ref_t* log_ref) {
+	if (qos == QOS_AT_MOST_ONCE) {
+		slim_msg_header_t out_hdr = *header;
+		out_hdr.session_id = session_wire_id(session);
+		memcpy(buffer, &out_hdr, sizeof(out_hdr));
+		deliver_logged_best_effort(sockfd, buffer, len, session, log_ref);
+	} else {
+		deliver_reliable(sockfd, qos, header, buffer, len, session, log_ref);
+	}
+}
+
+/**
+ * deliver_sequenced - send a sequenced QoS 1 delivery
+ *
+ * The subscriber does not ACK it; a lost delivery shows up as a gap in the
+ * topic's sequence numbers and is resent from the stream ring on NACK.
+ *
+ * @packet: delivery stamped by stream_table_stamp() (session_id rewritten in place)
+ */
+static void deliver_sequenced(int sockfd, uint8_t* packet, size_t len,
+															broker_session_t* session, const log_ref_t* log_ref) {
+	slim_msg_header_t out_hdr;
+	memcpy(&out_hdr, packet, sizeof(out_hdr));
+	out_hdr.session_id = session_wire_id(session);
+	memcpy(packet, &out_hdr, sizeof(out_hdr));
+
+	deliver_logged_best_effort(sockfd, packet, len, session, log_ref);
+}
+
+/**
+ * send_fec_parity - send the parity of a completed block to everyone who got the block's last packet
+ *
+ * Subscribers that joined the topic's multicast group get the parity through
+ * the group as well.
+ *
+ * @route: multicast route of the topic, or -1
+ * @multicast: whether the block's last packet went to the group
+ */
+static void send_fec_parity(int sockfd, fec_stream_t* fec, const SubscriberList* targets,
+														int route, bool multicast) {
+	for (uint8_t index = 0; index < fec->encoder.m; ++index) {
+		uint8_t data[FEC_PARITY_HEADER_SIZE + FEC_MAX_BODY];
+		size_t data_len = fec_encoder_parity(&fec->encoder, fec->id, index, data, sizeof(data));
+		if (data_len == 0) break;
+
+		slim_msg_header_t hdr = {
 			.version = 1,
 			.msg_type = MSG_CONTROL,
-			.qos_level = QOS_EXACTLY_ONCE,
-			.msg_id = header->msg_id,
+			.qos_level = QOS_AT_MOST_ONCE,
+			.msg_id = 0,
 			.topic_id = 0,
 			.frag_id = 0,
 			.frag_total = 1,
 			.batch_size = 1,
-			.payload_length = 1,
-			.client_node_count = 1
+			.payload_length = 1 + data_len,
+			.client_node_count = 1,
+			.session_id = 0
 		};
 
 		uint8_t buffer[2048];
-		serialize_control_message(&ctrl_hdr, CONTROL_RECEIVED, NULL, 0, buffer, sizeof(buffer));
-		send_bytes(sockfd, (const struct sockaddr*)client_addr, addrlen, buffer, sizeof(slim_msg_header_t) + 1);
+		int len = serialize_control_message(&hdr, CONTROL_FEC, data, data_len, buffer, sizeof(buffer));
+		if (len < 0) break;
 
-		if (debug_mode) {
-			printf("[BROKER] QoS2 -> Sent CONTROL_RECEIVED (msg_id=%u)\n", header->msg_id);
+		for (size_t i = 0; i < targets->count; ++i) {
+			broker_session_t* session = session_get(targets->items[i].session);
+			if (!session || (route >= 0 && (session->multicast_joined & (1u << route)))) continue;
+
+			hdr.session_id = session_wire_id(session);
+			memcpy(buffer, &hdr, sizeof(hdr));
+			send_fanout(sockfd, &session->addr, buffer, len);
+		}
+		if (multicast) {
+			const multicast_route_t* r = multicast_route_get(route);
+			hdr.session_id = 0;
+			memcpy(buffer, &hdr, sizeof(hdr));
+			send_fanout(sockfd, &r->group, buffer, len);
 		}
+	}
+	fec_encoder_next_block(&fec->encoder);
+}
+
+/**
+ * publish_to_subscribers - fan a message out to every matching subscriber
+ *
+ * QoS 0 messages of a topic routed to a multicast group are sent to the group
+ * once for all subscribers that joined it; everyone else gets a unicast copy.
+ * QoS 1 deliveries to sequenced sessions share one sequence number per
+ * publish; shared group members, which only see part of a topic, are ACKed
+ * as usual. QoS 0 publishes of FEC-protected topics are numbered as well and
+ * followed by parity packets after every block. Everything goes out through
+ * the fan-out pacer, so a large fan-out is spread at the -P rate.
+ */
+void publish_to_subscribers(int sockfd, const slim_msg_header_t* header, const char* topic_str, const void* payload, size_t payload_length, const log_ref_t* log_ref) {
+	int route = header->qos_level == QOS_AT_MOST_ONCE ? multicast_route_for_topic(topic_str) : -1;
+	bool multicast = false;
+
+	SubscriberList* targets = get_matching_subscribers(topic_str);
+	if (!targets) return;
+
+	if (debug_mode) {
+		printf("[BROKER] PUBLISH to %zu subscribers: %s\n", targets->count, topic_str);
+	}
+
+	slim_msg_header_t qos0_hdr = *header;
+	qos0_hdr.qos_level = QOS_AT_MOST_ONCE;
+	qos0_hdr.topic_id = 0;						// in deliveries it names the stream of a sequenced one
+
+	uint8_t buffer[2048];
+	int len = serialize_message(&qos0_hdr, topic_str, payload,
+															payload_length, buffer,
+															sizeof(buffer));
+	if (len < 0) {
+		free_subscriber_list(targets);
 		return;
 	}
-	
-	if (header->qos_level == QOS_AT_LEAST_ONCE) {
-		publish_to_subscribers(sockfd, header, topic_str, payload, payload_length);
 
-		slim_msg_header_t ack_header = {
-			.version = 1,
-			.msg_type = MSG_ACK,
-			.qos_level = QOS_AT_LEAST_ONCE,
-			.msg_id = header->msg_id,
-			.topic_id = 0,
-			.frag_id = 0,
-			.frag_total = 1,
-			.batch_size = 1,
-			.payload_length = 0,
-			.client_node_count = 1
-		};
-		uint8_t ack_buf[sizeof(slim_msg_header_t)];
-		memcpy(ack_buf, &ack_header, sizeof(ack_header));
-		send_bytes(sockfd, (const struct sockaddr*)client_addr,
-								addrlen, ack_buf, sizeof(ack_buf));
+	fec_stream_t* fec = header->qos_level == QOS_AT_MOST_ONCE ? fec_stream_for(topic_str) : NULL;
+	bool block_complete = false;
+	if (fec) {
+		block_complete = fec_stream_stamp(fec, buffer, len);
+		memcpy(&qos0_hdr, buffer, sizeof(qos0_hdr));
+	}
 
-		if (debug_mode) {
-			printf("[BROKER] Sent MSG_ACK for QoS1 msg_id=%u\n", header->msg_id);
+	uint8_t stamped[2048];
+	int stamp_result = 1;							// 1 = not stamped yet, else stream_table_stamp()
+
+	for (size_t i = 0; i < targets->count; ++i) {
+		const Subscriber* s = &targets->items[i];
+		broker_session_t* session = session_get(s->session);
+		// a consumer rewound to replay a lost record gets this one from the log too
+		if (!session || session->replaying) continue;
+
+		if (route >= 0 && (session->multicast_joined & (1u << route))) {
+			multicast = true;
+			continue;
 		}
-		return;
+
+		uint8_t qos = s->qos < header->qos_level ? s->qos : header->qos_level;
+		if (qos == QOS_AT_LEAST_ONCE && session->sequenced && !s->shared) {
+			if (stamp_result == 1) {
+				memcpy(stamped, buffer, len);
+				stamp_result = stream_table_stamp(topic_str, stamped, len);
+			}
+			if (stamp_result == 0) {
+				deliver_sequenced(sockfd, stamped, len, session, log_ref);
+				continue;
+			}
+		}
+		deliver_to_subscriber(sockfd, &qos0_hdr, buffer, len, session, qos, log_ref);
 	}
-	
-	// case for QoS0
-	publish_to_subscribers(sockfd, header, topic_str, payload, payload_length);
+
+	if (multicast) {
+		const multicast_route_t* r = multicast_route_get(route);
+		qos0_hdr.session_id = 0;
+		memcpy(buffer, &qos0_hdr, sizeof(qos0_hdr));
+		send_fanout(sockfd, &r->group, buffer, len);
+	}
+	if (block_complete) send_fec_parity(sockfd, fec, targets, route, multicast);
+
+	free_subscriber_list(targets);
 }
 
-void handle_control_release (int sockfd, const slim_msg_header_t* header, const struct sockaddr_in* client_addr, socklen_t addrlen) {
-	pending_table_update(client_addr, header->msg_id, QOS2_STATE_RELEASED);
+struct retained_replay_ctx {
+	int sockfd;
+	broker_session_t* session;
+	uint8_t qos;
+};
 
-	slim_msg_header_t complete_hdr = {
+/**
+ * replay_retained - deliver one retained message to a new subscriber
+ */
+static void replay_retained(const char* topic, uint8_t qos, const void* data, size_t len, void* arg) {
+	struct retained_replay_ctx* ctx = arg;
+
+	slim_msg_header_t header = {
 		.version = 1,
-		.msg_type = MSG_CONTROL,
-		.qos_level = QOS_EXACTLY_ONCE,
-		.msg_id = header->msg_id,
+		.msg_type = MSG_PUBLISH,
+		.qos_level = QOS_AT_MOST_ONCE,
+		.msg_id = 0,
+		.payload_length = 1 + strlen(topic) + len,
 		.topic_id = 0,
 		.frag_id = 0,
 		.frag_total = 1,
 		.batch_size = 1,
-		.payload_length = 1,
 		.client_node_count = 1
 	};
 
 	uint8_t buffer[2048];
-	serialize_control_message(&complete_hdr, CONTROL_COMPLETE, NULL, 0, buffer, sizeof(buffer));
+	int out_len = serialize_message(&header, topic, data, len, buffer, sizeof(buffer));
+	if (out_len < 0) return;
+
+	deliver_to_subscriber(ctx->sockfd, &header, buffer, out_len, ctx->session,
+												qos < ctx->qos ? qos : ctx->qos, NULL);
+}
+
+/**
+ * send_multicast_control - send a CONTROL_MULTICAST naming @group to a session
+ */
+static void send_multicast_control(int sockfd, const struct sockaddr_in* group,
+																		const broker_session_t* session) {
+	slim_msg_header_t hdr = {
+		.version = 1,
+		.msg_type = MSG_CONTROL,
+		.qos_level = QOS_AT_MOST_ONCE,
+		.msg_id = 0,
+		.topic_id = 0,
+		.frag_id = 0,
+		.frag_total = 1,
+		.batch_size = 1,
+		.payload_length = 1 + MULTICAST_SPEC_SIZE,
+		.client_node_count = 1,
+		.session_id = session_wire_id(session)
+	};
 
-	send_bytes(sockfd, (const struct sockaddr*)client_addr, addrlen, buffer, sizeof(slim_msg_header_t) + 1);
+	uint8_t spec[MULTICAST_SPEC_SIZE];
+	memcpy(spec, &group->sin_addr.s_addr, 4);
+	memcpy(spec + 4, &group->sin_port, 2);
 
-	pending_table_update(client_addr, header->msg_id, QOS2_STATE_COMPLETED);
+	uint8_t buffer[64];
+	int len = serialize_control_message(&hdr, CONTROL_MULTICAST, spec, sizeof(spec), buffer, sizeof(buffer));
+	if (len < 0) return;
 
-	if (debug_mode) {
-		printf("[BROKER] Received CONTROL_RELEASE -> Sent CONTROL_COMPLETE (msg_id=%u)\n", header->msg_id);
-	}
+	send_bytes(sockfd, (const struct sockaddr*)&session->addr, sizeof(session->addr), buffer, len);
 }
 
-void handle_control_received(int sockfd, const slim_msg_header_t* header, const uint8_t* payload, size_t payload_len, const struct sockaddr_in* client_addr, socklen_t addrlen) {
-	qos2_state_t current;
-	if (!pending_table_get(client_addr, header->msg_id, &current)) {
-		if (debug_mode) {
-			printf("[BROKER] CONTROL_RECEIVED for unknown msg_id=%u\n", header->msg_id);
-		}
-		return;
-	}
+/**
+ * offer_multicast - offer a new subscriber the multicast groups its filter fully covers
+ *
+ * Only covered routes are offered, so a joined subscriber never receives
+ * topics it did not subscribe to. The subscriber keeps unicast delivery until
+ * it confirms the join.
+ */
+static void offer_multicast(int sockfd, const char* topic_str, const broker_session_t* session) {
+	for (size_t i = 0; i < multicast_route_count(); ++i) {
+		const multicast_route_t* r = multicast_route_get((int)i);
+		if (!topic_filter_covers(topic_str, r->filter)) continue;
 
-	if (current != QOS2_STATE_RECEIVED) {
+		send_multicast_control(sockfd, &r->group, session);
 		if (debug_mode) {
-			printf("[BROKER] Unexpected CONTROL_RECEIVED for msg_id=%u, state=%d\n", header->msg_id, current);
+			printf("[BROKER] Offered multicast %s:%d for %s to session %u\n",
+							inet_ntoa(r->group.sin_addr), ntohs(r->group.sin_port), r->filter, session->id);
 		}
-		return;
 	}
+}
+
+/**
+ * handle_control_multicast - a subscriber joined an offered group, stop unicasting its traffic
+ *
+ * @data: CONTROL_MULTICAST data naming the group
+ * @len: length of @data
+ */
+static void handle_control_multicast(const char* data, size_t len, broker_session_t* session) {
+	if (len < MULTICAST_SPEC_SIZE) return;
+
+	struct sockaddr_in group = { .sin_family = AF_INET };
+	memcpy(&group.sin_addr.s_addr, data, 4);
+	memcpy(&group.sin_port, data + 4, 2);
 
-	pending_table_update(client_addr, header->msg_id, QOS2_STATE_WAIT_RELEASE);
+	int route = multicast_route_for_group(&group);
+	if (route < 0) return;
 
+	session->multicast_joined |= 1u << route;
 	if (debug_mode) {
-		printf("[BROKER] CONTROL_RECEIVED acknowledged for msg_id\%u -> state=WAIT_RELEASE\n", header->msg_id);
+		printf("[BROKER] Session %u joined multicast %s:%d\n", session->id,
+						inet_ntoa(group.sin_addr), ntohs(group.sin_port));
 	}
 }
 
-void handle_control(int sockfd, const slim_msg_header_t* header, const uint8_t* raw_buf, size_t buf_len, const struct sockaddr_in* client_addr, socklen_t addrlen) {
-	control_type_t ctrl_type;
-	char ctrl_data[2048];
+/**
+ * start_replay - position a subscriber's log cursor and queue it for catch-up
+ *
+ * The live subscription is registered only once the cursor reaches the end of
+ * the log, so history and live traffic reach the subscriber in log order.
+ *
+ * Return: 0 on success, -1 if the request cannot be served from the log
+ */
+static int start_replay(const char* topic_str, uint8_t qos, const uint8_t* spec,
+												size_t spec_len, broker_session_t* session) {
+	if (session->replaying || !message_log_enabled()) return -1;
 
-	int ctrl_result = deserialize_control_message(raw_buf, buf_len, (slim_msg_header_t*)header, &ctrl_type, ctrl_data, sizeof(ctrl_data));
+	uint8_t mode = spec[0];
+	uint64_t value;
+	memcpy(&value, spec + 1, sizeof(value));
 
-	if (ctrl_result != 0) {
-		fprintf(stderr, "[BROKER] Failed to parse CONTROL message.\n");
+	size_t name_len = spec_len - REPLAY_SPEC_SIZE;
+	if (name_len >= sizeof(session->consumer)) name_len = sizeof(session->consumer) - 1;
+	memcpy(session->consumer, spec + REPLAY_SPEC_SIZE, name_len);
+	session->consumer[name_len] = '\0';
+	session->consumer_end = 0;
+	// deliveries lost before are either replayed from the new position or skipped on request
+	outbound_clear_lost(&session->outbound);
+
+	uint64_t committed;
+	if (mode == REPLAY_FROM_COMMITTED && message_log_consumer_offset(session->consumer, &committed) == 0) {
+		value = committed;
+		mode = REPLAY_FROM_OFFSET;
+	}
+
+	if (mode == REPLAY_FROM_TIME) {
+		message_log_seek_time(value, &session->replay_cursor);
+	} else {
+		message_log_seek_offset(value, &session->replay_cursor);
+	}
+
+	snprintf(session->replay_filter, sizeof(session->replay_filter), "%s", topic_str);
+	session->replay_qos = qos;
+	session->replaying = true;
+	session->replay_next = replaying_sessions;
+	replaying_sessions = session;
+
+	if (debug_mode) {
+		printf("[BROKER] Replaying %s from offset %llu for consumer '%s'\n", topic_str,
+						(unsigned long long)message_log_cursor_offset(&session->replay_cursor),
+						session->consumer);
+	}
+	return 0;
+}
+
+/**
+ * handle_subscribe - register a subscription, optionally replaying the log first
+ *
+ * @sockfd: broker socket
+ * @topic_str: topic filter
+ * @qos: maximum QoS requested by the subscriber
+ * @spec: replay request carried in the SUBSCRIBE data (see replay_mode_t)
+ * @spec_len: length of @spec, 0 for a live-only subscription
+ * @session: subscriber session
+ */
+void handle_subscribe(int sockfd, const char* topic_str, uint8_t qos,
+											const uint8_t* spec, size_t spec_len,
+											broker_session_t* session) {
+	bool shared = topic_is_shared(topic_str);
+	if (!shared && spec_len >= REPLAY_SPEC_SIZE && spec[0] != REPLAY_NONE &&
+			start_replay(topic_str, qos, spec, spec_len, session) == 0) {
 		return;
 	}
 
-	switch (ctrl_type) {
-		case CONTROL_RELEASE:
-			handle_control_release(sockfd, header, client_addr, addrlen);
-			break;
-		case CONTROL_RECEIVED:
-			handle_control_received(sockfd, header, (const uint8_t*)ctrl_data, sizeof(ctrl_data), client_addr, addrlen);
-			break;
-		default:
-			if (debug_mode) {
-				printf("[BROKER] Unhandled CONTROL type: %d\n", ctrl_type);
-			}
-			break;
+	if (subscribe_topic_qos(topic_str, session->id, qos) != 0) {
+		fprintf(stderr, "[BROKER] Rejected subscription of session %u: %s\n", session->id, topic_str);
+		return;
 	}
+	if (debug_mode) {
+		printf("[BROKER] Subscribed session %u (qos=%u): %s\n", session->id, qos, topic_str);
+	}
+
+	// history would reach every member of a shared group, so it is only replayed to plain subscriptions
+	if (shared) return;
+
+	offer_multicast(sockfd, topic_str, session);
+
+	struct retained_replay_ctx ctx = { .sockfd = sockfd, .session = session, .qos = qos };
+	topic_retain_replay(topic_str, replay_retained, &ctx);
 }
 
+struct log_replay_ctx {
+	int sockfd;
+	broker_session_t* session;
+};
+
 /**
- * broker_main_loop - main loop of the broker
+ * replay_logged - deliver one log record to a replaying subscriber if it matches
+ */
+static void replay_logged(const log_ref_t* ref, const log_record_header_t* rec,
+													const char* topic, const void* data, void* arg) {
+	struct log_replay_ctx* ctx = arg;
+	broker_session_t* session = ctx->session;
+
+	if (!topic_matches_filter(session->replay_filter, topic)) return;
+
+	slim_msg_header_t header = {
+		.version = 1,
+		.msg_type = MSG_PUBLISH,
+		.qos_level = QOS_AT_MOST_ONCE,
+		.msg_id = 0,
+		.topic_id = 0,
+		.frag_id = 0,
+		.frag_total = 1,
+		.batch_size = 1,
+		.payload_length = 0,
+		.client_node_count = 1
+	};
+
+	uint8_t buffer[2048];
+	int len = serialize_message(&header, topic, data, rec->data_len, buffer, sizeof(buffer));
+	if (len < 0) return;
+
+	uint8_t qos = rec->qos < session->replay_qos ? rec->qos : session->replay_qos;
+	deliver_to_subscriber(ctx->sockfd, &header, buffer, len, session, qos, ref);
+}
+
+/**
+ * advance_replays - move every replaying subscriber forward through the log
  *
- * @sockfd: udp socket of broker
+ * Each subscriber advances as far as its outbound window and credits allow,
+ * up to LOG_GROUP_COMMIT_MAX records per call. A subscriber that reaches the
+ * end of the log switches to live delivery.
+ *
+ * Return: true if any subscriber made progress
  */
-void broker_main_loop(int sockfd) {
-	while(1) {
-		struct sockaddr_in client_addr;
-		socklen_t addrlen = sizeof(client_addr);
-		slim_msg_header_t header;
-		char topic[256];
-		char data[2048];
+static bool advance_replays(int sockfd) {
+	bool progress = false;
+	broker_session_t** link = &replaying_sessions;
 
-		uint8_t buffer[2048];
-		int received = recv_bytes(sockfd, buffer, sizeof(buffer),
-															(struct sockaddr*)&client_addr,
-															&addrlen);
+	while (*link) {
+		broker_session_t* session = *link;
+		struct log_replay_ctx ctx = { .sockfd = sockfd, .session = session };
+		bool at_end = false;
 
-		if (received < 0) {
-			fprintf(stderr, "[BROKER] Failed to receive bytes\n");
-			continue;
-		}
+		for (int n = 0; n < LOG_GROUP_COMMIT_MAX; ++n) {
+			if (session->outbound.queued > 0 ||
+					!outbound_slot_free(&session->outbound, session->next_msg_id)) break;
+			if (session->flow_control && session->credits == 0) break;
 
-		int result = deserialize_message(buffer, received,
-																			&header, topic,
-																			sizeof(topic),
-																			data, sizeof(data));
+			if (!message_log_read(&session->replay_cursor, replay_logged, &ctx)) {
+				at_end = true;
+				break;
+			}
+			progress = true;
+		}
 
-		if (result != 0) {
-			fprintf(stderr, "[BROKER] Failed to deserialize message.\n");
+		if (!at_end) {
+			link = &session->replay_next;
 			continue;
 		}
 
-		debug_dump_message(&header, data);
+		*link = session->replay_next;
+		session->replaying = false;
+		subscribe_topic_qos(session->replay_filter, session->id, session->replay_qos);
+		progress = true;
 
-		if (header.msg_type == MSG_SUBSCRIBE) {
-			handle_subscribe(topic, &client_addr);
-		} else if (header.msg_type == MSG_PUBLISH) {
-			handle_publish(sockfd, &header, topic, data,
-											header.payload_length - (1 + strlen(topic)),
-											&client_addr, addrlen);
-
-		} else if (header.msg_type == MSG_CONTROL) {
-			handle_control(sockfd, &header, buffer, received, &client_addr, addrlen);
-		} else {
-			if (debug_mode) {
-				printf("[BROKER] Unknown message type: %d\n", header.msg_type);
-			}
+		if (debug_mode) {
+			printf("[BROKER] Replay caught up, live delivery of %s\n", session->replay_filter);
 		}
 	}
+	return progress;
 }
 
-int main(int argc, char* argv[]) {
-	for (int i = 1; i < argc; ++i) {
-		if (strcmp(argv[i], "-d") == 0) {
+/**
+ * replay_low_watermark - lowest log offset an active replay still has to read
+ */
+static uint64_t replay_low_watermark(void) {
+	uint64_t low = UINT64_MAX;
+
+	for (broker_session_t* s = replaying_sessions; s != NULL; s = s->replay_next) {
+		uint64_t offset = message_log_cursor_offset(&s->replay_cursor);
+		if (offset < low) low = offset;
+	}
+	return low;
+}
+
+/**
+ * handle_ack - retire a reliable delivery acknowledged by a subscriber
+ *
+ * @header: MSG_ACK header carrying the broker-assigned msg_id
+ * @session: session of the acknowledging subscriber
+ */
+void handle_ack(const slim_msg_header_t* header, broker_session_t* session) {
+	log_ref_t ref;
+	bool retired = outbound_ack(&session->outbound, header->msg_id, &ref);
+	if (retired) consumer_advance(session, &ref);
+	if (debug_mode) {
+		printf("[BROKER] Subscriber ACK msg_id=%u%s\n", header->msg_id,
+						retired ? "" : " (unknown or duplicate)");
+	}
+}
+
+/**
+ * sack_frame_t - QoS 1 ACKs of one publisher not sent yet
+ *
+ * Acknowledges @first and first + 1 + i for every bit i of @bitmap. Only
+ * the listed ids are claimed: msg_ids are shared by every QoS level and
+ * session of a client, so the ids below @first say nothing.
+ */
+typedef struct {
+	uint32_t session;
+	uint32_t first;
+	uint64_t bitmap;
+} sack_frame_t;
+
+// one frame per publisher holding ACKs, sent after every receive batch, or when the
+// -a hold window is over
+static sack_frame_t sack_frames[SACK_MAX_FRAMES];
+static size_t sack_frame_count = 0;
+static uint32_t ack_hold_ms = 0;
+static size_t sack_frames_sent = 0;
+static size_t sack_acks_coalesced = 0;
+
+/**
+ * transmit_sack - send one coalesced ACK frame to its publisher
+ */
+static void transmit_sack(int sockfd, const sack_frame_t* frame) {
+	broker_session_t* session = session_get(frame->session);
+	if (!session) return;
+
+	slim_msg_header_t hdr = {
+		.version = 1,
+		.msg_type = MSG_CONTROL,
+		.qos_level = QOS_AT_LEAST_ONCE,
+		.msg_id = frame->first,
+		.topic_id = 0,
+		.frag_id = 0,
+		.frag_total = 1,
+		.batch_size = 1,
+		.payload_length = 1 + SACK_SPEC_SIZE,
+		.client_node_count = 1,
+		.session_id = session_wire_id(session)
+	};
+
+	uint8_t spec[SACK_SPEC_SIZE];
+	memcpy(spec, &frame->first, sizeof(frame->first));
+	memcpy(spec + 4, &frame->bitmap, sizeof(frame->bitmap));
+
+	uint8_t buffer[64];
+	int len = serialize_control_message(&hdr, CONTROL_SACK, spec, sizeof(spec), buffer, sizeof(buffer));
+	if (len < 0) return;
+
+	send_bytes(sockfd, (const struct sockaddr*)&session->addr, sizeof(session->addr), buffer, len);
+
+	size_t acks = 1 + (size_t)__builtin_popcountll(frame->bitmap);
+	sack_frames_sent++;
+	sack_acks_coalesced += acks;
+	if (debug_mode) {
+		printf("[BROKER] Sent CONTROL_SACK for %zu msg_id(s) from %u (%zu ACKs in %zu frames)\n",
+						acks, frame->first, sack_acks_coalesced, sack_frames_sent);
+	}
+}
+
+/**
+ * sack_frame_merge - add @msg_id to a frame if it fits its bitmap
+ *
+ * An id just below @first (publishing threads racing each other) rebases
+ * the frame when no set bit falls off the top.
+ *
+ * Return: true if the frame now acknowledges @msg_id
+ */
+static bool sack_frame_merge(sack_frame_t* frame, uint32_t msg_id) {
+	uint32_t ahead = msg_id - frame->first;
+	if (ahead == 0) return true;
+	if (ahead <= SACK_BITMAP_BITS) {
+		frame->bitmap |= 1ULL << (ahead - 1);
+		return true;
+	}
+
+	uint32_t behind = frame->first - msg_id;
+	if (behind > SACK_BITMAP_BITS) return false;
+
+	bool full = behind == SACK_BITMAP_BITS;
+	uint64_t dropped = full ? frame->bitmap : frame->bitmap >> (SACK_BITMAP_BITS - behind);
+	if (dropped != 0) return false;
+
+	frame->bitmap = (full ? 0 : frame->bitmap << behind) | 1ULL << (behind - 1);
+	frame->first = msg_id;
+	return true;
+}
+
+/**
+ * flush_sacks - send every held ACK frame
+ */
+static void flush_sacks(int sockfd) {
+	for (size_t i = 0; i < sack_frame_count; ++i) transmit_sack(sockfd, &sack_frames[i]);
+	sack_frame_count = 0;
+}
+
+/**
+ * hold_sack - hold back the QoS 1 ACK of a publisher that takes coalesced ACKs
+ *
+ * An id that does not fit the publisher's frame sends the frame first.
+ */
+static void hold_sack(int sockfd, uint32_t msg_id, const broker_session_t* session) {
+	for (size_t i = 0; i < sack_frame_count; ++i) {
+		sack_frame_t* frame = &sack_frames[i];
+		if (frame->session != session->id) continue;
+		if (sack_frame_merge(frame, msg_id)) return;
+
+		transmit_sack(sockfd, frame);
+		*frame = (sack_frame_t){ .session = session->id, .first = msg_id };
+		return;
+	}
+
+	if (sack_frame_count == SACK_MAX_FRAMES) flush_sacks(sockfd);
+	sack_frames[sack_frame_count++] = (sack_frame_t){ .session = session->id, .first = msg_id };
+}
+
+/**
+ * transmit_publish_ack - send MSG_ACK (QoS 1) or CONTROL_RECEIVED (QoS 2) to a publisher
+ *
+ * QoS 1 ACKs of publishers that asked for coalesced ACKs are held for a SACK frame.
+ */
+static void transmit_publish_ack(int sockfd, uint8_t qos, uint32_t msg_id,
+																	const broker_session_t* session) {
+	if (qos == QOS_AT_LEAST_ONCE && session->coalesced_acks) {
+		hold_sack(sockfd, msg_id, session);
+		return;
+	}
+
+	slim_msg_header_t ack_header = {
+		.version = 1,
+		.msg_type = MSG_ACK,
+		.qos_level = qos,
+		.msg_id = msg_id,
+		.topic_id = 0,
+		.frag_id = 0,
+		.frag_total = 1,
+		.batch_size = 1,
+		.payload_length = 0,
+		.client_node_count = 1,
+		.session_id = session_wire_id(session)
+	};
+
+	uint8_t buffer[64];
+	int len = sizeof(ack_header);
+	if (qos == QOS_EXACTLY_ONCE) {
+		len = serialize_control_message(&ack_header, CONTROL_RECEIVED, NULL, 0, buffer, sizeof(buffer));
+	} else {
+		memcpy(buffer, &ack_header, sizeof(ack_header));
+	}
+
+	send_bytes(sockfd, (const struct sockaddr*)&session->addr, sizeof(session->addr), buffer, len);
+
+	if (debug_mode) {
+		printf("[BROKER] Sent %s for QoS%u msg_id=%u\n",
+						qos == QOS_EXACTLY_ONCE ? "CONTROL_RECEIVED" : "MSG_ACK", qos, msg_id);
+	}
+}
+
+/**
+ * release_publish_ack - ack_batch_send_cb of the broker, @ctx carries the socket
+ */
+static void release_publish_ack(uint32_t session_id, uint8_t qos, uint32_t msg_id, void* ctx) {
+	broker_session_t* session = session_get(session_id);
+	if (session) transmit_publish_ack((int)(intptr_t)ctx, qos, msg_id, session);
+}
+
+/**
+ * commit_log - ack_batch_commit_cb of the broker: one msync for every record appended since the last
+ */
+static int commit_log(void) {
+	return message_log_dirty() ? message_log_commit() : 0;
+}
+
+/**
+ * commit_and_flush_acks - make appended records durable, then release their ACKs
+ */
+static void commit_and_flush_acks(void) {
+	if (ack_batch_flush() != 0) fprintf(stderr, "[BROKER] Log commit failed, ACKs withheld\n");
+}
+
+/**
+ * send_publish_ack - acknowledge a publisher, after its record is durable if logging
+ */
+static void send_publish_ack(int sockfd, uint8_t qos, uint32_t msg_id,
+															const broker_session_t* session) {
+	if (!message_log_dirty() && ack_batch_count() == 0) {
+		transmit_publish_ack(sockfd, qos, msg_id, session);
+		return;
+	}
+
+	if (!ack_batch_defer(session->id, qos, msg_id) && debug_mode) {
+		printf("[BROKER] Log commit failing, ACK of msg_id=%u dropped\n", msg_id);
+	}
+}
+
+/**
+ * accept_publish - retain, persist and fan out a newly accepted publish
+ *
+ * With a durable log, messages are appended first (so consumers can replay
+ * them) and every reliable delivery holds the record until it completes.
+ */
+static void accept_publish(int sockfd, const slim_msg_header_t* header,
+														const char* topic_str, const void* payload,
+														size_t payload_length) {
+	topic_retain_store(topic_str, header->qos_level, payload, payload_length);
+
+	if (!message_log_enabled()) {
+		publish_to_subscribers(sockfd, header, topic_str, payload, payload_length, NULL);
+		return;
+	}
+
+	log_ref_t ref;
+	if (message_log_append(topic_str, header->qos_level, payload, payload_length, &ref) != 0) {
+		fprintf(stderr, "[BROKER] Failed to append msg_id=%u to log\n", header->msg_id);
+		publish_to_subscribers(sockfd, header, topic_str, payload, payload_length, NULL);
+		return;
+	}
+
+	publish_to_subscribers(sockfd, header, topic_str, payload, payload_length, &ref);
+}
+
+/**
+ * handle_publish - handles a publish request and forwards it to matching subscribers
+ *
+ * @sockfd: UDP socket to send message
+ * @header: original message header from the publisher
+ * @topic_str: published topic string (used as payload here, for testing)
+ * @session: session of the publisher
+ */
+void handle_publish(int sockfd, const slim_msg_header_t* header,
+										const char* topic_str, const void* payload,
+										size_t payload_length, const broker_session_t* session) {
+	if (header->qos_level == QOS_EXACTLY_ONCE) {
+		// a duplicate is answered again, even one already completed whose COMPLETE
+		// the publisher may have lost, but never forwarded twice
+		qos2_state_t state;
+		if (pending_table_get(session->id, header->msg_id, &state)) {
+			if (debug_mode && state == QOS2_STATE_COMPLETED) {
+				printf("[BROKER] QoS2 duplicate msg_id=%u already completed, re-sending RECEIVED\n",
+								header->msg_id);
+			}
+		} else {
+			pending_table_update(session->id, header->msg_id, QOS2_STATE_RECEIVED);
+
+			accept_publish(sockfd, header, topic_str, payload, payload_length);
+		}
+
+		send_publish_ack(sockfd, QOS_EXACTLY_ONCE, header->msg_id, session);
+		return;
+	}
+	
+	if (header->qos_level == QOS_AT_LEAST_ONCE) {
+		// a retransmit whose ACK was lost is ACKed again but not fanned out twice
+		if (dedup_table_check_and_mark(session->id, header->msg_id)) {
+			if (debug_mode) printf("[BROKER] QoS1 duplicate msg_id=%u, re-ACKing only\n", header->msg_id);
+		} else {
+			accept_publish(sockfd, header, topic_str, payload, payload_length);
+		}
+
+		send_publish_ack(sockfd, QOS_AT_LEAST_ONCE, header->msg_id, session);
+		return;
+	}
+	
+	// case for QoS0
+	accept_publish(sockfd, header, topic_str, payload, payload_length);
+}
+
+void handle_control_release (int sockfd, const slim_msg_header_t* header, const broker_session_t* session) {
+	pending_table_update(session->id, header->msg_id, QOS2_STATE_RELEASED);
+
+	slim_msg_header_t complete_hdr = {
+		.version = 1,
+		.msg_type = MSG_CONTROL,
+		.qos_level = QOS_EXACTLY_ONCE,
+		.msg_id = header->msg_id,
+		.topic_id = 0,
+		.frag_id = 0,
+		.frag_total = 1,
+		.batch_size = 1,
+		.payload_length = 1,
+		.client_node_count = 1,
+		.session_id = session_wire_id(session)
+	};
+
+	uint8_t buffer[2048];
+	serialize_control_message(&complete_hdr, CONTROL_COMPLETE, NULL, 0, buffer, sizeof(buffer));
+
+	send_bytes(sockfd, (const struct sockaddr*)&session->addr, sizeof(session->addr),
+							buffer, sizeof(slim_msg_header_t) + 1);
+
+	pending_table_update(session->id, header->msg_id, QOS2_STATE_COMPLETED);
+
+	if (debug_mode) {
+		printf("[BROKER] Received CONTROL_RELEASE -> Sent CONTROL_COMPLETE (msg_id=%u)\n", header->msg_id);
+	}
+}
+
+/**
+ * handle_control_received - subscriber confirmed receipt of a QoS2 delivery (step 1)
+ *
+ * Answers with CONTROL_RELEASE, which replaces the PUBLISH as the datagram
+ * retransmitted until the subscriber's CONTROL_COMPLETE arrives.
+ */
+void handle_control_received(int sockfd, const slim_msg_header_t* header, broker_session_t* session) {
+	slim_msg_header_t release_hdr = {
+		.version = 1,
+		.msg_type = MSG_CONTROL,
+		.qos_level = QOS_EXACTLY_ONCE,
+		.msg_id = header->msg_id,
+		.topic_id = 0,
+		.frag_id = 0,
+		.frag_total = 1,
+		.batch_size = 1,
+		.payload_length = 1,
+		.client_node_count = 1,
+		.session_id = session_wire_id(session)
+	};
+
+	uint8_t buffer[64];
+	int len = serialize_control_message(&release_hdr, CONTROL_RELEASE, NULL, 0, buffer, sizeof(buffer));
+	if (len < 0) return;
+
+	if (!outbound_received(&session->outbound, header->msg_id, buffer, len, now_ms())) {
+		if (debug_mode) {
+			printf("[BROKER] CONTROL_RECEIVED for unknown msg_id=%u\n", header->msg_id);
+		}
+		return;
+	}
+
+	send_bytes(sockfd, (const struct sockaddr*)&session->addr, sizeof(session->addr), buffer, len);
+
+	if (debug_mode) {
+		printf("[BROKER] Subscriber CONTROL_RECEIVED -> Sent CONTROL_RELEASE (msg_id=%u)\n", header->msg_id);
+	}
+}
+
+/**
+ * handle_control_complete - subscriber finished a QoS2 delivery (step 3)
+ */
+void handle_control_complete(const slim_msg_header_t* header, broker_session_t* session) {
+	log_ref_t ref;
+	bool retired = outbound_complete(&session->outbound, header->msg_id, &ref);
+	if (retired) consumer_advance(session, &ref);
+	if (debug_mode) {
+		printf("[BROKER] Subscriber CONTROL_COMPLETE msg_id=%u%s\n", header->msg_id,
+						retired ? "" : " (unknown or duplicate)");
+	}
+}
+
+/**
+ * handle_control_credit - subscriber advertised how many deliveries it can accept
+ *
+ * The first advertisement switches the session to credit-based flow control.
+ * Held reliable deliveries are flushed against the new credit first.
+ */
+void handle_control_credit(int sockfd, const void* ctrl_data, size_t data_len, broker_session_t* session) {
+	if (data_len < sizeof(uint32_t)) return;
+
+	uint32_t credits;
+	memcpy(&credits, ctrl_data, sizeof(credits));
+
+	session->flow_control = true;
+	session->credits = credits;
+
+	size_t released = outbound_release_held(&session->outbound, sockfd, credits, now_ms());
+	session->credits -= released;
+
+	if (debug_mode) {
+		printf("[BROKER] CONTROL_CREDIT %u from session %u (released %zu held)\n", credits,
+						session->id, released);
+	}
+}
+
+/**
+ * handle_control_sequenced - subscriber switched sequenced QoS 1 delivery on or off
+ *
+ * Clients repeat the request with every keepalive, so a lost one only delays
+ * the switch; meanwhile deliveries are ACKed as usual.
+ */
+static void handle_control_sequenced(const char* data, size_t len, broker_session_t* session) {
+	if (len < 1) return;
+
+	bool enable = data[0] != 0;
+	if (debug_mode && enable != session->sequenced) {
+		printf("[BROKER] Session %u %s sequenced delivery\n", session->id, enable ? "enabled" : "disabled");
+	}
+	session->sequenced = enable;
+}
+
+/**
+ * handle_control_sack - publisher switched coalesced QoS 1 ACKs on or off
+ *
+ * Like the sequenced request it is repeated with every keepalive. ACKs
+ * already held for the session are still sent as a frame.
+ */
+static void handle_control_sack(const char* data, size_t len, broker_session_t* session) {
+	if (len < 1) return;
+
+	bool enable = data[0] != 0;
+	if (debug_mode && enable != session->coalesced_acks) {
+		printf("[BROKER] Session %u %s coalesced ACKs\n", session->id, enable ? "enabled" : "disabled");
+	}
+	session->coalesced_acks = enable;
+}
+
+/**
+ * handle_control_nack - resend the sequenced deliveries a subscriber missed
+ *
+ * Deliveries that already left the stream ring are not resent; the subscriber
+ * gives up on them after its retries.
+ *
+ * @data: CONTROL_NACK data, a stream id followed by missing ranges
+ */
+static void handle_control_nack(int sockfd, const char* data, size_t len, broker_session_t* session) {
+	uint16_t stream;
+	if (len < sizeof(stream)) return;
+	memcpy(&stream, data, sizeof(stream));
+
+	size_t ranges = (len - sizeof(stream)) / NACK_RANGE_SIZE;
+	if (ranges > NACK_MAX_RANGES) ranges = NACK_MAX_RANGES;
+
+	uint8_t buffer[2048];
+	size_t repaired = 0, missing = 0;
+	for (size_t r = 0; r < ranges; ++r) {
+		uint32_t first, last;
+		memcpy(&first, data + sizeof(stream) + r * NACK_RANGE_SIZE, sizeof(first));
+		memcpy(&last, data + sizeof(stream) + r * NACK_RANGE_SIZE + sizeof(first), sizeof(last));
+		if (last - first >= STREAM_RING_SIZE) first = last - STREAM_RING_SIZE + 1;
+
+		for (uint32_t seq = first; ; ++seq) {
+			size_t packet_len;
+			const uint8_t* packet = stream_table_lookup(stream, seq, &packet_len);
+			if (packet && packet_len <= sizeof(buffer)) {
+				memcpy(buffer, packet, packet_len);
+				deliver_sequenced(sockfd, buffer, packet_len, session, NULL);
+				repaired++;
+			} else {
+				missing++;
+			}
+			if (seq == last) break;
+		}
+	}
+
+	if (debug_mode) {
+		printf("[BROKER] CONTROL_NACK from session %u on stream %u: resent %zu, %zu gone\n",
+						session->id, stream, repaired, missing);
+	}
+}
+
+/**
+ * handle_control_connect - open a session, or resume one after the client moved
+ *
+ * A CONNECT carrying the wire id of a live connected session and its token
+ * rebinds it to the sender's address; any other CONNECT opens a new session.
+ * The reply echoes the request's msg_id and carries the wire id in its header
+ * and the session's token as data.
+ */
+void handle_control_connect(int sockfd, const slim_msg_header_t* header, const uint8_t* raw_buf,
+														size_t buf_len, const struct sockaddr_in* client_addr) {
+	control_type_t ctrl_type;
+	uint8_t token[SESSION_TOKEN_SIZE];
+	slim_msg_header_t request = *header;
+
+	if (deserialize_control_message(raw_buf, buf_len, &request, &ctrl_type, token, sizeof(token)) != 0) {
+		fprintf(stderr, "[BROKER] Failed to parse CONTROL_CONNECT.\n");
+		return;
+	}
+
+	broker_session_t* session = NULL;
+	if (header->session_id != 0) {
+		session = session_resume(header->session_id, token, request.payload_length - 1);
+	}
+	if (session) {
+		session_rebind(session, client_addr);
+	} else {
+		session = session_connect(client_addr);
+		if (!session) {
+			fprintf(stderr, "[BROKER] Out of session ids, CONNECT refused\n");
+			return;
+		}
+	}
+
+	slim_msg_header_t reply_hdr = {
+		.version = 1,
+		.msg_type = MSG_CONTROL,
+		.qos_level = QOS_AT_MOST_ONCE,
+		.msg_id = header->msg_id,
+		.topic_id = 0,
+		.frag_id = 0,
+		.frag_total = 1,
+		.batch_size = 1,
+		.payload_length = 1,
+		.client_node_count = 1,
+		.session_id = session_wire_id(session)
+	};
+
+	uint8_t buffer[64];
+	memcpy(token, &session->token, sizeof(token));
+	int len = serialize_control_message(&reply_hdr, CONTROL_CONNECT, token, sizeof(token), buffer, sizeof(buffer));
+	if (len < 0) return;
+
+	session->last_seen_ms = now_ms();
+	send_bytes(sockfd, (const struct sockaddr*)client_addr, sizeof(*client_addr), buffer, len);
+
+	if (debug_mode) {
+		printf("[BROKER] CONTROL_CONNECT from %s:%d -> session %u\n",
+						inet_ntoa(client_addr->sin_addr), ntohs(client_addr->sin_port), session->id);
+	}
+}
+
+/**
+ * send_unknown_session - tell a client that the session it named is not taken from it
+ *
+ * The session is gone, or the sender is not at the session's address. The
+ * reply is no larger than the datagram that caused it.
+ */
+static void send_unknown_session(int sockfd, uint32_t session_id, const struct sockaddr_in* client_addr) {
+	slim_msg_header_t reply_hdr = {
+		.version = 1,
+		.msg_type = MSG_CONTROL,
+		.qos_level = QOS_AT_MOST_ONCE,
+		.msg_id = 0,
+		.topic_id = 0,
+		.frag_id = 0,
+		.frag_total = 1,
+		.batch_size = 1,
+		.payload_length = 1,
+		.client_node_count = 1,
+		.session_id = session_id
+	};
+
+	uint8_t buffer[64];
+	int len = serialize_control_message(&reply_hdr, CONTROL_UNKNOWN_SESSION, NULL, 0, buffer, sizeof(buffer));
+	if (len < 0) return;
+
+	send_bytes(sockfd, (const struct sockaddr*)client_addr, sizeof(*client_addr), buffer, len);
+}
+
+void handle_control(int sockfd, const slim_msg_header_t* header, const uint8_t* raw_buf, size_t buf_len, broker_session_t* session) {
+	control_type_t ctrl_type;
+	char ctrl_data[2048];
+
+	int ctrl_result = deserialize_control_message(raw_buf, buf_len, (slim_msg_header_t*)header, &ctrl_type, ctrl_data, sizeof(ctrl_data));
+
+	if (ctrl_result != 0) {
+		fprintf(stderr, "[BROKER] Failed to parse CONTROL message.\n");
+		return;
+	}
+
+	switch (ctrl_type) {
+		case CONTROL_RELEASE:
+			handle_control_release(sockfd, header, session);
+			break;
+		case CONTROL_RECEIVED:
+			handle_control_received(sockfd, header, session);
+			break;
+		case CONTROL_COMPLETE:
+			handle_control_complete(header, session);
+			break;
+		case CONTROL_CREDIT:
+			handle_control_credit(sockfd, ctrl_data, header->payload_length - 1, session);
+			break;
+		case CONTROL_MULTICAST:
+			handle_control_multicast(ctrl_data, header->payload_length - 1, session);
+			break;
+		case CONTROL_SEQUENCED:
+			handle_control_sequenced(ctrl_data, header->payload_length - 1, session);
+			break;
+		case CONTROL_NACK:
+			handle_control_nack(sockfd, ctrl_data, header->payload_length - 1, session);
+			break;
+		case CONTROL_SACK:
+			handle_control_sack(ctrl_data, header->payload_length - 1, session);
+			break;
+		case CONTROL_HEARTBEAT:
+			// being heard from is all a heartbeat is for, see handle_datagram()
+			break;
+		default:
+			if (debug_mode) {
+				printf("[BROKER] Unhandled CONTROL type: %d\n", ctrl_type);
+			}
+			break;
+	}
+}
+
+/**
+ * session_of_datagram - find the session a datagram belongs to
+ *
+ * Datagrams carrying a session id are accepted from the session's address
+ * only. A client naming a session that expired, or that moved to another
+ * address, is told so and connects again; a client that moved proves the
+ * session's token in that CONNECT to resume it. Datagrams without a session
+ * id belong to the session of their source address, created on first
+ * contact.
+ *
+ * Return: session, or NULL if the datagram names an unknown session
+ */
+static broker_session_t* session_of_datagram(int sockfd, const slim_msg_header_t* header,
+																							const struct sockaddr_in* client_addr) {
+	if (header->session_id == 0) return session_get_or_create(client_addr);
+
+	broker_session_t* session = session_get_wire(header->session_id);
+	if (!session) {
+		if (debug_mode) printf("[BROKER] Unknown session %u, asking the client to connect\n", header->session_id);
+		send_unknown_session(sockfd, header->session_id, client_addr);
+		return NULL;
+	}
+
+	if (session->addr.sin_addr.s_addr != client_addr->sin_addr.s_addr ||
+			session->addr.sin_port != client_addr->sin_port) {
+		if (debug_mode) {
+			printf("[BROKER] Session %u heard from %s:%d, asking for its token\n", session->id,
+							inet_ntoa(client_addr->sin_addr), ntohs(client_addr->sin_port));
+		}
+		send_unknown_session(sockfd, header->session_id, client_addr);
+		return NULL;
+	}
+	return session;
+}
+
+/**
+ * handle_datagram - receive one datagram and dispatch it by message type
+ *
+ * @sockfd: udp socket of broker
+ */
+void handle_datagram(int sockfd) {
+	struct sockaddr_in client_addr;
+	socklen_t addrlen = sizeof(client_addr);
+	slim_msg_header_t header;
+	char topic[256];
+	char data[2048];
+
+	uint8_t buffer[2048];
+	int received = recv_bytes(sockfd, buffer, sizeof(buffer),
+														(struct sockaddr*)&client_addr,
+														&addrlen);
+
+	if (received < 0) {
+		fprintf(stderr, "[BROKER] Failed to receive bytes\n");
+		return;
+	}
+
+	int result = deserialize_message(buffer, received,
+																		&header, topic,
+																		sizeof(topic),
+																		data, sizeof(data));
+
+	if (result != 0) {
+		fprintf(stderr, "[BROKER] Failed to deserialize message.\n");
+		return;
+	}
+
+	debug_dump_message(&header, data);
+
+	if (header.msg_type == MSG_CONTROL && (size_t)received > sizeof(header) &&
+			buffer[sizeof(header)] == CONTROL_CONNECT) {
+		handle_control_connect(sockfd, &header, buffer, received, &client_addr);
+		return;
+	}
+
+	// from here on the client is identified by its session id
+	broker_session_t* session = session_of_datagram(sockfd, &header, &client_addr);
+	if (!session) return;
+	session->last_seen_ms = now_ms();
+
+	if (header.msg_type == MSG_SUBSCRIBE) {
+		handle_subscribe(sockfd, topic, header.qos_level, (const uint8_t*)data,
+											header.payload_length - (1 + strlen(topic)), session);
+	} else if (header.msg_type == MSG_PUBLISH) {
+		handle_publish(sockfd, &header, topic, data,
+										header.payload_length - (1 + strlen(topic)), session);
+
+	} else if (header.msg_type == MSG_ACK) {
+		handle_ack(&header, session);
+	} else if (header.msg_type == MSG_CONTROL) {
+		handle_control(sockfd, &header, buffer, received, session);
+	} else {
+		if (debug_mode) {
+			printf("[BROKER] Unknown message type: %d\n", header.msg_type);
+		}
+	}
+}
+
+/**
+ * redeliver_logged - fan a record left pending by a previous run out again
+ */
+static void redeliver_logged(const log_ref_t* ref, const log_record_header_t* rec,
+															const char* topic, const void* data, void* arg) {
+	int sockfd = *(int*)arg;
+
+	slim_msg_header_t header = {
+		.version = 1,
+		.msg_type = MSG_PUBLISH,
+		.qos_level = rec->qos,
+		.msg_id = 0,
+		.topic_id = 0,
+		.frag_id = 0,
+		.frag_total = 1,
+		.batch_size = 1,
+		.payload_length = 0,
+		.client_node_count = 1
+	};
+
+	if (debug_mode) {
+		printf("[BROKER] Redelivering logged offset=%llu on %s\n",
+						(unsigned long long)rec->offset, topic);
+	}
+	publish_to_subscribers(sockfd, &header, topic, data, rec->data_len, ref);
+}
+
+typedef struct {
+	timer_node_t timer;								// first member, the callback casts back
+	int sockfd;
+} socket_timer_t;
+
+static socket_timer_t redeliver_timer;
+static socket_timer_t sack_timer;
+static timer_node_t snapshot_timer;
+static timer_node_t keepalive_timer;
+
+/**
+ * on_redeliver - grace period after a restart is over, redeliver pending log records
+ */
+static void on_redeliver(timer_node_t* t) {
+	socket_timer_t* st = (socket_timer_t*)t;
+	message_log_for_each_pending(redeliver_logged, &st->sockfd);
+}
+
+/**
+ * on_sack_hold - the ACK hold window is over, send the held frames
+ */
+static void on_sack_hold(timer_node_t* t) {
+	socket_timer_t* st = (socket_timer_t*)t;
+	flush_sacks(st->sockfd);
+}
+
+/**
+ * on_snapshot - write the periodic state snapshot and re-arm
+ */
+static void on_snapshot(timer_node_t* t) {
+	snapshot_save(snapshot_path);
+	timer_wheel_add(&broker_timers, t, now_ms() + SNAPSHOT_INTERVAL_MS, on_snapshot);
+}
+
+/**
+ * session_load - outstanding reliable deliveries of a session, for least-loaded shared groups
+ */
+static size_t session_load(uint32_t id, void* ctx) {
+	(void)ctx;
+	broker_session_t* session = session_get(id);
+	return session ? session->outbound.inflight + session->outbound.queued : SIZE_MAX;
+}
+
+static bool session_is_expiring(uint32_t id, void* ctx) {
+	(void)ctx;
+	broker_session_t* session = session_get(id);
+	return session && session->expiring;
+}
+
+/**
+ * forget_sessions - drop every reference the broker holds to expiring sessions
+ *
+ * Subscriptions of the whole batch go in one walk of the topic trie. QoS
+ * state is forgotten because the session ids are handed out again.
+ */
+static void forget_sessions(broker_session_t** expired, size_t count, void* ctx) {
+	(void)ctx;
+	size_t subscriptions = topic_table_remove_sessions(session_is_expiring, NULL);
+
+	broker_session_t** link = &replaying_sessions;
+	while (*link) {
+		if ((*link)->expiring) *link = (*link)->replay_next;
+		else link = &(*link)->replay_next;
+	}
+	link = &backlogged_sessions;
+	while (*link) {
+		if ((*link)->expiring) *link = (*link)->backlog_next;
+		else link = &(*link)->backlog_next;
+	}
+
+	// ACKs are only left over here when a log commit failed
+	ack_batch_forget(session_is_expiring, NULL);
+
+	size_t kept = 0;
+	for (size_t i = 0; i < sack_frame_count; ++i) {
+		if (!session_is_expiring(sack_frames[i].session, NULL)) sack_frames[kept++] = sack_frames[i];
+	}
+	sack_frame_count = kept;
+
+	for (size_t i = 0; i < count; ++i) {
+		pending_table_forget(expired[i]->id);
+		dedup_table_forget(expired[i]->id);
+	}
+
+	if (debug_mode) {
+		printf("[BROKER] Expired %zu silent session(s), %zu subscription(s) removed\n",
+						count, subscriptions);
+	}
+}
+
+/**
+ * on_keepalive_sweep - expire sessions not heard from within the keepalive timeout and re-arm
+ */
+static void on_keepalive_sweep(timer_node_t* t) {
+	session_table_expire(now_ms(), keepalive_timeout_ms, forget_sessions, NULL);
+	timer_wheel_add(&broker_timers, t, now_ms() + SESSION_SWEEP_INTERVAL_MS, on_keepalive_sweep);
+}
+
+/**
+ * broker_main_loop - main loop of the broker
+ *
+ * Every readable datagram is drained (up to LOG_GROUP_COMMIT_MAX) before the
+ * durable log is committed, so a burst of reliable publishes shares one msync
+ * and their ACKs are released together afterwards. QoS 1 ACKs of publishers
+ * taking coalesced ACKs leave as one SACK frame per publisher at that point,
+ * or when the -a hold window is over. poll() sleeps until the next timer on
+ * the wheel is due or the pacer has tokens for queued deliveries, or not at
+ * all while a replay can progress. Deliveries queued behind full outbound
+ * windows move on after every batch, as the ACKs in it free slots.
+ *
+ * @sockfd: UDP socket the broker is bound to
+ */
+void broker_main_loop(int sockfd) {
+	if (message_log_enabled()) {
+		// records still pending from a previous run wait for subscribers to come back
+		redeliver_timer.sockfd = sockfd;
+		timer_wheel_add(&broker_timers, &redeliver_timer.timer,
+										now_ms() + LOG_REDELIVER_DELAY_MS, on_redeliver);
+	}
+	if (snapshot_path) {
+		timer_wheel_add(&broker_timers, &snapshot_timer, now_ms() + SNAPSHOT_INTERVAL_MS, on_snapshot);
+	}
+	if (keepalive_timeout_ms > 0) {
+		timer_wheel_add(&broker_timers, &keepalive_timer, now_ms() + SESSION_SWEEP_INTERVAL_MS,
+										on_keepalive_sweep);
+	}
+
+	bool replay_busy = false;
+
+	while(1) {
+		struct pollfd pfd = { .fd = sockfd, .events = POLLIN };
+		int timeout = replay_busy ? 0 : timer_wheel_next_timeout_ms(&broker_timers, now_ms());
+		int pacing = pacer_next_timeout_ms(&fanout_pacer, now_us());
+		if (pacing >= 0 && (timeout < 0 || pacing < timeout)) timeout = pacing;
+		int ready = poll(&pfd, 1, timeout);
+
+		for (int n = 0; ready > 0 && (pfd.revents & POLLIN) && n < LOG_GROUP_COMMIT_MAX; ++n) {
+			handle_datagram(sockfd);
+			ready = poll(&pfd, 1, 0);
+		}
+
+		commit_and_flush_acks();
+		if (ack_hold_ms == 0) {
+			flush_sacks(sockfd);
+		} else if (sack_frame_count > 0 && !sack_timer.timer.armed) {
+			sack_timer.sockfd = sockfd;
+			timer_wheel_add(&broker_timers, &sack_timer.timer, now_ms() + ack_hold_ms, on_sack_hold);
+		}
+		timer_wheel_advance(&broker_timers, now_ms());
+		pacer_drain(&fanout_pacer, sockfd, now_us());
+
+		advance_backlogs(sockfd);
+		replay_busy = advance_replays(sockfd);
+		message_log_compact(replay_low_watermark());
+	}
+}
+
+int main(int argc, char* argv[]) {
+	size_t dedup_budget = DEDUP_MEMORY_BUDGET;
+	init_topic_table();
+	topic_share_set_load_probe(session_load, NULL);
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-d") == 0) {
 			debug_mode = true;
 			enable_transport_debug(true);
 			set_packet_debug(true);
+		} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			// -r <filter>=<depth>: retain the last <depth> messages of matching topics
+			char* rule = argv[++i];
+			char* eq = strrchr(rule, '=');
+			size_t depth = 1;
+			if (eq) {
+				*eq = '\0';
+				depth = (size_t)atoi(eq + 1);
+			}
+			topic_retain_configure(rule, depth);
+		} else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc) {
+			// -R <bytes>: hard cap on retained message memory
+			topic_retain_set_budget((size_t)strtoul(argv[++i], NULL, 10));
+		} else if (strcmp(argv[i], "-D") == 0 && i + 1 < argc) {
+			// -D <bytes>: memory for remembering recent QoS 1 msg_ids per publisher
+			dedup_budget = (size_t)strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+			// -l <dir>: persist QoS 1/2 messages in a durable log before ACKing
+			if (message_log_open(argv[++i]) != 0) return 1;
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			// -s <file>: restore subscriptions from a snapshot and keep it up to date
+			snapshot_path = argv[++i];
+		} else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+			// -g <group>=<rr|load|hash>: member selection of a shared subscription group
+			char* rule = argv[++i];
+			char* eq = strrchr(rule, '=');
+			share_policy_t policy = SHARE_ROUND_ROBIN;
+			if (eq) {
+				*eq = '\0';
+				if (strcmp(eq + 1, "load") == 0) policy = SHARE_LEAST_LOADED;
+				else if (strcmp(eq + 1, "hash") == 0) policy = SHARE_KEY_HASH;
+			}
+			topic_share_configure(rule, policy);
+		} else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+			// -m <filter>=<group>:<port>: send QoS 0 traffic of matching topics to a multicast group
+			char* rule = argv[++i];
+			char* eq = strrchr(rule, '=');
+			char* colon = eq ? strrchr(eq, ':') : NULL;
+			struct sockaddr_in group = { .sin_family = AF_INET };
+			if (!colon) {
+				fprintf(stderr, "[BROKER] Expected -m <filter>=<group>:<port>\n");
+				return 1;
+			}
+			*eq = '\0';
+			*colon = '\0';
+			group.sin_port = htons((uint16_t)atoi(colon + 1));
+			if (inet_pton(AF_INET, eq + 1, &group.sin_addr) != 1 ||
+					!IN_MULTICAST(ntohl(group.sin_addr.s_addr)) || multicast_route_add(rule, &group) < 0) {
+				fprintf(stderr, "[BROKER] Invalid multicast route for %s\n", rule);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "-M") == 0 && i + 1 < argc) {
+			// -M <ip>: local interface multicast routes are sent through
+			multicast_iface = argv[++i];
+		} else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			// -f <filter>=<k>[:<m>]: send m parity packets per k QoS 0 deliveries of matching topics
+			char* rule = argv[++i];
+			char* eq = strrchr(rule, '=');
+			if (!eq) {
+				fprintf(stderr, "[BROKER] Expected -f <filter>=<k>[:<m>]\n");
+				return 1;
+			}
+			*eq = '\0';
+			char* colon = strchr(eq + 1, ':');
+			int k = atoi(eq + 1), m = colon ? atoi(colon + 1) : 1;
+			if (k <= 0 || k > FEC_MAX_BLOCK || m <= 0 || m > FEC_MAX_PARITY ||
+					fec_rule_add(rule, (uint8_t)k, (uint8_t)m) != 0) {
+				fprintf(stderr, "[BROKER] Invalid FEC rule for %s (k <= %d, m <= %d and m <= k)\n",
+								rule, FEC_MAX_BLOCK, FEC_MAX_PARITY);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+			// -k <sec>: expire sessions silent this long (0 keeps them forever)
+			keepalive_timeout_ms = strtoull(argv[++i], NULL, 10) * 1000;
+		} else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+			// -a <ms>: hold coalesced QoS 1 ACKs this long instead of one receive batch
+			ack_hold_ms = (uint32_t)strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc) {
+			// -P <datagrams/s>[:<burst>]: pace fan-out deliveries with a token bucket
+			char* colon = strchr(argv[++i], ':');
+			uint32_t rate = (uint32_t)strtoul(argv[i], NULL, 10);
+			uint32_t burst = colon ? (uint32_t)strtoul(colon + 1, NULL, 10) : 0;
+			pacer_init(&fanout_pacer, rate, burst, now_us());
+		} else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+			// -q <bytes/s>: let the kernel pace the socket (SO_MAX_PACING_RATE, needs the fq qdisc)
+			kernel_pacing_rate = strtoull(argv[++i], NULL, 10);
 		}
 	}
 
-	init_topic_table();
 	int sockfd = init_broker_socket();
 	if (sockfd < 0) return 1;
+
+	if (kernel_pacing_rate > 0 && set_pacing_rate(sockfd, kernel_pacing_rate) != 0) {
+		fprintf(stderr, "[BROKER] SO_MAX_PACING_RATE not available, use -P to pace in the broker\n");
+	}
+
+	struct in_addr iface;
+	if (multicast_iface && (inet_pton(AF_INET, multicast_iface, &iface) != 1 ||
+			set_multicast_interface(sockfd, iface) != 0)) {
+		fprintf(stderr, "[BROKER] Cannot send multicast through %s\n", multicast_iface);
+		return 1;
+	}
+	timer_wheel_init(&broker_timers, now_ms());
 	pending_table_init();
+	pending_table_set_expiry(&broker_timers, DEDUP_EXPIRATION_SEC * 1000);
+	if (dedup_table_init(&broker_timers, dedup_budget, DEDUP_EXPIRATION_SEC * 1000) != 0) {
+		fprintf(stderr, "[BROKER] QoS1 duplicate filter disabled (budget %zu bytes)\n", dedup_budget);
+	}
+	session_table_init();
+	stream_table_init();
+	outbound_init(&broker_timers, sockfd);
+	ack_batch_init(commit_log, release_publish_ack, (void*)(intptr_t)sockfd);
+
+	if (snapshot_path && snapshot_load(snapshot_path) == 0) {
+		printf("[BROKER] Restored subscriptions from %s\n", snapshot_path);
+	}
 
 	broker_main_loop(sockfd);
 
 	free_topic_table();
 	pending_table_destroy();
+	dedup_table_destroy();
+	snapshot_release();
+	session_table_destroy();
+	stream_table_destroy();
+	fec_table_destroy();
+	pacer_destroy(&fanout_pacer);
+	message_log_close();
 	close(sockfd);
 	return 0;
 }
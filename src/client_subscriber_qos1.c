@@ -51,6 +51,8 @@ int main(int argc, char* argv[]) {
 		return 1;
 	}
 
+	slimmq_set_qos(client, QOS_AT_LEAST_ONCE);
+
 	if (slimmq_subscribe(client, topic_str) < 0) {
 		fprintf(stderr, "[SUBSCRIBER-QOS1] Failed to subscribe.\n");
 		slimmq_close(client);
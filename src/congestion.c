@@ -0,0 +1,79 @@
+#include "../include/congestion.h"
+
+void cc_init(cc_state_t* cc, cc_mode_t mode, uint32_t max_window) {
+	if (max_window == 0) max_window = 1;
+
+	*cc = (cc_state_t){ .mode = mode, .max_window = max_window, .ssthresh = max_window };
+	cc->cwnd = max_window < CC_INITIAL_WINDOW ? max_window : CC_INITIAL_WINDOW;
+}
+
+uint32_t cc_window(const cc_state_t* cc) {
+	return cc->mode == CC_OFF ? cc->max_window : cc->cwnd;
+}
+
+/**
+ * sample_rtt - fold one round trip time into srtt and rttvar (RFC 6298)
+ */
+static void sample_rtt(cc_state_t* cc, uint32_t rtt_us) {
+	if (cc->srtt_us == 0) {
+		cc->srtt_us = rtt_us;
+		cc->rttvar_us = rtt_us / 2;
+	} else {
+		uint32_t delta = cc->srtt_us > rtt_us ? cc->srtt_us - rtt_us : rtt_us - cc->srtt_us;
+		cc->rttvar_us = (3 * cc->rttvar_us + delta) / 4;
+		cc->srtt_us = (7 * cc->srtt_us + rtt_us) / 8;
+	}
+	if (cc->min_rtt_us == 0 || rtt_us < cc->min_rtt_us) cc->min_rtt_us = rtt_us;
+}
+
+/**
+ * queued - publishes the window keeps waiting at the bottleneck, from srtt over min_rtt
+ */
+static uint32_t queued(const cc_state_t* cc) {
+	if (cc->srtt_us == 0) return 0;
+	return (uint32_t)((uint64_t)cc->cwnd * (cc->srtt_us - cc->min_rtt_us) / cc->srtt_us);
+}
+
+void cc_on_ack(cc_state_t* cc, uint32_t rtt_us) {
+	if (rtt_us > 0) sample_rtt(cc, rtt_us);
+	if (cc->mode == CC_OFF) return;
+
+	if (cc->cwnd < cc->ssthresh) {
+		// slow start, left early by the delay mode once publishes start to queue
+		if (cc->mode == CC_DELAY && queued(cc) > CC_DELAY_BETA) {
+			cc->ssthresh = cc->cwnd;
+		} else {
+			cc->cwnd++;
+		}
+	} else if (++cc->acked >= cc->cwnd) {
+		// a window's worth of ACKs, about one round trip
+		cc->acked = 0;
+		if (cc->mode == CC_DELAY && queued(cc) > CC_DELAY_BETA) {
+			if (cc->cwnd > 1) cc->cwnd--;
+		} else if (cc->mode == CC_AIMD || queued(cc) < CC_DELAY_ALPHA) {
+			cc->cwnd++;
+		}
+	}
+
+	if (cc->cwnd > cc->max_window) cc->cwnd = cc->max_window;
+}
+
+void cc_on_loss(cc_state_t* cc, uint64_t now_us) {
+	cc->losses++;
+	if (cc->mode == CC_OFF || now_us < cc->recovery_until_us) return;
+
+	cc->ssthresh = cc->cwnd > 1 ? cc->cwnd / 2 : 1;
+	cc->cwnd = cc->ssthresh;
+	cc->acked = 0;
+	cc->recovery_until_us = now_us + cc->srtt_us;
+}
+
+int cc_rto_ms(const cc_state_t* cc, int max_ms) {
+	if (cc->srtt_us == 0) return max_ms;
+
+	uint64_t rto_us = (uint64_t)cc->srtt_us + 4 * (uint64_t)cc->rttvar_us;
+	if (rto_us < CC_MIN_RTO_US) rto_us = CC_MIN_RTO_US;
+
+	uint64_t rto_ms = (rto_us + 999) / 1000;
+	return rto_ms < (uint64_t)max_ms ? (int)rto_ms : max_ms;
+}
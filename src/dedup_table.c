@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../include/dedup_table.h"
+
+// session id -> dedup_publisher_t*
+static hash_table_t index_table;
+
+static dedup_publisher_t* pool = NULL;
+static dedup_publisher_t* free_list = NULL;
+static dedup_publisher_t* lru_head = NULL;
+static dedup_publisher_t* lru_tail = NULL;
+
+static timer_wheel_t* expiry_wheel = NULL;
+static uint32_t expiry_after_ms = 0;
+
+static uint64_t monotonic_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void lru_unlink(dedup_publisher_t* p) {
+	if (p->lru_prev) p->lru_prev->lru_next = p->lru_next;
+	else lru_head = p->lru_next;
+	if (p->lru_next) p->lru_next->lru_prev = p->lru_prev;
+	else lru_tail = p->lru_prev;
+	p->lru_prev = p->lru_next = NULL;
+}
+
+static void lru_append(dedup_publisher_t* p) {
+	p->lru_next = NULL;
+	p->lru_prev = lru_tail;
+	if (lru_tail) lru_tail->lru_next = p;
+	else lru_head = p;
+	lru_tail = p;
+}
+
+/**
+ * retire - drop a publisher's window and return its record to the pool
+ */
+static void retire(dedup_publisher_t* p) {
+	timer_wheel_cancel(expiry_wheel, &p->expiry);
+	hash_table_remove(&index_table, p->session, NULL);
+	lru_unlink(p);
+	p->lru_next = free_list;
+	free_list = p;
+}
+
+static void expire_publisher(timer_node_t* t) {
+	retire((dedup_publisher_t*)((uint8_t*)t - offsetof(dedup_publisher_t, expiry)));
+}
+
+static dedup_publisher_t* find_or_create(uint32_t session, uint32_t msg_id) {
+	uint64_t* value = hash_table_find(&index_table, session);
+	if (value) return (dedup_publisher_t*)(uintptr_t)*value;
+
+	// budget exhausted: the least recently active publisher makes room
+	if (!free_list && lru_head) retire(lru_head);
+
+	dedup_publisher_t* p = free_list;
+	free_list = p->lru_next;
+	memset(p, 0, sizeof(*p));
+	p->session = session;
+	// leave half of the window for msg_ids that arrive out of order
+	p->base = msg_id - DEDUP_WINDOW_SIZE / 2;
+
+	if (hash_table_put(&index_table, session, (uintptr_t)p) < 0) {
+		p->lru_next = free_list;
+		free_list = p;
+		return NULL;
+	}
+	lru_append(p);
+	return p;
+}
+
+/**
+ * slide_window - move the window forward so it ends at @msg_id
+ */
+static void slide_window(dedup_publisher_t* p, uint32_t msg_id) {
+	uint32_t shift = msg_id - (p->base + DEDUP_WINDOW_SIZE - 1);
+
+	if (shift >= DEDUP_WINDOW_SIZE) {
+		memset(p->seen, 0, sizeof(p->seen));
+	} else {
+		for (uint32_t i = 0; i < shift; ++i) {
+			uint32_t idx = (p->base + i) % DEDUP_WINDOW_SIZE;
+			p->seen[idx / 64] &= ~((uint64_t)1 << (idx % 64));
+		}
+	}
+	p->base += shift;
+}
+
+int dedup_table_init(timer_wheel_t* wheel, size_t memory_budget, uint32_t expiry_ms) {
+	// each record also costs its index slots (kept below the resize threshold)
+	size_t per_publisher = sizeof(dedup_publisher_t) + 2 * sizeof(hash_slot_t);
+	size_t capacity = memory_budget / per_publisher;
+	if (capacity == 0) return -1;
+
+	pool = calloc(capacity, sizeof(dedup_publisher_t));
+	if (!pool) return -1;
+	if (hash_table_init(&index_table, capacity) < 0) {
+		free(pool);
+		pool = NULL;
+		return -1;
+	}
+
+	for (size_t i = 0; i < capacity; ++i) {
+		pool[i].lru_next = (i + 1 < capacity) ? &pool[i + 1] : NULL;
+	}
+	free_list = pool;
+	lru_head = lru_tail = NULL;
+	expiry_wheel = wheel;
+	expiry_after_ms = expiry_ms;
+	return 0;
+}
+
+void dedup_table_destroy(void) {
+	while (lru_head) retire(lru_head);
+	hash_table_destroy(&index_table);
+	free(pool);
+	pool = NULL;
+	free_list = NULL;
+}
+
+bool dedup_table_check_and_mark(uint32_t session, uint32_t msg_id) {
+	if (!pool) return false;
+
+	dedup_publisher_t* p = find_or_create(session, msg_id);
+	if (!p) return false;
+
+	int32_t offset = (int32_t)(msg_id - p->base);
+	if (offset < 0) return false;		// too old to tell, forwarding again is the safe side
+	if (offset >= DEDUP_WINDOW_SIZE) slide_window(p, msg_id);
+
+	uint32_t idx = msg_id % DEDUP_WINDOW_SIZE;
+	uint64_t bit = (uint64_t)1 << (idx % 64);
+	bool duplicate = p->seen[idx / 64] & bit;
+	p->seen[idx / 64] |= bit;
+
+	lru_unlink(p);
+	lru_append(p);
+	timer_wheel_add(expiry_wheel, &p->expiry, monotonic_ms() + expiry_after_ms, expire_publisher);
+	return duplicate;
+}
+
+void dedup_table_forget(uint32_t session) {
+	uint64_t* value = hash_table_find(&index_table, session);
+	if (value) retire((dedup_publisher_t*)(uintptr_t)*value);
+}
+
+size_t dedup_table_count(void) {
+	return hash_table_count(&index_table);
+}
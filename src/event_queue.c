@@ -2,19 +2,54 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 #include "../include/event_queue.h"
 #include "../include/slim_msg.h"
 
 void event_queue_init(slimmq_event_queue_t* q) {
 	memset(q, 0, sizeof(*q));
 	pthread_mutex_init(&q->lock, NULL);
-	pthread_cond_init(&q->not_empty, NULL);
+
+	// monotonic clock so timed pops are not affected by wall clock jumps
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&q->not_empty, &attr);
+	pthread_condattr_destroy(&attr);
+
+	q->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+/*
+ * readiness_set/readiness_clear - keep event_fd readable exactly while the
+ * queue holds events. Called with q->lock held on empty <-> non-empty edges.
+ */
+static void readiness_set(slimmq_event_queue_t* q) {
+	if (q->event_fd < 0) return;
+	uint64_t one = 1;
+	ssize_t r = write(q->event_fd, &one, sizeof(one));
+	(void)r;
+}
+
+static void readiness_clear(slimmq_event_queue_t* q) {
+	if (q->event_fd < 0) return;
+	uint64_t value;
+	ssize_t r = read(q->event_fd, &value, sizeof(value));
+	(void)r;
 }
 
 void event_queue_destroy(slimmq_event_queue_t *q) {
 	pthread_mutex_destroy(&q->lock);
 	pthread_cond_destroy(&q->not_empty);
 
+	if (q->event_fd >= 0) {
+		close(q->event_fd);
+		q->event_fd = -1;
+	}
+
 	for (size_t i = 0; i < q->count; ++i) {
 		size_t idx = (q->head + i) % MAX_EVENT_QUEUE_SIZE;
 		free(q->buffer[idx].data);
@@ -23,6 +58,11 @@ void event_queue_destroy(slimmq_event_queue_t *q) {
 
 int event_queue_push(slimmq_event_queue_t *q, uint8_t msg_type, uint32_t msg_id,
 										const char *topic, const void *data, size_t len) {
+	return event_queue_push_session(q, 0, msg_type, msg_id, topic, data, len);
+}
+
+int event_queue_push_session(slimmq_event_queue_t* q, uint32_t session_id, uint8_t msg_type,
+															uint32_t msg_id, const char* topic, const void* data, size_t len) {
 	pthread_mutex_lock(&q->lock);
 
 	if (q->count >= MAX_EVENT_QUEUE_SIZE) {
@@ -33,6 +73,7 @@ int event_queue_push(slimmq_event_queue_t *q, uint8_t msg_type, uint32_t msg_id,
 	size_t idx = q->tail;
 
 	q->buffer[idx].msg_type = msg_type;
+	q->buffer[idx].session_id = session_id;
 	q->buffer[idx].msg_id = msg_id;
 
 	strncpy(q->buffer[idx].topic, topic, MAX_TOPIC_LEN - 1);
@@ -51,7 +92,7 @@ int event_queue_push(slimmq_event_queue_t *q, uint8_t msg_type, uint32_t msg_id,
 	}
 
 	q->tail = (q->tail + 1) % MAX_EVENT_QUEUE_SIZE;
-	q->count++;
+	if (q->count++ == 0) readiness_set(q);
 
 	pthread_cond_signal(&q->not_empty);
 	pthread_mutex_unlock(&q->lock);
@@ -69,12 +110,62 @@ int event_queue_pop(slimmq_event_queue_t *q, slimmq_event_t *out_event) {
 	*out_event = q->buffer[idx];
 
 	q->head = (q->head + 1) % MAX_EVENT_QUEUE_SIZE;
-	q->count--;
-	
+	if (--q->count == 0) readiness_clear(q);
+
 	pthread_mutex_unlock(&q->lock);
 	return 0;
 }
 
+int event_queue_pop_batch(slimmq_event_queue_t* q, slimmq_event_t* out_events,
+													size_t max_events, int timeout_ms) {
+	if (!q || !out_events || max_events == 0) return -1;
+
+	pthread_mutex_lock(&q->lock);
+
+	if (timeout_ms < 0) {
+		while (q->count == 0) {
+			pthread_cond_wait(&q->not_empty, &q->lock);
+		}
+	} else if (timeout_ms > 0 && q->count == 0) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+
+		while (q->count == 0) {
+			if (pthread_cond_timedwait(&q->not_empty, &q->lock, &deadline) == ETIMEDOUT) break;
+		}
+	}
+
+	size_t n = q->count < max_events ? q->count : max_events;
+
+	// copy out in at most two contiguous runs of the ring
+	size_t first = MAX_EVENT_QUEUE_SIZE - q->head;
+	if (first > n) first = n;
+	memcpy(out_events, &q->buffer[q->head], first * sizeof(slimmq_event_t));
+	if (n > first) {
+		memcpy(out_events + first, &q->buffer[0], (n - first) * sizeof(slimmq_event_t));
+	}
+
+	q->head = (q->head + n) % MAX_EVENT_QUEUE_SIZE;
+	q->count -= n;
+	if (n > 0 && q->count == 0) readiness_clear(q);
+
+	pthread_mutex_unlock(&q->lock);
+	return (int)n;
+}
+
+size_t event_queue_free_slots(slimmq_event_queue_t* q) {
+	pthread_mutex_lock(&q->lock);
+	size_t free_slots = MAX_EVENT_QUEUE_SIZE - q->count;
+	pthread_mutex_unlock(&q->lock);
+	return free_slots;
+}
+
 int event_queue_wait_ack(slimmq_event_queue_t* q, uint32_t expected_msg_id) {
 	pthread_mutex_lock(&q->lock);
 
@@ -92,7 +183,7 @@ int event_queue_wait_ack(slimmq_event_queue_t* q, uint32_t expected_msg_id) {
 			}
 
 			q->tail = (q->tail + MAX_EVENT_QUEUE_SIZE - 1) % MAX_EVENT_QUEUE_SIZE;
-			q->count--;
+			if (--q->count == 0) readiness_clear(q);
 
 			pthread_mutex_unlock(&q->lock);
 			return 0;
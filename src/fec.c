@@ -0,0 +1,128 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../include/fec.h"
+
+int fec_encoder_init(fec_encoder_t* e, uint8_t k, uint8_t m) {
+	if (k == 0 || k > FEC_MAX_BLOCK || m == 0 || m > FEC_MAX_PARITY || m > k) return -1;
+
+	memset(e, 0, sizeof(*e));
+	e->k = k;
+	e->m = m;
+	return 0;
+}
+
+bool fec_encoder_add(fec_encoder_t* e, uint32_t seq, const uint8_t* body, size_t len) {
+	if (e->filled == 0) e->first = seq;
+
+	uint8_t index = (uint8_t)((seq - e->first) % e->m);
+	if (len > FEC_MAX_BODY) {
+		e->oversized = true;
+	} else {
+		uint8_t* parity = e->parity[index];
+		for (size_t i = 0; i < len; ++i) parity[i] ^= body[i];
+		e->len_xor[index] ^= (uint16_t)len;
+		if (len > e->parity_len[index]) e->parity_len[index] = (uint16_t)len;
+	}
+
+	return ++e->filled == e->k;
+}
+
+size_t fec_encoder_parity(const fec_encoder_t* e, uint16_t stream, uint8_t index,
+													uint8_t* out, size_t size) {
+	if (e->oversized || index >= e->m) return 0;
+
+	size_t len = FEC_PARITY_HEADER_SIZE + e->parity_len[index];
+	if (len > size) return 0;
+
+	memcpy(out, &stream, sizeof(stream));
+	memcpy(out + 2, &e->first, sizeof(e->first));
+	out[6] = e->k;
+	out[7] = e->m;
+	out[8] = index;
+	memcpy(out + 9, &e->len_xor[index], sizeof(e->len_xor[index]));
+	memcpy(out + FEC_PARITY_HEADER_SIZE, e->parity[index], e->parity_len[index]);
+	return len;
+}
+
+void fec_encoder_next_block(fec_encoder_t* e) {
+	for (uint8_t i = 0; i < e->m; ++i) {
+		memset(e->parity[i], 0, e->parity_len[i]);
+		e->parity_len[i] = 0;
+		e->len_xor[i] = 0;
+	}
+	e->filled = 0;
+	e->oversized = false;
+}
+
+/**
+ * store_slot - put a body in the slot of @seq, replacing what an older packet left there
+ */
+static bool store_slot(fec_slot_t* slot, uint32_t seq, const uint8_t* body, size_t len) {
+	if (len > slot->capacity) {
+		uint8_t* grown = realloc(slot->body, len);
+		if (!grown) return false;
+		slot->body = grown;
+		slot->capacity = len;
+	}
+	memcpy(slot->body, body, len);
+	slot->len = (uint16_t)len;
+	slot->seq = seq;
+	slot->present = true;
+	return true;
+}
+
+bool fec_decoder_store(fec_decoder_t* d, uint32_t seq, const uint8_t* body, size_t len) {
+	fec_slot_t* slot = &d->slots[seq % FEC_WINDOW];
+	if (slot->present && slot->seq == seq) return false;
+
+	return store_slot(slot, seq, body, len);
+}
+
+size_t fec_decoder_repair(fec_decoder_t* d, const uint8_t* data, size_t len,
+													uint32_t* seq, uint8_t* out, size_t size) {
+	if (len < FEC_PARITY_HEADER_SIZE) return 0;
+
+	uint32_t first;
+	uint16_t len_xor;
+	memcpy(&first, data + 2, sizeof(first));
+	uint8_t k = data[6], m = data[7], index = data[8];
+	memcpy(&len_xor, data + 9, sizeof(len_xor));
+	if (k == 0 || k > FEC_MAX_BLOCK || m == 0 || index >= m || index >= k) return 0;
+
+	size_t parity_len = len - FEC_PARITY_HEADER_SIZE;
+	if (parity_len > size) return 0;
+	memcpy(out, data + FEC_PARITY_HEADER_SIZE, parity_len);
+
+	bool found_missing = false;
+	uint32_t missing = 0;
+	for (uint32_t i = index; i < k; i += m) {
+		uint32_t member = first + i;
+		const fec_slot_t* slot = &d->slots[member % FEC_WINDOW];
+
+		if (slot->present && slot->seq == member) {
+			if (slot->len > parity_len) return 0;			// not the block this parity was built over
+			for (size_t b = 0; b < slot->len; ++b) out[b] ^= slot->body[b];
+			len_xor ^= slot->len;
+			continue;
+		}
+		// a newer packet took the slot, the block is too old to tell what is missing
+		if (slot->present && (int32_t)(slot->seq - member) > 0) return 0;
+		if (found_missing) return 0;
+		found_missing = true;
+		missing = member;
+	}
+
+	if (!found_missing || len_xor > parity_len) return 0;
+
+	*seq = missing;
+	return len_xor;
+}
+
+void fec_decoder_free(fec_decoder_t* d) {
+	for (size_t i = 0; i < FEC_WINDOW; ++i) {
+		free(d->slots[i].body);
+		d->slots[i].body = NULL;
+		d->slots[i].capacity = 0;
+		d->slots[i].present = false;
+	}
+}
@@ -0,0 +1,75 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "../include/fec_table.h"
+#include "../include/topic_table.h"
+#include "../include/topic_registry.h"
+
+static fec_rule_t rules[FEC_MAX_RULES];
+static size_t rule_count = 0;
+
+// protected topics, id -> fec_stream_t
+static topic_registry_t registry = { .max = FEC_MAX_STREAMS };
+
+/**
+ * rule_for_topic - rule covering a topic (latest matching rule wins)
+ */
+static const fec_rule_t* rule_for_topic(const char* topic) {
+	for (size_t i = rule_count; i-- > 0;) {
+		if (topic_matches_filter(rules[i].filter, topic)) return &rules[i];
+	}
+	return NULL;
+}
+
+int fec_rule_add(const char* filter, uint8_t k, uint8_t m) {
+	fec_encoder_t probe;
+	if (rule_count == FEC_MAX_RULES || fec_encoder_init(&probe, k, m) != 0) return -1;
+
+	fec_rule_t* r = &rules[rule_count++];
+	snprintf(r->filter, sizeof(r->filter), "%s", filter);
+	r->k = k;
+	r->m = m;
+	return 0;
+}
+
+fec_stream_t* fec_stream_for(const char* topic) {
+	if (rule_count == 0) return NULL;
+
+	fec_stream_t* s = topic_registry_find(&registry, topic);
+	if (s) return s;
+
+	const fec_rule_t* rule = rule_for_topic(topic);
+	if (!rule) return NULL;
+
+	s = calloc(1, sizeof(fec_stream_t));
+	if (!s) return NULL;
+	s->id = topic_registry_add(&registry, topic, s);
+	if (s->id == 0) {
+		free(s);
+		return NULL;
+	}
+	s->next_seq = 1;
+	fec_encoder_init(&s->encoder, rule->k, rule->m);
+	return s;
+}
+
+bool fec_stream_stamp(fec_stream_t* s, uint8_t* packet, size_t len) {
+	slim_msg_header_t hdr;
+	memcpy(&hdr, packet, sizeof(hdr));
+	hdr.topic_id = s->id;
+	hdr.msg_id = s->next_seq++;
+	if (s->next_seq == 0) s->next_seq = 1;		// 0 never names a delivery
+	memcpy(packet, &hdr, sizeof(hdr));
+
+	return fec_encoder_add(&s->encoder, hdr.msg_id, packet + sizeof(hdr), len - sizeof(hdr));
+}
+
+size_t fec_stream_count(void) {
+	return registry.count;
+}
+
+void fec_table_destroy(void) {
+	for (uint16_t id = 1; id <= registry.count; ++id) free(topic_registry_get(&registry, id));
+	topic_registry_clear(&registry);
+	rule_count = 0;
+}
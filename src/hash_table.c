@@ -0,0 +1,214 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../include/hash_table.h"
+
+/**
+ * mix - splitmix64 finalizer, spreads sequential keys (msg_ids, ports) evenly
+ */
+static uint64_t mix(uint64_t key) {
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebULL;
+	key ^= key >> 31;
+	return key;
+}
+
+static int array_alloc(hash_array_t* a, size_t capacity) {
+	a->slots = calloc(capacity, sizeof(hash_slot_t));
+	if (!a->slots) return -1;
+	a->capacity = capacity;
+	a->count = 0;
+	return 0;
+}
+
+static void array_free(hash_array_t* a) {
+	free(a->slots);
+	a->slots = NULL;
+	a->capacity = 0;
+	a->count = 0;
+}
+
+static hash_slot_t* array_find(hash_array_t* a, uint64_t key) {
+	if (a->count == 0) return NULL;
+
+	size_t mask = a->capacity - 1;
+	size_t idx = mix(key) & mask;
+
+	for (uint32_t dist = 1; ; ++dist, idx = (idx + 1) & mask) {
+		hash_slot_t* s = &a->slots[idx];
+		// a poorer resident (or an empty slot) means the key would have been placed here
+		if (s->dist < dist) return NULL;
+		if (s->key == key) return s;
+	}
+}
+
+/**
+ * array_insert - Robin Hood insert of a key known to be absent
+ */
+static void array_insert(hash_array_t* a, uint64_t key, uint64_t value) {
+	size_t mask = a->capacity - 1;
+	size_t idx = mix(key) & mask;
+	hash_slot_t item = { .key = key, .value = value, .dist = 1 };
+
+	while (true) {
+		hash_slot_t* s = &a->slots[idx];
+		if (s->dist == 0) {
+			*s = item;
+			a->count++;
+			return;
+		}
+		if (s->dist < item.dist) {
+			hash_slot_t evicted = *s;
+			*s = item;
+			item = evicted;
+		}
+		item.dist++;
+		idx = (idx + 1) & mask;
+	}
+}
+
+/**
+ * array_erase - delete a slot and shift the following probe run back by one
+ */
+static void array_erase(hash_array_t* a, hash_slot_t* s) {
+	size_t mask = a->capacity - 1;
+	size_t idx = (size_t)(s - a->slots);
+
+	while (true) {
+		size_t next = (idx + 1) & mask;
+		hash_slot_t* n = &a->slots[next];
+		if (n->dist <= 1) break;
+
+		a->slots[idx] = *n;
+		a->slots[idx].dist--;
+		idx = next;
+	}
+	memset(&a->slots[idx], 0, sizeof(hash_slot_t));
+	a->count--;
+}
+
+/**
+ * migrate - move up to @budget occupied slots of the old table into the current one
+ *
+ * Removing the entry at the cursor shifts its successors back into the
+ * cursor slot, so every slot before the cursor stays empty and no entry
+ * is skipped.
+ */
+static void migrate(hash_table_t* t, size_t budget) {
+	hash_array_t* old = &t->old;
+
+	while (old->slots && budget-- > 0) {
+		while (t->migrate_pos < old->capacity && old->slots[t->migrate_pos].dist == 0) {
+			t->migrate_pos++;
+		}
+		if (old->count == 0 || t->migrate_pos >= old->capacity) {
+			array_free(old);
+			t->migrate_pos = 0;
+			return;
+		}
+
+		hash_slot_t* s = &old->slots[t->migrate_pos];
+		array_insert(&t->cur, s->key, s->value);
+		array_erase(old, s);
+	}
+}
+
+static int grow(hash_table_t* t) {
+	// a resize cannot start while the previous one is still draining
+	migrate(t, SIZE_MAX);
+
+	size_t capacity = t->cur.capacity ? t->cur.capacity * 2 : HASH_TABLE_MIN_CAPACITY;
+	hash_array_t bigger;
+	if (array_alloc(&bigger, capacity) < 0) return -1;
+
+	t->old = t->cur;
+	t->cur = bigger;
+	t->migrate_pos = 0;
+	return 0;
+}
+
+int hash_table_init(hash_table_t* t, size_t capacity) {
+	size_t cap = HASH_TABLE_MIN_CAPACITY;
+	while (cap * HASH_TABLE_MAX_LOAD_PCT / 100 < capacity) cap *= 2;
+
+	memset(t, 0, sizeof(*t));
+	return array_alloc(&t->cur, cap);
+}
+
+void hash_table_destroy(hash_table_t* t) {
+	array_free(&t->cur);
+	array_free(&t->old);
+	t->migrate_pos = 0;
+}
+
+uint64_t* hash_table_find(hash_table_t* t, uint64_t key) {
+	hash_slot_t* s = array_find(&t->cur, key);
+	if (!s && t->old.slots) s = array_find(&t->old, key);
+	return s ? &s->value : NULL;
+}
+
+int hash_table_put(hash_table_t* t, uint64_t key, uint64_t value) {
+	migrate(t, HASH_TABLE_MIGRATE_STEP);
+
+	uint64_t* existing = hash_table_find(t, key);
+	if (existing) {
+		*existing = value;
+		return 0;
+	}
+
+	if ((t->cur.count + 1) * 100 > t->cur.capacity * HASH_TABLE_MAX_LOAD_PCT && grow(t) < 0) {
+		return -1;
+	}
+	array_insert(&t->cur, key, value);
+	return 0;
+}
+
+bool hash_table_remove(hash_table_t* t, uint64_t key, uint64_t* out_value) {
+	migrate(t, HASH_TABLE_MIGRATE_STEP);
+
+	hash_array_t* a = &t->cur;
+	hash_slot_t* s = array_find(a, key);
+	if (!s && t->old.slots) {
+		a = &t->old;
+		s = array_find(a, key);
+	}
+	if (!s) return false;
+
+	if (out_value) *out_value = s->value;
+	array_erase(a, s);
+	return true;
+}
+
+size_t hash_table_count(const hash_table_t* t) {
+	return t->cur.count + t->old.count;
+}
+
+void hash_table_foreach(hash_table_t* t,
+												void (*fn)(uint64_t key, uint64_t* value, void* ctx), void* ctx) {
+	hash_array_t* arrays[] = { &t->cur, &t->old };
+
+	for (size_t a = 0; a < 2; ++a) {
+		for (size_t i = 0; i < arrays[a]->capacity; ++i) {
+			hash_slot_t* s = &arrays[a]->slots[i];
+			if (s->dist != 0) fn(s->key, &s->value, ctx);
+		}
+	}
+}
+
+size_t hash_table_remove_if(hash_table_t* t,
+														bool (*pred)(uint64_t key, uint64_t value, void* ctx), void* ctx) {
+	migrate(t, SIZE_MAX);
+
+	size_t removed = 0;
+	for (size_t i = 0; i < t->cur.capacity; ) {
+		hash_slot_t* s = &t->cur.slots[i];
+		if (s->dist != 0 && pred(s->key, s->value, ctx)) {
+			array_erase(&t->cur, s);
+			removed++;
+			continue;		// the next entry of the run was shifted into slot i
+		}
+		i++;
+	}
+	return removed;
+}
@@ -0,0 +1,124 @@
+#include <errno.h>
+#include <time.h>
+#include "../include/inflight_table.h"
+
+#define PENDING(msg_id) ((uint64_t)(msg_id) << 1)
+#define ACKED(msg_id) (PENDING(msg_id) | 1)
+
+static inflight_slot_t* slot_of(inflight_table_t* t, uint32_t msg_id) {
+	return &t->slots[msg_id % INFLIGHT_TABLE_SIZE];
+}
+
+static bool is_acked(inflight_slot_t* s, uint32_t msg_id) {
+	return atomic_load(&s->state) == ACKED(msg_id);
+}
+
+void inflight_table_init(inflight_table_t* t) {
+	for (size_t i = 0; i < INFLIGHT_TABLE_SIZE; ++i) {
+		atomic_init(&t->slots[i].state, 0);
+	}
+	atomic_init(&t->waiters, 0);
+	pthread_mutex_init(&t->wake_lock, NULL);
+
+	// monotonic clock so waits are not affected by wall clock jumps
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&t->acked, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+void inflight_table_destroy(inflight_table_t* t) {
+	pthread_cond_destroy(&t->acked);
+	pthread_mutex_destroy(&t->wake_lock);
+}
+
+int inflight_claim(inflight_table_t* t, uint32_t msg_id) {
+	uint64_t expected = 0;
+	return atomic_compare_exchange_strong(&slot_of(t, msg_id)->state, &expected, PENDING(msg_id)) ? 0 : -1;
+}
+
+/**
+ * mark_acked - flip a pending slot to acked
+ *
+ * Return: 1 if @msg_id was pending, 0 if it was already acked, -1 if not in flight
+ */
+static int mark_acked(inflight_table_t* t, uint32_t msg_id) {
+	uint64_t expected = PENDING(msg_id);
+	if (atomic_compare_exchange_strong(&slot_of(t, msg_id)->state, &expected, ACKED(msg_id))) return 1;
+	return expected == ACKED(msg_id) ? 0 : -1;
+}
+
+static void wake_waiters(inflight_table_t* t) {
+	// the waiter registers before checking @acked, so a zero count means nobody sleeps
+	if (atomic_load(&t->waiters) > 0) {
+		pthread_mutex_lock(&t->wake_lock);
+		pthread_cond_broadcast(&t->acked);
+		pthread_mutex_unlock(&t->wake_lock);
+	}
+}
+
+bool inflight_ack(inflight_table_t* t, uint32_t msg_id) {
+	int marked = mark_acked(t, msg_id);
+	if (marked <= 0) return marked == 0;		// duplicate ACK
+
+	wake_waiters(t);
+	return true;
+}
+
+size_t inflight_ack_sack(inflight_table_t* t, uint32_t first, uint64_t bitmap) {
+	size_t acked = 0;
+	bool woke = false;
+
+	int marked = mark_acked(t, first);
+	acked += marked >= 0;
+	woke |= marked > 0;
+	for (uint32_t i = 0; bitmap != 0; ++i, bitmap >>= 1) {
+		if (!(bitmap & 1)) continue;
+		marked = mark_acked(t, first + 1 + i);
+		acked += marked >= 0;
+		woke |= marked > 0;
+	}
+
+	if (woke) wake_waiters(t);
+	return acked;
+}
+
+bool inflight_wait(inflight_table_t* t, uint32_t msg_id, int timeout_ms) {
+	inflight_slot_t* s = slot_of(t, msg_id);
+	if (is_acked(s, msg_id)) return true;
+
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	atomic_fetch_add(&t->waiters, 1);
+	pthread_mutex_lock(&t->wake_lock);
+
+	bool acked;
+	while (!(acked = is_acked(s, msg_id))) {
+		if (pthread_cond_timedwait(&t->acked, &t->wake_lock, &deadline) == ETIMEDOUT) {
+			acked = is_acked(s, msg_id);
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&t->wake_lock);
+	atomic_fetch_sub(&t->waiters, 1);
+	return acked;
+}
+
+void inflight_release(inflight_table_t* t, uint32_t msg_id) {
+	inflight_slot_t* s = slot_of(t, msg_id);
+	uint64_t expected = PENDING(msg_id);
+
+	if (!atomic_compare_exchange_strong(&s->state, &expected, 0)) {
+		expected = ACKED(msg_id);
+		atomic_compare_exchange_strong(&s->state, &expected, 0);
+	}
+}
@@ -0,0 +1,558 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/message_log.h"
+
+typedef struct log_segment {
+	char path[PATH_MAX];
+	int fd;
+	uint8_t* base;
+	size_t size;
+	size_t write_pos;					// end of the last appended record
+	size_t synced_pos;				// end of the last record made durable
+	uint64_t base_offset;			// offset of the first record
+	size_t pending;						// sum of pending deliveries over all records
+	bool sealed;							// full, no further appends
+	struct log_segment* next;
+} log_segment_t;
+
+/**
+ * log_consumer_t - committed offset of a named consumer, kept in consumers.idx
+ */
+typedef struct {
+	char name[LOG_CONSUMER_NAME_MAX];
+	uint64_t offset;									// next record to deliver
+} log_consumer_t;
+
+static char log_dir[PATH_MAX / 2];				// leaves room for segment file names
+static bool log_open = false;
+static log_segment_t* segments_head = NULL;	// oldest segment
+static log_segment_t* active = NULL;					// segment receiving appends
+static uint64_t next_offset = 0;
+static size_t uncommitted = 0;
+
+static int consumers_fd = -1;
+static log_consumer_t* consumers = NULL;				// mapped consumers.idx
+static bool consumers_dirty = false;
+
+static pthread_t compactor_thread;
+static pthread_mutex_t compactor_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t compactor_cond = PTHREAD_COND_INITIALIZER;
+static log_segment_t* retired = NULL;					// segments handed to the compactor
+static bool compactor_running = false;
+
+static size_t align8(size_t n) {
+	return (n + 7) & ~(size_t)7;
+}
+
+static uint64_t wall_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static log_record_header_t* record_at(log_segment_t* seg, size_t pos) {
+	return (log_record_header_t*)(seg->base + pos);
+}
+
+static bool record_valid(log_segment_t* seg, size_t pos) {
+	if (pos + sizeof(log_record_header_t) > seg->size) return false;
+
+	log_record_header_t* rec = record_at(seg, pos);
+	return rec->magic == LOG_RECORD_MAGIC &&
+		rec->record_len >= sizeof(log_record_header_t) &&
+		pos + rec->record_len <= seg->size;
+}
+
+/**
+ * unmap_segment - release the mapping and descriptor of a segment
+ */
+static void unmap_segment(log_segment_t* seg) {
+	if (seg->base) munmap(seg->base, seg->size);
+	if (seg->fd >= 0) close(seg->fd);
+	seg->base = NULL;
+	seg->fd = -1;
+}
+
+/**
+ * map_segment - open and map a segment file, creating it at full size if needed
+ */
+static log_segment_t* map_segment(const char* path, uint64_t base_offset, bool create) {
+	log_segment_t* seg = calloc(1, sizeof(log_segment_t));
+	if (!seg) return NULL;
+
+	snprintf(seg->path, sizeof(seg->path), "%s", path);
+	seg->base_offset = base_offset;
+	seg->fd = open(path, O_RDWR | (create ? O_CREAT | O_EXCL : 0), 0644);
+	if (seg->fd < 0) {
+		perror("[LOG] open() failed");
+		free(seg);
+		return NULL;
+	}
+
+	if (create && ftruncate(seg->fd, LOG_SEGMENT_SIZE) < 0) {
+		perror("[LOG] ftruncate() failed");
+		close(seg->fd);
+		free(seg);
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(seg->fd, &st) < 0 || st.st_size <= 0) {
+		close(seg->fd);
+		free(seg);
+		return NULL;
+	}
+	seg->size = (size_t)st.st_size;
+
+	seg->base = mmap(NULL, seg->size, PROT_READ | PROT_WRITE, MAP_SHARED, seg->fd, 0);
+	if (seg->base == MAP_FAILED) {
+		perror("[LOG] mmap() failed");
+		seg->base = NULL;
+		unmap_segment(seg);
+		free(seg);
+		return NULL;
+	}
+	return seg;
+}
+
+static void append_segment(log_segment_t* seg) {
+	seg->next = NULL;
+	if (!segments_head) {
+		segments_head = seg;
+	} else {
+		log_segment_t* tail = segments_head;
+		while (tail->next) tail = tail->next;
+		tail->next = seg;
+	}
+	active = seg;
+}
+
+static log_segment_t* create_segment(uint64_t base_offset) {
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%020llu.seg", log_dir, (unsigned long long)base_offset);
+
+	log_segment_t* seg = map_segment(path, base_offset, true);
+	if (seg) append_segment(seg);
+	return seg;
+}
+
+/**
+ * scan_segment - find the end of valid records and rebuild pending counts
+ */
+static void scan_segment(log_segment_t* seg) {
+	size_t pos = 0;
+	while (record_valid(seg, pos)) {
+		log_record_header_t* rec = record_at(seg, pos);
+		seg->pending += rec->pending;
+		next_offset = rec->offset + 1;
+		pos += rec->record_len;
+	}
+	seg->write_pos = pos;
+	seg->synced_pos = pos;
+}
+
+static int compare_names(const void* a, const void* b) {
+	return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+/**
+ * load_segments - map existing segments in offset order (names are zero padded)
+ */
+static int load_segments(void) {
+	DIR* dir = opendir(log_dir);
+	if (!dir) return -1;
+
+	char** names = NULL;
+	size_t count = 0;
+	struct dirent* ent;
+	while ((ent = readdir(dir)) != NULL) {
+		size_t len = strlen(ent->d_name);
+		if (len < 5 || strcmp(ent->d_name + len - 4, ".seg") != 0) continue;
+
+		char** grown = realloc(names, sizeof(char*) * (count + 1));
+		if (!grown) break;
+		names = grown;
+		names[count++] = strdup(ent->d_name);
+	}
+	closedir(dir);
+
+	qsort(names, count, sizeof(char*), compare_names);
+
+	for (size_t i = 0; i < count; ++i) {
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), "%s/%s", log_dir, names[i]);
+
+		log_segment_t* seg = map_segment(path, strtoull(names[i], NULL, 10), false);
+		if (seg) {
+			scan_segment(seg);
+			if (active) active->sealed = true;
+			append_segment(seg);
+		}
+		free(names[i]);
+	}
+	free(names);
+	return 0;
+}
+
+/**
+ * map_consumers - map the fixed-size committed offset table
+ */
+static int map_consumers(void) {
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/consumers.idx", log_dir);
+
+	size_t size = sizeof(log_consumer_t) * LOG_MAX_CONSUMERS;
+	consumers_fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (consumers_fd < 0 || ftruncate(consumers_fd, size) < 0) {
+		perror("[LOG] consumers.idx");
+		return -1;
+	}
+
+	consumers = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, consumers_fd, 0);
+	if (consumers == MAP_FAILED) {
+		perror("[LOG] mmap() failed");
+		consumers = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+static void unmap_consumers(void) {
+	if (consumers) munmap(consumers, sizeof(log_consumer_t) * LOG_MAX_CONSUMERS);
+	if (consumers_fd >= 0) close(consumers_fd);
+	consumers = NULL;
+	consumers_fd = -1;
+}
+
+static void* compactor_loop(void* arg) {
+	(void)arg;
+
+	pthread_mutex_lock(&compactor_lock);
+	while (compactor_running || retired) {
+		while (!retired && compactor_running) {
+			pthread_cond_wait(&compactor_cond, &compactor_lock);
+		}
+
+		log_segment_t* seg = retired;
+		if (!seg) continue;
+		retired = seg->next;
+		pthread_mutex_unlock(&compactor_lock);
+
+		unmap_segment(seg);
+		unlink(seg->path);
+		free(seg);
+
+		pthread_mutex_lock(&compactor_lock);
+	}
+	pthread_mutex_unlock(&compactor_lock);
+	return NULL;
+}
+
+int message_log_open(const char* dir) {
+	if (log_open) return -1;
+
+	snprintf(log_dir, sizeof(log_dir), "%s", dir);
+	mkdir(log_dir, 0755);
+
+	if (load_segments() < 0) {
+		fprintf(stderr, "[LOG] Cannot open log directory %s\n", log_dir);
+		return -1;
+	}
+	if (!active && !create_segment(next_offset)) return -1;
+	if (map_consumers() < 0) return -1;
+
+	compactor_running = true;
+	if (pthread_create(&compactor_thread, NULL, compactor_loop, NULL) != 0) {
+		compactor_running = false;
+		return -1;
+	}
+
+	log_open = true;
+	return 0;
+}
+
+void message_log_close(void) {
+	if (!log_open) return;
+
+	message_log_commit();
+
+	pthread_mutex_lock(&compactor_lock);
+	compactor_running = false;
+	pthread_cond_signal(&compactor_cond);
+	pthread_mutex_unlock(&compactor_lock);
+	pthread_join(compactor_thread, NULL);
+
+	while (segments_head) {
+		log_segment_t* next = segments_head->next;
+		unmap_segment(segments_head);
+		free(segments_head);
+		segments_head = next;
+	}
+	active = NULL;
+	unmap_consumers();
+	log_open = false;
+}
+
+bool message_log_enabled(void) {
+	return log_open;
+}
+
+int message_log_append(const char* topic, uint8_t qos, const void* data, size_t len,
+												log_ref_t* out_ref) {
+	if (!log_open) return -1;
+
+	size_t topic_len = strlen(topic);
+	if (topic_len > 255) return -1;
+
+	size_t record_len = align8(sizeof(log_record_header_t) + topic_len + len);
+	if (record_len > LOG_SEGMENT_SIZE) return -1;
+
+	if (active->write_pos + record_len > active->size) {
+		// the full segment is sealed only after its tail is durable
+		if (message_log_commit() < 0) return -1;
+		active->sealed = true;
+		if (!create_segment(next_offset)) return -1;
+	}
+
+	size_t pos = active->write_pos;
+	log_record_header_t* rec = record_at(active, pos);
+	rec->record_len = (uint32_t)record_len;
+	rec->offset = next_offset++;
+	rec->timestamp_ms = wall_ms();
+	rec->pending = 0;
+	rec->qos = qos;
+	rec->topic_len = (uint8_t)topic_len;
+	rec->data_len = (uint32_t)len;
+
+	uint8_t* body = (uint8_t*)(rec + 1);
+	memcpy(body, topic, topic_len);
+	if (len > 0) memcpy(body + topic_len, data, len);
+
+	// magic last: a torn record is never mistaken for a valid one
+	__atomic_store_n(&rec->magic, LOG_RECORD_MAGIC, __ATOMIC_RELEASE);
+
+	active->write_pos += record_len;
+	uncommitted++;
+
+	if (out_ref) {
+		out_ref->segment = active;
+		out_ref->pos = (uint32_t)pos;
+	}
+	return 0;
+}
+
+void message_log_hold(const log_ref_t* ref) {
+	if (!ref || !ref->segment) return;
+
+	record_at(ref->segment, ref->pos)->pending++;
+	ref->segment->pending++;
+}
+
+void message_log_release(const log_ref_t* ref) {
+	if (!ref || !ref->segment) return;
+
+	log_record_header_t* rec = record_at(ref->segment, ref->pos);
+	if (rec->pending > 0) rec->pending--;
+	if (ref->segment->pending > 0) ref->segment->pending--;
+}
+
+bool message_log_dirty(void) {
+	return log_open && uncommitted > 0;
+}
+
+int message_log_commit(void) {
+	if (!log_open) return 0;
+
+	if (consumers_dirty) {
+		if (msync(consumers, sizeof(log_consumer_t) * LOG_MAX_CONSUMERS, MS_SYNC) < 0) {
+			perror("[LOG] msync() failed");
+			return -1;
+		}
+		consumers_dirty = false;
+	}
+
+	if (active->synced_pos == active->write_pos) {
+		uncommitted = 0;
+		return 0;
+	}
+
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t start = active->synced_pos & ~(page - 1);
+
+	if (msync(active->base + start, active->write_pos - start, MS_SYNC) < 0) {
+		perror("[LOG] msync() failed");
+		return -1;
+	}
+
+	active->synced_pos = active->write_pos;
+	uncommitted = 0;
+	return 0;
+}
+
+void message_log_compact(uint64_t keep_from) {
+	if (!log_open) return;
+
+	for (size_t i = 0; i < LOG_MAX_CONSUMERS; ++i) {
+		if (consumers[i].name[0] && consumers[i].offset < keep_from) {
+			keep_from = consumers[i].offset;
+		}
+	}
+
+	log_segment_t* prev = NULL;
+	log_segment_t* seg = segments_head;
+
+	while (seg) {
+		log_segment_t* next = seg->next;
+
+		// a sealed segment always has a successor starting right after its last record;
+		// strict so a cursor parked at the end of a segment never dangles
+		if (seg->sealed && seg->pending == 0 && seg != active &&
+				next && next->base_offset < keep_from) {
+			if (prev) prev->next = next;
+			else segments_head = next;
+
+			pthread_mutex_lock(&compactor_lock);
+			seg->next = retired;
+			retired = seg;
+			pthread_cond_signal(&compactor_cond);
+			pthread_mutex_unlock(&compactor_lock);
+		} else {
+			prev = seg;
+		}
+		seg = next;
+	}
+}
+
+void message_log_for_each_pending(log_record_cb cb, void* ctx) {
+	for (log_segment_t* seg = segments_head; seg != NULL; seg = seg->next) {
+		for (size_t pos = 0; pos < seg->write_pos; pos += record_at(seg, pos)->record_len) {
+			log_record_header_t* rec = record_at(seg, pos);
+			if (rec->pending == 0) continue;
+
+			seg->pending -= rec->pending;
+			rec->pending = 0;
+
+			char topic[256];
+			memcpy(topic, rec + 1, rec->topic_len);
+			topic[rec->topic_len] = '\0';
+
+			log_ref_t ref = { .segment = seg, .pos = (uint32_t)pos };
+			cb(&ref, rec, topic, (const uint8_t*)(rec + 1) + rec->topic_len, ctx);
+		}
+	}
+}
+
+int message_log_seek_offset(uint64_t offset, log_ref_t* cursor) {
+	if (!log_open) return -1;
+
+	log_segment_t* seg = segments_head;
+	while (seg->next && seg->next->base_offset <= offset) seg = seg->next;
+
+	size_t pos = 0;
+	while (pos < seg->write_pos && record_at(seg, pos)->offset < offset) {
+		pos += record_at(seg, pos)->record_len;
+	}
+
+	cursor->segment = seg;
+	cursor->pos = (uint32_t)pos;
+	return 0;
+}
+
+int message_log_seek_time(uint64_t timestamp_ms, log_ref_t* cursor) {
+	if (!log_open) return -1;
+
+	// skip whole segments whose successor already starts at or before the target
+	log_segment_t* seg = segments_head;
+	while (seg->next && seg->next->write_pos > 0 &&
+					record_at(seg->next, 0)->timestamp_ms <= timestamp_ms) {
+		seg = seg->next;
+	}
+
+	size_t pos = 0;
+	while (pos < seg->write_pos && record_at(seg, pos)->timestamp_ms < timestamp_ms) {
+		pos += record_at(seg, pos)->record_len;
+	}
+
+	cursor->segment = seg;
+	cursor->pos = (uint32_t)pos;
+	return 0;
+}
+
+bool message_log_read(log_ref_t* cursor, log_record_cb cb, void* ctx) {
+	log_segment_t* seg = cursor->segment;
+
+	while (cursor->pos >= seg->write_pos) {
+		if (!seg->sealed || !seg->next) return false;
+		seg = seg->next;
+		cursor->segment = seg;
+		cursor->pos = 0;
+	}
+
+	log_record_header_t* rec = record_at(seg, cursor->pos);
+
+	char topic[256];
+	memcpy(topic, rec + 1, rec->topic_len);
+	topic[rec->topic_len] = '\0';
+
+	log_ref_t ref = *cursor;
+	cursor->pos += rec->record_len;
+
+	cb(&ref, rec, topic, (const uint8_t*)(rec + 1) + rec->topic_len, ctx);
+	return true;
+}
+
+uint64_t message_log_cursor_offset(const log_ref_t* cursor) {
+	log_segment_t* seg = cursor->segment;
+
+	if (cursor->pos < seg->write_pos) return record_at(seg, cursor->pos)->offset;
+	if (seg->next) return seg->next->base_offset;
+	return next_offset;
+}
+
+uint64_t message_log_record_offset(const log_ref_t* ref) {
+	return record_at(ref->segment, ref->pos)->offset;
+}
+
+int message_log_consumer_offset(const char* name, uint64_t* out) {
+	if (!log_open || name[0] == '\0') return -1;
+
+	for (size_t i = 0; i < LOG_MAX_CONSUMERS; ++i) {
+		if (strncmp(consumers[i].name, name, LOG_CONSUMER_NAME_MAX) == 0) {
+			*out = consumers[i].offset;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int message_log_consumer_commit(const char* name, uint64_t next_offset) {
+	if (!log_open || name[0] == '\0' || strlen(name) >= LOG_CONSUMER_NAME_MAX) return -1;
+
+	log_consumer_t* free_slot = NULL;
+	for (size_t i = 0; i < LOG_MAX_CONSUMERS; ++i) {
+		if (strcmp(consumers[i].name, name) == 0) {
+			if (next_offset > consumers[i].offset) {
+				consumers[i].offset = next_offset;
+				consumers_dirty = true;
+			}
+			return 0;
+		}
+		if (!free_slot && consumers[i].name[0] == '\0') free_slot = &consumers[i];
+	}
+
+	if (!free_slot) return -1;
+
+	free_slot->offset = next_offset;
+	snprintf(free_slot->name, sizeof(free_slot->name), "%s", name);
+	consumers_dirty = true;
+	return 0;
+}
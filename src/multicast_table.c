@@ -0,0 +1,46 @@
+#include <string.h>
+#include <stdio.h>
+#include "../include/multicast_table.h"
+#include "../include/topic_table.h"
+
+static multicast_route_t routes[MULTICAST_MAX_ROUTES];
+static size_t route_count = 0;
+
+int multicast_route_add(const char* filter, const struct sockaddr_in* group) {
+	if (route_count == MULTICAST_MAX_ROUTES) return -1;
+
+	multicast_route_t* r = &routes[route_count];
+	snprintf(r->filter, sizeof(r->filter), "%s", filter);
+	r->group = *group;
+	return (int)route_count++;
+}
+
+int multicast_route_for_topic(const char* topic) {
+	for (size_t i = route_count; i-- > 0;) {
+		if (topic_matches_filter(routes[i].filter, topic)) return (int)i;
+	}
+	return -1;
+}
+
+int multicast_route_for_group(const struct sockaddr_in* group) {
+	for (size_t i = 0; i < route_count; ++i) {
+		if (routes[i].group.sin_addr.s_addr == group->sin_addr.s_addr &&
+				routes[i].group.sin_port == group->sin_port) {
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
+const multicast_route_t* multicast_route_get(int idx) {
+	if (idx < 0 || (size_t)idx >= route_count) return NULL;
+	return &routes[idx];
+}
+
+size_t multicast_route_count(void) {
+	return route_count;
+}
+
+void multicast_routes_clear(void) {
+	route_count = 0;
+}
@@ -0,0 +1,281 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "../include/outbound_table.h"
+#include "../include/transport.h"
+#include "../include/slim_msg.h"
+
+static timer_wheel_t* retry_timers = NULL;
+static int retry_sockfd = -1;
+
+static void list_append(outbound_list_t* list, outbound_entry_t* e) {
+	e->next = NULL;
+	e->prev = list->tail;
+	if (list->tail) list->tail->next = e;
+	else list->head = e;
+	list->tail = e;
+}
+
+static void list_unlink(outbound_list_t* list, outbound_entry_t* e) {
+	if (e->prev) e->prev->next = e->next;
+	else list->head = e->next;
+	if (e->next) e->next->prev = e->prev;
+	else list->tail = e->prev;
+	e->prev = e->next = NULL;
+}
+
+static void release_entry(outbound_window_t* w, outbound_entry_t* e) {
+	if (e->held) list_unlink(&w->held, e);
+	else timer_wheel_cancel(retry_timers, &e->retry_timer);
+	message_log_release(&e->log_ref);
+	e->log_ref.segment = NULL;
+	free(e->packet);
+	e->packet = NULL;
+	e->in_use = false;
+	e->held = false;
+	w->inflight--;
+}
+
+static outbound_window_t* window_of(outbound_entry_t* e) {
+	size_t idx = e->msg_id % OUTBOUND_WINDOW_SIZE;
+	return (outbound_window_t*)((uint8_t*)(e - idx) - offsetof(outbound_window_t, slots));
+}
+
+/**
+ * retransmit - retry timer callback: resend the entry or give up on it
+ */
+static void retransmit(timer_node_t* t) {
+	outbound_entry_t* e = (outbound_entry_t*)((uint8_t*)t - offsetof(outbound_entry_t, retry_timer));
+
+	if (e->retries >= OUTBOUND_MAX_RETRIES) {
+		outbound_window_t* w = window_of(e);
+		w->dropped++;
+		outbound_mark_lost(w, &e->log_ref);
+		release_entry(w, e);
+		return;
+	}
+
+	send_bytes(retry_sockfd, (const struct sockaddr*)e->dest, sizeof(*e->dest),
+						e->packet, e->packet_len);
+
+	e->retries++;
+	timer_wheel_add(retry_timers, &e->retry_timer,
+									t->expires_tick * TIMER_WHEEL_TICK_MS + OUTBOUND_RETRY_TIMEOUT_MS, retransmit);
+}
+
+static void schedule(outbound_entry_t* e, uint64_t now_ms) {
+	timer_wheel_add(retry_timers, &e->retry_timer, now_ms + OUTBOUND_RETRY_TIMEOUT_MS, retransmit);
+}
+
+void outbound_init(timer_wheel_t* timers, int sockfd) {
+	retry_timers = timers;
+	retry_sockfd = sockfd;
+}
+
+void outbound_window_clear(outbound_window_t* w) {
+	for (size_t i = 0; i < OUTBOUND_WINDOW_SIZE; ++i) {
+		if (w->slots[i].in_use) {
+			release_entry(w, &w->slots[i]);
+		}
+	}
+
+	while (w->queue_head) {
+		outbound_queued_t* q = w->queue_head;
+		w->queue_head = q->next;
+		message_log_release(&q->log_ref);
+		free(q);
+	}
+	w->queue_tail = NULL;
+	w->queued = 0;
+}
+
+int outbound_track(outbound_window_t* w, uint32_t msg_id, uint8_t qos,
+									const struct sockaddr_in* dest,
+									const uint8_t* packet, size_t len, uint64_t now_ms,
+									bool send_now, const log_ref_t* log_ref) {
+	outbound_entry_t* e = &w->slots[msg_id % OUTBOUND_WINDOW_SIZE];
+	if (e->in_use) return -1;
+
+	e->packet = malloc(len);
+	if (!e->packet) return -2;
+	memcpy(e->packet, packet, len);
+
+	e->packet_len = len;
+	e->msg_id = msg_id;
+	e->state = (qos == QOS_EXACTLY_ONCE) ? OUTBOUND_WAIT_RECEIVED : OUTBOUND_WAIT_ACK;
+	e->dest = dest;
+	e->retries = 0;
+	e->in_use = true;
+	e->held = !send_now;
+	w->inflight++;
+
+	e->log_ref.segment = NULL;
+	if (log_ref) {
+		e->log_ref = *log_ref;
+		message_log_hold(log_ref);
+	}
+
+	if (e->held) list_append(&w->held, e);
+	else schedule(e, now_ms);
+	return 0;
+}
+
+int outbound_enqueue(outbound_window_t* w, uint8_t qos, const uint8_t* packet, size_t len,
+											const log_ref_t* log_ref) {
+	if (len < sizeof(slim_msg_header_t)) return -2;
+	if (w->queued >= OUTBOUND_QUEUE_MAX) {
+		outbound_mark_lost(w, log_ref);
+		return -1;
+	}
+
+	outbound_queued_t* q = malloc(sizeof(outbound_queued_t) + len);
+	if (!q) return -2;
+
+	q->next = NULL;
+	q->qos = qos;
+	q->packet_len = len;
+	memcpy(q->packet, packet, len);
+
+	q->log_ref.segment = NULL;
+	q->low_offset = UINT64_MAX;
+	if (log_ref) {
+		q->log_ref = *log_ref;
+		if (log_ref->segment) q->low_offset = message_log_record_offset(log_ref);
+		message_log_hold(log_ref);
+	}
+
+	// lowest offsets never decrease towards the tail, so only a trailing run needs lowering
+	for (outbound_queued_t* p = w->queue_tail; p && p->low_offset > q->low_offset; p = p->prev) {
+		p->low_offset = q->low_offset;
+	}
+
+	q->prev = w->queue_tail;
+	if (w->queue_tail) w->queue_tail->next = q;
+	else w->queue_head = q;
+	w->queue_tail = q;
+	w->queued++;
+	return 0;
+}
+
+const outbound_entry_t* outbound_dequeue(outbound_window_t* w, uint32_t msg_id,
+																					const struct sockaddr_in* dest,
+																					uint64_t now_ms, bool send_now) {
+	outbound_queued_t* q = w->queue_head;
+	if (!q) return NULL;
+
+	slim_msg_header_t hdr;
+	memcpy(&hdr, q->packet, sizeof(hdr));
+	hdr.msg_id = msg_id;
+	memcpy(q->packet, &hdr, sizeof(hdr));
+
+	if (outbound_track(w, msg_id, q->qos, dest, q->packet, q->packet_len, now_ms, send_now,
+										q->log_ref.segment ? &q->log_ref : NULL) != 0) {
+		return NULL;
+	}
+
+	w->queue_head = q->next;
+	if (w->queue_head) w->queue_head->prev = NULL;
+	else w->queue_tail = NULL;
+	w->queued--;
+	message_log_release(&q->log_ref);		// the window entry holds it now
+	free(q);
+	return &w->slots[msg_id % OUTBOUND_WINDOW_SIZE];
+}
+
+size_t outbound_release_held(outbound_window_t* w, int sockfd, size_t max, uint64_t now_ms) {
+	size_t sent = 0;
+
+	while (w->held.head && sent < max) {
+		outbound_entry_t* e = w->held.head;
+		list_unlink(&w->held, e);
+		e->held = false;
+
+		send_bytes(sockfd, (const struct sockaddr*)e->dest, sizeof(*e->dest),
+							e->packet, e->packet_len);
+		schedule(e, now_ms);
+		sent++;
+	}
+	return sent;
+}
+
+static outbound_entry_t* find_entry(outbound_window_t* w, uint32_t msg_id, outbound_state_t state) {
+	outbound_entry_t* e = &w->slots[msg_id % OUTBOUND_WINDOW_SIZE];
+	if (!e->in_use || e->held || e->msg_id != msg_id || e->state != state) return NULL;
+	return e;
+}
+
+void outbound_mark_lost(outbound_window_t* w, const log_ref_t* log_ref) {
+	if (!log_ref || !log_ref->segment) return;
+
+	uint64_t offset = message_log_record_offset(log_ref);
+	if (!w->lost_logged || offset < w->lost_offset) {
+		w->lost_logged = true;
+		w->lost_offset = offset;
+	}
+}
+
+void outbound_clear_lost(outbound_window_t* w) {
+	w->lost_logged = false;
+	w->lost_offset = 0;
+}
+
+static void lower_to(uint64_t* low, bool* found, const log_ref_t* log_ref) {
+	if (!log_ref->segment) return;
+
+	uint64_t offset = message_log_record_offset(log_ref);
+	if (!*found || offset < *low) *low = offset;
+	*found = true;
+}
+
+bool outbound_low_offset(const outbound_window_t* w, uint64_t* out) {
+	bool found = w->lost_logged;
+	uint64_t low = w->lost_offset;
+
+	for (size_t i = 0; i < OUTBOUND_WINDOW_SIZE; ++i) {
+		if (w->slots[i].in_use) lower_to(&low, &found, &w->slots[i].log_ref);
+	}
+	if (w->queue_head && w->queue_head->low_offset != UINT64_MAX) {
+		if (!found || w->queue_head->low_offset < low) low = w->queue_head->low_offset;
+		found = true;
+	}
+
+	if (found) *out = low;
+	return found;
+}
+
+bool outbound_slot_free(const outbound_window_t* w, uint32_t msg_id) {
+	return !w->slots[msg_id % OUTBOUND_WINDOW_SIZE].in_use;
+}
+
+bool outbound_ack(outbound_window_t* w, uint32_t msg_id, log_ref_t* retired_ref) {
+	outbound_entry_t* e = find_entry(w, msg_id, OUTBOUND_WAIT_ACK);
+	if (!e) return false;
+
+	if (retired_ref) *retired_ref = e->log_ref;
+	release_entry(w, e);
+	return true;
+}
+
+bool outbound_received(outbound_window_t* w, uint32_t msg_id,
+												const uint8_t* release, size_t len, uint64_t now_ms) {
+	if (find_entry(w, msg_id, OUTBOUND_WAIT_COMPLETE)) return true;
+
+	outbound_entry_t* e = find_entry(w, msg_id, OUTBOUND_WAIT_RECEIVED);
+	if (!e || len > e->packet_len) return false;
+
+	memcpy(e->packet, release, len);
+	e->packet_len = len;
+	e->state = OUTBOUND_WAIT_COMPLETE;
+	e->retries = 0;
+	schedule(e, now_ms);
+	return true;
+}
+
+bool outbound_complete(outbound_window_t* w, uint32_t msg_id, log_ref_t* retired_ref) {
+	outbound_entry_t* e = find_entry(w, msg_id, OUTBOUND_WAIT_COMPLETE);
+	if (!e) return false;
+
+	if (retired_ref) *retired_ref = e->log_ref;
+	release_entry(w, e);
+	return true;
+}
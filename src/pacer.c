@@ -0,0 +1,100 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../include/pacer.h"
+#include "../include/transport.h"
+
+#define TOKEN 1000000ULL								// credit of one datagram
+
+void pacer_init(pacer_t* p, uint32_t rate, uint32_t burst, uint64_t now_us) {
+	if (burst == 0) burst = PACER_DEFAULT_BURST;
+	// the broker wakes at most once per millisecond, a bucket smaller than that would lose tokens
+	if (burst < rate / 1000 + 1) burst = rate / 1000 + 1;
+
+	*p = (pacer_t){ .rate = rate, .burst = burst, .last_us = now_us };
+	p->credit = (uint64_t)burst * TOKEN;
+}
+
+static void refill(pacer_t* p, uint64_t now_us) {
+	if (now_us <= p->last_us) return;
+
+	uint64_t cap = (uint64_t)p->burst * TOKEN;
+	uint64_t earned = (now_us - p->last_us) * p->rate;
+	p->credit = p->credit + earned > cap ? cap : p->credit + earned;
+	p->last_us = now_us;
+}
+
+static bool take_token(pacer_t* p) {
+	if (p->credit < TOKEN) return false;
+	p->credit -= TOKEN;
+	return true;
+}
+
+int pacer_send(pacer_t* p, int sockfd, const struct sockaddr_in* dest,
+							const uint8_t* buffer, size_t len, uint64_t now_us) {
+	if (p->rate == 0) {
+		send_bytes(sockfd, (const struct sockaddr*)dest, sizeof(*dest), buffer, len);
+		return 0;
+	}
+
+	refill(p, now_us);
+	if (!p->head && take_token(p)) {
+		send_bytes(sockfd, (const struct sockaddr*)dest, sizeof(*dest), buffer, len);
+		return 0;
+	}
+
+	pacer_packet_t* pkt = p->queued < PACER_QUEUE_MAX ? malloc(sizeof(pacer_packet_t) + len) : NULL;
+	if (!pkt) {
+		p->dropped++;
+		return -1;
+	}
+	pkt->next = NULL;
+	pkt->dest = *dest;
+	pkt->len = len;
+	memcpy(pkt->data, buffer, len);
+
+	if (p->tail) p->tail->next = pkt;
+	else p->head = pkt;
+	p->tail = pkt;
+	p->queued++;
+	p->delayed++;
+	return 0;
+}
+
+size_t pacer_drain(pacer_t* p, int sockfd, uint64_t now_us) {
+	if (!p->head) return 0;
+
+	refill(p, now_us);
+	size_t sent = 0;
+	while (p->head && take_token(p)) {
+		pacer_packet_t* pkt = p->head;
+		p->head = pkt->next;
+		if (!p->head) p->tail = NULL;
+		p->queued--;
+
+		send_bytes(sockfd, (const struct sockaddr*)&pkt->dest, sizeof(pkt->dest), pkt->data, pkt->len);
+		free(pkt);
+		sent++;
+	}
+	return sent;
+}
+
+int pacer_next_timeout_ms(const pacer_t* p, uint64_t now_us) {
+	if (!p->head) return -1;
+
+	uint64_t credit = p->credit;
+	if (now_us > p->last_us) credit += (now_us - p->last_us) * p->rate;
+	if (credit >= TOKEN) return 0;
+
+	uint64_t wait_us = (TOKEN - credit + p->rate - 1) / p->rate;
+	return (int)((wait_us + 999) / 1000);
+}
+
+void pacer_destroy(pacer_t* p) {
+	while (p->head) {
+		pacer_packet_t* pkt = p->head;
+		p->head = pkt->next;
+		free(pkt);
+	}
+	p->tail = NULL;
+	p->queued = 0;
+}
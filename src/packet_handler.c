@@ -32,9 +32,9 @@ void dump_hex(const uint8_t* data, size_t len) {
 void dump_header(const slim_msg_header_t* hdr) {
 	if (!packet_debug_enabled || hdr == NULL) return;
 
-	printf("[HEADER] version=%u, type=%u, qos=%u, topic_id=%u, msg_id=%u\n", 
+	printf("[HEADER] version=%u, type=%u, qos=%u, topic_id=%u, msg_id=%u, session=%u\n", 
 		hdr->version, hdr->msg_type, hdr->qos_level,
-		hdr->topic_id, hdr->msg_id);
+		hdr->topic_id, hdr->msg_id, hdr->session_id);
 	printf("	 frag_id=%u/%u, batch_size=%u, payload_len=%u, client_nodes=%u\n",
 		hdr->frag_id, hdr->frag_total,
 		hdr->batch_size, hdr->payload_length, hdr->client_node_count);
@@ -104,7 +104,7 @@ int serialize_message(const slim_msg_header_t* header, const char* topic,
  * serialize_control_message - Serialize a MSG_CONTROL packet into a flat byte buffer
  *
  * @header: pointer to the base message header (msg_type will be overwritten as MSG_CONTROL
- * @ctrl_type: control type identifier(CONTROL_HEARTBEAT, CONTROL_DISCONNECT)
+ * @ctrl_type: control type identifier (see control_type_t)
  * @data: optional payload data(can be NULL)
  * @data_len: length of the optional data in bytes
  * @buffer: Output buffer to write the serialized packet
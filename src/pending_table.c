@@ -1,105 +1,232 @@
-#include <netinet/in.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include "../include/pending_table.h"
+#include "../include/hash_table.h"
 
-#define PENDING_TABLE_SIZE 1024
+// session id -> pending_client_t*
+static hash_table_t table;
 
-static pending_entry_t* table[PENDING_TABLE_SIZE];
+// clients adopted from a snapshot image live in it and are never freed
+static const uint8_t* arena_base = NULL;
+static size_t arena_len = 0;
 
-static uint32_t hash_key(const struct sockaddr_in* addr, uint32_t msg_id) {
-	return ((addr->sin_addr.s_addr ^ addr->sin_port) ^ msg_id) % PENDING_TABLE_SIZE;
+static timer_wheel_t* expiry_wheel = NULL;
+static uint32_t expiry_after_ms = 0;
+
+static uint64_t monotonic_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-void pending_table_init(void) {
-	memset(table, 0, sizeof(table));
+static void release(pending_client_t* c) {
+	if (expiry_wheel) timer_wheel_cancel(expiry_wheel, &c->expiry);
+	if (arena_base && (const uint8_t*)c >= arena_base && (const uint8_t*)c < arena_base + arena_len) return;
+	free(c);
 }
 
-void pending_table_destroy() {
-	for (int i = 0; i < PENDING_TABLE_SIZE; ++i) {
-		pending_entry_t* cur = table[i];
-		while (cur) {
-			pending_entry_t* next = cur->next;
-			free(cur);
-			cur = next;
-		}
-		table[i] = NULL;
+static void expire_client(timer_node_t* t) {
+	pending_client_t* c = (pending_client_t*)((uint8_t*)t - offsetof(pending_client_t, expiry));
+	hash_table_remove(&table, c->session, NULL);
+	release(c);
+}
+
+static void touch(pending_client_t* c) {
+	c->timestamp = time(NULL);
+	if (expiry_wheel) {
+		timer_wheel_add(expiry_wheel, &c->expiry, monotonic_ms() + expiry_after_ms, expire_client);
 	}
 }
 
-void pending_table_update(const struct sockaddr_in *addr, uint32_t msg_id, qos2_state_t state) {
-	uint32_t idx = hash_key(addr, msg_id);
-	pending_entry_t* cur = table[idx];
-	time_t now = time(NULL);
+static pending_client_t* find_client(uint32_t session) {
+	uint64_t* value = hash_table_find(&table, session);
+	return value ? (pending_client_t*)(uintptr_t)*value : NULL;
+}
 
-	while(cur) {
-		if (cur->msg_id == msg_id && memcmp(&cur->addr, addr, sizeof(struct sockaddr_in)) == 0) {
-			cur->state = state;
-			cur->timestamp = now;
-			return;
-		}
-		cur = cur->next;
-	}
+static uint8_t slot_get(const pending_client_t* c, uint32_t msg_id) {
+	uint32_t idx = msg_id % PENDING_WINDOW_SIZE;
+	return (c->states[idx / 2] >> ((idx & 1) * 4)) & 0x0f;
+}
 
-	pending_entry_t* new_entry = calloc(1, sizeof(pending_entry_t));
-	new_entry->addr = *addr;
-	new_entry->msg_id = msg_id;
-	new_entry->state = state;
-	new_entry->timestamp = now;
-	new_entry->next = table[idx];
-	table[idx] = new_entry;
+static void slot_set(pending_client_t* c, uint32_t msg_id, uint8_t value) {
+	uint32_t idx = msg_id % PENDING_WINDOW_SIZE;
+	uint8_t shift = (idx & 1) * 4;
+	c->states[idx / 2] = (c->states[idx / 2] & ~(0x0f << shift)) | (value << shift);
 }
 
-bool pending_table_get(const struct sockaddr_in *addr, uint32_t msg_id, qos2_state_t *out_state) {
-	uint32_t idx = hash_key(addr, msg_id);
-	pending_entry_t* cur = table[idx];
+/**
+ * slide_window - move the window forward so it ends at @msg_id
+ */
+static void slide_window(pending_client_t* c, uint32_t msg_id) {
+	uint32_t shift = msg_id - (c->base + PENDING_WINDOW_SIZE - 1);
 
-	while (cur) {
-		if (cur->msg_id == msg_id && memcmp(&cur->addr, addr, sizeof(struct sockaddr_in)) == 0) {
-			if (out_state) *out_state = cur->state;
-			return true;
-		}
-		cur = cur->next;
+	if (shift >= PENDING_WINDOW_SIZE) {
+		memset(c->states, 0, sizeof(c->states));
+	} else {
+		for (uint32_t i = 0; i < shift; ++i) slot_set(c, c->base + i, 0);
 	}
-	return false;
+	c->base += shift;
 }
 
-void pending_table_remove(const struct sockaddr_in *addr, uint32_t msg_id) {
-	uint32_t idx = hash_key(addr, msg_id);
-	pending_entry_t* cur = table[idx];
-	pending_entry_t* prev = NULL;
+/**
+ * restart_window - center an empty window on @msg_id
+ *
+ * Half of the window is left for msg_ids that arrive out of order.
+ */
+static void restart_window(pending_client_t* c, uint32_t msg_id) {
+	memset(c->states, 0, sizeof(c->states));
+	c->base = msg_id - PENDING_WINDOW_SIZE / 2;
+}
+
+/**
+ * far_behind - check whether @msg_id is too far behind the window to be a late retransmit
+ */
+static bool far_behind(const pending_client_t* c, uint32_t msg_id) {
+	return (int32_t)(msg_id - c->base) < -PENDING_WINDOW_SIZE;
+}
 
-	while (cur) {
-		if (cur->msg_id == msg_id && memcmp(&cur->addr, addr, sizeof(struct sockaddr_in)) == 0) {
-			if (prev) prev->next = cur->next;
-			else table[idx] = cur->next;
-			free(cur);
+void pending_table_init(void) {
+	hash_table_init(&table, PENDING_CLIENT_TABLE_INITIAL_CAPACITY);
+}
+
+void pending_table_set_expiry(timer_wheel_t* wheel, uint32_t expiry_ms) {
+	expiry_wheel = wheel;
+	expiry_after_ms = expiry_ms;
+}
+
+static void release_entry(uint64_t key, uint64_t* value, void* ctx) {
+	(void)key; (void)ctx;
+	release((pending_client_t*)(uintptr_t)*value);
+}
+
+void pending_table_destroy() {
+	hash_table_foreach(&table, release_entry, NULL);
+	hash_table_destroy(&table);
+	arena_base = NULL;
+	arena_len = 0;
+}
+
+void pending_table_update(uint32_t session, uint32_t msg_id, qos2_state_t state) {
+	pending_client_t* c = find_client(session);
+
+	if (!c) {
+		c = calloc(1, sizeof(pending_client_t));
+		if (!c) return;
+
+		c->session = session;
+		restart_window(c, msg_id);
+		if (hash_table_put(&table, session, (uintptr_t)c) < 0) {
+			free(c);
 			return;
 		}
-		prev = cur;
-		cur = cur->next;
 	}
+
+	if (far_behind(c, msg_id)) restart_window(c, msg_id);
+
+	int32_t offset = (int32_t)(msg_id - c->base);
+	if (offset < 0) return;		// behind the window, already counted as completed
+	if (offset >= PENDING_WINDOW_SIZE) slide_window(c, msg_id);
+
+	slot_set(c, msg_id, (uint8_t)state + 1);
+	touch(c);
+}
+
+bool pending_table_get(uint32_t session, uint32_t msg_id, qos2_state_t *out_state) {
+	pending_client_t* c = find_client(session);
+	if (!c || far_behind(c, msg_id)) return false;
+
+	int32_t offset = (int32_t)(msg_id - c->base);
+	if (offset >= PENDING_WINDOW_SIZE) return false;
+
+	uint8_t value = offset < 0 ? QOS2_STATE_COMPLETED + 1 : slot_get(c, msg_id);
+	if (value == 0) return false;
+
+	if (out_state) *out_state = (qos2_state_t)(value - 1);
+	return true;
+}
+
+void pending_table_remove(uint32_t session, uint32_t msg_id) {
+	pending_client_t* c = find_client(session);
+	if (!c) return;
+
+	uint32_t offset = msg_id - c->base;
+	if (offset < PENDING_WINDOW_SIZE) slot_set(c, msg_id, 0);
+}
+
+void pending_table_forget(uint32_t session) {
+	pending_client_t* c = find_client(session);
+	if (!c) return;
+
+	hash_table_remove(&table, session, NULL);
+	release(c);
+}
+
+typedef struct {
+	time_t now;
+	time_t expiration_sec;
+} expiry_ctx_t;
+
+static bool release_if_expired(uint64_t key, uint64_t value, void* ctx) {
+	(void)key;
+	expiry_ctx_t* e = ctx;
+	pending_client_t* c = (pending_client_t*)(uintptr_t)value;
+
+	if (e->now - c->timestamp <= e->expiration_sec) return false;
+	release(c);
+	return true;
 }
 
 void pending_table_cleanup_expired(time_t expiration_sec) {
-	time_t now = time(NULL);
-	for (int i = 0; i < PENDING_TABLE_SIZE; ++i) {
-		pending_entry_t* cur = table[i];
-		pending_entry_t* prev = NULL;
-
-		while (cur) {
-			if (now - cur->timestamp > expiration_sec) {
-				pending_entry_t* to_delete = cur;
-				if (prev) prev->next = cur->next;
-				else table[i] = cur->next;
-				cur = cur->next;
-				free(to_delete);
-			} else {
-				prev = cur;
-				cur = cur->next;
-			}
+	expiry_ctx_t ctx = { .now = time(NULL), .expiration_sec = expiration_sec };
+	hash_table_remove_if(&table, release_if_expired, &ctx);
+}
+
+typedef struct {
+	pending_client_t* out;
+	uint64_t count;
+} snapshot_ctx_t;
+
+static void copy_client(uint64_t key, uint64_t* value, void* ctx) {
+	(void)key;
+	snapshot_ctx_t* s = ctx;
+
+	if (s->out) {
+		s->out[s->count] = *(pending_client_t*)(uintptr_t)*value;
+		memset(&s->out[s->count].expiry, 0, sizeof(s->out[s->count].expiry));
+	}
+	s->count++;
+}
+
+size_t pending_table_snapshot_write(uint8_t* image) {
+	snapshot_ctx_t ctx = { .out = image ? (pending_client_t*)(image + sizeof(uint64_t)) : NULL };
+
+	hash_table_foreach(&table, copy_client, &ctx);
+
+	if (image) memcpy(image, &ctx.count, sizeof(ctx.count));
+	return sizeof(ctx.count) + sizeof(pending_client_t) * ctx.count;
+}
+
+int pending_table_snapshot_adopt(uint8_t* image, size_t len) {
+	uint64_t count;
+	if (len < sizeof(count)) return -1;
+	memcpy(&count, image, sizeof(count));
+	if (count > (len - sizeof(count)) / sizeof(pending_client_t)) return -1;
+
+	pending_table_destroy();
+	hash_table_init(&table, count);
+	arena_base = image;
+	arena_len = len;
+
+	pending_client_t* clients = (pending_client_t*)(image + sizeof(count));
+	for (uint64_t i = 0; i < count; ++i) {
+		memset(&clients[i].expiry, 0, sizeof(clients[i].expiry));
+		if (hash_table_put(&table, clients[i].session, (uintptr_t)&clients[i]) < 0) {
+			pending_table_destroy();
+			return -1;
 		}
+		touch(&clients[i]);
 	}
+	return 0;
 }
@@ -1,99 +1,114 @@
-#include <stdlib.h>
-#include <string.h>
+#include <errno.h>
 #include <time.h>
 #include "../include/qos2_table.h"
 
-static qos2_entry_t* table[QOS2_TABLE_SIZE];
+static qos2_client_state_t lookup(qos2_table_t* t, uint32_t msg_id) {
+	uint64_t* value = hash_table_find(&t->entries, msg_id);
+	return value ? (qos2_client_state_t)*value : QOS2_CLIENT_STATE_NONE;
+}
+
+void qos2_table_init(qos2_table_t* t) {
+	hash_table_init(&t->entries, QOS2_TABLE_INITIAL_CAPACITY);
+	pthread_mutex_init(&t->lock, NULL);
 
-static uint32_t hash_msg_id(uint32_t msg_id) {
-	return msg_id % QOS2_TABLE_SIZE;
+	// monotonic clock so waits are not affected by wall clock jumps
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&t->changed, &attr);
+	pthread_condattr_destroy(&attr);
 }
 
-void qos2_table_init(void) {
-	memset(table, 0, sizeof(table));
+void qos2_table_destroy(qos2_table_t* t) {
+	hash_table_destroy(&t->entries);
+	pthread_cond_destroy(&t->changed);
+	pthread_mutex_destroy(&t->lock);
 }
 
-void qos2_table_destroy(void) {
-	for (int i = 0; i < QOS2_TABLE_SIZE; ++i) {
-		qos2_entry_t* cur = table[i];
-		while(cur) {
-			qos2_entry_t* next = cur->next;
-			free(cur);
-			cur = next;
-		}
-		table[i] = NULL;
+int qos2_table_begin(qos2_table_t* t, uint32_t msg_id) {
+	pthread_mutex_lock(&t->lock);
+	int rc = hash_table_put(&t->entries, msg_id, QOS2_CLIENT_STATE_WAIT_RECEIVED) < 0 ? -1 : 0;
+	pthread_mutex_unlock(&t->lock);
+	return rc;
+}
+
+bool qos2_table_set(qos2_table_t* t, uint32_t msg_id, qos2_client_state_t state) {
+	pthread_mutex_lock(&t->lock);
+	uint64_t* value = hash_table_find(&t->entries, msg_id);
+	if (value) {
+		*value = state;
+		pthread_cond_broadcast(&t->changed);
 	}
+	pthread_mutex_unlock(&t->lock);
+	return value != NULL;
 }
 
-void qos2_table_set(uint32_t msg_id, qos2_client_state_t state) {
-	uint32_t idx = hash_msg_id(msg_id);
-	qos2_entry_t* cur = table[idx];
-	time_t now = time(NULL);
+qos2_client_state_t qos2_table_get_state(qos2_table_t* t, uint32_t msg_id) {
+	pthread_mutex_lock(&t->lock);
+	qos2_client_state_t state = lookup(t, msg_id);
+	pthread_mutex_unlock(&t->lock);
+	return state;
+}
+
+bool qos2_table_wait_state(qos2_table_t* t, uint32_t msg_id, qos2_client_state_t state, int timeout_ms) {
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
 
-	while (cur) {
-		if (cur->msg_id == msg_id) {
-			cur->state = state;
-			cur->timestamp = now;
-			return;
+	pthread_mutex_lock(&t->lock);
+	bool reached;
+	while (!(reached = (lookup(t, msg_id) == state))) {
+		if (pthread_cond_timedwait(&t->changed, &t->lock, &deadline) == ETIMEDOUT) {
+			reached = (lookup(t, msg_id) == state);
+			break;
 		}
-		cur = cur->next;
 	}
+	pthread_mutex_unlock(&t->lock);
+	return reached;
+}
 
-	qos2_entry_t* new_entry = calloc(1, sizeof(qos2_entry_t));
-	new_entry->msg_id = msg_id;
-	new_entry->state = state;
-	new_entry->timestamp = now;
-	new_entry->next = table[idx];
-	table[idx] = new_entry;
+void qos2_table_remove(qos2_table_t* t, uint32_t msg_id) {
+	pthread_mutex_lock(&t->lock);
+	hash_table_remove(&t->entries, msg_id, NULL);
+	pthread_mutex_unlock(&t->lock);
 }
 
-qos2_client_state_t qos2_table_get_state(uint32_t msg_id) {
-	uint32_t idx = hash_msg_id(msg_id);
-	qos2_entry_t* cur = table[idx];
+void qos2_dedup_init(qos2_dedup_window_t* w) {
+	w->base = 1;
+	w->seen = 0;
+}
 
-	while(cur) {
-		if (cur->msg_id == msg_id) {
-			return cur->state;
-		}
-		cur = cur->next;
-	}
-	return QOS2_CLIENT_STATE_NONE;
+bool qos2_dedup_is_duplicate(const qos2_dedup_window_t* w, uint32_t msg_id) {
+	int32_t offset = (int32_t)(msg_id - w->base);
+
+	if (w->seen == 0 || offset < -QOS2_DEDUP_WINDOW) return false;
+	if (offset < 0) return true;
+	if (offset >= QOS2_DEDUP_WINDOW) return false;
+	return (w->seen >> offset) & 1;
 }
 
-void qos2_table_remove(uint32_t msg_id) {
-	uint32_t idx = hash_msg_id(msg_id);
-	qos2_entry_t* cur = table[idx];
-	qos2_entry_t* prev = NULL;
-
-	while(cur) {
-		if (cur->msg_id == msg_id) {
-			if (prev) prev->next = cur->next;
-			else table[idx] = cur->next;
-			free(cur);
-			return;
-		}
-		prev = cur;
-		cur = cur->next;
+void qos2_dedup_mark(qos2_dedup_window_t* w, uint32_t msg_id) {
+	int32_t offset = (int32_t)(msg_id - w->base);
+	if (w->seen == 0 || offset < -QOS2_DEDUP_WINDOW) {
+		// first delivery, or numbering restarted; ids just below @msg_id may still be on their way
+		w->base = msg_id - (QOS2_DEDUP_WINDOW - 1);
+		w->seen = 0;
+		offset = QOS2_DEDUP_WINDOW - 1;
+	} else if (offset < 0) {
+		return;
 	}
-}
 
-void qos2_table_cleanup_expired(time_t expiration_sec) {
-	time_t now = time(NULL);
-	for (int i = 0; i < QOS2_TABLE_SIZE; ++i) {
-		qos2_entry_t* cur = table[i];
-		qos2_entry_t* prev = NULL;
-
-		while (cur) {
-			if (now - cur->timestamp > expiration_sec) {
-				qos2_entry_t* to_delete = cur;
-				if (prev) prev->next = cur->next;
-				else table[i] = cur->next;
-				cur = cur->next;
-				free(to_delete);
-			} else {
-				prev = cur;
-				cur = cur->next;
-			}
-		}
+	if (offset >= QOS2_DEDUP_WINDOW) {
+		uint32_t shift = (uint32_t)offset - (QOS2_DEDUP_WINDOW - 1);
+		w->seen = (shift >= QOS2_DEDUP_WINDOW) ? 0 : (w->seen >> shift);
+		w->base += shift;
+		offset = QOS2_DEDUP_WINDOW - 1;
 	}
+
+	w->seen |= (uint64_t)1 << offset;
 }
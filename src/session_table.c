@@ -0,0 +1,293 @@
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/random.h>
+#include "../include/session_table.h"
+#include "../include/hash_table.h"
+
+// id -> session, slot 0 is never used
+static broker_session_t** sessions = NULL;
+// id -> generation it was last handed out under, kept while the id is free
+static uint8_t* generations = NULL;
+static uint32_t capacity = 0;
+static uint32_t next_id = 1;
+static size_t live = 0;
+
+// ids of expired sessions, handed out again before next_id grows
+static uint32_t* free_ids = NULL;
+static size_t free_count = 0;
+static size_t free_capacity = 0;
+
+// address key -> id of sessions identified by address
+static hash_table_t by_addr;
+
+static uint64_t addr_key(const struct sockaddr_in* addr) {
+	return ((uint64_t)addr->sin_addr.s_addr << 16) | addr->sin_port;
+}
+
+/**
+ * random_u32 - unpredictable 32-bit value from the kernel, or the clock if it has none
+ */
+static uint32_t random_u32(void) {
+	uint32_t value;
+	if (getrandom(&value, sizeof(value), 0) != sizeof(value)) {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		value = (uint32_t)(ts.tv_nsec ^ ts.tv_sec) * 2654435761u;
+	}
+	return value;
+}
+
+/**
+ * reserve - grow the session array so it can hold @id
+ */
+static int reserve(uint32_t id) {
+	if (id < capacity) return 0;
+
+	uint32_t grown = capacity ? capacity : SESSION_TABLE_INITIAL_CAPACITY;
+	while (grown <= id) grown *= 2;
+
+	broker_session_t** resized = realloc(sessions, sizeof(broker_session_t*) * grown);
+	if (!resized) return -1;
+	sessions = resized;
+
+	uint8_t* resized_gen = realloc(generations, grown);
+	if (!resized_gen) return -1;
+	generations = resized_gen;
+
+	memset(sessions + capacity, 0, sizeof(broker_session_t*) * (grown - capacity));
+	// ids start at a random generation so wire ids of an earlier run do not match
+	for (uint32_t id = capacity; id < grown; ++id) generations[id] = (uint8_t)random_u32();
+	capacity = grown;
+	return 0;
+}
+
+/**
+ * create_at - allocate a session with a given id
+ */
+static broker_session_t* create_at(uint32_t id, const struct sockaddr_in* addr, bool connected) {
+	if (id == 0 || id >= SESSION_ID_MAX || reserve(id) != 0 || sessions[id]) return NULL;
+
+	broker_session_t* s = calloc(1, sizeof(broker_session_t));
+	if (!s) return NULL;
+
+	s->id = id;
+	s->connected = connected;
+	s->generation = ++generations[id];
+	s->addr = *addr;
+	// a client that outlived an earlier session with this id must not take
+	// the new deliveries for ones it already accepted
+	s->next_msg_id = random_u32() | 1;
+	if (connected) s->token = ((uint64_t)random_u32() << 32) | random_u32();
+
+	if (!connected && hash_table_put(&by_addr, addr_key(addr), id) < 0) {
+		free(s);
+		return NULL;
+	}
+
+	sessions[id] = s;
+	live++;
+	if (id >= next_id) next_id = id + 1;
+	return s;
+}
+
+/**
+ * create_new - allocate a session under a recycled or fresh id
+ */
+static broker_session_t* create_new(const struct sockaddr_in* addr, bool connected) {
+	if (free_count == 0) return create_at(next_id, addr, connected);
+
+	broker_session_t* s = create_at(free_ids[free_count - 1], addr, connected);
+	if (s) free_count--;
+	return s;
+}
+
+/**
+ * release_id - remember an expired id for reuse
+ */
+static void release_id(uint32_t id) {
+	if (free_count == free_capacity) {
+		size_t grown = free_capacity ? free_capacity * 2 : 64;
+		uint32_t* resized = realloc(free_ids, sizeof(uint32_t) * grown);
+		if (!resized) return; // the id is simply not reused
+		free_ids = resized;
+		free_capacity = grown;
+	}
+	free_ids[free_count++] = id;
+}
+
+void session_table_init(void) {
+	sessions = NULL;
+	generations = NULL;
+	capacity = 0;
+	next_id = 1;
+	live = 0;
+	free_ids = NULL;
+	free_count = 0;
+	free_capacity = 0;
+	hash_table_init(&by_addr, 0);
+}
+
+void session_table_destroy(void) {
+	for (uint32_t id = 1; id < capacity; ++id) {
+		if (!sessions[id]) continue;
+		outbound_window_clear(&sessions[id]->outbound);
+		free(sessions[id]);
+	}
+	free(sessions);
+	sessions = NULL;
+	free(generations);
+	generations = NULL;
+	capacity = 0;
+	next_id = 1;
+	live = 0;
+	free(free_ids);
+	free_ids = NULL;
+	free_count = 0;
+	free_capacity = 0;
+	hash_table_destroy(&by_addr);
+}
+
+broker_session_t* session_get(uint32_t id) {
+	return id < capacity ? sessions[id] : NULL;
+}
+
+broker_session_t* session_get_wire(uint32_t wire_id) {
+	broker_session_t* s = session_get(wire_id & (SESSION_ID_MAX - 1));
+	if (!s || !s->connected || session_wire_id(s) != wire_id) return NULL;
+	return s;
+}
+
+broker_session_t* session_find(const struct sockaddr_in* addr) {
+	uint64_t* id = hash_table_find(&by_addr, addr_key(addr));
+	return id ? sessions[*id] : NULL;
+}
+
+broker_session_t* session_get_or_create(const struct sockaddr_in* addr) {
+	broker_session_t* s = session_find(addr);
+	if (s) return s;
+
+	return create_new(addr, false);
+}
+
+broker_session_t* session_connect(const struct sockaddr_in* addr) {
+	return create_new(addr, true);
+}
+
+broker_session_t* session_resume(uint32_t wire_id, const void* token, size_t len) {
+	broker_session_t* s = session_get_wire(wire_id);
+	if (!s || len != sizeof(s->token)) return NULL;
+
+	uint64_t proof;
+	memcpy(&proof, token, sizeof(proof));
+	return proof == s->token ? s : NULL;
+}
+
+void session_rebind(broker_session_t* session, const struct sockaddr_in* addr) {
+	session->addr.sin_addr = addr->sin_addr;
+	session->addr.sin_port = addr->sin_port;
+}
+
+uint32_t session_wire_id(const broker_session_t* session) {
+	if (!session->connected) return 0;
+	return ((uint32_t)session->generation << SESSION_GENERATION_SHIFT) | session->id;
+}
+
+size_t session_table_expire(uint64_t now_ms, uint64_t timeout_ms, session_expire_cb cb, void* ctx) {
+	broker_session_t** expired = NULL;
+	size_t count = 0, cap = 0;
+
+	for (uint32_t id = 1; id < capacity; ++id) {
+		broker_session_t* s = sessions[id];
+		if (!s) continue;
+
+		if (s->last_seen_ms == 0) {
+			s->last_seen_ms = now_ms;
+			continue;
+		}
+		if (now_ms - s->last_seen_ms <= timeout_ms) continue;
+
+		if (count == cap) {
+			size_t grown = cap ? cap * 2 : 16;
+			broker_session_t** resized = realloc(expired, sizeof(broker_session_t*) * grown);
+			if (!resized) break; // expire the rest on the next sweep
+			expired = resized;
+			cap = grown;
+		}
+		s->expiring = true;
+		expired[count++] = s;
+	}
+
+	if (count > 0 && cb) cb(expired, count, ctx);
+
+	for (size_t i = 0; i < count; ++i) {
+		broker_session_t* s = expired[i];
+		if (!s->connected) hash_table_remove(&by_addr, addr_key(&s->addr), NULL);
+
+		outbound_window_clear(&s->outbound);
+		sessions[s->id] = NULL;
+		live--;
+		release_id(s->id);
+		free(s);
+	}
+
+	free(expired);
+	return count;
+}
+
+size_t session_table_count(void) {
+	return live;
+}
+
+size_t session_table_snapshot_write(uint8_t* image) {
+	uint64_t count = 0;
+	session_record_t* out = image ? (session_record_t*)(image + sizeof(count)) : NULL;
+
+	for (uint32_t id = 1; id < capacity; ++id) {
+		broker_session_t* s = sessions[id];
+		if (!s) continue;
+
+		if (out) {
+			session_record_t rec;
+			memset(&rec, 0, sizeof(rec));		// no stray bytes in the padding
+			rec.id = s->id;
+			rec.connected = s->connected;
+			rec.generation = s->generation;
+			rec.token = s->token;
+			rec.addr = s->addr;
+			memcpy(&out[count], &rec, sizeof(rec));
+		}
+		count++;
+	}
+
+	if (image) memcpy(image, &count, sizeof(count));
+	return sizeof(count) + sizeof(session_record_t) * count;
+}
+
+int session_table_snapshot_adopt(const uint8_t* image, size_t len) {
+	uint64_t count;
+	if (len < sizeof(count)) return -1;
+	memcpy(&count, image, sizeof(count));
+	if (count > (len - sizeof(count)) / sizeof(session_record_t)) return -1;
+
+	session_table_destroy();
+	session_table_init();
+
+	const session_record_t* records = (const session_record_t*)(image + sizeof(count));
+	for (uint64_t i = 0; i < count; ++i) {
+		session_record_t rec;
+		memcpy(&rec, &records[i], sizeof(rec));
+
+		broker_session_t* s = create_at(rec.id, &rec.addr, rec.connected != 0);
+		if (!s) {
+			session_table_destroy();
+			session_table_init();
+			return -1;
+		}
+		s->generation = generations[rec.id] = (uint8_t)rec.generation;
+		s->token = rec.token;
+	}
+	return 0;
+}
@@ -1,9 +1,13 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
 
 #include "../include/slimmq_client.h"
 #include "../include/transport.h"
@@ -14,55 +18,917 @@
 
 #define MAX_PACKET_SIZE 2048
 
-static void* listener_loop(void* arg) {
-	slimmq_client_t* client = (slimmq_client_t*)arg;
+/**
+ * slimmq_session_sub - topic filter a session subscribed to, kept to subscribe again on reconnect
+ */
+struct slimmq_session_sub {
+	struct slimmq_session_sub* next;
+	uint8_t qos;
+	char topic[];
+};
+
+/**
+ * send_control - send a data-less control message (QoS 2 handshake step, CONNECT or heartbeat)
+ */
+static void send_control(slimmq_client_t* client, const struct sockaddr_in* to,
+													control_type_t ctrl_type, uint32_t msg_id, uint32_t session_id) {
+	slim_msg_header_t ctrl_hdr = {
+		.version = 1,
+		.msg_type = MSG_CONTROL,
+		.qos_level = QOS_EXACTLY_ONCE,
+		.msg_id = msg_id,
+		.topic_id = 0,
+		.frag_id = 0,
+		.frag_total = 1,
+		.batch_size = 1,
+		.payload_length = 1,
+		.client_node_count = 1,
+		.session_id = session_id
+	};
+
+	uint8_t buffer[64];
+	int len = serialize_control_message(&ctrl_hdr, ctrl_type, NULL, 0, buffer, sizeof(buffer));
+	if (len > 0) {
+		send_bytes(client->sockfd, (const struct sockaddr*)to, sizeof(*to), buffer, len);
+	}
+}
+
+/**
+ * send_connect - ask the broker to resume a session, proving it with the session's token
+ */
+static void send_connect(slimmq_client_t* client, uint32_t msg_id, uint32_t session_id,
+													const uint8_t* token) {
+	slim_msg_header_t ctrl_hdr = {
+		.version = 1,
+		.msg_type = MSG_CONTROL,
+		.qos_level = QOS_EXACTLY_ONCE,
+		.msg_id = msg_id,
+		.topic_id = 0,
+		.frag_id = 0,
+		.frag_total = 1,
+		.batch_size = 1,
+		.payload_length = 1 + SESSION_TOKEN_SIZE,
+		.client_node_count = 1,
+		.session_id = session_id
+	};
+
+	uint8_t buffer[64];
+	int len = serialize_control_message(&ctrl_hdr, CONTROL_CONNECT, token, SESSION_TOKEN_SIZE,
+																			buffer, sizeof(buffer));
+	if (len > 0) {
+		send_bytes(client->sockfd, (const struct sockaddr*)&client->broker_addr,
+								sizeof(client->broker_addr), buffer, len);
+	}
+}
+
+/**
+ * send_ack - acknowledge a QoS 1 delivery back to its sender
+ */
+static void send_ack(slimmq_client_t* client, const struct sockaddr_in* to, uint32_t msg_id,
+											uint32_t session_id) {
+	slim_msg_header_t ack_header = {
+		.version = 1,
+		.msg_type = MSG_ACK,
+		.qos_level = QOS_AT_LEAST_ONCE,
+		.msg_id = msg_id,
+		.topic_id = 0,
+		.frag_id = 0,
+		.frag_total = 1,
+		.batch_size = 1,
+		.payload_length = 0,
+		.client_node_count = 1,
+		.session_id = session_id
+	};
+
+	send_bytes(client->sockfd, (const struct sockaddr*)to, sizeof(*to),
+							(const uint8_t*)&ack_header, sizeof(ack_header));
+}
+
+static uint64_t now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * alloc_msg_id - hand out the next msg_id, safe for concurrent publishers
+ *
+ * 0 is skipped on wrap-around since it marks a free in-flight slot.
+ */
+static uint32_t alloc_msg_id(slimmq_client_t* client) {
+	uint32_t id;
+	do {
+		id = atomic_fetch_add(&client->next_msg_id, 1);
+	} while (id == 0);
+	return id;
+}
+
+/**
+ * advertise_credit - tell the broker how many deliveries the event queue can take
+ */
+static void advertise_credit(slimmq_client_t* client) {
+	uint32_t credits = (uint32_t)event_queue_free_slots(&client->event_queue);
+
+	slim_msg_header_t ctrl_hdr = {
+		.version = 1,
+		.msg_type = MSG_CONTROL,
+		.qos_level = QOS_AT_MOST_ONCE,
+		.msg_id = 0,
+		.topic_id = 0,
+		.frag_id = 0,
+		.frag_total = 1,
+		.batch_size = 1,
+		.payload_length = 1 + sizeof(credits),
+		.client_node_count = 1
+	};
+
+	uint8_t buffer[64];
+	int len = serialize_control_message(&ctrl_hdr, CONTROL_CREDIT, &credits, sizeof(credits),
+																			buffer, sizeof(buffer));
+	if (len > 0) {
+		send_bytes(client->sockfd, (struct sockaddr*)&client->broker_addr,
+								sizeof(client->broker_addr), buffer, len);
+	}
+	client->last_credit_ms = now_ms();
+}
+
+/**
+ * send_option - switch a session option (CONTROL_SEQUENCED, CONTROL_SACK) on or off
+ */
+static void send_option(slimmq_client_t* client, uint32_t session_id, control_type_t type, bool enable) {
+	uint8_t flag = enable ? 1 : 0;
+
+	slim_msg_header_t ctrl_hdr = {
+		.version = 1,
+		.msg_type = MSG_CONTROL,
+		.qos_level = QOS_AT_MOST_ONCE,
+		.msg_id = 0,
+		.topic_id = 0,
+		.frag_id = 0,
+		.frag_total = 1,
+		.batch_size = 1,
+		.payload_length = 1 + sizeof(flag),
+		.client_node_count = 1,
+		.session_id = session_id
+	};
+
+	uint8_t buffer[64];
+	int len = serialize_control_message(&ctrl_hdr, type, &flag, sizeof(flag), buffer, sizeof(buffer));
+	if (len > 0) {
+		send_bytes(client->sockfd, (struct sockaddr*)&client->broker_addr,
+								sizeof(client->broker_addr), buffer, len);
+	}
+}
+
+/**
+ * send_liveness - keep a session alive, renewing the options it asked for if any
+ */
+static void send_liveness(slimmq_client_t* client, uint32_t session_id) {
+	if (client->sequenced) send_option(client, session_id, CONTROL_SEQUENCED, true);
+	if (client->coalesced_acks) send_option(client, session_id, CONTROL_SACK, true);
+	if (!client->sequenced && !client->coalesced_acks) {
+		send_control(client, &client->broker_addr, CONTROL_HEARTBEAT, 0, session_id);
+	}
+}
+
+static void collect_session_id(uint64_t id, uint64_t* value, void* ctx) {
+	(void)value;
+	uint32_t** out = ctx;
+	*(*out)++ = (uint32_t)id;
+}
+
+/**
+ * for_each_session_id - call @fn for the client (session id 0) and every connected session
+ *
+ * Ids are copied out first so no lock is held across sends, which are
+ * cancellation points of the listener thread.
+ */
+static void for_each_session_id(slimmq_client_t* client,
+																void (*fn)(slimmq_client_t* client, uint32_t session_id)) {
+	pthread_mutex_lock(&client->session_lock);
+	size_t count = hash_table_count(&client->sessions);
+	uint32_t* ids = count ? malloc(sizeof(uint32_t) * count) : NULL;
+	if (ids) {
+		uint32_t* cursor = ids;
+		hash_table_foreach(&client->sessions, collect_session_id, &cursor);
+	} else {
+		count = 0;
+	}
+	pthread_mutex_unlock(&client->session_lock);
+
+	fn(client, 0);
+	for (size_t i = 0; i < count; ++i) fn(client, ids[i]);
+	free(ids);
+}
+
+/**
+ * send_keepalives - send a heartbeat for the client and every connected session
+ */
+static void send_keepalives(slimmq_client_t* client) {
+	client->last_keepalive_ms = now_ms();
+	for_each_session_id(client, send_liveness);
+}
+
+/**
+ * listener_timeout_ms - how long the listener may wait for traffic before its periodic duties
+ *
+ * Return: poll() timeout in milliseconds, -1 to wait for traffic only
+ */
+static int listener_timeout_ms(const slimmq_client_t* client) {
+	int interval_ms = client->credit_interval_ms;
+	if (client->keepalive_interval_ms > 0 &&
+			(interval_ms == 0 || client->keepalive_interval_ms < interval_ms)) {
+		interval_ms = client->keepalive_interval_ms;
+	}
+	if (client->seq_gaps > 0 && (interval_ms == 0 || SLIMMQ_NACK_INTERVAL_MS < interval_ms)) {
+		interval_ms = SLIMMQ_NACK_INTERVAL_MS;
+	}
+	return interval_ms > 0 ? interval_ms : -1;
+}
+
+/**
+ * local_interface - address of the local interface the broker is reached through
+ *
+ * Multicast groups are joined on it, so a broker on 127.0.0.1 is joined over
+ * loopback.
+ */
+static struct in_addr local_interface(const slimmq_client_t* client) {
+	struct sockaddr_in local = { .sin_addr.s_addr = htonl(INADDR_ANY) };
+	socklen_t len = sizeof(local);
+
+	int probe = socket(AF_INET, SOCK_DGRAM, 0);
+	if (probe >= 0) {
+		if (connect(probe, (const struct sockaddr*)&client->broker_addr, sizeof(client->broker_addr)) < 0 ||
+				getsockname(probe, (struct sockaddr*)&local, &len) < 0) {
+			local.sin_addr.s_addr = htonl(INADDR_ANY);
+		}
+		close(probe);
+	}
+	return local.sin_addr;
+}
+
+/**
+ * join_offered_group - join a multicast group offered by the broker and confirm it
+ *
+ * The broker keeps unicasting the group's topics until it receives the
+ * confirmation, so a client that cannot join (no multicast route, too many
+ * groups) simply stays on unicast. Sessions multiplexed over the socket keep
+ * unicast as well, since a multicast datagram cannot name its session.
+ */
+static void join_offered_group(slimmq_client_t* client, const slim_msg_header_t* header,
+																const char* data, size_t len) {
+	if (header->session_id != 0 || len < MULTICAST_SPEC_SIZE) return;
+
+	struct sockaddr_in group = { .sin_family = AF_INET };
+	memcpy(&group.sin_addr.s_addr, data, 4);
+	memcpy(&group.sin_port, data + 4, 2);
+
+	bool joined = false;
+	for (size_t i = 0; i < client->multicast_count; ++i) {
+		if (client->multicast_groups[i].sin_addr.s_addr == group.sin_addr.s_addr &&
+				client->multicast_groups[i].sin_port == group.sin_port) {
+			joined = true;		// offered again after another SUBSCRIBE, confirm again
+		}
+	}
+
+	if (!joined) {
+		if (client->multicast_count == SLIMMQ_MULTICAST_MAX) return;
+
+		int fd = join_multicast(&group, local_interface(client));
+		if (fd < 0) return;
+
+		client->multicast_fds[client->multicast_count] = fd;
+		client->multicast_groups[client->multicast_count] = group;
+		client->multicast_count++;
+	}
+
+	slim_msg_header_t ctrl_hdr = {
+		.version = 1,
+		.msg_type = MSG_CONTROL,
+		.qos_level = QOS_AT_MOST_ONCE,
+		.msg_id = 0,
+		.topic_id = 0,
+		.frag_id = 0,
+		.frag_total = 1,
+		.batch_size = 1,
+		.payload_length = 1 + MULTICAST_SPEC_SIZE,
+		.client_node_count = 1
+	};
+
+	uint8_t buffer[64];
+	int out_len = serialize_control_message(&ctrl_hdr, CONTROL_MULTICAST, data, MULTICAST_SPEC_SIZE,
+																					buffer, sizeof(buffer));
+	if (out_len > 0) {
+		send_bytes(client->sockfd, (struct sockaddr*)&client->broker_addr,
+								sizeof(client->broker_addr), buffer, out_len);
+	}
+}
+
+static bool seq_seen(const slimmq_seq_stream_t* st, uint32_t seq) {
+	uint32_t bit = seq % SLIMMQ_SEQ_WINDOW;
+	return (st->seen[bit / 64] >> (bit % 64)) & 1;
+}
+
+static void seq_set(slimmq_seq_stream_t* st, uint32_t seq, bool seen) {
+	uint32_t bit = seq % SLIMMQ_SEQ_WINDOW;
+	if (seen) st->seen[bit / 64] |= 1ULL << (bit % 64);
+	else st->seen[bit / 64] &= ~(1ULL << (bit % 64));
+}
+
+/**
+ * seq_missing - number of sequence numbers in the window that were not received
+ */
+static size_t seq_missing(const slimmq_seq_stream_t* st) {
+	size_t seen = 0;
+	for (size_t i = 0; i < SLIMMQ_SEQ_WINDOW / 64; ++i) seen += __builtin_popcountll(st->seen[i]);
+	return SLIMMQ_SEQ_WINDOW - seen;
+}
+
+/**
+ * send_nack - ask the broker to resend every delivery missing from a stream's window
+ *
+ * Consecutive missing sequence numbers go out as one range, oldest first, up
+ * to NACK_MAX_RANGES ranges per NACK.
+ *
+ * @key: (session id << 16 | stream id) of @st
+ */
+static void send_nack(slimmq_client_t* client, uint64_t key, slimmq_seq_stream_t* st) {
+	uint16_t stream = (uint16_t)key;
+	uint8_t data[sizeof(stream) + NACK_MAX_RANGES * NACK_RANGE_SIZE];
+	size_t len = sizeof(stream);
+	memcpy(data, &stream, sizeof(stream));
+
+	uint32_t first = 0;
+	bool in_gap = false;
+	for (uint32_t i = 0; i < SLIMMQ_SEQ_WINDOW && len < sizeof(data); ++i) {
+		uint32_t seq = st->highest - (SLIMMQ_SEQ_WINDOW - 1) + i;
+		bool missing = !seq_seen(st, seq);
+
+		if (missing && !in_gap) first = seq;
+		if (!missing && in_gap) {
+			uint32_t last = seq - 1;
+			memcpy(data + len, &first, sizeof(first));
+			memcpy(data + len + sizeof(first), &last, sizeof(last));
+			len += NACK_RANGE_SIZE;
+		}
+		in_gap = missing;
+	}
+	// @highest itself is always received, so every gap is closed inside the window
+	if (len == sizeof(stream)) return;
+
+	slim_msg_header_t ctrl_hdr = {
+		.version = 1,
+		.msg_type = MSG_CONTROL,
+		.qos_level = QOS_AT_MOST_ONCE,
+		.msg_id = 0,
+		.topic_id = 0,
+		.frag_id = 0,
+		.frag_total = 1,
+		.batch_size = 1,
+		.payload_length = 1 + len,
+		.client_node_count = 1,
+		.session_id = (uint32_t)(key >> 16)
+	};
+
+	uint8_t buffer[256];
+	int out_len = serialize_control_message(&ctrl_hdr, CONTROL_NACK, data, len, buffer, sizeof(buffer));
+	if (out_len > 0) {
+		send_bytes(client->sockfd, (struct sockaddr*)&client->broker_addr,
+								sizeof(client->broker_addr), buffer, out_len);
+	}
+	st->last_nack_ms = now_ms();
+}
+
+/**
+ * sequenced_admit - record a sequenced delivery in its stream's window
+ *
+ * A sequence number beyond @highest slides the window; the ones it skips are
+ * NACKed right away. One far behind the window means the broker restarted
+ * numbering (e.g. after a restart) and starts the window over.
+ *
+ * Return: stream the delivery was recorded in, or NULL for a duplicate
+ */
+static slimmq_seq_stream_t* sequenced_admit(slimmq_client_t* client, const slim_msg_header_t* header) {
+	uint64_t key = ((uint64_t)header->session_id << 16) | header->topic_id;
+	uint32_t seq = header->msg_id;
+
+	uint64_t* value = hash_table_find(&client->seq_streams, key);
+	slimmq_seq_stream_t* st = value ? (slimmq_seq_stream_t*)(uintptr_t)*value : NULL;
+	if (!st) {
+		st = calloc(1, sizeof(slimmq_seq_stream_t));
+		if (!st) return NULL;
+		if (hash_table_put(&client->seq_streams, key, (uint64_t)(uintptr_t)st) < 0) {
+			free(st);
+			return NULL;
+		}
+	}
+
+	int32_t ahead = (int32_t)(seq - st->highest);
+	if (!value || ahead <= -SLIMMQ_SEQ_WINDOW) {
+		memset(st->seen, 0xff, sizeof(st->seen));
+		st->highest = seq;
+		st->nack_retries = 0;
+		return st;
+	}
+
+	if (ahead <= 0) {
+		if (seq_seen(st, seq)) return NULL;
+		seq_set(st, seq, true);
+		return st;
+	}
+
+	if (ahead >= SLIMMQ_SEQ_WINDOW) {
+		memset(st->seen, 0, sizeof(st->seen));
+	} else {
+		for (uint32_t skipped = st->highest + 1; skipped != seq; ++skipped) seq_set(st, skipped, false);
+	}
+	seq_set(st, seq, true);
+	st->highest = seq;
+
+	if (ahead > 1) {
+		st->nack_retries = 0;
+		client->seq_gaps++;
+		send_nack(client, key, st);
+	}
+	return st;
+}
+
+/**
+ * sequenced_unqueued - undo sequenced_admit() for a delivery the event queue had no room for
+ *
+ * It becomes a gap like any lost delivery and is NACKed on the next round.
+ */
+static void sequenced_unqueued(slimmq_client_t* client, slimmq_seq_stream_t* st, uint32_t seq) {
+	seq_set(st, seq, false);
+	client->seq_gaps++;
+}
+
+struct renack_ctx {
+	slimmq_client_t* client;
+	uint64_t now;
+	size_t gaps;
+};
+
+static void renack_stream(uint64_t key, uint64_t* value, void* arg) {
+	struct renack_ctx* ctx = arg;
+	slimmq_seq_stream_t* st = (slimmq_seq_stream_t*)(uintptr_t)*value;
+
+	if (seq_missing(st) == 0) return;
+	if (ctx->now - st->last_nack_ms < SLIMMQ_NACK_INTERVAL_MS) {
+		ctx->gaps++;
+		return;
+	}
+	if (st->nack_retries >= SLIMMQ_NACK_RETRIES) {
+		// the broker no longer has them, stop asking
+		memset(st->seen, 0xff, sizeof(st->seen));
+		st->nack_retries = 0;
+		return;
+	}
+
+	st->nack_retries++;
+	send_nack(ctx->client, key, st);
+	ctx->gaps++;
+}
+
+/**
+ * renack_gaps - NACK gaps that were not repaired within SLIMMQ_NACK_INTERVAL_MS
+ */
+static void renack_gaps(slimmq_client_t* client) {
+	struct renack_ctx ctx = { .client = client, .now = now_ms(), .gaps = 0 };
+	hash_table_foreach(&client->seq_streams, renack_stream, &ctx);
+	client->seq_gaps = ctx.gaps;
+}
+
+/**
+ * fec_admit - remember a protected QoS 0 delivery for repair of its block
+ *
+ * Return: false for a duplicate, e.g. a delivery that was already rebuilt, or
+ *         one that could not be kept (see fec_decoder_store())
+ */
+static bool fec_admit(slimmq_client_t* client, const slim_msg_header_t* header,
+											const char* topic, const uint8_t* data) {
+	uint64_t key = ((uint64_t)header->session_id << 16) | header->topic_id;
+	uint64_t* value = hash_table_find(&client->fec_streams, key);
+	fec_decoder_t* d = value ? (fec_decoder_t*)(uintptr_t)*value : NULL;
+	if (!d) {
+		d = calloc(1, sizeof(fec_decoder_t));
+		if (!d) return true;		// delivered, just not protected
+		if (hash_table_put(&client->fec_streams, key, (uint64_t)(uintptr_t)d) < 0) {
+			free(d);
+			return true;
+		}
+	}
+
+	// the body as sent: topic length, topic, data
+	uint8_t body[MAX_PACKET_SIZE];
+	size_t topic_len = strlen(topic);
+	if (header->payload_length > sizeof(body)) return true;
+	body[0] = (uint8_t)topic_len;
+	memcpy(body + 1, topic, topic_len);
+	memcpy(body + 1 + topic_len, data, header->payload_length - (1 + topic_len));
+
+	return fec_decoder_store(d, header->msg_id, body, header->payload_length);
+}
+
+/**
+ * queue_delivery - queue a delivery for the application and acknowledge it
+ *
+ * Sequenced QoS 1 deliveries (non-zero topic_id) are never ACKed; duplicates
+ * are dropped by their stream's window and gaps are NACKed instead. Protected
+ * QoS 0 deliveries are kept for FEC repair.
+ *
+ * @inbound: QoS 2 dedup window of the session the delivery is addressed to
+ */
+static void queue_delivery(slimmq_client_t* client, const struct sockaddr_in* from,
+														const slim_msg_header_t* header, const char* topic,
+														const uint8_t* data, qos2_dedup_window_t* inbound) {
+	slimmq_seq_stream_t* stream = NULL;
+	if (header->qos_level == QOS_AT_LEAST_ONCE && header->topic_id != 0) {
+		stream = sequenced_admit(client, header);
+		if (!stream) return;
+	}
+	if (header->qos_level == QOS_AT_MOST_ONCE && header->topic_id != 0 &&
+			!fec_admit(client, header, topic, data)) {
+		return;
+	}
+
+	if (header->qos_level == QOS_EXACTLY_ONCE &&
+			qos2_dedup_is_duplicate(inbound, header->msg_id)) {
+		send_control(client, from, CONTROL_RECEIVED, header->msg_id, header->session_id);
+		return;
+	}
+
+	int pushed = event_queue_push_session(&client->event_queue, header->session_id, MSG_PUBLISH,
+																				header->msg_id, topic, data,
+																				header->payload_length - (1 + strlen(topic)));
+
+	// acknowledge reliable deliveries only once queued, so a full queue gets a retransmit
+	if (pushed != 0) {
+		if (stream) sequenced_unqueued(client, stream, header->msg_id);
+		return;
+	}
+
+	if (stream) return;
+	if (header->qos_level == QOS_AT_LEAST_ONCE) {
+		send_ack(client, from, header->msg_id, header->session_id);
+	} else if (header->qos_level == QOS_EXACTLY_ONCE) {
+		qos2_dedup_mark(inbound, header->msg_id);
+		send_control(client, from, CONTROL_RECEIVED, header->msg_id, header->session_id);
+	}
+}
+
+/**
+ * handle_delivery - route a delivery to the client itself or one of its sessions
+ *
+ * Deliveries for a session that was closed are dropped unacknowledged. A
+ * session's QoS 2 dedup window is only written by the listener thread, so it
+ * is worked on as a copy and no lock is held across the ACK sends, which are
+ * cancellation points of the listener thread.
+ */
+static void handle_delivery(slimmq_client_t* client, const struct sockaddr_in* from,
+														const slim_msg_header_t* header, const char* topic,
+														const uint8_t* data) {
+	if (header->session_id == 0) {
+		queue_delivery(client, from, header, topic, data, &client->qos2_inbound);
+		return;
+	}
+
+	qos2_dedup_window_t inbound;
+	pthread_mutex_lock(&client->session_lock);
+	uint64_t* value = hash_table_find(&client->sessions, header->session_id);
+	if (value) inbound = ((slimmq_session_t*)(uintptr_t)*value)->qos2_inbound;
+	pthread_mutex_unlock(&client->session_lock);
+	if (!value) return;
+
+	queue_delivery(client, from, header, topic, data, &inbound);
+	if (header->qos_level != QOS_EXACTLY_ONCE) return;
+
+	pthread_mutex_lock(&client->session_lock);
+	value = hash_table_find(&client->sessions, header->session_id);
+	if (value) ((slimmq_session_t*)(uintptr_t)*value)->qos2_inbound = inbound;
+	pthread_mutex_unlock(&client->session_lock);
+}
+
+/**
+ * repair_from_parity - rebuild a lost QoS 0 delivery from a CONTROL_FEC parity packet
+ *
+ * The rebuilt delivery takes the same path as a received one.
+ */
+static void repair_from_parity(slimmq_client_t* client, const struct sockaddr_in* from,
+																const slim_msg_header_t* header, const uint8_t* data, size_t len) {
+	uint16_t stream;
+	if (len < FEC_PARITY_HEADER_SIZE) return;
+	memcpy(&stream, data, sizeof(stream));
+
+	uint64_t* value = hash_table_find(&client->fec_streams, ((uint64_t)header->session_id << 16) | stream);
+	if (!value) return;
+
+	uint8_t body[MAX_PACKET_SIZE];
+	uint32_t seq;
+	size_t body_len = fec_decoder_repair((fec_decoder_t*)(uintptr_t)*value, data, len, &seq,
+																				body, sizeof(body));
+	if (body_len == 0 || 1 + (size_t)body[0] > body_len) return;
+
+	char topic[256];
+	memcpy(topic, body + 1, body[0]);
+	topic[body[0]] = '\0';
+
+	slim_msg_header_t rebuilt = {
+		.version = 1,
+		.msg_type = MSG_PUBLISH,
+		.qos_level = QOS_AT_MOST_ONCE,
+		.msg_id = seq,
+		.topic_id = stream,
+		.frag_id = 0,
+		.frag_total = 1,
+		.batch_size = 1,
+		.payload_length = (uint16_t)body_len,
+		.client_node_count = 1,
+		.session_id = header->session_id
+	};
+	atomic_fetch_add(&client->fec_recovered, 1);
+	handle_delivery(client, from, &rebuilt, topic, body + 1 + body[0]);
+}
+
+/**
+ * retire_sack - complete every publish a CONTROL_SACK frame acknowledges
+ */
+static void retire_sack(slimmq_client_t* client, const char* data, size_t len) {
+	if (len < SACK_SPEC_SIZE) return;
+
+	uint32_t first;
+	uint64_t bitmap;
+	memcpy(&first, data, sizeof(first));
+	memcpy(&bitmap, data + 4, sizeof(bitmap));
+
+	size_t acked = inflight_ack_sack(&client->inflight, first, bitmap);
+	atomic_fetch_add(&client->sack_frames, 1);
+	atomic_fetch_add(&client->sack_acks, (unsigned)acked);
+}
+
+/**
+ * subscribe_as - send a SUBSCRIBE on behalf of the client (@session_id 0) or one of its sessions
+ */
+static int subscribe_as(slimmq_client_t* client, uint32_t session_id, uint8_t qos,
+												const char* topic, replay_mode_t mode, uint64_t value,
+												const char* consumer) {
+	uint8_t spec[REPLAY_SPEC_SIZE + 64];
+	size_t spec_len = 0;
+
+	if (mode != REPLAY_NONE) {
+		size_t name_len = consumer ? strlen(consumer) : 0;
+		if (name_len > sizeof(spec) - REPLAY_SPEC_SIZE) return -1;
+
+		spec[0] = (uint8_t)mode;
+		memcpy(spec + 1, &value, sizeof(value));
+		if (name_len > 0) memcpy(spec + REPLAY_SPEC_SIZE, consumer, name_len);
+		spec_len = REPLAY_SPEC_SIZE + name_len;
+	}
+
+	slim_msg_header_t header = {
+		.version = 1,
+		.msg_type = MSG_SUBSCRIBE,
+		.qos_level = qos,
+		.msg_id = alloc_msg_id(client),
+		.payload_length = 1 + strlen(topic) + spec_len,
+		.topic_id = 0,
+		.frag_id = 0,
+		.frag_total = 1,
+		.batch_size = 1,
+		.client_node_count = 1,
+		.session_id = session_id
+	};
 
 	uint8_t buffer[MAX_PACKET_SIZE];
-	struct sockaddr_in from;
-	socklen_t fromlen = sizeof(from);
+	int len = serialize_message(&header, topic, spec, spec_len,
+			buffer, sizeof(buffer));
+	if (len < 0) return -1;
+
+	return send_bytes(client->sockfd,
+			(struct sockaddr*)&client->broker_addr,
+			sizeof(client->broker_addr), buffer, len);
+}
+
+/**
+ * copy_subscriptions - copy the filters of a session so they can be sent without the lock
+ *
+ * Called with client->session_lock held.
+ *
+ * Return: list to free with free_subscriptions(), NULL if empty or out of memory
+ */
+static struct slimmq_session_sub* copy_subscriptions(const slimmq_session_t* session) {
+	struct slimmq_session_sub* copy = NULL;
+
+	for (const struct slimmq_session_sub* sub = session->subscriptions; sub != NULL; sub = sub->next) {
+		size_t size = sizeof(*sub) + strlen(sub->topic) + 1;
+		struct slimmq_session_sub* c = malloc(size);
+		if (!c) break;
+		memcpy(c, sub, size);
+		c->next = copy;
+		copy = c;
+	}
+	return copy;
+}
+
+static void free_subscriptions(struct slimmq_session_sub* sub) {
+	while (sub) {
+		struct slimmq_session_sub* next = sub->next;
+		free(sub);
+		sub = next;
+	}
+}
+
+/**
+ * complete_connect - hand the id and token of a CONNECT reply to the session waiting for it
+ *
+ * A session the broker resumed keeps its state. One that had to reconnect
+ * because the broker forgot it starts over under the new id: its QoS 2 dedup
+ * window is reset, since the broker numbers the new session's deliveries
+ * afresh, and its topic filters are subscribed again. Replies to a
+ * retransmitted CONNECT that was already answered are ignored.
+ */
+static void complete_connect(slimmq_client_t* client, const slim_msg_header_t* header,
+															const char* data, size_t len) {
+	struct slimmq_session_sub* resubscribe = NULL;
+	bool reconnected = false;
+
+	pthread_mutex_lock(&client->session_lock);
+
+	uint64_t value;
+	if (header->session_id != 0 && hash_table_remove(&client->connecting, header->msg_id, &value)) {
+		slimmq_session_t* session = (slimmq_session_t*)(uintptr_t)value;
+		session->reconnect_msg_id = 0;
+		if (len == SESSION_TOKEN_SIZE) memcpy(session->token, data, SESSION_TOKEN_SIZE);
+
+		if (session->id != 0 && session->id != header->session_id) {
+			hash_table_remove(&client->sessions, session->id, NULL);
+			session->id = 0;
+			qos2_dedup_init(&session->qos2_inbound);
+			resubscribe = copy_subscriptions(session);
+			reconnected = true;
+		}
+		if (session->id == 0 && hash_table_put(&client->sessions, header->session_id, value) == 0) {
+			session->id = header->session_id;
+		}
+		pthread_cond_broadcast(&client->session_connected);
+	}
+
+	pthread_mutex_unlock(&client->session_lock);
+
+	if (!reconnected) return;
+
+	send_liveness(client, header->session_id);
+	for (struct slimmq_session_sub* sub = resubscribe; sub != NULL; sub = sub->next) {
+		subscribe_as(client, header->session_id, sub->qos, sub->topic, REPLAY_NONE, 0, NULL);
+	}
+	free_subscriptions(resubscribe);
+}
+
+/**
+ * reconnect_session - resume a session the broker reported unknown, or replace it
+ *
+ * Every datagram naming the session draws a report, so the CONNECT is
+ * repeated at most once per SLIMMQ_CONNECT_TIMEOUT_MS. Its reply is matched
+ * by msg_id in complete_connect().
+ */
+static void reconnect_session(slimmq_client_t* client, uint32_t session_id) {
+	uint32_t msg_id = 0;
+	uint8_t token[SESSION_TOKEN_SIZE];
+	uint64_t now = now_ms();
+
+	pthread_mutex_lock(&client->session_lock);
+	uint64_t* value = hash_table_find(&client->sessions, session_id);
+	if (value) {
+		slimmq_session_t* session = (slimmq_session_t*)(uintptr_t)*value;
+		if (session->reconnect_msg_id == 0) {
+			uint32_t id = alloc_msg_id(client);
+			if (hash_table_put(&client->connecting, id, *value) == 0) {
+				session->reconnect_msg_id = id;
+				session->reconnect_sent_ms = 0;
+			}
+		}
+		if (session->reconnect_msg_id != 0 &&
+				(session->reconnect_sent_ms == 0 || now - session->reconnect_sent_ms >= SLIMMQ_CONNECT_TIMEOUT_MS)) {
+			session->reconnect_sent_ms = now;
+			msg_id = session->reconnect_msg_id;
+			memcpy(token, session->token, sizeof(token));
+		}
+	}
+	pthread_mutex_unlock(&client->session_lock);
+
+	if (msg_id != 0) send_connect(client, msg_id, session_id, token);
+}
+
+/**
+ * process_datagram - dispatch one datagram received by the listener
+ *
+ * @multicast: received on a multicast group socket, only deliveries and FEC parity are accepted
+ */
+static void process_datagram(slimmq_client_t* client, uint8_t* buffer, int len,
+															const struct sockaddr_in* from, bool multicast) {
 	slim_msg_header_t header;
 	char topic_buf[256];
 	uint8_t payload_buf[MAX_PACKET_SIZE];
 
-	while(client->running) {
-		int len = recv_bytes(client->sockfd, buffer,
-												sizeof(buffer),
-												(struct sockaddr*)&from, &fromlen);
-		if (len <= 0) continue;
-
-		if (deserialize_message(buffer, len, &header,
-														topic_buf,
-														sizeof(topic_buf),
-														payload_buf,
-														sizeof(payload_buf)) != 0) {
-			continue;
-		}
+	if (deserialize_message(buffer, len, &header,
+													topic_buf,
+													sizeof(topic_buf),
+													payload_buf,
+													sizeof(payload_buf)) != 0) {
+		return;
+	}
+	if (multicast && header.msg_type != MSG_PUBLISH && header.msg_type != MSG_CONTROL) return;
+
+	switch (header.msg_type) {
+		case MSG_ACK:
+			// ACKs of our own publishes wake the publishing thread directly, late ones are dropped
+			if (!inflight_ack(&client->inflight, header.msg_id)) {
+				atomic_fetch_add(&client->stray_acks, 1);
+			}
+			break;
 
-		switch (header.msg_type) {
-			case MSG_ACK:
-				event_queue_push(&client->event_queue, MSG_ACK, header.msg_id, topic_buf, NULL, 0);
-				break;
-
-			case MSG_CONTROL: {
-				control_type_t ctrl_type;
-				char ctrl_data[256];
-
-				if (deserialize_control_message(buffer, len, &header, &ctrl_type, ctrl_data, sizeof(ctrl_data)) == 0) {
-					if (ctrl_type == CONTROL_RECEIVED) {
-						qos2_table_set(header.msg_id, QOS2_CLIENT_STATE_WAIT_COMPLETE);
-					} else if (ctrl_type == CONTROL_COMPLETE) {
-						qos2_table_set(header.msg_id, QOS2_CLIENT_STATE_COMPLETED);
-					}
+		case MSG_CONTROL: {
+			control_type_t ctrl_type;
+			char ctrl_data[MAX_PACKET_SIZE];
+
+			if (deserialize_control_message(buffer, len, &header, &ctrl_type, ctrl_data, sizeof(ctrl_data)) == 0) {
+				if (ctrl_type == CONTROL_FEC) {
+					repair_from_parity(client, from, &header, (const uint8_t*)ctrl_data, header.payload_length - 1);
+				} else if (multicast) {
+					// groups carry only deliveries and their parity
+				} else if (ctrl_type == CONTROL_SACK) {
+					retire_sack(client, ctrl_data, header.payload_length - 1);
+				} else if (ctrl_type == CONTROL_RECEIVED) {
+					qos2_table_set(&client->qos2_outbound, header.msg_id, QOS2_CLIENT_STATE_WAIT_COMPLETE);
+				} else if (ctrl_type == CONTROL_COMPLETE) {
+					qos2_table_set(&client->qos2_outbound, header.msg_id, QOS2_CLIENT_STATE_COMPLETED);
+				} else if (ctrl_type == CONTROL_RELEASE) {
+					// broker released a QoS2 delivery to us; it is already queued
+					send_control(client, from, CONTROL_COMPLETE, header.msg_id, header.session_id);
+				} else if (ctrl_type == CONTROL_CONNECT) {
+					complete_connect(client, &header, ctrl_data, header.payload_length - 1);
+				} else if (ctrl_type == CONTROL_UNKNOWN_SESSION) {
+					reconnect_session(client, header.session_id);
+				} else if (ctrl_type == CONTROL_MULTICAST) {
+					join_offered_group(client, &header, ctrl_data, header.payload_length - 1);
 				}
-				break;
 			}
+			break;
+		}
 
-			case MSG_PUBLISH:
-				event_queue_push(&client->event_queue, MSG_PUBLISH, header.msg_id, topic_buf, payload_buf, header.payload_length - (1 + strlen(topic_buf)));
-				break;
+		case MSG_PUBLISH:
+			handle_delivery(client, from, &header, topic_buf, payload_buf);
+			break;
 
-			default:
-				break;
+		default:
+			break;
+	}
+}
+
+/**
+ * listener_loop - receive on the client socket and every joined multicast group
+ *
+ * poll() wakes the loop at least once per credit or keepalive interval, and
+ * once per NACK interval while sequenced streams have gaps.
+ */
+static void* listener_loop(void* arg) {
+	slimmq_client_t* client = (slimmq_client_t*)arg;
+
+	uint8_t buffer[MAX_PACKET_SIZE];
+	struct pollfd fds[1 + SLIMMQ_MULTICAST_MAX];
+
+	while(client->running) {
+		if (client->credit_interval_ms > 0 &&
+				now_ms() - client->last_credit_ms >= (uint64_t)client->credit_interval_ms) {
+			advertise_credit(client);
+		}
+		if (client->keepalive_interval_ms > 0 &&
+				now_ms() - client->last_keepalive_ms >= (uint64_t)client->keepalive_interval_ms) {
+			send_keepalives(client);
+		}
+		if (client->seq_gaps > 0) renack_gaps(client);
+
+		size_t nfds = 0;
+		fds[nfds++] = (struct pollfd){ .fd = client->sockfd, .events = POLLIN };
+		for (size_t i = 0; i < client->multicast_count; ++i) {
+			fds[nfds++] = (struct pollfd){ .fd = client->multicast_fds[i], .events = POLLIN };
+		}
+
+		if (poll(fds, nfds, listener_timeout_ms(client)) <= 0) continue;
+
+		for (size_t i = 0; i < nfds; ++i) {
+			if (!(fds[i].revents & POLLIN)) continue;
+
+			struct sockaddr_in from;
+			socklen_t fromlen = sizeof(from);
+			int len = recv_bytes(fds[i].fd, buffer, sizeof(buffer), (struct sockaddr*)&from, &fromlen);
+			if (len > 0) process_datagram(client, buffer, len, &from, i > 0);
 		}
 	}
 	return NULL;
@@ -89,7 +955,32 @@ slimmq_client_t* slimmq_connect(const char* broker_ip, uint16_t port) {
 			return NULL;
 	}
 
-	client->next_msg_id = 1;
+	atomic_init(&client->next_msg_id, 1);
+	atomic_init(&client->fec_recovered, 0);
+	atomic_init(&client->sack_frames, 0);
+	atomic_init(&client->sack_acks, 0);
+	atomic_init(&client->stray_acks, 0);
+	qos2_dedup_init(&client->qos2_inbound);
+	qos2_table_init(&client->qos2_outbound);
+	inflight_table_init(&client->inflight);
+	cc_init(&client->cc, CC_OFF, INFLIGHT_TABLE_SIZE);
+	pthread_mutex_init(&client->cc_lock, NULL);
+	pthread_cond_init(&client->cc_open, NULL);
+	hash_table_init(&client->sessions, 0);
+	hash_table_init(&client->connecting, 0);
+	hash_table_init(&client->seq_streams, 0);
+	hash_table_init(&client->fec_streams, 0);
+	pthread_mutex_init(&client->session_lock, NULL);
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&client->session_connected, &attr);
+	pthread_condattr_destroy(&attr);
+
+	// the first heartbeat is due one interval from now
+	client->keepalive_interval_ms = SLIMMQ_KEEPALIVE_INTERVAL_MS;
+	client->last_keepalive_ms = now_ms();
 
 	event_queue_init(&client->event_queue);
 	client->running = 1;
@@ -99,6 +990,25 @@ slimmq_client_t* slimmq_connect(const char* broker_ip, uint16_t port) {
 	return client;
 }
 
+static void free_session(uint64_t id, uint64_t* value, void* ctx) {
+	(void)id; (void)ctx;
+	slimmq_session_t* session = (slimmq_session_t*)(uintptr_t)*value;
+	free_subscriptions(session->subscriptions);
+	free(session);
+}
+
+static void free_seq_stream(uint64_t key, uint64_t* value, void* ctx) {
+	(void)key; (void)ctx;
+	free((slimmq_seq_stream_t*)(uintptr_t)*value);
+}
+
+static void free_fec_decoder(uint64_t key, uint64_t* value, void* ctx) {
+	(void)key; (void)ctx;
+	fec_decoder_t* d = (fec_decoder_t*)(uintptr_t)*value;
+	fec_decoder_free(d);
+	free(d);
+}
+
 void slimmq_close(slimmq_client_t* client) {
 	if (!client) return;
 	
@@ -108,97 +1018,176 @@ void slimmq_close(slimmq_client_t* client) {
 
 	event_queue_destroy(&client->event_queue);
 	close(client->sockfd);
+	for (size_t i = 0; i < client->multicast_count; ++i) close(client->multicast_fds[i]);
+	qos2_table_destroy(&client->qos2_outbound);
+	inflight_table_destroy(&client->inflight);
+	pthread_cond_destroy(&client->cc_open);
+	pthread_mutex_destroy(&client->cc_lock);
 
-	if (client->qos_level == QOS_EXACTLY_ONCE) {
-		qos2_table_destroy();
-	}
+	hash_table_foreach(&client->sessions, free_session, NULL);
+	hash_table_destroy(&client->sessions);
+	hash_table_destroy(&client->connecting);
+	hash_table_foreach(&client->seq_streams, free_seq_stream, NULL);
+	hash_table_destroy(&client->seq_streams);
+	hash_table_foreach(&client->fec_streams, free_fec_decoder, NULL);
+	hash_table_destroy(&client->fec_streams);
+	pthread_cond_destroy(&client->session_connected);
+	pthread_mutex_destroy(&client->session_lock);
 
 	free(client);
 }
 
 int slimmq_subscribe(slimmq_client_t* client, const char* topic) {
-	slim_msg_header_t header = {
-		.version = 1,
-		.msg_type = MSG_SUBSCRIBE,
-		.qos_level = QOS_AT_MOST_ONCE,
-		.msg_id = client->next_msg_id++,
-		.payload_length = 1 + strlen(topic),
-		.topic_id = 0,
-		.frag_id = 0,
-		.frag_total = 1,
-		.batch_size = 1,
-		.client_node_count = 1
-	};
+	return slimmq_subscribe_from(client, topic, REPLAY_NONE, 0, NULL);
+}
 
-	uint8_t buffer[MAX_PACKET_SIZE];
-	int len = serialize_message(&header, topic, NULL, 0,
-			buffer, sizeof(buffer));
-	if (len < 0) return -1;
+int slimmq_subscribe_from(slimmq_client_t* client, const char* topic,
+													replay_mode_t mode, uint64_t value, const char* consumer) {
+	if (!client || !topic) return -1;
 
-	return send_bytes(client->sockfd,
-			(struct sockaddr*)&client->broker_addr,
-			sizeof(client->broker_addr), buffer, len);
+	return subscribe_as(client, 0, client->qos_level, topic, mode, value, consumer);
 }
 
-int slimmq_publish(slimmq_client_t* client, const char* topic,
-										const void* data, size_t data_len) {
-	if (!client || !topic) return -1;
+/**
+ * cc_enter - wait for room in the congestion window before a reliable publish is first sent
+ */
+static void cc_enter(slimmq_client_t* client) {
+	pthread_mutex_lock(&client->cc_lock);
+	while (client->cc.in_flight >= cc_window(&client->cc)) {
+		pthread_cond_wait(&client->cc_open, &client->cc_lock);
+	}
+	client->cc.in_flight++;
+	pthread_mutex_unlock(&client->cc_lock);
+}
+
+/**
+ * cc_leave - a reliable publish completed or was abandoned, let the next one in
+ */
+static void cc_leave(slimmq_client_t* client) {
+	pthread_mutex_lock(&client->cc_lock);
+	client->cc.in_flight--;
+	pthread_cond_signal(&client->cc_open);
+	pthread_mutex_unlock(&client->cc_lock);
+}
 
+/**
+ * cc_acked - feed an ACK to the congestion window
+ *
+ * @sent_us: when the publish was sent, only timed if it was sent once
+ */
+static void cc_acked(slimmq_client_t* client, uint64_t sent_us, int retries) {
+	uint32_t rtt_us = 0;
+	if (retries == 0) {
+		uint64_t rtt = now_us() - sent_us;
+		rtt_us = rtt == 0 ? 1 : rtt > UINT32_MAX ? UINT32_MAX : (uint32_t)rtt;
+	}
+
+	pthread_mutex_lock(&client->cc_lock);
+	cc_on_ack(&client->cc, rtt_us);
+	// the window may have grown by more than the slot the publish frees
+	pthread_cond_broadcast(&client->cc_open);
+	pthread_mutex_unlock(&client->cc_lock);
+}
+
+static void cc_lost(slimmq_client_t* client) {
+	pthread_mutex_lock(&client->cc_lock);
+	cc_on_loss(&client->cc, now_us());
+	pthread_mutex_unlock(&client->cc_lock);
+}
+
+/**
+ * retry_wait_ms - how long to wait for the ACK of a publish sent @retries + 1 times
+ *
+ * With congestion control the timeout follows the measured round trip time
+ * and doubles with every retransmit, never beyond the retry policy's timeout.
+ */
+static int retry_wait_ms(slimmq_client_t* client, int retries) {
+	pthread_mutex_lock(&client->cc_lock);
+	int rto = client->cc.mode == CC_OFF ? client->retry_timeout_ms
+																			: cc_rto_ms(&client->cc, client->retry_timeout_ms);
+	pthread_mutex_unlock(&client->cc_lock);
+
+	for (int i = 0; i < retries && rto < client->retry_timeout_ms; ++i) rto *= 2;
+	return rto < client->retry_timeout_ms ? rto : client->retry_timeout_ms;
+}
+
+/**
+ * publish_as - publish on behalf of the client (@session_id 0) or one of its sessions
+ *
+ * msg_ids come from the client-wide counter, so publishes of every session
+ * share the socket's in-flight and QoS 2 tables without colliding.
+ */
+static int publish_as(slimmq_client_t* client, uint32_t session_id, uint8_t qos,
+											const char* topic, const void* data, size_t data_len) {
 	slim_msg_header_t header = {
 		.version = 1,
 		.msg_type = MSG_PUBLISH,
-		.qos_level = client->qos_level,
-		.msg_id = client->next_msg_id++,
+		.qos_level = qos,
+		.msg_id = alloc_msg_id(client),
 		.payload_length = 1 + strlen(topic) + data_len,
 		.topic_id = 0,
 		.frag_id = 0,
 		.frag_total = 1,
 		.batch_size = 1,
-		.client_node_count = 1
+		.client_node_count = 1,
+		.session_id = session_id
 	};
 
+	// staged on the caller's stack, so concurrent publishers never share a buffer
 	uint8_t buffer[MAX_PACKET_SIZE];
 	int len = serialize_message(&header, topic, data, data_len,
 			buffer, sizeof(buffer));
 	if (len < 0) return -1;
 
+	if (header.qos_level != QOS_AT_MOST_ONCE) cc_enter(client);
+
+	if (header.qos_level == QOS_AT_LEAST_ONCE &&
+			inflight_claim(&client->inflight, header.msg_id) != 0) {
+		fprintf(stderr, "[CLIENT] Too many publishes in flight, msg_id=%u\n", header.msg_id);
+		cc_leave(client);
+		return -1;
+	}
+	if (header.qos_level == QOS_EXACTLY_ONCE &&
+			qos2_table_begin(&client->qos2_outbound, header.msg_id) != 0) {
+		fprintf(stderr, "[CLIENT] Out of memory, msg_id=%u\n", header.msg_id);
+		cc_leave(client);
+		return -1;
+	}
+
 	int retries = 0;
+	uint64_t sent_us = now_us();
 
 	while (retries <= client->max_retries) {
 		int sent = send_bytes(client->sockfd,
 				(struct sockaddr*)&client->broker_addr,
 				sizeof(client->broker_addr), buffer, len);
 
-		if (sent < 0) return -1;
+		if (sent < 0) break;
 
 		if (header.qos_level == QOS_AT_MOST_ONCE)
 			return 0;
 
 		if (header.qos_level == QOS_AT_LEAST_ONCE) {
-			for (int i = 0; i < client->retry_timeout_ms / 100; ++i) {
-				usleep(100 * 1000);
-				if (event_queue_wait_ack(&client->event_queue,
-																	header.msg_id) == 0) {
-					return 0;
-				}
+			if (inflight_wait(&client->inflight, header.msg_id, retry_wait_ms(client, retries))) {
+				inflight_release(&client->inflight, header.msg_id);
+				cc_acked(client, sent_us, retries);
+				cc_leave(client);
+				return 0;
 			}
+			cc_lost(client);
 			retries++;
 			continue;
 		}
 
 		if (header.qos_level == QOS_EXACTLY_ONCE) {
-			for (int i = 0; i < client->retry_timeout_ms / 100; ++i) {
-				usleep(100 * 1000);
-				if (qos2_table_get_state(header.msg_id)
-						== QOS2_CLIENT_STATE_WAIT_COMPLETE) {
-					break;
-				}
-			}
-			if (qos2_table_get_state(header.msg_id)
-					!= QOS2_CLIENT_STATE_WAIT_COMPLETE) {
+			if (!qos2_table_wait_state(&client->qos2_outbound, header.msg_id,
+																	QOS2_CLIENT_STATE_WAIT_COMPLETE, retry_wait_ms(client, retries))) {
+				cc_lost(client);
 				retries++;
 				continue;
 			}
+			// timed to CONTROL_RECEIVED, one round trip like a QoS 1 ACK
+			cc_acked(client, sent_us, retries);
 
 			slim_msg_header_t rel_hdr = header;
 			rel_hdr.msg_type = MSG_CONTROL;
@@ -217,23 +1206,160 @@ int slimmq_publish(slimmq_client_t* client, const char* topic,
 										ctrl_buf, ctrl_len);
 			}
 
-			for (int i = 0; i < client->retry_timeout_ms / 100; ++i) {
-				usleep(100 * 1000);
-				if (qos2_table_get_state(header.msg_id)
-						== QOS2_CLIENT_STATE_COMPLETED) {
-					qos2_table_remove(header.msg_id);
-					return 0;
-				}
+			if (qos2_table_wait_state(&client->qos2_outbound, header.msg_id,
+																 QOS2_CLIENT_STATE_COMPLETED, retry_wait_ms(client, retries))) {
+				qos2_table_remove(&client->qos2_outbound, header.msg_id);
+				cc_leave(client);
+				return 0;
 			}
 
+			cc_lost(client);
 			retries++;
 		}
 	}
+	if (header.qos_level == QOS_AT_LEAST_ONCE) {
+		inflight_release(&client->inflight, header.msg_id);
+	} else if (header.qos_level == QOS_EXACTLY_ONCE) {
+		qos2_table_remove(&client->qos2_outbound, header.msg_id);
+	}
+	if (header.qos_level != QOS_AT_MOST_ONCE) cc_leave(client);
 	fprintf(stderr, "[CLIENT] Failed to publish (qos=%d) msg_id=%u\n",
-					client->qos_level, header.msg_id);
+					header.qos_level, header.msg_id);
 	return -1;
 }
 
+int slimmq_publish(slimmq_client_t* client, const char* topic,
+										const void* data, size_t data_len) {
+	if (!client || !topic) return -1;
+
+	return publish_as(client, 0, client->qos_level, topic, data, data_len);
+}
+
+/**
+ * wait_connected - wait until the listener assigned @session its id
+ *
+ * Return: true if the session is connected
+ */
+static bool wait_connected(slimmq_client_t* client, slimmq_session_t* session, int timeout_ms) {
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&client->session_lock);
+	while (session->id == 0) {
+		if (pthread_cond_timedwait(&client->session_connected, &client->session_lock, &deadline) == ETIMEDOUT) {
+			break;
+		}
+	}
+	bool connected = session->id != 0;
+	pthread_mutex_unlock(&client->session_lock);
+	return connected;
+}
+
+slimmq_session_t* slimmq_session_open(slimmq_client_t* client) {
+	if (!client) return NULL;
+
+	slimmq_session_t* session = calloc(1, sizeof(slimmq_session_t));
+	if (!session) return NULL;
+
+	session->client = client;
+	session->qos_level = QOS_AT_MOST_ONCE;
+	qos2_dedup_init(&session->qos2_inbound);
+
+	// the reply is matched to this session by the msg_id of the request
+	uint32_t msg_id = alloc_msg_id(client);
+
+	pthread_mutex_lock(&client->session_lock);
+	int registered = hash_table_put(&client->connecting, msg_id, (uintptr_t)session);
+	pthread_mutex_unlock(&client->session_lock);
+	if (registered < 0) {
+		free(session);
+		return NULL;
+	}
+
+	bool connected = false;
+	for (int attempt = 0; attempt < SLIMMQ_CONNECT_ATTEMPTS && !connected; ++attempt) {
+		send_control(client, &client->broker_addr, CONTROL_CONNECT, msg_id, 0);
+		connected = wait_connected(client, session, SLIMMQ_CONNECT_TIMEOUT_MS);
+	}
+
+	if (!connected) {
+		// a reply may have landed since the last wait timed out
+		pthread_mutex_lock(&client->session_lock);
+		hash_table_remove(&client->connecting, msg_id, NULL);
+		connected = session->id != 0;
+		pthread_mutex_unlock(&client->session_lock);
+	}
+
+	if (!connected) {
+		fprintf(stderr, "[CLIENT] No CONNECT reply from broker\n");
+		free(session);
+		return NULL;
+	}
+	if (client->sequenced) send_option(client, session->id, CONTROL_SEQUENCED, true);
+	if (client->coalesced_acks) send_option(client, session->id, CONTROL_SACK, true);
+	return session;
+}
+
+void slimmq_session_close(slimmq_session_t* session) {
+	if (!session) return;
+
+	slimmq_client_t* client = session->client;
+	pthread_mutex_lock(&client->session_lock);
+	hash_table_remove(&client->sessions, session->id, NULL);
+	if (session->reconnect_msg_id != 0) hash_table_remove(&client->connecting, session->reconnect_msg_id, NULL);
+	pthread_mutex_unlock(&client->session_lock);
+
+	free_subscriptions(session->subscriptions);
+	free(session);
+}
+
+/**
+ * session_id_of - id the broker currently knows a session by
+ */
+static uint32_t session_id_of(slimmq_session_t* session) {
+	pthread_mutex_lock(&session->client->session_lock);
+	uint32_t id = session->id;
+	pthread_mutex_unlock(&session->client->session_lock);
+	return id;
+}
+
+void slimmq_session_set_qos(slimmq_session_t* session, uint8_t qos_level) {
+	if (session) session->qos_level = qos_level;
+}
+
+int slimmq_session_subscribe(slimmq_session_t* session, const char* topic) {
+	if (!session || !topic) return -1;
+
+	size_t topic_len = strlen(topic);
+	struct slimmq_session_sub* sub = malloc(sizeof(*sub) + topic_len + 1);
+	if (!sub) return -1;
+	uint8_t qos = session->qos_level;
+	sub->qos = qos;
+	memcpy(sub->topic, topic, topic_len + 1);
+
+	slimmq_client_t* client = session->client;
+	pthread_mutex_lock(&client->session_lock);
+	sub->next = session->subscriptions;
+	session->subscriptions = sub;
+	uint32_t id = session->id;
+	pthread_mutex_unlock(&client->session_lock);
+
+	return subscribe_as(client, id, qos, topic, REPLAY_NONE, 0, NULL);
+}
+
+int slimmq_session_publish(slimmq_session_t* session, const char* topic,
+														const void* data, size_t data_len) {
+	if (!session || !topic) return -1;
+
+	return publish_as(session->client, session_id_of(session), session->qos_level, topic, data, data_len);
+}
+
 int slimmq_receive(slimmq_client_t* client, char* out_topic,
 		size_t topic_buf_size, void* out_data, size_t data_buf_size) {
 	uint8_t buffer[MAX_PACKET_SIZE];
@@ -265,14 +1391,105 @@ int slimmq_next_event(slimmq_client_t* client, char* out_topic,
 	return 0;
 }
 
+int slimmq_next_events(slimmq_client_t* client, slimmq_event_t* events,
+		size_t max_events, int timeout_ms) {
+	if (!client || !events) return -1;
+
+	return event_queue_pop_batch(&client->event_queue, events, max_events, timeout_ms);
+}
+
+int slimmq_get_fd(slimmq_client_t* client) {
+	if (!client) return -1;
+
+	return client->event_queue.event_fd;
+}
+
 void slimmq_set_qos(slimmq_client_t* client, uint8_t qos_level) {
 	if (!client) return;
 
 	client->qos_level = qos_level;
+}
+
+int slimmq_set_flow_control(slimmq_client_t* client, int interval_ms) {
+	if (!client || interval_ms < 0) return -1;
 
-	if (qos_level == QOS_EXACTLY_ONCE) {
-		qos2_table_init();
+	// the listener wakes at least once per period even when no traffic arrives
+	client->credit_interval_ms = interval_ms;
+	if (interval_ms > 0) advertise_credit(client);
+	return 0;
+}
+
+int slimmq_set_keepalive(slimmq_client_t* client, int interval_ms) {
+	if (!client || interval_ms < 0) return -1;
+
+	client->keepalive_interval_ms = interval_ms;
+	return 0;
+}
+
+static void request_sequenced(slimmq_client_t* client, uint32_t session_id) {
+	send_option(client, session_id, CONTROL_SEQUENCED, client->sequenced);
+}
+
+int slimmq_set_sequenced(slimmq_client_t* client, int enable) {
+	if (!client) return -1;
+
+	client->sequenced = enable != 0;
+	for_each_session_id(client, request_sequenced);
+	return 0;
+}
+
+static void request_coalesced_acks(slimmq_client_t* client, uint32_t session_id) {
+	send_option(client, session_id, CONTROL_SACK, client->coalesced_acks);
+}
+
+int slimmq_set_ack_coalescing(slimmq_client_t* client, int enable) {
+	if (!client) return -1;
+
+	client->coalesced_acks = enable != 0;
+	for_each_session_id(client, request_coalesced_acks);
+	return 0;
+}
+
+void slimmq_sack_stats(slimmq_client_t* client, uint64_t* frames, uint64_t* acks) {
+	if (frames) *frames = client ? atomic_load(&client->sack_frames) : 0;
+	if (acks) *acks = client ? atomic_load(&client->sack_acks) : 0;
+}
+
+uint64_t slimmq_stray_acks(slimmq_client_t* client) {
+	return client ? atomic_load(&client->stray_acks) : 0;
+}
+
+uint64_t slimmq_fec_recovered(slimmq_client_t* client) {
+	return client ? atomic_load(&client->fec_recovered) : 0;
+}
+
+int slimmq_set_congestion_control(slimmq_client_t* client, cc_mode_t mode, int max_window) {
+	if (!client || max_window < 0 || max_window > INFLIGHT_TABLE_SIZE) return -1;
+	if (mode != CC_OFF && mode != CC_AIMD && mode != CC_DELAY) return -1;
+
+	pthread_mutex_lock(&client->cc_lock);
+	uint32_t in_flight = client->cc.in_flight;
+	cc_init(&client->cc, mode, max_window ? (uint32_t)max_window : INFLIGHT_TABLE_SIZE);
+	client->cc.in_flight = in_flight;
+	pthread_cond_broadcast(&client->cc_open);
+	pthread_mutex_unlock(&client->cc_lock);
+	return 0;
+}
+
+void slimmq_congestion_stats(slimmq_client_t* client, slimmq_cc_stats_t* out) {
+	if (!out) return;
+	if (!client) {
+		*out = (slimmq_cc_stats_t){ 0 };
+		return;
 	}
+
+	pthread_mutex_lock(&client->cc_lock);
+	out->window = cc_window(&client->cc);
+	out->in_flight = client->cc.in_flight;
+	out->srtt_us = client->cc.srtt_us;
+	out->min_rtt_us = client->cc.min_rtt_us;
+	out->losses = client->cc.losses;
+	pthread_mutex_unlock(&client->cc_lock);
 }
 
 void slimmq_set_retry_policy(slimmq_client_t* client, int timeout_ms, int max_retries) {
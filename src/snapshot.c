@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/snapshot.h"
+#include "../include/topic_table.h"
+#include "../include/pending_table.h"
+#include "../include/session_table.h"
+
+static uint8_t* mapped = NULL;
+static size_t mapped_len = 0;
+
+static uint64_t layout_tag(void) {
+	return ((uint64_t)sizeof(void*) << 48) |
+		((uint64_t)sizeof(pending_client_t) << 24) |
+		((uint64_t)sizeof(session_record_t) << 8) |
+		(uint64_t)sizeof(struct sockaddr_in);
+}
+
+static size_t align8(size_t n) {
+	return (n + 7) & ~(size_t)7;
+}
+
+static int write_all(int fd, const uint8_t* buf, size_t len) {
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n < 0) return -1;
+		buf += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+int snapshot_save(const char* path) {
+	snapshot_header_t header = {
+		.magic = SNAPSHOT_MAGIC,
+		.version = SNAPSHOT_VERSION,
+		.layout = layout_tag(),
+		.topic_off = align8(sizeof(snapshot_header_t)),
+		.topic_len = topic_table_snapshot_write(NULL),
+		.pending_len = pending_table_snapshot_write(NULL),
+		.session_len = session_table_snapshot_write(NULL)
+	};
+	header.pending_off = align8(header.topic_off + header.topic_len);
+	header.session_off = align8(header.pending_off + header.pending_len);
+
+	size_t total = header.session_off + header.session_len;
+	uint8_t* buf = calloc(1, total);
+	if (!buf) return -1;
+
+	memcpy(buf, &header, sizeof(header));
+	topic_table_snapshot_write(buf + header.topic_off);
+	pending_table_snapshot_write(buf + header.pending_off);
+	session_table_snapshot_write(buf + header.session_off);
+
+	char tmp[PATH_MAX];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	int result = -1;
+	if (fd >= 0) {
+		if (write_all(fd, buf, total) == 0 && fsync(fd) == 0) result = 0;
+		close(fd);
+	}
+	free(buf);
+
+	if (result == 0 && rename(tmp, path) < 0) result = -1;
+	if (result < 0) {
+		perror("[SNAPSHOT] save failed");
+		unlink(tmp);
+	}
+	return result;
+}
+
+int snapshot_load(const char* path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return -1;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(snapshot_header_t)) {
+		close(fd);
+		return -1;
+	}
+
+	size_t len = (size_t)st.st_size;
+	uint8_t* image = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED) return -1;
+
+	snapshot_header_t header;
+	memcpy(&header, image, sizeof(header));
+
+	bool valid = header.magic == SNAPSHOT_MAGIC &&
+		header.version == SNAPSHOT_VERSION &&
+		header.layout == layout_tag() &&
+		header.topic_off <= len && header.topic_len <= len - header.topic_off &&
+		header.pending_off <= len && header.pending_len <= len - header.pending_off &&
+		header.session_off <= len && header.session_len <= len - header.session_off;
+
+	// subscriptions and QoS 2 state refer to sessions by id, so sessions come first
+	bool adopted = valid &&
+		session_table_snapshot_adopt(image + header.session_off, header.session_len) == 0;
+
+	// the pending table only fails its bounds check, before linking anything
+	if (adopted && pending_table_snapshot_adopt(image + header.pending_off, header.pending_len) < 0) {
+		session_table_destroy();
+		session_table_init();
+		adopted = false;
+	}
+
+	if (adopted && topic_table_snapshot_adopt(image + header.topic_off, header.topic_len) < 0) {
+		pending_table_destroy();
+		session_table_destroy();
+		session_table_init();
+		adopted = false;
+	}
+
+	if (!adopted) {
+		fprintf(stderr, "[SNAPSHOT] Ignoring unusable snapshot %s\n", path);
+		munmap(image, len);
+		return -1;
+	}
+
+	mapped = image;
+	mapped_len = len;
+	return 0;
+}
+
+void snapshot_release(void) {
+	if (mapped) munmap(mapped, mapped_len);
+	mapped = NULL;
+	mapped_len = 0;
+}
@@ -0,0 +1,85 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../include/stream_table.h"
+#include "../include/topic_registry.h"
+#include "../include/slim_msg.h"
+
+// sequenced topics, id -> stream_t
+static topic_registry_t registry = { .max = STREAM_MAX };
+
+/**
+ * stream_for_topic - find the stream of @topic, creating it on first use
+ *
+ * Return: stream, or NULL if @topic cannot be sequenced
+ */
+static stream_t* stream_for_topic(const char* topic) {
+	stream_t* s = topic_registry_find(&registry, topic);
+	if (s) return s;
+
+	s = calloc(1, sizeof(stream_t));
+	if (!s) return NULL;
+	s->id = topic_registry_add(&registry, topic, s);
+	if (s->id == 0) {
+		free(s);
+		return NULL;
+	}
+	s->next_seq = 1;
+	return s;
+}
+
+void stream_table_init(void) {
+	topic_registry_clear(&registry);
+}
+
+void stream_table_destroy(void) {
+	for (uint16_t id = 1; id <= registry.count; ++id) {
+		stream_t* s = topic_registry_get(&registry, id);
+		for (size_t i = 0; i < STREAM_RING_SIZE; ++i) free(s->ring[i].packet);
+		free(s);
+	}
+	topic_registry_clear(&registry);
+}
+
+int stream_table_stamp(const char* topic, uint8_t* packet, size_t len) {
+	stream_t* s = stream_for_topic(topic);
+	if (!s) return -1;
+
+	uint32_t seq = s->next_seq;
+	stream_slot_t* slot = &s->ring[seq % STREAM_RING_SIZE];
+	if (len > slot->capacity) {
+		uint8_t* grown = realloc(slot->packet, len);
+		if (!grown) return -1;
+		slot->packet = grown;
+		slot->capacity = len;
+	}
+
+	slim_msg_header_t hdr;
+	memcpy(&hdr, packet, sizeof(hdr));
+	hdr.qos_level = QOS_AT_LEAST_ONCE;
+	hdr.topic_id = s->id;
+	hdr.msg_id = seq;
+	hdr.session_id = 0;
+	memcpy(packet, &hdr, sizeof(hdr));
+
+	memcpy(slot->packet, packet, len);
+	slot->len = len;
+	slot->seq = seq;
+	s->next_seq++;
+	if (s->next_seq == 0) s->next_seq = 1;		// 0 never names a delivery
+	return 0;
+}
+
+const uint8_t* stream_table_lookup(uint16_t id, uint32_t seq, size_t* len) {
+	const stream_t* s = topic_registry_get(&registry, id);
+	if (!s || seq == 0) return NULL;
+
+	const stream_slot_t* slot = &s->ring[seq % STREAM_RING_SIZE];
+	if (!slot->packet || slot->seq != seq) return NULL;
+
+	*len = slot->len;
+	return slot->packet;
+}
+
+size_t stream_table_count(void) {
+	return registry.count;
+}
@@ -0,0 +1,124 @@
+#include <string.h>
+#include "../include/timer_wheel.h"
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+static void slot_insert(timer_node_t** slot, timer_node_t* t) {
+	t->slot = slot;
+	t->prev = NULL;
+	t->next = *slot;
+	if (*slot) (*slot)->prev = t;
+	*slot = t;
+}
+
+static void slot_unlink(timer_node_t** slot, timer_node_t* t) {
+	if (t->prev) t->prev->next = t->next;
+	else *slot = t->next;
+	if (t->next) t->next->prev = t->prev;
+	t->prev = t->next = NULL;
+	t->slot = NULL;
+}
+
+/**
+ * slot_of - slot a timer belongs to, chosen by how far away its expiry is
+ */
+static timer_node_t** slot_of(timer_wheel_t* w, uint64_t expires_tick) {
+	uint64_t delta = expires_tick > w->now_tick ? expires_tick - w->now_tick : 0;
+
+	for (int level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+		if (delta < ((uint64_t)1 << (TIMER_WHEEL_BITS * (level + 1)))) {
+			size_t idx = (expires_tick >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK;
+			return &w->slots[level][idx];
+		}
+	}
+
+	// beyond the wheel's range: park in the farthest slot, re-cascaded when reached
+	int top = TIMER_WHEEL_LEVELS - 1;
+	size_t idx = ((w->now_tick >> (TIMER_WHEEL_BITS * top)) - 1) & SLOT_MASK;
+	return &w->slots[top][idx];
+}
+
+static void place(timer_wheel_t* w, timer_node_t* t) {
+	// already due: fire on the next processed tick rather than a revolution later
+	if (t->expires_tick < w->now_tick) t->expires_tick = w->now_tick;
+	slot_insert(slot_of(w, t->expires_tick), t);
+}
+
+void timer_wheel_init(timer_wheel_t* w, uint64_t now_ms) {
+	memset(w, 0, sizeof(*w));
+	w->now_tick = now_ms / TIMER_WHEEL_TICK_MS;
+}
+
+void timer_wheel_add(timer_wheel_t* w, timer_node_t* t, uint64_t expires_ms, timer_fn fn) {
+	timer_wheel_cancel(w, t);
+
+	// round up so a timer never fires early
+	t->expires_tick = (expires_ms + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+	t->fn = fn;
+	t->armed = true;
+	w->count++;
+	place(w, t);
+}
+
+void timer_wheel_cancel(timer_wheel_t* w, timer_node_t* t) {
+	if (!t->armed) return;
+
+	slot_unlink(t->slot, t);
+	t->armed = false;
+	w->count--;
+}
+
+/**
+ * cascade - move the timers of one upper-level slot down to where they belong now
+ */
+static void cascade(timer_wheel_t* w, int level) {
+	size_t idx = (w->now_tick >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK;
+	timer_node_t* t = w->slots[level][idx];
+	w->slots[level][idx] = NULL;
+
+	while (t) {
+		timer_node_t* next = t->next;
+		place(w, t);
+		t = next;
+	}
+
+	if (idx == 0 && level + 1 < TIMER_WHEEL_LEVELS) cascade(w, level + 1);
+}
+
+void timer_wheel_advance(timer_wheel_t* w, uint64_t now_ms) {
+	uint64_t target = now_ms / TIMER_WHEEL_TICK_MS;
+
+	while (w->now_tick <= target) {
+		size_t idx = w->now_tick & SLOT_MASK;
+		if (idx == 0) cascade(w, 1);
+
+		timer_node_t** slot = &w->slots[0][idx];
+		while (*slot) {
+			timer_node_t* t = *slot;
+			slot_unlink(slot, t);
+			t->armed = false;
+			w->count--;
+			t->fn(t);
+		}
+
+		if (w->count == 0) {
+			w->now_tick = target + 1;
+			break;
+		}
+		w->now_tick++;
+	}
+}
+
+int timer_wheel_next_timeout_ms(const timer_wheel_t* w, uint64_t now_ms) {
+	if (w->count == 0) return -1;
+
+	uint64_t now_tick = now_ms / TIMER_WHEEL_TICK_MS;
+	uint64_t tick = w->now_tick;
+	if (tick <= now_tick) return 0;
+
+	for (size_t n = 0; n < TIMER_WHEEL_SLOTS; ++n, ++tick) {
+		// a level-0 wrap cascades upper levels, so wake up then at the latest
+		if (w->slots[0][tick & SLOT_MASK] || (tick & SLOT_MASK) == 0) break;
+	}
+	return (int)(tick * TIMER_WHEEL_TICK_MS - now_ms);
+}
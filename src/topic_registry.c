@@ -0,0 +1,53 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../include/topic_registry.h"
+
+static uint64_t topic_key(const char* topic) {
+	uint64_t key = 14695981039346656037ULL;
+	for (const char* c = topic; *c; ++c) key = (key ^ (uint8_t)*c) * 1099511628211ULL;
+	return key;
+}
+
+void* topic_registry_find(topic_registry_t* r, const char* topic) {
+	uint64_t* id = hash_table_find(&r->by_topic, topic_key(topic));
+	if (!id) return NULL;
+
+	const topic_registry_entry_t* e = &r->entries[*id];
+	return strcmp(e->topic, topic) == 0 ? e->value : NULL;
+}
+
+uint16_t topic_registry_add(topic_registry_t* r, const char* topic, void* value) {
+	if (r->count == r->max) return 0;
+
+	uint64_t key = topic_key(topic);
+	if (hash_table_find(&r->by_topic, key)) return 0;
+
+	if (!r->entries) {
+		r->entries = calloc((size_t)r->max + 1, sizeof(topic_registry_entry_t));
+		if (!r->entries) return 0;
+	}
+
+	uint16_t id = r->count + 1;
+	char* copy = strdup(topic);
+	if (!copy || hash_table_put(&r->by_topic, key, id) < 0) {
+		free(copy);
+		return 0;
+	}
+
+	r->entries[id] = (topic_registry_entry_t){ .topic = copy, .value = value };
+	r->count = id;
+	return id;
+}
+
+void* topic_registry_get(const topic_registry_t* r, uint16_t id) {
+	if (id == 0 || id > r->count) return NULL;
+	return r->entries[id].value;
+}
+
+void topic_registry_clear(topic_registry_t* r) {
+	for (uint16_t id = 1; id <= r->count; ++id) free(r->entries[id].topic);
+	free(r->entries);
+	r->entries = NULL;
+	r->count = 0;
+	hash_table_destroy(&r->by_topic);
+}
@@ -6,86 +6,200 @@
 #include <arpa/inet.h>
 #include "../include/topic_table.h"
 
-typedef struct subscriber_list_entry {
-	struct sockaddr_in addr;
-	struct subscriber_list_entry* next;
-} subscriber_list_entry;
+struct retain_node;
+
+/**
+ * retained_msg - one retained message, allocated together with its payload
+ *
+ * Messages of a topic form a singly linked list from oldest to newest. All
+ * retained messages are also kept in one broker-wide list in store order, so
+ * the globally oldest message (always the head of its topic) is evicted first
+ * when the memory budget is exceeded.
+ */
+typedef struct retained_msg {
+	struct retain_node* node;
+	struct retained_msg* node_next;
+	struct retained_msg* lru_prev;
+	struct retained_msg* lru_next;
+	uint8_t qos;
+	size_t len;
+	uint8_t data[];
+} retained_msg;
+
+/**
+ * share_group - members of one shared subscription ($share/<name>/<filter>)
+ *
+ * Every message matching the filter goes to a single member, picked by the
+ * policy configured for the group name (round-robin unless configured).
+ */
+typedef struct share_group {
+	char* name;
+	Subscriber* members;
+	size_t member_count;
+	size_t member_capacity;
+	uint32_t cursor;									// next member in round-robin order
+} share_group;
 
 typedef struct topic_node {
 	char* segment;
 	struct topic_node** children;
 	size_t child_count;
 
-	subscriber_list_entry* subscribers;
-} topic_node;
+	Subscriber* subscribers;					// sessions subscribed to this exact filter
+	size_t subscriber_count;
+	size_t subscriber_capacity;
 
-static topic_node* topic_root = NULL;
+	share_group* groups;							// shared subscriptions of this exact filter
+	size_t group_count;
+} topic_node;
 
 /**
- * remove_duplicates - 
+ * retain_node - one topic level of the retained message trie
+ *
+ * Retained messages live in their own trie of concrete topics, apart from
+ * the subscription filters, so that every node can be charged to the
+ * retention budget and removed once it holds neither messages nor children.
  */
-void remove_duplicates(SubscriberList* list) {
-	Subscriber* prev = NULL;
-	Subscriber* curr = list->head;
+typedef struct retain_node {
+	char* segment;
+	struct retain_node* parent;
+	struct retain_node** children;
+	size_t child_count;
 
-	while(curr) {
-		Subscriber* runner = list->head;
-		bool found_duplicate = false;
+	retained_msg* retained_head;
+	retained_msg* retained_tail;
+	size_t retained_count;
+} retain_node;
 
-		while(runner != curr) {
-			if (memcmp(&runner->addr, &curr->addr, sizeof(struct sockaddr_in)) == 0) {
-				found_duplicate = true;
-				break;
-			}
-			runner = runner->next;
-		}
+typedef struct share_rule {
+	char* group;
+	share_policy_t policy;
+	struct share_rule* next;
+} share_rule;
 
-		if (found_duplicate) {
-			Subscriber* temp = curr;
-			curr = curr->next;
-			if (prev) prev->next = curr;
-			else list->head = curr;
-			free(temp);
-			list->count--;
-		} else {
-			prev = curr;
-			curr = curr->next;
-		}
-	}
+typedef struct retain_rule {
+	char* filter;
+	size_t depth;
+	struct retain_rule* next;
+} retain_rule;
+
+#define MAX_RETAIN_TOPIC_LEN 256
+
+static topic_node* topic_root = NULL;
+static retain_node* retain_root = NULL;
+
+static retain_rule* retain_rules = NULL;
+static share_rule* share_rules = NULL;
+static share_load_cb share_load = NULL;
+static void* share_load_ctx = NULL;
+static retained_msg* retained_oldest = NULL;
+static retained_msg* retained_newest = NULL;
+static size_t retained_bytes = 0;						// messages and the retain nodes holding them
+static size_t retained_budget = RETAIN_DEFAULT_BUDGET;
+
+// snapshot image adopted by topic_table_snapshot_adopt(), its objects are never freed
+static const uint8_t* arena_base = NULL;
+static size_t arena_len = 0;
+
+static bool in_arena(const void* p) {
+	return arena_base && (const uint8_t*)p >= arena_base && (const uint8_t*)p < arena_base + arena_len;
+}
+
+/**
+ * release - free a trie object unless it lives in the adopted snapshot image
+ */
+static void release(void* p) {
+	if (!in_arena(p)) free(p);
 }
 
 /**
- * is_in_list - Check if given address is in subscriber list
+ * find_in_list - Find a session in a routing result
  *
- * @list: subscriber list to check
- * @addr: finding address
+ * @list: routing result to check
+ * @session: session id to find
  *
- * Return: true if in list, false otherwise
+ * Return: matching entry if in list, NULL otherwise
  */
-static bool is_in_list(SubscriberList* list, const struct sockaddr_in* addr) {
-	for (Subscriber* s = list->head; s != NULL; s = s->next) {
-		if (memcmp(&s->addr, addr, sizeof(struct sockaddr_in)) == 0) {
-			return true;
-		}
+static Subscriber* find_in_list(SubscriberList* list, uint32_t session) {
+	for (size_t i = 0; i < list->count; ++i) {
+		if (list->items[i].session == session) return &list->items[i];
 	}
-	return false;
+	return NULL;
 }
 
 /**
- * is_duplicate_subscriber - Check if the subscriber already exists in the list
+ * find_subscriber_entry - Find the subscription of a session in a subscriber array
  *
- * @list: subscriber_list_entry* (linked list of subscribers)
- * @addr: address of the subscriber to check
+ * @items: subscribers of one filter, or members of one shared group
+ * @count: number of entries in @items
+ * @session: session id to find
+ *
+ * Return: existing entry if subscribed, NULL otherwise
+ */
+static Subscriber* find_subscriber_entry(Subscriber* items, size_t count, uint32_t session) {
+	for (size_t i = 0; i < count; ++i) {
+		if (items[i].session == session) return &items[i];
+	}
+	return NULL;
+}
+
+/**
+ * retain_node_cost - bytes a retain node is charged against the budget
  *
- * Return: true if duplicate, false otherwise
+ * Covers the node, its segment and its slot in the parent's child array.
  */
-static bool is_duplicate_subscriber(subscriber_list_entry* list, const struct sockaddr_in* addr) {
-	for (; list != NULL; list = list->next) {
-		if (memcmp(&list->addr, addr, sizeof(struct sockaddr_in)) == 0) {
-			return true;
+static size_t retain_node_cost(const retain_node* node) {
+	return sizeof(retain_node) + strlen(node->segment) + 1 + sizeof(retain_node*);
+}
+
+/**
+ * prune_retain_node - free a retain node left empty, and its ancestors left empty by it
+ */
+static void prune_retain_node(retain_node* node) {
+	while (node != retain_root && node->retained_head == NULL && node->child_count == 0) {
+		retain_node* parent = node->parent;
+		for (size_t i = 0; i < parent->child_count; ++i) {
+			if (parent->children[i] == node) {
+				parent->children[i] = parent->children[--parent->child_count];
+				break;
+			}
 		}
+		if (parent->child_count == 0) {
+			free(parent->children);
+			parent->children = NULL;
+		}
+
+		retained_bytes -= retain_node_cost(node);
+		free(node->segment);
+		free(node->children);
+		free(node);
+		node = parent;
 	}
-	return false;
+}
+
+/**
+ * evict_retained - drop the oldest retained message of its topic
+ *
+ * The topic's node is pruned once its history is empty.
+ *
+ * @msg: message to drop (always the head of its topic's history)
+ */
+static void evict_retained(retained_msg* msg) {
+	retain_node* node = msg->node;
+
+	node->retained_head = msg->node_next;
+	if (!node->retained_head) node->retained_tail = NULL;
+	node->retained_count--;
+
+	if (msg->lru_prev) msg->lru_prev->lru_next = msg->lru_next;
+	else retained_oldest = msg->lru_next;
+	if (msg->lru_next) msg->lru_next->lru_prev = msg->lru_prev;
+	else retained_newest = msg->lru_prev;
+
+	retained_bytes -= sizeof(retained_msg) + msg->len;
+	free(msg);
+
+	if (!node->retained_head) prune_retain_node(node);
 }
 
 /**
@@ -94,6 +208,9 @@ static bool is_duplicate_subscriber(subscriber_list_entry* list, const struct so
 void init_topic_table(void) {
 	topic_root = calloc(1, sizeof(topic_node));
 	topic_root->segment = strdup("");
+
+	retain_root = calloc(1, sizeof(retain_node));
+	retain_root->segment = strdup("");
 }
 
 /**
@@ -103,25 +220,93 @@ void init_topic_table(void) {
  */
 void free_subscriber_list(SubscriberList* list) {
 	if (!list) return;
-	Subscriber* cur = list->head;
-	while(cur) {
-		Subscriber* next = cur->next;
-		free(cur);
-		cur = next;
-	}
+	free(list->items);
 	free(list);
 }
 
 /**
- * add_subscriber - add subscriber node to list internally
+ * append_subscriber - append an entry to a subscriber array, doubling it when full
+ *
+ * Arrays inside the adopted snapshot image are copied out instead of realloc()ed.
+ *
+ * Return: 0 on success, -1 on allocation failure
+ */
+static int append_subscriber(Subscriber** items, size_t* count, size_t* capacity,
+															uint32_t session, uint8_t qos) {
+	if (*count == *capacity) {
+		size_t grown = *capacity ? *capacity * 2 : 4;
+		Subscriber* resized;
+		if (in_arena(*items)) {
+			resized = malloc(sizeof(Subscriber) * grown);
+			if (resized) memcpy(resized, *items, sizeof(Subscriber) * *count);
+		} else {
+			resized = realloc(*items, sizeof(Subscriber) * grown);
+		}
+		if (!resized) return -1;
+
+		*items = resized;
+		*capacity = grown;
+	}
+
+	(*items)[*count].session = session;
+	(*items)[*count].qos = qos;
+	(*items)[*count].shared = false;
+	(*count)++;
+	return 0;
+}
+
+/**
+ * subscribe_entry - add a session to a subscriber array, or update its QoS if present
+ *
+ * Return: 0 on success, -1 on allocation failure
  */
-static void add_subscriber(subscriber_list_entry** list, const struct sockaddr_in* addr) {
-	subscriber_list_entry* node = calloc(1, sizeof(subscriber_list_entry));
-	memcpy(&node->addr, addr, sizeof(struct sockaddr_in));
-	node->next = *list;
-	*list = node;
+static int subscribe_entry(Subscriber** items, size_t* count, size_t* capacity,
+														uint32_t session, uint8_t qos) {
+	Subscriber* existing = find_subscriber_entry(*items, *count, session);
+	if (existing) {
+		existing->qos = qos;
+		return 0;
+	}
+	return append_subscriber(items, count, capacity, session, qos);
 }
 
+/**
+ * find_or_create_group - return or create the shared group @name of a node
+ *
+ * @node: node of the group's filter
+ * @name: group name, not NUL-terminated
+ * @name_len: length of @name
+ *
+ * Return: group, or NULL on allocation failure
+ */
+static share_group* find_or_create_group(topic_node* node, const char* name, size_t name_len) {
+	for (size_t i = 0; i < node->group_count; ++i) {
+		share_group* g = &node->groups[i];
+		if (strncmp(g->name, name, name_len) == 0 && g->name[name_len] == '\0') return g;
+	}
+
+	char* copy = strndup(name, name_len);
+	if (!copy) return NULL;
+
+	share_group* grown;
+	if (in_arena(node->groups)) {
+		// copy-on-grow: arrays inside the snapshot image cannot be realloc()ed
+		grown = malloc(sizeof(share_group) * (node->group_count + 1));
+		if (grown) memcpy(grown, node->groups, sizeof(share_group) * node->group_count);
+	} else {
+		grown = realloc(node->groups, sizeof(share_group) * (node->group_count + 1));
+	}
+	if (!grown) {
+		free(copy);
+		return NULL;
+	}
+
+	node->groups = grown;
+	share_group* g = &node->groups[node->group_count++];
+	memset(g, 0, sizeof(*g));
+	g->name = copy;
+	return g;
+}
 
 /**
  * find_or_create_child - return or create child node that has given segment
@@ -140,7 +325,15 @@ static topic_node* find_or_create_child(topic_node* parent, const char* segment)
 
 	topic_node* child = calloc(1, sizeof(topic_node));
 	child->segment = strdup(segment);
-	parent->children = realloc(parent->children, sizeof(topic_node*) * (parent->child_count + 1));
+
+	if (in_arena(parent->children)) {
+		// copy-on-grow: arrays inside the snapshot image cannot be realloc()ed
+		topic_node** grown = malloc(sizeof(topic_node*) * (parent->child_count + 1));
+		memcpy(grown, parent->children, sizeof(topic_node*) * parent->child_count);
+		parent->children = grown;
+	} else {
+		parent->children = realloc(parent->children, sizeof(topic_node*) * (parent->child_count + 1));
+	}
 	parent->children[parent->child_count++] = child;
 	return child;
 }
@@ -175,14 +368,41 @@ static char** split_topic(const char* topic, int* count_out) {
 }
 
 /**
- * subscribe_topic - register subscriber to MQTT styled topic
+ * subscribe_topic - register QoS 0 subscriber to MQTT styled topic
  *
  * @topic_str: string of subscribe topic (ex: "sensor/+/temp")
- * @addr: address information of subscriber
+ * @session: broker session id of the subscriber
  *
  * Return: 0 on success
  */
-int subscribe_topic(const char* topic_str, const struct sockaddr_in* addr) {
+int subscribe_topic(const char* topic_str, uint32_t session) {
+	return subscribe_topic_qos(topic_str, session, 0);
+}
+
+/**
+ * subscribe_topic_qos - register subscriber to MQTT styled topic with a QoS level
+ *
+ * Subscribing again with the same filter updates the granted QoS. A filter of
+ * the form "$share/<group>/<filter>" joins the shared group instead, so each
+ * message matching <filter> reaches only one of the group's members.
+ *
+ * @topic_str: string of subscribe topic (ex: "sensor/+/temp")
+ * @session: broker session id of the subscriber
+ * @qos: maximum QoS the subscriber wants deliveries at
+ *
+ * Return: 0 on success, -1 on a malformed shared filter or allocation failure
+ */
+int subscribe_topic_qos(const char* topic_str, uint32_t session, uint8_t qos) {
+	const char* group = NULL;
+	size_t group_len = 0;
+	if (topic_is_shared(topic_str)) {
+		group = topic_str + SHARE_PREFIX_LEN;
+		const char* slash = strchr(group, '/');
+		if (!slash || slash == group || slash[1] == '\0') return -1;
+		group_len = slash - group;
+		topic_str = slash + 1;
+	}
+
 	int depth = 0;
 	char** segments = split_topic(topic_str, &depth);
 
@@ -191,13 +411,174 @@ int subscribe_topic(const char* topic_str, const struct sockaddr_in* addr) {
 		curr = find_or_create_child(curr, segments[i]);
 	}
 
-	if (!is_duplicate_subscriber(curr->subscribers, addr)) {
-		add_subscriber(&curr->subscribers, addr);
+	int result = -1;
+	if (!group) {
+		result = subscribe_entry(&curr->subscribers, &curr->subscriber_count,
+															&curr->subscriber_capacity, session, qos);
+	} else {
+		share_group* shared = find_or_create_group(curr, group, group_len);
+		if (shared) {
+			result = subscribe_entry(&shared->members, &shared->member_count,
+																&shared->member_capacity, session, qos);
+		}
 	}
 
 	for(int i = 0; i < depth; ++i) free(segments[i]);
 	free(segments);
-	return 0;
+	return result;
+}
+
+/**
+ * remove_matching - compact a subscriber array in place, dropping sessions selected by @match
+ *
+ * Return: number of entries removed
+ */
+static size_t remove_matching(Subscriber** items, size_t* count, size_t* capacity,
+															session_match_cb match, void* ctx) {
+	size_t kept = 0;
+	for (size_t i = 0; i < *count; ++i) {
+		if (!match((*items)[i].session, ctx)) (*items)[kept++] = (*items)[i];
+	}
+
+	size_t removed = *count - kept;
+	*count = kept;
+	if (kept == 0 && *items) {
+		release(*items);
+		*items = NULL;
+		*capacity = 0;
+	}
+	return removed;
+}
+
+/**
+ * remove_sessions_recursive - drop matching subscribers and group members from a subtree
+ *
+ * Shared groups left without members are removed.
+ *
+ * Return: number of subscriptions removed
+ */
+static size_t remove_sessions_recursive(topic_node* node, session_match_cb match, void* ctx) {
+	size_t removed = remove_matching(&node->subscribers, &node->subscriber_count,
+																		&node->subscriber_capacity, match, ctx);
+
+	size_t kept = 0;
+	for (size_t i = 0; i < node->group_count; ++i) {
+		share_group* g = &node->groups[i];
+		removed += remove_matching(&g->members, &g->member_count, &g->member_capacity, match, ctx);
+		if (g->member_count == 0) {
+			release(g->name);
+			continue;
+		}
+		node->groups[kept++] = *g;
+	}
+	node->group_count = kept;
+
+	for (size_t i = 0; i < node->child_count; ++i) {
+		removed += remove_sessions_recursive(node->children[i], match, ctx);
+	}
+	return removed;
+}
+
+/**
+ * topic_table_remove_sessions - drop every subscription of the sessions selected by @match
+ *
+ * Walks the trie once however many sessions are removed, so a batch of
+ * expired sessions costs a single pass.
+ *
+ * @match: returns true for sessions whose subscriptions are removed
+ * @ctx: passed to @match
+ *
+ * Return: number of subscriptions removed
+ */
+size_t topic_table_remove_sessions(session_match_cb match, void* ctx) {
+	if (!topic_root) return 0;
+	return remove_sessions_recursive(topic_root, match, ctx);
+}
+
+/**
+ * merge_subscriber - add a routing target, keeping one entry per session at its highest QoS
+ */
+static void merge_subscriber(SubscriberList* result, const Subscriber* s, bool shared) {
+	Subscriber* found = find_in_list(result, s->session);
+	if (!found) {
+		if (append_subscriber(&result->items, &result->count, &result->capacity, s->session, s->qos) == 0) {
+			result->items[result->count - 1].shared = shared;
+		}
+		return;
+	}
+	if (s->qos > found->qos) found->qos = s->qos;
+	found->shared = found->shared && shared;
+}
+
+/**
+ * mix - splitmix64 finalizer
+ */
+static uint64_t mix(uint64_t key) {
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebULL;
+	key ^= key >> 31;
+	return key;
+}
+
+/**
+ * share_policy_for - selection policy of a shared group (latest matching rule wins)
+ */
+static share_policy_t share_policy_for(const char* group) {
+	for (share_rule* r = share_rules; r != NULL; r = r->next) {
+		if (strcmp(r->group, group) == 0) return r->policy;
+	}
+	return SHARE_ROUND_ROBIN;
+}
+
+/**
+ * pick_member - select the member of a shared group that receives a message
+ *
+ * Key-hash uses rendezvous hashing on the published topic, so every topic
+ * sticks to one member (preserving its order) and a member leaving only moves
+ * the topics it owned. Least-loaded asks the load probe and breaks ties in
+ * round-robin order; without a probe it is plain round-robin.
+ *
+ * @g: shared group
+ * @topic_str: published topic
+ *
+ * Return: selected member, or NULL if the group is empty
+ */
+static const Subscriber* pick_member(share_group* g, const char* topic_str) {
+	if (g->member_count == 0) return NULL;
+
+	share_policy_t policy = share_policy_for(g->name);
+	if (policy == SHARE_KEY_HASH) {
+		uint64_t key = 14695981039346656037ULL;		// FNV-1a of the topic
+		for (const char* c = topic_str; *c; ++c) key = (key ^ (uint8_t)*c) * 1099511628211ULL;
+
+		size_t best = 0;
+		uint64_t best_score = 0;
+		for (size_t i = 0; i < g->member_count; ++i) {
+			uint64_t score = mix(key ^ mix(g->members[i].session));
+			if (i == 0 || score > best_score) {
+				best = i;
+				best_score = score;
+			}
+		}
+		return &g->members[best];
+	}
+
+	size_t pick = g->cursor % g->member_count;
+	if (policy == SHARE_LEAST_LOADED && share_load) {
+		size_t best_load = SIZE_MAX;
+		for (size_t n = 0; n < g->member_count; ++n) {
+			size_t i = (g->cursor + n) % g->member_count;
+			size_t load = share_load(g->members[i].session, share_load_ctx);
+			if (load < best_load) {
+				pick = i;
+				best_load = load;
+			}
+		}
+	}
+	g->cursor = (uint32_t)(pick + 1);
+	return &g->members[pick];
 }
 
 /**
@@ -207,21 +588,19 @@ int subscribe_topic(const char* topic_str, const struct sockaddr_in* addr) {
  * @segments: segment array of topic path
  * @depth: segment count
  * @level: current searching level
+ * @topic_str: published topic, the key of key-hash shared groups
  * @result: result for subscriber list
  */
-static void match_recursive(topic_node* node, char** segments, int depth, int level, SubscriberList* result) {
+static void match_recursive(topic_node* node, char** segments, int depth, int level,
+														const char* topic_str, SubscriberList* result) {
 	if (!node) return;
 	if (level == depth || strcmp(node->segment, "#") == 0) {
-		subscriber_list_entry* s = node->subscribers;
-		while(s) {
-			if (!is_in_list(result, &s->addr)) {
-				Subscriber* copy = calloc(1, sizeof(Subscriber));
-				memcpy(&copy->addr, &s->addr, sizeof(struct sockaddr_in));
-				copy->next = result->head;
-				result->head = copy;
-				result->count++;
-			}
-			s = s->next;
+		for (size_t i = 0; i < node->subscriber_count; ++i) {
+			merge_subscriber(result, &node->subscribers[i], false);
+		}
+		for (size_t i = 0; i < node->group_count; ++i) {
+			const Subscriber* member = pick_member(&node->groups[i], topic_str);
+			if (member) merge_subscriber(result, member, true);
 		}
 	}
 
@@ -232,7 +611,7 @@ static void match_recursive(topic_node* node, char** segments, int depth, int le
 		if (strcmp(child->segment, segments[level]) == 0 ||
 		    strcmp(child->segment, "+") == 0 ||
 		    strcmp(child->segment, "#") == 0) {
-			match_recursive(child, segments, depth, level + 1, result);
+			match_recursive(child, segments, depth, level + 1, topic_str, result);
 		}
 	}
 }
@@ -249,16 +628,380 @@ SubscriberList* get_matching_subscribers(const char* topic_str) {
 	char** segments = split_topic(topic_str, &depth);
 
 	SubscriberList* list = calloc(1, sizeof(SubscriberList));
-	match_recursive(topic_root, segments, depth, 0, list);
+	match_recursive(topic_root, segments, depth, 0, topic_str, list);
 
 	for (int i = 0; i < depth; ++i) free(segments[i]);
 	free(segments);
 
-	remove_duplicates(list);
-
 	return list;
 }
 
+/**
+ * topic_matches_filter - check a published topic against a subscription filter
+ *
+ * '+' matches exactly one segment, '#' matches the remaining segments
+ * (including none, so "a/#" matches "a").
+ *
+ * @filter: subscription filter (ex: "sensor/+/temp")
+ * @topic: concrete topic (ex: "sensor/room1/temp")
+ *
+ * Return: true if @topic matches @filter
+ */
+bool topic_matches_filter(const char* filter, const char* topic) {
+	const char* f = filter;
+	const char* t = topic;
+
+	while (true) {
+		size_t f_len = strcspn(f, "/");
+		if (f_len == 1 && f[0] == '#') return true;
+
+		size_t t_len = strcspn(t, "/");
+		bool any = (f_len == 1 && f[0] == '+');
+		if (!any && (f_len != t_len || strncmp(f, t, f_len) != 0)) return false;
+
+		bool f_last = (f[f_len] == '\0');
+		bool t_last = (t[t_len] == '\0');
+		if (f_last || t_last) {
+			if (f_last && t_last) return true;
+			// topic exhausted: only a trailing "#" can still match
+			return t_last && strcmp(f + f_len + 1, "#") == 0;
+		}
+
+		f += f_len + 1;
+		t += t_len + 1;
+	}
+}
+
+/**
+ * topic_filter_covers - check that every topic matching @inner also matches @outer
+ *
+ * @outer: broader subscription filter (ex: "sensor/#")
+ * @inner: filter whose topics are checked (ex: "sensor/+/temp")
+ *
+ * Return: true if @outer matches a superset of the topics of @inner
+ */
+bool topic_filter_covers(const char* outer, const char* inner) {
+	const char* o = outer;
+	const char* i = inner;
+
+	while (true) {
+		size_t o_len = strcspn(o, "/");
+		size_t i_len = strcspn(i, "/");
+		if (o_len == 1 && o[0] == '#') return true;
+		if (i_len == 1 && i[0] == '#') return false;
+
+		bool any = (o_len == 1 && o[0] == '+');
+		if (!any && (o_len != i_len || strncmp(o, i, o_len) != 0)) return false;
+
+		bool o_last = (o[o_len] == '\0');
+		bool i_last = (i[i_len] == '\0');
+		if (o_last || i_last) {
+			if (o_last && i_last) return true;
+			// "a/#" also matches "a", so it covers an inner filter that ends here
+			return i_last && strcmp(o + o_len + 1, "#") == 0;
+		}
+
+		o += o_len + 1;
+		i += i_len + 1;
+	}
+}
+
+/**
+ * topic_is_shared - check whether a subscription filter is a shared subscription
+ *
+ * @filter: subscription filter as sent by the client
+ *
+ * Return: true for "$share/<group>/<filter>"
+ */
+bool topic_is_shared(const char* filter) {
+	return strncmp(filter, SHARE_PREFIX, SHARE_PREFIX_LEN) == 0;
+}
+
+/**
+ * topic_share_configure - select how members of shared group @group are picked
+ *
+ * @group: group name as used in "$share/<group>/<filter>"
+ * @policy: selection policy for every filter the group subscribes to
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int topic_share_configure(const char* group, share_policy_t policy) {
+	share_rule* rule = calloc(1, sizeof(share_rule));
+	if (!rule) return -1;
+
+	rule->group = strdup(group);
+	if (!rule->group) {
+		free(rule);
+		return -1;
+	}
+	rule->policy = policy;
+	rule->next = share_rules;
+	share_rules = rule;
+	return 0;
+}
+
+/**
+ * topic_share_set_load_probe - set how least-loaded groups measure a member's load
+ *
+ * @cb: returns the outstanding work of a session, or NULL to disable
+ * @ctx: passed to @cb
+ */
+void topic_share_set_load_probe(share_load_cb cb, void* ctx) {
+	share_load = cb;
+	share_load_ctx = ctx;
+}
+
+/**
+ * topic_retain_configure - retain the last @depth messages of topics matching @filter
+ *
+ * @filter: topic filter the rule applies to (ex: "config/#")
+ * @depth: number of messages kept per topic, 0 to disable retention
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int topic_retain_configure(const char* filter, size_t depth) {
+	retain_rule* rule = calloc(1, sizeof(retain_rule));
+	if (!rule) return -1;
+
+	rule->filter = strdup(filter);
+	rule->depth = depth;
+	rule->next = retain_rules;
+	retain_rules = rule;
+	return 0;
+}
+
+/**
+ * topic_retain_set_budget - set the hard cap on retained message memory
+ *
+ * @max_bytes: budget covering payloads, per-message bookkeeping and topic nodes
+ */
+void topic_retain_set_budget(size_t max_bytes) {
+	retained_budget = max_bytes;
+	while (retained_bytes > retained_budget && retained_oldest) {
+		evict_retained(retained_oldest);
+	}
+}
+
+/**
+ * retain_depth_for - history depth configured for a topic (latest matching rule wins)
+ */
+static size_t retain_depth_for(const char* topic_str) {
+	for (retain_rule* r = retain_rules; r != NULL; r = r->next) {
+		if (topic_matches_filter(r->filter, topic_str)) return r->depth;
+	}
+	return 0;
+}
+
+/**
+ * find_retain_child - return the child of a retain node that has given segment
+ *
+ * Return: child node, or NULL if there is none
+ */
+static retain_node* find_retain_child(retain_node* parent, const char* segment) {
+	for (size_t i = 0; i < parent->child_count; ++i) {
+		if (strcmp(parent->children[i]->segment, segment) == 0) {
+			return parent->children[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * find_or_create_retain_child - return or create the child of a retain node
+ *
+ * A created node is charged to the retention budget at once.
+ *
+ * Return: child node, or NULL on allocation failure (empty ancestors are pruned)
+ */
+static retain_node* find_or_create_retain_child(retain_node* parent, const char* segment) {
+	retain_node* child = find_retain_child(parent, segment);
+	if (child) return child;
+
+	child = calloc(1, sizeof(retain_node));
+	retain_node** grown = realloc(parent->children, sizeof(retain_node*) * (parent->child_count + 1));
+	if (child) child->segment = strdup(segment);
+	if (!child || !child->segment || !grown) {
+		if (child) free(child->segment);
+		free(child);
+		if (grown) parent->children = grown;
+		prune_retain_node(parent);
+		return NULL;
+	}
+
+	child->parent = parent;
+	parent->children = grown;
+	parent->children[parent->child_count++] = child;
+	retained_bytes += retain_node_cost(child);
+	return child;
+}
+
+/**
+ * topic_retain_store - keep a published message as retained history of its topic
+ *
+ * A message with an empty payload clears the topic's history. Whenever the
+ * memory budget is exceeded, the oldest retained messages broker-wide are
+ * evicted; topic nodes left empty are pruned, and count against the budget
+ * while they hold messages.
+ *
+ * @topic_str: published topic
+ * @qos: QoS the message was published with
+ * @data: message body
+ * @len: length of the message body
+ */
+void topic_retain_store(const char* topic_str, uint8_t qos, const void* data, size_t len) {
+	if (!retain_rules) return;
+
+	size_t depth = retain_depth_for(topic_str);
+	if (depth == 0) return;
+
+	size_t cost = sizeof(retained_msg) + len;
+	if (len > 0 && cost > retained_budget) return;
+
+	int count = 0;
+	char** segments = split_topic(topic_str, &count);
+	retain_node* node = retain_root;
+	for (int i = 0; i < count && node; ++i) {
+		node = (len > 0) ? find_or_create_retain_child(node, segments[i])
+										 : find_retain_child(node, segments[i]);
+	}
+	for (int i = 0; i < count; ++i) free(segments[i]);
+	free(segments);
+
+	if (len == 0) {
+		// evicting the last message prunes the node itself
+		for (size_t n = node ? node->retained_count : 0; n > 0; --n) {
+			evict_retained(node->retained_head);
+		}
+		return;
+	}
+	if (!node) return;
+
+	retained_msg* msg = malloc(cost);
+	if (!msg) {
+		prune_retain_node(node);
+		return;
+	}
+
+	msg->node = node;
+	msg->node_next = NULL;
+	msg->qos = qos;
+	msg->len = len;
+	memcpy(msg->data, data, len);
+
+	if (node->retained_tail) node->retained_tail->node_next = msg;
+	else node->retained_head = msg;
+	node->retained_tail = msg;
+	node->retained_count++;
+
+	msg->lru_next = NULL;
+	msg->lru_prev = retained_newest;
+	if (retained_newest) retained_newest->lru_next = msg;
+	else retained_oldest = msg;
+	retained_newest = msg;
+	retained_bytes += cost;
+
+	while (node->retained_count > depth) {
+		evict_retained(node->retained_head);
+	}
+	while (retained_bytes > retained_budget && retained_oldest) {
+		evict_retained(retained_oldest);
+	}
+}
+
+/**
+ * topic_retain_usage - memory charged to the retention budget
+ *
+ * Return: bytes of retained messages and the topic nodes holding them
+ */
+size_t topic_retain_usage(void) {
+	return retained_bytes;
+}
+
+/**
+ * replay_node - hand every retained message of one topic to the callback
+ */
+static void replay_node(retain_node* node, const char* path, retained_cb cb, void* ctx) {
+	for (retained_msg* m = node->retained_head; m != NULL; m = m->node_next) {
+		cb(path, m->qos, m->data, m->len, ctx);
+	}
+}
+
+/**
+ * replay_subtree - replay a node and all of its descendants ("#" match)
+ */
+static void replay_subtree(retain_node* node, char* path, size_t path_len, retained_cb cb, void* ctx) {
+	replay_node(node, path, cb, ctx);
+
+	for (size_t i = 0; i < node->child_count; ++i) {
+		retain_node* child = node->children[i];
+		size_t seg_len = strlen(child->segment);
+		if (path_len + 1 + seg_len >= MAX_RETAIN_TOPIC_LEN) continue;
+
+		size_t child_len = path_len;
+		if (child_len > 0) path[child_len++] = '/';
+		memcpy(path + child_len, child->segment, seg_len + 1);
+		replay_subtree(child, path, child_len + seg_len, cb, ctx);
+	}
+	path[path_len] = '\0';
+}
+
+/**
+ * replay_recursive - walk concrete topic nodes matching a filter
+ *
+ * @node: current node, whose topic is @path
+ * @segments: filter segments
+ * @depth: number of filter segments
+ * @level: filter segment to match against @node's children
+ */
+static void replay_recursive(retain_node* node, char** segments, int depth, int level,
+															char* path, size_t path_len, retained_cb cb, void* ctx) {
+	if (level == depth) {
+		replay_node(node, path, cb, ctx);
+		return;
+	}
+
+	const char* seg = segments[level];
+	if (strcmp(seg, "#") == 0) {
+		replay_subtree(node, path, path_len, cb, ctx);
+		return;
+	}
+
+	bool any = strcmp(seg, "+") == 0;
+	for (size_t i = 0; i < node->child_count; ++i) {
+		retain_node* child = node->children[i];
+		if (!any && strcmp(child->segment, seg) != 0) continue;
+
+		size_t seg_len = strlen(child->segment);
+		if (path_len + 1 + seg_len >= MAX_RETAIN_TOPIC_LEN) continue;
+
+		size_t child_len = path_len;
+		if (child_len > 0) path[child_len++] = '/';
+		memcpy(path + child_len, child->segment, seg_len + 1);
+		replay_recursive(child, segments, depth, level + 1, path, child_len + seg_len, cb, ctx);
+		path[path_len] = '\0';
+	}
+}
+
+/**
+ * topic_retain_replay - replay retained messages of every topic matching a filter
+ *
+ * @filter: subscription filter
+ * @cb: called once per retained message, oldest first within a topic
+ * @ctx: opaque pointer passed to @cb
+ */
+void topic_retain_replay(const char* filter, retained_cb cb, void* ctx) {
+	if (!retained_oldest) return;
+
+	int depth = 0;
+	char** segments = split_topic(filter, &depth);
+	char path[MAX_RETAIN_TOPIC_LEN] = "";
+
+	replay_recursive(retain_root, segments, depth, 0, path, 0, cb, ctx);
+
+	for (int i = 0; i < depth; ++i) free(segments[i]);
+	free(segments);
+}
+
 /**
  * free_topic_node - free topic node, its children, and its subscribers recursively
  *
@@ -267,17 +1010,39 @@ SubscriberList* get_matching_subscribers(const char* topic_str) {
 static void free_topic_node(topic_node* node) {
 	if (!node) return;
 
-	subscriber_list_entry* sub = node->subscribers;
-	while(sub) {
-		subscriber_list_entry* next = sub->next;
-		free(sub);
-		sub = next;
+	release(node->subscribers);
+	for (size_t i = 0; i < node->group_count; ++i) {
+		release(node->groups[i].name);
+		release(node->groups[i].members);
 	}
+	release(node->groups);
 
 	for (size_t i = 0; i < node->child_count; ++i) {
 		free_topic_node(node->children[i]);
 	}
 
+	release(node->segment);
+	release(node->children);
+	release(node);
+}
+
+/**
+ * free_retain_node - free a retain node, its children, and their retained messages
+ */
+static void free_retain_node(retain_node* node) {
+	if (!node) return;
+
+	retained_msg* msg = node->retained_head;
+	while(msg) {
+		retained_msg* next = msg->node_next;
+		free(msg);
+		msg = next;
+	}
+
+	for (size_t i = 0; i < node->child_count; ++i) {
+		free_retain_node(node->children[i]);
+	}
+
 	free(node->segment);
 	free(node->children);
 	free(node);
@@ -289,6 +1054,204 @@ static void free_topic_node(topic_node* node) {
 void free_topic_table(void) {
 	free_topic_node(topic_root);
 	topic_root = NULL;
+	arena_base = NULL;
+	arena_len = 0;
+
+	free_retain_node(retain_root);
+	retain_root = NULL;
+
+	retained_oldest = retained_newest = NULL;
+	retained_bytes = 0;
+
+	while (retain_rules) {
+		retain_rule* next = retain_rules->next;
+		free(retain_rules->filter);
+		free(retain_rules);
+		retain_rules = next;
+	}
+
+	while (share_rules) {
+		share_rule* next = share_rules->next;
+		free(share_rules->group);
+		free(share_rules);
+		share_rules = next;
+	}
+	share_load = NULL;
+	share_load_ctx = NULL;
+}
+
+/**
+ * image_alloc - reserve 8-byte aligned space in a snapshot image
+ *
+ * Return: offset of the reserved space
+ */
+static size_t image_alloc(size_t* used, size_t len) {
+	size_t off = *used;
+	*used += (len + 7) & ~(size_t)7;
+	return off;
+}
+
+/**
+ * image_node - write a node and its subtree into a snapshot image
+ *
+ * Pointers are stored as offsets from the image start (0 stands for NULL).
+ * Retained messages live outside the subscription trie and are not part of
+ * the image.
+ *
+ * @node: node to write
+ * @image: image buffer, or NULL to only compute the size
+ * @used: bytes of the image used so far, advanced past the written subtree
+ *
+ * Return: offset of the written node
+ */
+static size_t image_node(const topic_node* node, uint8_t* image, size_t* used) {
+	size_t node_off = image_alloc(used, sizeof(topic_node));
+	size_t seg_len = strlen(node->segment) + 1;
+	size_t seg_off = image_alloc(used, seg_len);
+
+	size_t sub_count = node->subscriber_count;
+	size_t subs_off = sub_count ? image_alloc(used, sizeof(Subscriber) * sub_count) : 0;
+	size_t children_off = node->child_count ? image_alloc(used, sizeof(topic_node*) * node->child_count) : 0;
+	size_t groups_off = node->group_count ? image_alloc(used, sizeof(share_group) * node->group_count) : 0;
+
+	for (size_t i = 0; i < node->group_count; ++i) {
+		const share_group* g = &node->groups[i];
+		size_t name_len = strlen(g->name) + 1;
+		size_t name_off = image_alloc(used, name_len);
+		size_t members_off = image_alloc(used, sizeof(Subscriber) * g->member_count);
+
+		if (image) {
+			share_group copy = {0};
+			copy.name = (char*)(uintptr_t)name_off;
+			copy.members = (Subscriber*)(uintptr_t)members_off;
+			copy.member_count = g->member_count;
+			copy.member_capacity = g->member_count;
+			memcpy(image + groups_off + sizeof(share_group) * i, &copy, sizeof(copy));
+			memcpy(image + name_off, g->name, name_len);
+			memcpy(image + members_off, g->members, sizeof(Subscriber) * g->member_count);
+		}
+	}
+
+	if (image) {
+		topic_node copy = {0};
+		copy.segment = (char*)(uintptr_t)seg_off;
+		copy.children = (topic_node**)(uintptr_t)children_off;
+		copy.child_count = node->child_count;
+		copy.subscribers = (Subscriber*)(uintptr_t)subs_off;
+		copy.subscriber_count = sub_count;
+		copy.subscriber_capacity = sub_count;
+		copy.groups = (share_group*)(uintptr_t)groups_off;
+		copy.group_count = node->group_count;
+		memcpy(image + node_off, &copy, sizeof(copy));
+		memcpy(image + seg_off, node->segment, seg_len);
+		if (sub_count) memcpy(image + subs_off, node->subscribers, sizeof(Subscriber) * sub_count);
+	}
+
+	for (size_t i = 0; i < node->child_count; ++i) {
+		size_t child_off = image_node(node->children[i], image, used);
+		if (image) {
+			((topic_node**)(image + children_off))[i] = (topic_node*)(uintptr_t)child_off;
+		}
+	}
+	return node_off;
+}
+
+/**
+ * topic_table_snapshot_write - serialize the subscription trie into a relocatable image
+ *
+ * @image: output buffer, or NULL to query the required size
+ *
+ * Return: size of the image in bytes
+ */
+size_t topic_table_snapshot_write(uint8_t* image) {
+	size_t used = 0;
+	size_t header_off = image_alloc(&used, sizeof(uint64_t));	// keeps offset 0 free for NULL
+
+	size_t root_off = image_node(topic_root, image, &used);
+	if (image) memcpy(image + header_off, &(uint64_t){ root_off }, sizeof(uint64_t));
+	return used;
+}
+
+/**
+ * rebase - turn an image offset back into a pointer
+ *
+ * Return: false if @off points outside the image or cannot hold @size bytes
+ */
+static bool rebase(uint8_t* image, size_t len, void** field, size_t size) {
+	uintptr_t off = (uintptr_t)*field;
+	if (off == 0) return true;
+	if (off >= len || size > len - off) return false;
+
+	*field = image + off;
+	return true;
+}
+
+/**
+ * fixup_node - rebase every pointer of a node and its subtree in place
+ */
+static bool fixup_node(topic_node* node, uint8_t* image, size_t len) {
+	if (!rebase(image, len, (void**)&node->segment, 1) ||
+			!rebase(image, len, (void**)&node->children, sizeof(topic_node*) * node->child_count) ||
+			!rebase(image, len, (void**)&node->subscribers, sizeof(Subscriber) * node->subscriber_count) ||
+			node->subscriber_capacity != node->subscriber_count) {
+		return false;
+	}
+	if (!node->segment || memchr(node->segment, '\0', image + len - (uint8_t*)node->segment) == NULL) {
+		return false;
+	}
+
+	if (node->group_count > len / sizeof(share_group) ||
+			!rebase(image, len, (void**)&node->groups, sizeof(share_group) * node->group_count)) {
+		return false;
+	}
+	for (size_t i = 0; i < node->group_count; ++i) {
+		share_group* g = &node->groups[i];
+		if (g->member_count == 0 || g->member_capacity != g->member_count ||
+				g->member_count > len / sizeof(Subscriber) ||
+				!rebase(image, len, (void**)&g->name, 1) ||
+				!rebase(image, len, (void**)&g->members, sizeof(Subscriber) * g->member_count) ||
+				!g->name || memchr(g->name, '\0', image + len - (uint8_t*)g->name) == NULL) {
+			return false;
+		}
+	}
+
+	for (size_t i = 0; i < node->child_count; ++i) {
+		if (!rebase(image, len, (void**)&node->children[i], sizeof(topic_node)) ||
+				!node->children[i] || !fixup_node(node->children[i], image, len)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * topic_table_snapshot_adopt - replace the trie with one loaded from a snapshot image
+ *
+ * Pointers are fixed up in place, so @image must be writable (a private
+ * mapping is enough) and stay valid until free_topic_table(). Objects inside
+ * the image are never freed; child arrays are copied out when they grow.
+ *
+ * @image: image written by topic_table_snapshot_write()
+ * @len: size of @image
+ *
+ * Return: 0 on success, -1 if the image is malformed
+ */
+int topic_table_snapshot_adopt(uint8_t* image, size_t len) {
+	uint64_t root_off;
+	if (len < sizeof(root_off) + sizeof(topic_node)) return -1;
+	memcpy(&root_off, image, sizeof(root_off));
+
+	topic_node* root = (topic_node*)(uintptr_t)root_off;
+	if (!rebase(image, len, (void**)&root, sizeof(topic_node)) || !root ||
+			!fixup_node(root, image, len)) {
+		return -1;
+	}
+
+	free_topic_node(topic_root);
+	topic_root = root;
+	arena_base = image;
+	arena_len = len;
+	return 0;
 }
 
 /**
@@ -305,8 +1268,11 @@ static void print_topic_tree_recursive(topic_node* node, int depth) {
 	}
 
 	printf("- %s", node->segment);
-	if (node->subscribers) {
-		printf(" (%s)", node->subscribers ? "subscribers" : "");
+	if (node->subscriber_count > 0) {
+		printf(" (%zu subscribers)", node->subscriber_count);
+	}
+	for (size_t i = 0; i < node->group_count; ++i) {
+		printf(" ($share/%s: %zu members)", node->groups[i].name, node->groups[i].member_count);
 	}
 	printf("\n");
 
@@ -321,6 +1287,7 @@ static void print_topic_tree_recursive(topic_node* node, int depth) {
 void print_topic_tree(void) {
 	printf("== topic tree ==\n");
 	print_topic_tree_recursive(topic_root, 0);
+	if (retained_bytes > 0) printf("(%zu bytes retained)\n", retained_bytes);
 	printf("================\n");
 }
 
@@ -132,3 +132,23 @@ int recv_bytes(int sockfd, uint8_t* buffer, size_t max_len, struct sockaddr* fro
 	return (int)len;
 }
 
+
+/**
+ * join_multicast - Multicast needs datagrams, so a stream transport cannot join
+ *
+ * Return: always -1, receivers fall back to unicast delivery
+ */
+int join_multicast(const struct sockaddr_in* group, struct in_addr iface) {
+	(void)group; (void)iface;
+	return -1;
+}
+
+/**
+ * set_multicast_interface - Multicast needs datagrams, nothing to configure
+ *
+ * Return: always -1
+ */
+int set_multicast_interface(int sockfd, struct in_addr iface) {
+	(void)sockfd; (void)iface;
+	return -1;
+}
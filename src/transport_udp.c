@@ -6,6 +6,7 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
 #include <arpa/inet.h>
 #include "../include/transport.h"
 
@@ -98,3 +99,75 @@ int recv_bytes(int sockfd, uint8_t* buffer, size_t max_len, struct sockaddr* fro
 	return (int)len;
 }
 
+/**
+ * join_multicast - Create a socket receiving the datagrams sent to a multicast group
+ *
+ * The socket is bound to the group's address and port with SO_REUSEADDR, so
+ * several receivers on one host each get a copy.
+ *
+ * @group: multicast group address and port
+ * @iface: address of the local interface to join on (INADDR_ANY for the default)
+ *
+ * Return: socket file descriptor, or -1 if the group cannot be joined
+ */
+int join_multicast(const struct sockaddr_in* group, struct in_addr iface) {
+	int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sockfd < 0) return -1;
+
+	int on = 1;
+	struct ip_mreq mreq = { .imr_multiaddr = group->sin_addr, .imr_interface = iface };
+	if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+			bind(sockfd, (const struct sockaddr*)group, sizeof(*group)) < 0 ||
+			setsockopt(sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+		if (debug_enabled) perror("[TRANSPORT] multicast join failed");
+		close(sockfd);
+		return -1;
+	}
+	return sockfd;
+}
+
+/**
+ * set_multicast_interface - Send multicast datagrams of a socket through a given interface
+ *
+ * Loopback of multicast datagrams is enabled, so receivers on the sending
+ * host (including 127.0.0.1 for testing) get them too.
+ *
+ * @sockfd: UDP socket file descriptor
+ * @iface: address of the outgoing interface
+ *
+ * Return: 0 on success, -1 on error
+ */
+int set_multicast_interface(int sockfd, struct in_addr iface) {
+	unsigned char loop = 1;
+	if (setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface)) < 0 ||
+			setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0) {
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * set_pacing_rate - let the kernel pace the datagrams of a socket
+ *
+ * Only effective with the fq qdisc on the outgoing interface.
+ *
+ * @sockfd: UDP socket file descriptor
+ * @bytes_per_sec: sending rate cap
+ *
+ * Return: 0 on success, -1 if SO_MAX_PACING_RATE is not supported
+ */
+int set_pacing_rate(int sockfd, uint64_t bytes_per_sec) {
+#ifdef SO_MAX_PACING_RATE
+	// older kernels take a 32-bit rate, larger values saturate
+	unsigned int rate = bytes_per_sec > 0xffffffffULL ? 0xffffffffU : (unsigned int)bytes_per_sec;
+	if (setsockopt(sockfd, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof(rate)) < 0) {
+		if (debug_enabled) perror("[TRANSPORT] SO_MAX_PACING_RATE failed");
+		return -1;
+	}
+	return 0;
+#else
+	(void)sockfd;
+	(void)bytes_per_sec;
+	return -1;
+#endif
+}
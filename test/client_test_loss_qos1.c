@@ -1,38 +1,82 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "../include/slimmq_client.h"
 #include "../include/slim_msg.h"
 
 #define DEFAULT_BROKER_PORT 9000
 #define DEFAULT_BROKER_IP "127.0.0.1"
+#define MAX_THREADS 64
 
+static slimmq_client_t* client;
+static atomic_int next_msg;
+static atomic_int delivered;
+static int total = 100;
+
+static void* publisher(void* arg) {
+	(void)arg;
+	int i;
+	while ((i = atomic_fetch_add(&next_msg, 1)) < total) {
+		char msg[32];
+		snprintf(msg, sizeof(msg), "msg-%03d", i);
+		if (slimmq_publish(client, "loss/qos1", msg, strlen(msg)) == 0) atomic_fetch_add(&delivered, 1);
+	}
+	return NULL;
+}
+
+/*
+ * Publishes -n messages from -t threads sharing one client, optionally under
+ * a congestion window (-c aimd|delay), and reports the goodput.
+ */
 int main(int argc, char* argv[]) {
 	const char* broker_ip = DEFAULT_BROKER_IP;
 	int port = DEFAULT_BROKER_PORT;
+	int threads = 1;
+	cc_mode_t mode = CC_OFF;
 
 	for (int i = 1; i < argc; ++i) {
 		if (strcmp(argv[i], "-ip") == 0 && i + 1 < argc) {
 			broker_ip = argv[++i];
 		} else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
 			port = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			total = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+			if (threads < 1) threads = 1;
+			if (threads > MAX_THREADS) threads = MAX_THREADS;
+		} else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+			++i;
+			mode = strcmp(argv[i], "delay") == 0 ? CC_DELAY : strcmp(argv[i], "aimd") == 0 ? CC_AIMD : CC_OFF;
 		}
 	}
-	slimmq_client_t* client = slimmq_connect(broker_ip, port);
+	client = slimmq_connect(broker_ip, port);
 
     if (!client) return 1;
 
     slimmq_set_qos(client, QOS_AT_LEAST_ONCE);
     slimmq_set_retry_policy(client, 1000, 5);  // 최대 5번 재전송
+    slimmq_set_congestion_control(client, mode, threads);
 
-    for (int i = 0; i < 100; i++) {
-        char msg[32];
-        snprintf(msg, sizeof(msg), "msg-%03d", i);
-        slimmq_publish(client, "loss/qos1", msg, strlen(msg));
-    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-    printf("QoS1: Sent 100 messages with retry policy\n");
+    pthread_t workers[MAX_THREADS];
+    for (int t = 0; t < threads; ++t) pthread_create(&workers[t], NULL, publisher, NULL);
+    for (int t = 0; t < threads; ++t) pthread_join(workers[t], NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    slimmq_cc_stats_t stats;
+    slimmq_congestion_stats(client, &stats);
+    printf("QoS1: Sent %d/%d messages with retry policy in %.2fs (%.0f msg/s), "
+           "%llu timeouts, window %u, srtt %uus\n",
+           atomic_load(&delivered), total, seconds, atomic_load(&delivered) / seconds,
+           (unsigned long long)stats.losses, stats.window, stats.srtt_us);
     slimmq_close(client);
     return 0;
 }
-
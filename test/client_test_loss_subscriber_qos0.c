@@ -5,6 +5,7 @@
 
 #define DEFAULT_BROKER_PORT 9000
 #define DEFAULT_BROKER_IP "127.0.0.1"
+#define QUIET_TIMEOUT_MS 2000
 
 int main(int argc, char* argv[]) {
 	const char* broker_ip = DEFAULT_BROKER_IP;
@@ -25,26 +26,34 @@ int main(int argc, char* argv[]) {
 
     char seen[100] = {0};
     int count = 0;
+    int distinct = 0;
 
+    // lost messages never arrive, so stop once the stream has been quiet for a while
     while (count < 100) {
-        char topic[128];
-        void* data;
-        size_t len;
-        if (slimmq_next_event(client, topic, sizeof(topic), &data, &len) == 0) {
-            int msg_id;
-            if (sscanf(data, "msg-%d", &msg_id) == 1 && msg_id < 100) {
-                if (!seen[msg_id]) {
-                    seen[msg_id] = 1;
-                    printf("[QoS0] Received: msg-%03d\n", msg_id);
-                } else {
-                    printf("[QoS0] Duplicate: msg-%03d\n", msg_id);
-                }
+        slimmq_event_t evt;
+        if (slimmq_next_events(client, &evt, 1, QUIET_TIMEOUT_MS) <= 0) break;
+
+        char msg[32];
+        size_t n = evt.data_len < sizeof(msg) - 1 ? evt.data_len : sizeof(msg) - 1;
+        memcpy(msg, evt.data, n);
+        msg[n] = '\0';
+
+        int msg_id;
+        if (sscanf(msg, "msg-%d", &msg_id) == 1 && msg_id >= 0 && msg_id < 100) {
+            if (!seen[msg_id]) {
+                seen[msg_id] = 1;
+                distinct++;
+                printf("[QoS0] Received: msg-%03d\n", msg_id);
+            } else {
+                printf("[QoS0] Duplicate: msg-%03d\n", msg_id);
             }
-            free(data);
-            count++;
         }
+        free(evt.data);
+        count++;
     }
 
+    printf("[QoS0] Delivered %d/100 (%llu rebuilt from FEC parity)\n", distinct,
+           (unsigned long long)slimmq_fec_recovered(client));
     slimmq_close(client);
     return 0;
 }
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "../include/slimmq_client.h"
+#include "../include/slim_msg.h"
 
 #define DEFAULT_BROKER_PORT 9000
 #define DEFAULT_BROKER_IP "127.0.0.1"
@@ -21,6 +22,7 @@ int main(int argc, char* argv[]) {
 
     if (!client) return 1;
 
+    slimmq_set_qos(client, QOS_AT_LEAST_ONCE);
     slimmq_subscribe(client, "loss/qos1");
 
     char seen[100] = {0};
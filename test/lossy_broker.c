@@ -10,12 +10,15 @@
 #include "../include/packet_handler.h"
 #include "../include/topic_table.h"
 #include "../include/pending_table.h"
+#include "../include/session_table.h"
+#include "../include/fec_table.h"
 
 #define BROKER_PORT 9000
 #define DEDUP_TABLE_SIZE 1024
 #define DEDUP_EXPIRATION_SEC 10
 
 static bool debug_mode = false;
+static int loss_percent = 33;						// share of datagrams dropped on purpose
 
 int init_broker_socket() {
 	int sockfd = init_socket(NULL, BROKER_PORT, false);
@@ -103,6 +106,14 @@ int echo_to_client(int sockfd, const struct sockaddr_in* client_addr,
 	return sent;
 }
 
+/**
+ * session_id_of - session id of a client, which this broker identifies by address
+ */
+static uint32_t session_id_of(const struct sockaddr_in* client_addr) {
+	broker_session_t* session = session_get_or_create(client_addr);
+	return session ? session->id : 0;
+}
+
 /**
  * handle_subscribe - handles a subscription request
  *
@@ -110,12 +121,70 @@ int echo_to_client(int sockfd, const struct sockaddr_in* client_addr,
  * @client_addr: address of subscribing client
  */
 void handle_subscribe(const char* topic_str, const struct sockaddr_in* client_addr) {
-	subscribe_topic(topic_str, client_addr);
+	subscribe_topic(topic_str, session_id_of(client_addr));
 	if (debug_mode) {
 		printf("[BROKER] Subscribed: %s\n", topic_str);
 	}
 }
 
+/**
+ * simulate_loss - decide whether the next datagram is dropped
+ */
+static bool simulate_loss(void) {
+	return (rand() % 100) < loss_percent;
+}
+
+/**
+ * send_qos0 - send a QoS 0 delivery or FEC parity over the simulated lossy last hop
+ */
+static void send_qos0(int sockfd, const broker_session_t* s, const uint8_t* buffer, size_t len) {
+	if (simulate_loss()) {
+		printf("[BROKER][QoS0] Simulating packet loss\n");
+		return;
+	}
+	send_bytes(sockfd, (const struct sockaddr*)&s->addr, sizeof(s->addr), buffer, len);
+}
+
+/**
+ * send_parity - send every parity packet of a completed FEC block to the subscribers
+ */
+static void send_parity(int sockfd, fec_stream_t* fec, const SubscriberList* targets) {
+	for (uint8_t index = 0; index < fec->encoder.m; ++index) {
+		uint8_t data[FEC_PARITY_HEADER_SIZE + FEC_MAX_BODY];
+		size_t data_len = fec_encoder_parity(&fec->encoder, fec->id, index, data, sizeof(data));
+		if (data_len == 0) break;
+
+		slim_msg_header_t hdr = {
+			.version = 1,
+			.msg_type = MSG_CONTROL,
+			.qos_level = QOS_AT_MOST_ONCE,
+			.msg_id = 0,
+			.topic_id = 0,
+			.frag_id = 0,
+			.frag_total = 1,
+			.batch_size = 1,
+			.payload_length = 1 + data_len,
+			.client_node_count = 1
+		};
+
+		uint8_t buffer[2048];
+		int len = serialize_control_message(&hdr, CONTROL_FEC, data, data_len, buffer, sizeof(buffer));
+		if (len < 0) break;
+
+		for (size_t i = 0; i < targets->count; ++i) {
+			broker_session_t* s = session_get(targets->items[i].session);
+			if (s) send_qos0(sockfd, s, buffer, len);
+		}
+	}
+	fec_encoder_next_block(&fec->encoder);
+}
+
+/**
+ * publish_to_subscribers - fan a message out, dropping QoS 0 datagrams on the way
+ *
+ * QoS 0 traffic of topics given -f is numbered and followed by parity packets,
+ * so subscribers rebuild some of what the simulated loss takes.
+ */
 void publish_to_subscribers(int sockfd, const slim_msg_header_t* header, const char* topic_str, const void* payload, size_t payload_length) {
 	SubscriberList* targets = get_matching_subscribers(topic_str);
 	if (!targets) return;
@@ -124,17 +193,34 @@ void publish_to_subscribers(int sockfd, const slim_msg_header_t* header, const c
 		printf("[BROKER] PUBLISH to %zu subscribers: %s\n", targets->count, topic_str);
 	}
 
-	for (Subscriber* s = targets->head; s != NULL; s = s->next) {
-		uint8_t buffer[2048];
+	slim_msg_header_t out_hdr = *header;
+	out_hdr.topic_id = 0;
 
-		int len = serialize_message(header, topic_str, payload,
-																payload_length, buffer,
-																sizeof(buffer));
-		if (len > 0){
+	uint8_t buffer[2048];
+	int len = serialize_message(&out_hdr, topic_str, payload,
+															payload_length, buffer,
+															sizeof(buffer));
+	if (len < 0) {
+		free_subscriber_list(targets);
+		return;
+	}
+
+	bool qos0 = header->qos_level == QOS_AT_MOST_ONCE;
+	fec_stream_t* fec = qos0 ? fec_stream_for(topic_str) : NULL;
+	bool block_complete = fec && fec_stream_stamp(fec, buffer, len);
+
+	for (size_t i = 0; i < targets->count; ++i) {
+		broker_session_t* s = session_get(targets->items[i].session);
+		if (!s) continue;
+
+		if (qos0) {
+			send_qos0(sockfd, s, buffer, len);
+		} else {
 			send_bytes(sockfd, (const struct sockaddr*)&s->addr,
 									sizeof(s->addr), buffer, len);
 		}
 	}
+	if (block_complete) send_parity(sockfd, fec, targets);
 
 	free_subscriber_list(targets);
 }
@@ -152,13 +238,13 @@ void handle_publish(int sockfd, const slim_msg_header_t* header,
 										socklen_t addrlen) {
 	if (header->qos_level == QOS_EXACTLY_ONCE) {
 		qos2_state_t state;
-		if (pending_table_get(client_addr, header->msg_id, &state)) {
+		if (pending_table_get(session_id_of(client_addr), header->msg_id, &state)) {
 			if (state == QOS2_STATE_COMPLETED) {
 				if (debug_mode) printf("[BROKER] QoS2 msg already completed, skiping\n");
 				return;
 			}
 		} else {
-			pending_table_update(client_addr, header->msg_id, QOS2_STATE_RECEIVED);
+			pending_table_update(session_id_of(client_addr), header->msg_id, QOS2_STATE_RECEIVED);
 
 			publish_to_subscribers(sockfd, header, topic_str, payload, payload_length);
 		}
@@ -187,7 +273,7 @@ void handle_publish(int sockfd, const slim_msg_header_t* header,
 	}
 	
 	if (header->qos_level == QOS_AT_LEAST_ONCE) {
-		if ((rand() % 3) == 0) {
+		if (simulate_loss()) {
 			printf("[BROKER][QoS1] Simulating packet loss\n");
 			return;
 		}
@@ -216,16 +302,12 @@ void handle_publish(int sockfd, const slim_msg_header_t* header,
 		return;
 	}
 
-	if ((rand() % 3) == 0) {
-		printf("[BROKER][QoS0] Simulating packet loss\n");
-		return;
-	}
-	// case for QoS0
+	// case for QoS0, lost on the way to the subscribers
 	publish_to_subscribers(sockfd, header, topic_str, payload, payload_length);
 }
 
 void handle_control_release (int sockfd, const slim_msg_header_t* header, const struct sockaddr_in* client_addr, socklen_t addrlen) {
-	pending_table_update(client_addr, header->msg_id, QOS2_STATE_RELEASED);
+	pending_table_update(session_id_of(client_addr), header->msg_id, QOS2_STATE_RELEASED);
 
 	slim_msg_header_t complete_hdr = {
 		.version = 1,
@@ -245,7 +327,7 @@ void handle_control_release (int sockfd, const slim_msg_header_t* header, const
 
 	send_bytes(sockfd, (const struct sockaddr*)client_addr, addrlen, buffer, sizeof(slim_msg_header_t) + 1);
 
-	pending_table_update(client_addr, header->msg_id, QOS2_STATE_COMPLETED);
+	pending_table_update(session_id_of(client_addr), header->msg_id, QOS2_STATE_COMPLETED);
 
 	if (debug_mode) {
 		printf("[BROKER] Received CONTROL_RELEASE -> Sent CONTROL_COMPLETE (msg_id=%u)\n", header->msg_id);
@@ -254,7 +336,7 @@ void handle_control_release (int sockfd, const slim_msg_header_t* header, const
 
 void handle_control_received(int sockfd, const slim_msg_header_t* header, const uint8_t* payload, size_t payload_len, const struct sockaddr_in* client_addr, socklen_t addrlen) {
 	qos2_state_t current;
-	if (!pending_table_get(client_addr, header->msg_id, &current)) {
+	if (!pending_table_get(session_id_of(client_addr), header->msg_id, &current)) {
 		if (debug_mode) {
 			printf("[BROKER] CONTROL_RECEIVED for unknown msg_id=%u\n", header->msg_id);
 		}
@@ -268,7 +350,7 @@ void handle_control_received(int sockfd, const slim_msg_header_t* header, const
 		return;
 	}
 
-	pending_table_update(client_addr, header->msg_id, QOS2_STATE_WAIT_RELEASE);
+	pending_table_update(session_id_of(client_addr), header->msg_id, QOS2_STATE_WAIT_RELEASE);
 
 	if (debug_mode) {
 		printf("[BROKER] CONTROL_RECEIVED acknowledged for msg_id\%u -> state=WAIT_RELEASE\n", header->msg_id);
@@ -359,6 +441,22 @@ int main(int argc, char* argv[]) {
 			debug_mode = true;
 			enable_transport_debug(true);
 			set_packet_debug(true);
+		} else if (strcmp(argv[i], "-L") == 0 && i + 1 < argc) {
+			// -L <percent>: simulated packet loss (default 33)
+			loss_percent = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			// -f <filter>=<k>[:<m>]: protect QoS 0 traffic of matching topics with FEC
+			char* rule = argv[++i];
+			char* eq = strrchr(rule, '=');
+			if (!eq) return 1;
+			*eq = '\0';
+			char* colon = strchr(eq + 1, ':');
+			int k = atoi(eq + 1), m = colon ? atoi(colon + 1) : 1;
+			if (k <= 0 || k > FEC_MAX_BLOCK || m <= 0 || m > FEC_MAX_PARITY ||
+					fec_rule_add(rule, (uint8_t)k, (uint8_t)m) != 0) {
+				fprintf(stderr, "[BROKER] Invalid FEC rule for %s\n", rule);
+				return 1;
+			}
 		}
 	}
 
@@ -366,11 +464,14 @@ int main(int argc, char* argv[]) {
 	int sockfd = init_broker_socket();
 	if (sockfd < 0) return 1;
 	pending_table_init();
+	session_table_init();
 
 	broker_main_loop(sockfd);
 
 	free_topic_table();
 	pending_table_destroy();
+	session_table_destroy();
+	fec_table_destroy();
 	close(sockfd);
 	return 0;
 }
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include "../include/transport.h"
+#include "../include/packet_handler.h"
+#include "../include/slim_msg.h"
+
+#define DEFAULT_BROKER_PORT 9000
+#define DEFAULT_BROKER_IP "127.0.0.1"
+#define BENCH_TOPIC "pace/burst"
+#define SETUP_CHUNK 64									// CONNECTs/SUBSCRIBEs sent before pausing
+#define QUIET_TIMEOUT_MS 1000
+
+/*
+ * Fan-out loss benchmark: one receiver socket with a small receive buffer,
+ * read at a limited rate like a constrained device, carries -s subscriber
+ * sessions. Every publish makes the broker send one datagram per session to
+ * it, so an unpaced fan-out overflows the buffer the way a burst overflows a
+ * NIC or receiver queue. Run it against a broker with and without -P.
+ */
+
+static int rx_sockfd;
+static struct sockaddr_in broker_addr;
+static int subscribers = 2000;
+static int messages = 20;
+static int reader_rate = 0;							// datagrams per second the receiver handles, 0 = unlimited
+static atomic_int received = 0;
+static atomic_int reading = 1;
+
+static uint64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void send_to_broker(int sockfd, const uint8_t* buf, int len) {
+	send_bytes(sockfd, (const struct sockaddr*)&broker_addr, sizeof(broker_addr), buf, len);
+}
+
+/**
+ * connect_sessions - open @subscribers sessions on the receiver socket
+ *
+ * Return: number of session ids received, stored in @ids
+ */
+static int connect_sessions(uint32_t* ids) {
+	int connected = 0;
+	uint8_t buf[256];
+
+	for (int first = 0; first < subscribers; first += SETUP_CHUNK) {
+		int last = first + SETUP_CHUNK < subscribers ? first + SETUP_CHUNK : subscribers;
+		for (int i = first; i < last; ++i) {
+			slim_msg_header_t hdr = { .version = 1, .msg_id = (uint32_t)i + 1, .frag_total = 1,
+																.batch_size = 1, .client_node_count = 1 };
+			int len = serialize_control_message(&hdr, CONTROL_CONNECT, NULL, 0, buf, sizeof(buf));
+			send_to_broker(rx_sockfd, buf, len);
+		}
+
+		for (int got = first; got < last;) {
+			int len = recv_bytes(rx_sockfd, buf, sizeof(buf), NULL, NULL);
+			if (len <= 0) break;
+
+			slim_msg_header_t hdr;
+			control_type_t type;
+			char data[16];
+			if (deserialize_control_message(buf, len, &hdr, &type, data, sizeof(data)) == 0 &&
+					type == CONTROL_CONNECT && hdr.msg_id >= 1 && hdr.msg_id <= (uint32_t)subscribers) {
+				ids[connected++] = hdr.session_id;
+				got++;
+			}
+		}
+	}
+	return connected;
+}
+
+static void subscribe_sessions(const uint32_t* ids, int count) {
+	uint8_t buf[256];
+	for (int i = 0; i < count; ++i) {
+		slim_msg_header_t hdr = { .version = 1, .msg_type = MSG_SUBSCRIBE, .qos_level = QOS_AT_MOST_ONCE,
+															.msg_id = (uint32_t)i + 1, .frag_total = 1, .batch_size = 1,
+															.payload_length = 1 + strlen(BENCH_TOPIC), .client_node_count = 1,
+															.session_id = ids[i] };
+		int len = serialize_message(&hdr, BENCH_TOPIC, NULL, 0, buf, sizeof(buf));
+		send_to_broker(rx_sockfd, buf, len);
+		if (i % SETUP_CHUNK == SETUP_CHUNK - 1) usleep(5000);
+	}
+	usleep(200000);
+}
+
+/**
+ * reader - count deliveries, no faster than @reader_rate datagrams per second
+ */
+static void* reader(void* arg) {
+	(void)arg;
+	uint8_t buf[2048];
+	uint64_t start = 0;
+	int count = 0;
+
+	while (atomic_load(&reading)) {
+		int len = recv_bytes(rx_sockfd, buf, sizeof(buf), NULL, NULL);
+		if (len <= 0 || buf[1] != MSG_PUBLISH) continue;
+
+		if (count++ == 0) start = now_us();
+		atomic_fetch_add(&received, 1);
+
+		if (reader_rate > 0) {
+			uint64_t due = start + (uint64_t)count * 1000000 / reader_rate;
+			uint64_t now = now_us();
+			if (due > now) usleep((useconds_t)(due - now));
+		}
+	}
+	return NULL;
+}
+
+int main(int argc, char* argv[]) {
+	const char* broker_ip = DEFAULT_BROKER_IP;
+	int port = DEFAULT_BROKER_PORT;
+	int interval_ms = 100;
+	int rcvbuf = 64 * 1024;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-ip") == 0 && i + 1 < argc) {
+			broker_ip = argv[++i];
+		} else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+			port = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			subscribers = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+			messages = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+			interval_ms = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			reader_rate = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+			rcvbuf = atoi(argv[++i]);
+		}
+	}
+	if (subscribers < 1) subscribers = 1;
+
+	broker_addr.sin_family = AF_INET;
+	broker_addr.sin_port = htons((uint16_t)port);
+	inet_pton(AF_INET, broker_ip, &broker_addr.sin_addr);
+
+	rx_sockfd = init_socket(NULL, 0, false);
+	int tx_sockfd = init_socket(NULL, 0, false);
+	if (rx_sockfd < 0 || tx_sockfd < 0) return 1;
+
+	struct timeval tv = { .tv_usec = 500000 };
+	setsockopt(rx_sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	uint32_t* ids = calloc((size_t)subscribers, sizeof(uint32_t));
+	if (!ids) return 1;
+	int connected = connect_sessions(ids);
+	subscribe_sessions(ids, connected);
+	printf("[BENCH] %d/%d subscriber sessions on one socket\n", connected, subscribers);
+
+	// the receive buffer is shrunk only now, so setup replies are not lost
+	setsockopt(rx_sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	pthread_t reader_thread;
+	pthread_create(&reader_thread, NULL, reader, NULL);
+
+	uint8_t buf[256];
+	uint64_t start = now_us();
+	for (int m = 0; m < messages; ++m) {
+		char payload[16];
+		snprintf(payload, sizeof(payload), "m%d", m);
+		slim_msg_header_t hdr = { .version = 1, .msg_type = MSG_PUBLISH, .qos_level = QOS_AT_MOST_ONCE,
+															.msg_id = (uint32_t)m + 1, .frag_total = 1, .batch_size = 1,
+															.payload_length = 1 + strlen(BENCH_TOPIC) + strlen(payload),
+															.client_node_count = 1 };
+		int len = serialize_message(&hdr, BENCH_TOPIC, payload, strlen(payload), buf, sizeof(buf));
+		send_to_broker(tx_sockfd, buf, len);
+		usleep((useconds_t)interval_ms * 1000);
+	}
+
+	// deliveries may still be paced out after the last publish
+	int last = -1;
+	while (atomic_load(&received) != last) {
+		last = atomic_load(&received);
+		usleep(QUIET_TIMEOUT_MS * 1000);
+	}
+	double seconds = (now_us() - start) / 1e6 - QUIET_TIMEOUT_MS / 1000.0;
+	atomic_store(&reading, 0);
+	pthread_join(reader_thread, NULL);
+
+	long expected = (long)connected * messages;
+	int got = atomic_load(&received);
+	printf("[BENCH] Received %d/%ld deliveries (%.1f%% loss) in %.2fs\n", got, expected,
+					expected ? 100.0 * (expected - got) / expected : 0.0, seconds);
+
+	free(ids);
+	close(tx_sockfd);
+	close(rx_sockfd);
+	return 0;
+}
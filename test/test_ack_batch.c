@@ -0,0 +1,100 @@
+#include <string.h>
+#include "test_common.h"
+#include "../include/ack_batch.h"
+
+static int commit_result = 0;
+static int commits = 0;
+static uint32_t sent[ACK_BATCH_MAX * 2];
+static size_t sent_count = 0;
+
+static int fake_commit(void) {
+	commits++;
+	return commit_result;
+}
+
+static void record_send(uint32_t session, uint8_t qos, uint32_t msg_id, void* ctx) {
+	(void)session; (void)qos; (void)ctx;
+	if (sent_count < ACK_BATCH_MAX * 2) sent[sent_count++] = msg_id;
+}
+
+static void reset(int result) {
+	commit_result = result;
+	commits = 0;
+	sent_count = 0;
+	ack_batch_init(fake_commit, record_send, NULL);
+}
+
+void test_acks_wait_for_commit() {
+	reset(0);
+
+	for (uint32_t id = 1; id <= 3; ++id) ASSERT_TRUE(ack_batch_defer(7, 1, id));
+	ASSERT_EQ(sent_count, 0);
+
+	ASSERT_EQ(ack_batch_flush(), 0);
+	ASSERT_EQ(commits, 1);
+	ASSERT_EQ(sent_count, 3);
+	for (uint32_t i = 0; i < 3; ++i) ASSERT_EQ(sent[i], i + 1);
+	ASSERT_EQ(ack_batch_count(), 0);
+}
+
+void test_full_batch_commits_first() {
+	reset(0);
+
+	for (uint32_t id = 1; id <= ACK_BATCH_MAX; ++id) ASSERT_TRUE(ack_batch_defer(7, 1, id));
+	ASSERT_EQ(commits, 0);
+
+	ASSERT_TRUE(ack_batch_defer(7, 1, ACK_BATCH_MAX + 1));
+	ASSERT_EQ(commits, 1);
+	ASSERT_EQ(sent_count, ACK_BATCH_MAX);
+	ASSERT_EQ(ack_batch_count(), 1);
+}
+
+void test_failed_commit_drops_past_full_batch() {
+	reset(-1);
+
+	for (uint32_t id = 1; id <= ACK_BATCH_MAX; ++id) ASSERT_TRUE(ack_batch_defer(7, 1, id));
+
+	// the disk stays unhealthy: nothing is released and nothing written past the batch
+	for (uint32_t id = ACK_BATCH_MAX + 1; id <= ACK_BATCH_MAX + 10; ++id) {
+		ASSERT_TRUE(!ack_batch_defer(7, 1, id));
+		ASSERT_EQ(ack_batch_count(), ACK_BATCH_MAX);
+	}
+	ASSERT_EQ(ack_batch_flush(), -1);
+	ASSERT_EQ(sent_count, 0);
+
+	// once a commit succeeds the held ACKs leave, the dropped ones never do
+	commit_result = 0;
+	ASSERT_EQ(ack_batch_flush(), 0);
+	ASSERT_EQ(sent_count, ACK_BATCH_MAX);
+	ASSERT_EQ(sent[ACK_BATCH_MAX - 1], ACK_BATCH_MAX);
+	ASSERT_TRUE(ack_batch_defer(7, 1, 1000));
+}
+
+static bool session_gone(uint32_t session, void* ctx) {
+	return session == *(uint32_t*)ctx;
+}
+
+void test_forget_drops_expired_sessions() {
+	reset(-1);
+
+	ASSERT_TRUE(ack_batch_defer(1, 1, 10));
+	ASSERT_TRUE(ack_batch_defer(2, 2, 11));
+	ASSERT_TRUE(ack_batch_defer(1, 1, 12));
+
+	uint32_t expired = 1;
+	ack_batch_forget(session_gone, &expired);
+	ASSERT_EQ(ack_batch_count(), 1);
+
+	commit_result = 0;
+	ASSERT_EQ(ack_batch_flush(), 0);
+	ASSERT_EQ(sent_count, 1);
+	ASSERT_EQ(sent[0], 11);
+}
+
+int main() {
+	RUN_TEST(test_acks_wait_for_commit);
+	RUN_TEST(test_full_batch_commits_first);
+	RUN_TEST(test_failed_commit_drops_past_full_batch);
+	RUN_TEST(test_forget_drops_expired_sessions);
+	return 0;
+}
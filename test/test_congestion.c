@@ -0,0 +1,78 @@
+#include "test_common.h"
+#include "../include/congestion.h"
+
+void test_aimd_grows_and_halves_once_per_round_trip() {
+	cc_state_t cc;
+	cc_init(&cc, CC_AIMD, 64);
+	ASSERT_EQ(cc_window(&cc), CC_INITIAL_WINDOW);
+
+	// slow start: one more per ACK
+	for (int i = 0; i < 4; ++i) cc_on_ack(&cc, 1000);
+	ASSERT_EQ(cc_window(&cc), 8);
+
+	cc_on_loss(&cc, 10000);
+	ASSERT_EQ(cc_window(&cc), 4);
+	cc_on_loss(&cc, 10500);							// same window, within one srtt
+	ASSERT_EQ(cc_window(&cc), 4);
+	ASSERT_EQ(cc.losses, 2);
+
+	// congestion avoidance: one more per window of ACKs
+	for (int i = 0; i < 3; ++i) cc_on_ack(&cc, 1000);
+	ASSERT_EQ(cc_window(&cc), 4);
+	cc_on_ack(&cc, 1000);
+	ASSERT_EQ(cc_window(&cc), 5);
+
+	cc_on_loss(&cc, 20000);
+	ASSERT_EQ(cc_window(&cc), 2);
+
+	// never beyond the user's window
+	cc_init(&cc, CC_AIMD, 3);
+	for (int i = 0; i < 10; ++i) cc_on_ack(&cc, 1000);
+	ASSERT_EQ(cc_window(&cc), 3);
+
+	cc_init(&cc, CC_OFF, 16);
+	cc_on_loss(&cc, 1);
+	ASSERT_EQ(cc_window(&cc), 16);
+}
+
+void test_delay_mode_backs_off_as_rtt_grows() {
+	cc_state_t cc;
+	cc_init(&cc, CC_DELAY, 64);
+
+	// a fast, empty path: slow start as usual
+	for (int i = 0; i < 12; ++i) cc_on_ack(&cc, 1000);
+	ASSERT_EQ(cc_window(&cc), 16);
+
+	// round trips triple as publishes queue: slow start ends, then the window shrinks
+	for (int i = 0; i < 40; ++i) cc_on_ack(&cc, 3000);
+	uint32_t queued = cc_window(&cc);
+	ASSERT_TRUE(queued < 16);
+	ASSERT_TRUE(cc.ssthresh < 64);
+	ASSERT_EQ(cc.losses, 0);
+
+	// the queue drains: the window grows again
+	for (int i = 0; i < 200; ++i) cc_on_ack(&cc, 1000);
+	ASSERT_TRUE(cc_window(&cc) > queued);
+}
+
+void test_rto_follows_rtt() {
+	cc_state_t cc;
+	cc_init(&cc, CC_AIMD, 8);
+	ASSERT_EQ(cc_rto_ms(&cc, 1000), 1000);		// nothing measured yet
+
+	for (int i = 0; i < 50; ++i) cc_on_ack(&cc, 20000);
+	int rto = cc_rto_ms(&cc, 1000);
+	ASSERT_TRUE(rto >= 20 && rto < 40);
+	ASSERT_EQ(cc_rto_ms(&cc, 10), 10);				// the retry policy bounds it
+
+	cc_init(&cc, CC_AIMD, 8);
+	cc_on_ack(&cc, 50);
+	ASSERT_EQ(cc_rto_ms(&cc, 1000), CC_MIN_RTO_US / 1000);
+}
+
+int main() {
+	RUN_TEST(test_aimd_grows_and_halves_once_per_round_trip);
+	RUN_TEST(test_delay_mode_backs_off_as_rtt_grows);
+	RUN_TEST(test_rto_follows_rtt);
+	return 0;
+}
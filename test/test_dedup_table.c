@@ -0,0 +1,82 @@
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "test_common.h"
+#include "../include/dedup_table.h"
+
+static timer_wheel_t wheel;
+
+static uint64_t monotonic_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void test_retransmits_are_flagged() {
+	timer_wheel_init(&wheel, monotonic_ms());
+	ASSERT_EQ(dedup_table_init(&wheel, 64 * 1024, 10000), 0);
+
+	uint32_t a = 1, b = 2;
+
+	ASSERT_TRUE(!dedup_table_check_and_mark(a, 1));
+	ASSERT_TRUE(dedup_table_check_and_mark(a, 1));
+	ASSERT_TRUE(!dedup_table_check_and_mark(b, 1));		// msg_ids are per publisher
+	ASSERT_TRUE(!dedup_table_check_and_mark(a, 2));
+
+	// sliding far ahead forgets old ids, which are forwarded again rather than dropped
+	ASSERT_TRUE(!dedup_table_check_and_mark(a, 1000));
+	ASSERT_TRUE(dedup_table_check_and_mark(a, 1000));
+	ASSERT_TRUE(!dedup_table_check_and_mark(a, 2));
+	ASSERT_EQ(dedup_table_count(), 2);
+
+	// a forgotten session leaves nothing behind for the next owner of its id
+	dedup_table_forget(a);
+	ASSERT_EQ(dedup_table_count(), 1);
+	ASSERT_TRUE(!dedup_table_check_and_mark(a, 1000));
+
+	dedup_table_destroy();
+}
+
+void test_budget_evicts_least_recent() {
+	timer_wheel_init(&wheel, monotonic_ms());
+	// room for exactly two publishers
+	ASSERT_EQ(dedup_table_init(&wheel, 2 * (sizeof(dedup_publisher_t) + 2 * sizeof(hash_slot_t)), 10000), 0);
+
+	uint32_t a = 1, b = 2, c = 3;
+
+	dedup_table_check_and_mark(a, 5);
+	dedup_table_check_and_mark(b, 5);
+	dedup_table_check_and_mark(a, 6);		// b is now the least recently active
+	dedup_table_check_and_mark(c, 5);
+
+	ASSERT_EQ(dedup_table_count(), 2);
+	ASSERT_TRUE(dedup_table_check_and_mark(a, 5));
+	ASSERT_TRUE(!dedup_table_check_and_mark(b, 5));		// evicted, so forwarded again
+
+	dedup_table_destroy();
+	ASSERT_EQ(dedup_table_init(&wheel, 1, 10000), -1);
+}
+
+void test_idle_publishers_expire() {
+	uint64_t start = monotonic_ms();
+	timer_wheel_init(&wheel, start);
+	ASSERT_EQ(dedup_table_init(&wheel, 64 * 1024, 1000), 0);
+
+	uint32_t a = 1;
+	dedup_table_check_and_mark(a, 1);
+
+	timer_wheel_advance(&wheel, start + 500);
+	ASSERT_EQ(dedup_table_count(), 1);
+	timer_wheel_advance(&wheel, start + 2000);
+	ASSERT_EQ(dedup_table_count(), 0);
+	ASSERT_TRUE(!dedup_table_check_and_mark(a, 1));
+
+	dedup_table_destroy();
+}
+
+int main() {
+	RUN_TEST(test_retransmits_are_flagged);
+	RUN_TEST(test_budget_evicts_least_recent);
+	RUN_TEST(test_idle_publishers_expire);
+	return 0;
+}
@@ -1,7 +1,9 @@
 #include <string.h>
 #include <stdlib.h>
+#include <poll.h>
 #include "test_common.h"
 #include "../include/event_queue.h"
+#include "../include/slim_msg.h"
 
 void test_single_push_pop() {
 	slimmq_event_queue_t queue;
@@ -10,7 +12,7 @@ void test_single_push_pop() {
 	const char* topic = "sensor/room1/temp";
 	const char* data = "23.5C";
 
-	ASSERT_EQ(event_queue_push(&queue, topic, data, strlen(data)), 0);
+	ASSERT_EQ(event_queue_push(&queue, MSG_PUBLISH, 1, topic, data, strlen(data)), 0);
 
 	slimmq_event_t event;
 	ASSERT_EQ(event_queue_pop(&queue, &event), 0);
@@ -31,7 +33,7 @@ void test_fifo_order() {
 	const char* messages[] = { "1", "2", "3" };
 
 	for (int i = 0; i < 3; ++i) {
-		ASSERT_EQ(event_queue_push(&queue, topics[i], messages[i], strlen(messages[i])), 0);
+		ASSERT_EQ(event_queue_push(&queue, MSG_PUBLISH, i, topics[i], messages[i], strlen(messages[i])), 0);
 	}
 
 	for (int i = 0; i < 3; ++i) {
@@ -53,10 +55,10 @@ void test_event_queue_overflow() {
 	const char* payload = "data";
 
 	for (int i = 0; i < MAX_EVENT_QUEUE_SIZE; ++i) {
-		ASSERT_EQ(event_queue_push(&queue, topic, payload, strlen(payload)), 0);
+		ASSERT_EQ(event_queue_push(&queue, MSG_PUBLISH, i, topic, payload, strlen(payload)), 0);
 	}
 
-	int result = event_queue_push(&queue, topic, payload, strlen(payload));
+	int result = event_queue_push(&queue, MSG_PUBLISH, 0, topic, payload, strlen(payload));
 	ASSERT_EQ(result, -1);
 
 	for (int i = 0; i < MAX_EVENT_QUEUE_SIZE; ++i) {
@@ -68,10 +70,79 @@ void test_event_queue_overflow() {
 	event_queue_destroy(&queue);
 }
 
+void test_batch_pop() {
+	slimmq_event_queue_t queue;
+	event_queue_init(&queue);
+
+	slimmq_event_t events[8];
+	ASSERT_EQ(event_queue_pop_batch(&queue, events, 8, 0), 0);
+	ASSERT_EQ(event_queue_pop_batch(&queue, events, 8, 20), 0);
+
+	// wrap the ring so the batch spans its end
+	for (int i = 0; i < MAX_EVENT_QUEUE_SIZE - 2; ++i) {
+		ASSERT_EQ(event_queue_push(&queue, MSG_PUBLISH, i, "skip", NULL, 0), 0);
+	}
+	for (int i = 0; i < MAX_EVENT_QUEUE_SIZE - 2; ++i) {
+		slimmq_event_t e;
+		ASSERT_EQ(event_queue_pop(&queue, &e), 0);
+	}
+
+	for (int i = 0; i < 5; ++i) {
+		char msg[8];
+		snprintf(msg, sizeof(msg), "m%d", i);
+		ASSERT_EQ(event_queue_push(&queue, MSG_PUBLISH, i, "batch", msg, strlen(msg)), 0);
+	}
+
+	ASSERT_EQ(event_queue_pop_batch(&queue, events, 3, -1), 3);
+	ASSERT_EQ(event_queue_pop_batch(&queue, events + 3, 8, 0), 2);
+	for (int i = 0; i < 5; ++i) {
+		ASSERT_EQ(events[i].msg_id, i);
+		ASSERT_STR_EQ(events[i].topic, "batch");
+		free(events[i].data);
+	}
+
+	event_queue_destroy(&queue);
+}
+
+static int is_readable(int fd) {
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
+void test_readiness_fd() {
+	slimmq_event_queue_t queue;
+	event_queue_init(&queue);
+	ASSERT_TRUE(queue.event_fd >= 0);
+
+	ASSERT_TRUE(!is_readable(queue.event_fd));
+
+	ASSERT_EQ(event_queue_push(&queue, MSG_PUBLISH, 1, "a", "1", 1), 0);
+	ASSERT_EQ(event_queue_push(&queue, MSG_PUBLISH, 2, "a", "2", 1), 0);
+	ASSERT_TRUE(is_readable(queue.event_fd));
+
+	slimmq_event_t e;
+	ASSERT_EQ(event_queue_pop(&queue, &e), 0);
+	free(e.data);
+	ASSERT_TRUE(is_readable(queue.event_fd));
+
+	ASSERT_EQ(event_queue_pop(&queue, &e), 0);
+	free(e.data);
+	ASSERT_TRUE(!is_readable(queue.event_fd));
+
+	ASSERT_EQ(event_queue_push(&queue, MSG_ACK, 7, "", NULL, 0), 0);
+	ASSERT_TRUE(is_readable(queue.event_fd));
+	ASSERT_EQ(event_queue_wait_ack(&queue, 7), 0);
+	ASSERT_TRUE(!is_readable(queue.event_fd));
+
+	event_queue_destroy(&queue);
+}
+
 int main() {
 	RUN_TEST(test_single_push_pop);
 	RUN_TEST(test_fifo_order);
 	RUN_TEST(test_event_queue_overflow);
+	RUN_TEST(test_batch_pop);
+	RUN_TEST(test_readiness_fd);
 
 	printf("=== All event_queue tests passed ===\n");
 	return 0;
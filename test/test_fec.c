@@ -0,0 +1,123 @@
+#include <string.h>
+#include <stdlib.h>
+#include "test_common.h"
+#include "../include/fec.h"
+#include "../include/fec_table.h"
+#include "../include/packet_handler.h"
+
+static const char* bodies[] = { "alpha", "b", "charlie-long", "dd", "echo", "f", "golf", "hh" };
+
+static size_t parity_of(fec_encoder_t* e, uint8_t index, uint8_t* out) {
+	return fec_encoder_parity(e, 3, index, out, FEC_PARITY_HEADER_SIZE + FEC_MAX_BODY);
+}
+
+void test_single_loss_is_rebuilt() {
+	fec_encoder_t e;
+	fec_decoder_t d;
+	memset(&d, 0, sizeof(d));
+	ASSERT_EQ(fec_encoder_init(&e, 4, 1), 0);
+
+	for (uint32_t seq = 1; seq <= 4; ++seq) {
+		const char* b = bodies[seq - 1];
+		ASSERT_EQ(fec_encoder_add(&e, seq, (const uint8_t*)b, strlen(b)), seq == 4);
+		if (seq != 3) ASSERT_TRUE(fec_decoder_store(&d, seq, (const uint8_t*)b, strlen(b)));
+	}
+
+	uint8_t parity[FEC_PARITY_HEADER_SIZE + FEC_MAX_BODY];
+	size_t len = parity_of(&e, 0, parity);
+	ASSERT_EQ(len, FEC_PARITY_HEADER_SIZE + strlen("charlie-long"));
+
+	uint8_t out[FEC_MAX_BODY];
+	uint32_t seq = 0;
+	size_t rebuilt = fec_decoder_repair(&d, parity, len, &seq, out, sizeof(out));
+	ASSERT_EQ(rebuilt, strlen("charlie-long"));
+	ASSERT_EQ(seq, 3);
+	ASSERT_TRUE(memcmp(out, "charlie-long", rebuilt) == 0);
+
+	// once delivered, the late original is a duplicate and nothing is left to rebuild
+	ASSERT_TRUE(fec_decoder_store(&d, seq, out, rebuilt));
+	ASSERT_TRUE(!fec_decoder_store(&d, 3, (const uint8_t*)"charlie-long", rebuilt));
+	ASSERT_EQ(fec_decoder_repair(&d, parity, len, &seq, out, sizeof(out)), 0);
+
+	fec_decoder_free(&d);
+}
+
+void test_interleaved_parity_covers_bursts() {
+	fec_encoder_t e;
+	fec_decoder_t d;
+	memset(&d, 0, sizeof(d));
+	ASSERT_EQ(fec_encoder_init(&e, 8, 2), 0);
+
+	// 100..107, a burst loses 104 and 105
+	for (uint32_t i = 0; i < 8; ++i) {
+		const char* b = bodies[i];
+		fec_encoder_add(&e, 100 + i, (const uint8_t*)b, strlen(b));
+		if (i != 4 && i != 5) fec_decoder_store(&d, 100 + i, (const uint8_t*)b, strlen(b));
+	}
+
+	uint8_t parity[FEC_PARITY_HEADER_SIZE + FEC_MAX_BODY];
+	uint8_t out[FEC_MAX_BODY];
+	uint32_t seq;
+	for (uint8_t index = 0; index < 2; ++index) {
+		size_t len = parity_of(&e, index, parity);
+		size_t rebuilt = fec_decoder_repair(&d, parity, len, &seq, out, sizeof(out));
+		ASSERT_EQ(seq, 104 + index);
+		ASSERT_EQ(rebuilt, strlen(bodies[4 + index]));
+		ASSERT_TRUE(memcmp(out, bodies[4 + index], rebuilt) == 0);
+	}
+
+	// two losses under the same parity cannot be told apart
+	fec_encoder_next_block(&e);
+	fec_decoder_free(&d);
+	for (uint32_t i = 0; i < 8; ++i) {
+		const char* b = bodies[i];
+		fec_encoder_add(&e, 200 + i, (const uint8_t*)b, strlen(b));
+		if (i != 0 && i != 2) fec_decoder_store(&d, 200 + i, (const uint8_t*)b, strlen(b));
+	}
+	size_t len = parity_of(&e, 0, parity);
+	ASSERT_EQ(fec_decoder_repair(&d, parity, len, &seq, out, sizeof(out)), 0);
+
+	fec_decoder_free(&d);
+	ASSERT_EQ(fec_encoder_init(&e, 2, 3), -1);					// more parity than data
+	ASSERT_EQ(fec_encoder_init(&e, FEC_MAX_BLOCK + 1, 1), -1);
+}
+
+void test_rules_number_protected_topics() {
+	ASSERT_EQ(fec_rule_add("sensor/#", 4, 1), 0);
+	ASSERT_EQ(fec_rule_add("sensor/raw", 2, 2), 0);		// latest matching rule wins
+	ASSERT_EQ(fec_rule_add("bad", 0, 1), -1);
+
+	ASSERT_TRUE(fec_stream_for("other/topic") == NULL);
+	fec_stream_t* temp = fec_stream_for("sensor/temp");
+	fec_stream_t* raw = fec_stream_for("sensor/raw");
+	ASSERT_NOT_NULL(temp);
+	ASSERT_NOT_NULL(raw);
+	ASSERT_TRUE(temp->id != raw->id);
+	ASSERT_EQ(temp->encoder.k, 4);
+	ASSERT_EQ(raw->encoder.k, 2);
+	ASSERT_TRUE(fec_stream_for("sensor/temp") == temp);
+
+	slim_msg_header_t header = { .version = 1, .msg_type = MSG_PUBLISH, .frag_total = 1, .batch_size = 1,
+															 .msg_id = 77, .payload_length = 1 + strlen("sensor/raw") + 1,
+															 .client_node_count = 1 };
+	uint8_t buf[256];
+	int len = serialize_message(&header, "sensor/raw", "x", 1, buf, sizeof(buf));
+	ASSERT_TRUE(!fec_stream_stamp(raw, buf, len));
+	ASSERT_TRUE(fec_stream_stamp(raw, buf, len));
+
+	slim_msg_header_t stamped;
+	memcpy(&stamped, buf, sizeof(stamped));
+	ASSERT_EQ(stamped.topic_id, raw->id);
+	ASSERT_EQ(stamped.msg_id, 2);
+	ASSERT_EQ(fec_stream_count(), 2);
+
+	fec_table_destroy();
+	ASSERT_TRUE(fec_stream_for("sensor/temp") == NULL);
+}
+
+int main() {
+	RUN_TEST(test_single_loss_is_rebuilt);
+	RUN_TEST(test_interleaved_parity_covers_bursts);
+	RUN_TEST(test_rules_number_protected_topics);
+	return 0;
+}
@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+#include "../include/hash_table.h"
+
+#define MODEL_KEYS 4096
+
+void test_put_find_remove() {
+	hash_table_t t;
+	ASSERT_EQ(hash_table_init(&t, 4), 0);
+
+	ASSERT_EQ(hash_table_put(&t, 42, 7), 0);
+	ASSERT_EQ(hash_table_put(&t, 42, 8), 0);		// overwrite keeps one entry
+	ASSERT_EQ(hash_table_count(&t), 1);
+	ASSERT_NOT_NULL(hash_table_find(&t, 42));
+	ASSERT_EQ(*hash_table_find(&t, 42), 8);
+	ASSERT_TRUE(hash_table_find(&t, 43) == NULL);
+
+	uint64_t value = 0;
+	ASSERT_TRUE(hash_table_remove(&t, 42, &value));
+	ASSERT_EQ(value, 8);
+	ASSERT_TRUE(!hash_table_remove(&t, 42, NULL));
+	ASSERT_EQ(hash_table_count(&t), 0);
+
+	hash_table_destroy(&t);
+}
+
+void test_matches_model_across_resizes() {
+	hash_table_t t;
+	memset(&t, 0, sizeof(t));		// a zeroed table is usable as is
+
+	static uint64_t model[MODEL_KEYS];		// 0 = absent, otherwise value
+	memset(model, 0, sizeof(model));
+	srand(11);
+
+	for (int op = 0; op < 200000; ++op) {
+		uint64_t key = (uint64_t)(rand() % MODEL_KEYS);
+		if (rand() % 3) {
+			uint64_t value = (uint64_t)op + 1;
+			ASSERT_EQ(hash_table_put(&t, key, value), 0);
+			model[key] = value;
+		} else {
+			ASSERT_EQ(hash_table_remove(&t, key, NULL), model[key] != 0);
+			model[key] = 0;
+		}
+
+		// every few operations, check the whole table, including mid-migration states
+		if (op % 4999 == 0) {
+			size_t expected = 0;
+			for (uint64_t k = 0; k < MODEL_KEYS; ++k) {
+				uint64_t* v = hash_table_find(&t, k);
+				if (model[k]) {
+					ASSERT_NOT_NULL(v);
+					ASSERT_EQ(*v, model[k]);
+					expected++;
+				} else {
+					ASSERT_TRUE(v == NULL);
+				}
+			}
+			ASSERT_EQ(hash_table_count(&t), expected);
+		}
+	}
+
+	hash_table_destroy(&t);
+}
+
+static bool is_odd(uint64_t key, uint64_t value, void* ctx) {
+	(void)value; (void)ctx;
+	return key & 1;
+}
+
+void test_remove_if() {
+	hash_table_t t;
+	ASSERT_EQ(hash_table_init(&t, 0), 0);
+
+	for (uint64_t k = 0; k < 10000; ++k) {
+		ASSERT_EQ(hash_table_put(&t, k, k), 0);
+	}
+	ASSERT_EQ(hash_table_remove_if(&t, is_odd, NULL), 5000);
+	ASSERT_EQ(hash_table_count(&t), 5000);
+
+	for (uint64_t k = 0; k < 10000; ++k) {
+		ASSERT_EQ(hash_table_find(&t, k) != NULL, !(k & 1));
+	}
+	hash_table_destroy(&t);
+}
+
+int main() {
+	RUN_TEST(test_put_find_remove);
+	RUN_TEST(test_matches_model_across_resizes);
+	RUN_TEST(test_remove_if);
+	return 0;
+}
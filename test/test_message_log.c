@@ -0,0 +1,183 @@
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include "test_common.h"
+#include "../include/message_log.h"
+
+static char log_path[] = "/tmp/slimmq_log_XXXXXX";
+static char compact_path[] = "/tmp/slimmq_compact_XXXXXX";
+
+static uint64_t visited[16];
+static size_t visit_count = 0;
+
+static void collect(const log_ref_t* ref, const log_record_header_t* rec,
+										const char* topic, const void* data, void* ctx) {
+	(void)ref; (void)topic; (void)data; (void)ctx;
+	if (visit_count < 16) visited[visit_count++] = rec->offset;
+}
+
+static void append_n(int n, log_ref_t* refs) {
+	char payload[32];
+	for (int i = 0; i < n; ++i) {
+		int len = snprintf(payload, sizeof(payload), "msg-%d", i);
+		ASSERT_EQ(message_log_append("sensor/temp", 1, payload, len, refs ? &refs[i] : NULL), 0);
+	}
+}
+
+void test_append_seek_and_read() {
+	ASSERT_EQ(message_log_open(log_path), 0);
+	append_n(5, NULL);
+
+	log_ref_t cursor;
+	ASSERT_EQ(message_log_seek_offset(2, &cursor), 0);
+	ASSERT_EQ(message_log_cursor_offset(&cursor), 2);
+
+	visit_count = 0;
+	while (message_log_read(&cursor, collect, NULL));
+	ASSERT_EQ(visit_count, 3);
+	ASSERT_EQ(visited[0], 2);
+	ASSERT_EQ(visited[2], 4);
+	ASSERT_EQ(message_log_cursor_offset(&cursor), 5);
+
+	// every record was appended after time 0
+	ASSERT_EQ(message_log_seek_time(0, &cursor), 0);
+	ASSERT_EQ(message_log_cursor_offset(&cursor), 0);
+
+	ASSERT_EQ(message_log_commit(), 0);
+	message_log_close();
+}
+
+void test_pending_survives_reopen() {
+	ASSERT_EQ(message_log_open(log_path), 0);
+
+	log_ref_t refs[3];
+	append_n(3, refs);
+	message_log_hold(&refs[0]);
+	message_log_hold(&refs[1]);
+	message_log_release(&refs[0]);
+	message_log_close();
+
+	ASSERT_EQ(message_log_open(log_path), 0);
+	visit_count = 0;
+	message_log_for_each_pending(collect, NULL);
+	ASSERT_EQ(visit_count, 1);
+	ASSERT_EQ(visited[0], 6);
+
+	// appends continue after the last valid record
+	log_ref_t ref;
+	ASSERT_EQ(message_log_append("sensor/temp", 1, "x", 1, &ref), 0);
+	ASSERT_EQ(message_log_record_offset(&ref), 8);
+	message_log_close();
+}
+
+void test_consumer_offsets() {
+	ASSERT_EQ(message_log_open(log_path), 0);
+
+	uint64_t offset;
+	ASSERT_EQ(message_log_consumer_offset("analytics", &offset), -1);
+	ASSERT_EQ(message_log_consumer_commit("analytics", 4), 0);
+	ASSERT_EQ(message_log_consumer_commit("analytics", 2), 0);		// never moves back
+	ASSERT_EQ(message_log_consumer_commit("", 1), -1);
+	message_log_close();
+
+	ASSERT_EQ(message_log_open(log_path), 0);
+	ASSERT_EQ(message_log_consumer_offset("analytics", &offset), 0);
+	ASSERT_EQ(offset, 4);
+	message_log_close();
+}
+
+void test_commit_and_torn_tail() {
+	ASSERT_EQ(message_log_open(log_path), 0);
+	ASSERT_TRUE(!message_log_dirty());
+
+	log_ref_t refs[2];
+	append_n(2, refs);
+	ASSERT_TRUE(message_log_dirty());
+	ASSERT_EQ(message_log_commit(), 0);
+	ASSERT_TRUE(!message_log_dirty());
+	uint64_t last = message_log_record_offset(&refs[1]);
+	message_log_close();
+
+	// a crash mid-append leaves a record without its magic, written last
+	char path[128];
+	snprintf(path, sizeof(path), "%s/%020d.seg", log_path, 0);
+	int fd = open(path, O_RDWR);
+	ASSERT_TRUE(fd >= 0);
+	uint32_t torn = 0;
+	ASSERT_EQ(pwrite(fd, &torn, sizeof(torn), refs[1].pos), sizeof(torn));
+	close(fd);
+
+	ASSERT_EQ(message_log_open(log_path), 0);
+	log_ref_t ref;
+	ASSERT_EQ(message_log_append("sensor/temp", 1, "y", 1, &ref), 0);
+	ASSERT_EQ(message_log_record_offset(&ref), last);
+	ASSERT_EQ(ref.pos, refs[1].pos);
+	message_log_close();
+}
+
+static int segment_files(const char* dir) {
+	DIR* d = opendir(dir);
+	if (!d) return -1;
+
+	int count = 0;
+	struct dirent* ent;
+	while ((ent = readdir(d)) != NULL) {
+		if (strstr(ent->d_name, ".seg")) count++;
+	}
+	closedir(d);
+	return count;
+}
+
+void test_compaction_reclaims_sealed_segments() {
+	ASSERT_EQ(message_log_open(compact_path), 0);
+
+	// records of a little under 1 MiB: the 17th no longer fits the first segment
+	size_t len = 1024 * 1024 - 256;
+	char* payload = calloc(1, len);
+	ASSERT_NOT_NULL(payload);
+	log_ref_t first, ref;
+	ASSERT_EQ(message_log_append("bulk", 1, payload, len, &first), 0);
+	message_log_hold(&first);
+	for (int i = 1; i < 17; ++i) ASSERT_EQ(message_log_append("bulk", 1, payload, len, &ref), 0);
+	free(payload);
+	ASSERT_TRUE(ref.segment != first.segment);
+	uint64_t second_base = message_log_record_offset(&ref);
+
+	// neither a pending delivery nor a reader or consumer behind it may lose the segment
+	message_log_compact(UINT64_MAX);
+	message_log_release(&first);
+	message_log_compact(second_base);
+	ASSERT_EQ(message_log_consumer_commit("slow", 3), 0);
+	message_log_compact(UINT64_MAX);
+	message_log_close();
+	ASSERT_EQ(segment_files(compact_path), 2);
+
+	ASSERT_EQ(message_log_open(compact_path), 0);
+	ASSERT_EQ(message_log_consumer_commit("slow", second_base + 1), 0);
+	message_log_compact(UINT64_MAX);
+	message_log_close();
+	ASSERT_EQ(segment_files(compact_path), 1);
+
+	// reads of reclaimed offsets resolve to the oldest record left
+	ASSERT_EQ(message_log_open(compact_path), 0);
+	log_ref_t cursor;
+	ASSERT_EQ(message_log_seek_offset(0, &cursor), 0);
+	ASSERT_EQ(message_log_cursor_offset(&cursor), second_base);
+	message_log_close();
+}
+
+int main() {
+	if (!mkdtemp(log_path) || !mkdtemp(compact_path)) return 1;
+
+	RUN_TEST(test_append_seek_and_read);
+	RUN_TEST(test_pending_survives_reopen);
+	RUN_TEST(test_consumer_offsets);
+	RUN_TEST(test_commit_and_torn_tail);
+	RUN_TEST(test_compaction_reclaims_sealed_segments);
+
+	char cmd[96];
+	snprintf(cmd, sizeof(cmd), "rm -rf %s %s", log_path, compact_path);
+	return system(cmd);
+}
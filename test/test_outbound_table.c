@@ -0,0 +1,405 @@
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "test_common.h"
+#include "../include/outbound_table.h"
+#include "../include/transport.h"
+#include "../include/packet_handler.h"
+#include "../include/slim_msg.h"
+
+#define OUTBOUND_TEST_PORT 9911
+
+static char log_path[] = "/tmp/slimmq_outbound_XXXXXX";
+
+static timer_wheel_t wheel;
+static int rx = -1;
+static int tx = -1;
+static struct sockaddr_in dest;
+
+static void setup(void) {
+	timer_wheel_init(&wheel, 0);
+	outbound_init(&wheel, tx);
+}
+
+/**
+ * delivery - serialize a delivery whose header carries @msg_id
+ */
+static size_t delivery(uint32_t msg_id, uint8_t qos, uint8_t* buf, size_t size) {
+	slim_msg_header_t hdr = { .version = 1, .msg_type = MSG_PUBLISH, .qos_level = qos,
+														.msg_id = msg_id, .frag_total = 1, .batch_size = 1,
+														.payload_length = 1 + strlen("t/x") + 1, .client_node_count = 1 };
+	int len = serialize_message(&hdr, "t/x", "d", 1, buf, size);
+	ASSERT_TRUE(len > 0);
+	return (size_t)len;
+}
+
+/**
+ * received_ids - drain the receiver socket, storing the msg_id of each datagram
+ *
+ * Return: number of datagrams received
+ */
+static int received_ids(uint32_t* ids, int max) {
+	uint8_t buf[256];
+	int n = 0;
+	while (recv(rx, buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+		slim_msg_header_t hdr;
+		memcpy(&hdr, buf, sizeof(hdr));
+		if (n < max) ids[n] = hdr.msg_id;
+		n++;
+	}
+	return n;
+}
+
+void test_ack_retires_entry() {
+	setup();
+	outbound_window_t w = { 0 };
+	uint8_t buf[64];
+	size_t len = delivery(1, QOS_AT_LEAST_ONCE, buf, sizeof(buf));
+
+	ASSERT_EQ(outbound_track(&w, 1, QOS_AT_LEAST_ONCE, &dest, buf, len, 0, true, NULL), 0);
+	ASSERT_EQ(w.inflight, 1);
+	ASSERT_EQ(wheel.count, 1);
+	ASSERT_TRUE(!outbound_slot_free(&w, 1));
+	ASSERT_TRUE(!outbound_slot_free(&w, 1 + OUTBOUND_WINDOW_SIZE));
+
+	// the QoS 2 handshake messages do not retire a QoS 1 delivery, nor do other ids
+	ASSERT_TRUE(!outbound_complete(&w, 1, NULL));
+	ASSERT_TRUE(!outbound_ack(&w, 2, NULL));
+	ASSERT_TRUE(!outbound_ack(&w, 1 + OUTBOUND_WINDOW_SIZE, NULL));
+
+	ASSERT_TRUE(outbound_ack(&w, 1, NULL));
+	ASSERT_TRUE(!outbound_ack(&w, 1, NULL));
+	ASSERT_EQ(w.inflight, 0);
+	ASSERT_EQ(wheel.count, 0);
+	ASSERT_TRUE(outbound_slot_free(&w, 1 + OUTBOUND_WINDOW_SIZE));
+}
+
+void test_retransmit_until_given_up() {
+	setup();
+	outbound_window_t w = { 0 };
+	uint8_t buf[64];
+	size_t len = delivery(7, QOS_AT_LEAST_ONCE, buf, sizeof(buf));
+	uint32_t ids[8];
+
+	ASSERT_EQ(outbound_track(&w, 7, QOS_AT_LEAST_ONCE, &dest, buf, len, 0, true, NULL), 0);
+
+	timer_wheel_advance(&wheel, OUTBOUND_RETRY_TIMEOUT_MS - TIMER_WHEEL_TICK_MS);
+	ASSERT_EQ(received_ids(ids, 8), 0);
+
+	uint64_t now = 0;
+	for (int retry = 1; retry <= OUTBOUND_MAX_RETRIES; ++retry) {
+		now += OUTBOUND_RETRY_TIMEOUT_MS;
+		timer_wheel_advance(&wheel, now);
+		ASSERT_EQ(received_ids(ids, 8), 1);
+		ASSERT_EQ(ids[0], 7);
+	}
+
+	// one more timeout gives the delivery up and frees its slot
+	now += OUTBOUND_RETRY_TIMEOUT_MS;
+	timer_wheel_advance(&wheel, now);
+	ASSERT_EQ(received_ids(ids, 8), 0);
+	ASSERT_EQ(w.dropped, 1);
+	ASSERT_EQ(w.inflight, 0);
+	ASSERT_EQ(wheel.count, 0);
+	ASSERT_TRUE(outbound_slot_free(&w, 7));
+}
+
+/**
+ * release_packet - serialize the CONTROL_RELEASE the broker answers CONTROL_RECEIVED with
+ */
+static size_t release_packet(uint32_t msg_id, uint8_t* buf, size_t size) {
+	slim_msg_header_t hdr = { .version = 1, .msg_type = MSG_CONTROL, .qos_level = QOS_EXACTLY_ONCE,
+														.msg_id = msg_id, .frag_total = 1, .batch_size = 1,
+														.payload_length = 1, .client_node_count = 1 };
+	int len = serialize_control_message(&hdr, CONTROL_RELEASE, NULL, 0, buf, size);
+	ASSERT_TRUE(len > 0);
+	return (size_t)len;
+}
+
+void test_qos2_handshake() {
+	setup();
+	outbound_window_t w = { 0 };
+	uint8_t buf[64], rel[64];
+	uint32_t ids[8];
+	size_t len = delivery(9, QOS_EXACTLY_ONCE, buf, sizeof(buf));
+	size_t rel_len = release_packet(9, rel, sizeof(rel));
+
+	ASSERT_EQ(outbound_track(&w, 9, QOS_EXACTLY_ONCE, &dest, buf, len, 0, true, NULL), 0);
+
+	// neither an ACK nor an early COMPLETE finishes a QoS 2 delivery
+	ASSERT_TRUE(!outbound_ack(&w, 9, NULL));
+	ASSERT_TRUE(!outbound_complete(&w, 9, NULL));
+	ASSERT_TRUE(!outbound_received(&w, 10, rel, rel_len, 0));
+
+	// RECEIVED: RELEASE replaces the PUBLISH as the retransmitted datagram
+	ASSERT_TRUE(outbound_received(&w, 9, rel, rel_len, 100));
+	timer_wheel_advance(&wheel, 100 + OUTBOUND_RETRY_TIMEOUT_MS);
+	uint8_t got[64];
+	ASSERT_EQ(recv(rx, got, sizeof(got), MSG_DONTWAIT), (ssize_t)rel_len);
+	ASSERT_EQ(got[sizeof(slim_msg_header_t)], CONTROL_RELEASE);
+	ASSERT_EQ(received_ids(ids, 8), 0);
+
+	// a repeated RECEIVED (our RELEASE was lost) asks for RELEASE again
+	ASSERT_TRUE(outbound_received(&w, 9, rel, rel_len, 100));
+	ASSERT_EQ(w.inflight, 1);
+
+	ASSERT_TRUE(outbound_complete(&w, 9, NULL));
+	ASSERT_TRUE(!outbound_complete(&w, 9, NULL));
+	ASSERT_TRUE(!outbound_received(&w, 9, rel, rel_len, 100));
+	ASSERT_EQ(w.inflight, 0);
+	ASSERT_EQ(wheel.count, 0);
+}
+
+void test_held_until_credit() {
+	setup();
+	outbound_window_t w = { 0 };
+	uint8_t buf[64];
+	uint32_t ids[8];
+
+	// a subscriber out of credit: tracked, but not sent or retried yet
+	for (uint32_t id = 1; id <= 3; ++id) {
+		size_t len = delivery(id, QOS_AT_LEAST_ONCE, buf, sizeof(buf));
+		ASSERT_EQ(outbound_track(&w, id, QOS_AT_LEAST_ONCE, &dest, buf, len, 0, false, NULL), 0);
+	}
+	ASSERT_EQ(w.inflight, 3);
+	ASSERT_EQ(wheel.count, 0);
+	timer_wheel_advance(&wheel, 10 * OUTBOUND_RETRY_TIMEOUT_MS);
+	ASSERT_EQ(received_ids(ids, 8), 0);
+
+	// an ACK for a delivery never sent is not taken
+	ASSERT_TRUE(!outbound_ack(&w, 1, NULL));
+
+	// credit releases the oldest held deliveries first, no more than it allows
+	uint64_t now = 10 * OUTBOUND_RETRY_TIMEOUT_MS;
+	ASSERT_EQ(outbound_release_held(&w, tx, 2, now), 2);
+	ASSERT_EQ(received_ids(ids, 8), 2);
+	ASSERT_EQ(ids[0], 1);
+	ASSERT_EQ(ids[1], 2);
+	ASSERT_EQ(wheel.count, 2);
+
+	// released deliveries are retried, the one still held is not
+	timer_wheel_advance(&wheel, now + OUTBOUND_RETRY_TIMEOUT_MS);
+	ASSERT_EQ(received_ids(ids, 8), 2);
+	ASSERT_TRUE(outbound_ack(&w, 1, NULL));
+	ASSERT_TRUE(outbound_ack(&w, 2, NULL));
+
+	ASSERT_EQ(outbound_release_held(&w, tx, 0, now), 0);
+	ASSERT_EQ(outbound_release_held(&w, tx, 5, now), 1);
+	ASSERT_EQ(received_ids(ids, 8), 1);
+	ASSERT_EQ(ids[0], 3);
+	ASSERT_TRUE(outbound_ack(&w, 3, NULL));
+	ASSERT_EQ(w.inflight, 0);
+	ASSERT_EQ(wheel.count, 0);
+}
+
+void test_full_window_queues_in_order() {
+	setup();
+	outbound_window_t w = { 0 };
+	uint8_t buf[64];
+	uint32_t ids[8];
+
+	for (uint32_t id = 1; id <= OUTBOUND_WINDOW_SIZE; ++id) {
+		size_t len = delivery(id, QOS_AT_LEAST_ONCE, buf, sizeof(buf));
+		ASSERT_EQ(outbound_track(&w, id, QOS_AT_LEAST_ONCE, &dest, buf, len, 0, true, NULL), 0);
+	}
+	uint32_t next = OUTBOUND_WINDOW_SIZE + 1;
+	ASSERT_TRUE(!outbound_slot_free(&w, next));
+
+	// queued deliveries carry no msg_id yet
+	for (int i = 0; i < 2; ++i) {
+		size_t len = delivery(0, QOS_AT_LEAST_ONCE, buf, sizeof(buf));
+		ASSERT_EQ(outbound_enqueue(&w, QOS_AT_LEAST_ONCE, buf, len, NULL), 0);
+	}
+	ASSERT_EQ(w.queued, 2);
+	ASSERT_TRUE(outbound_dequeue(&w, next, &dest, 0, true) == NULL);
+	ASSERT_EQ(w.queued, 2);
+
+	ASSERT_TRUE(outbound_ack(&w, 1, NULL));
+	const outbound_entry_t* e = outbound_dequeue(&w, next, &dest, 0, true);
+	ASSERT_NOT_NULL(e);
+	ASSERT_EQ(w.queued, 1);
+	ASSERT_EQ(w.inflight, OUTBOUND_WINDOW_SIZE);
+
+	// the caller sends the dequeued packet, stamped with its new msg_id
+	send_bytes(tx, (const struct sockaddr*)&dest, sizeof(dest), e->packet, e->packet_len);
+	ASSERT_EQ(received_ids(ids, 8), 1);
+	ASSERT_EQ(ids[0], next);
+	ASSERT_TRUE(outbound_ack(&w, next, NULL));
+
+	outbound_window_clear(&w);
+	ASSERT_EQ(w.inflight, 0);
+	ASSERT_EQ(w.queued, 0);
+	ASSERT_TRUE(w.queue_head == NULL && w.queue_tail == NULL);
+	ASSERT_EQ(wheel.count, 0);
+}
+
+static size_t pending_count = 0;
+
+static void count_pending(const log_ref_t* ref, const log_record_header_t* rec,
+													const char* topic, const void* data, void* ctx) {
+	(void)ref; (void)rec; (void)topic; (void)data; (void)ctx;
+	pending_count++;
+}
+
+/**
+ * pending_after_reopen - number of log records a restarted broker would redeliver
+ */
+static size_t pending_after_reopen(void) {
+	message_log_close();
+	ASSERT_EQ(message_log_open(log_path), 0);
+	pending_count = 0;
+	message_log_for_each_pending(count_pending, NULL);
+	return pending_count;
+}
+
+void test_log_records_held_until_retired() {
+	ASSERT_EQ(message_log_open(log_path), 0);
+	setup();
+	outbound_window_t w = { 0 };
+	uint8_t buf[64];
+
+	log_ref_t refs[2];
+	ASSERT_EQ(message_log_append("t/x", QOS_AT_LEAST_ONCE, "a", 1, &refs[0]), 0);
+	ASSERT_EQ(message_log_append("t/x", QOS_AT_LEAST_ONCE, "b", 1, &refs[1]), 0);
+
+	size_t len = delivery(1, QOS_AT_LEAST_ONCE, buf, sizeof(buf));
+	ASSERT_EQ(outbound_track(&w, 1, QOS_AT_LEAST_ONCE, &dest, buf, len, 0, true, &refs[0]), 0);
+	len = delivery(0, QOS_AT_LEAST_ONCE, buf, sizeof(buf));
+	ASSERT_EQ(outbound_enqueue(&w, QOS_AT_LEAST_ONCE, buf, len, &refs[1]), 0);
+
+	log_ref_t retired;
+	ASSERT_TRUE(outbound_ack(&w, 1, &retired));
+	ASSERT_EQ(message_log_record_offset(&retired), message_log_record_offset(&refs[0]));
+
+	// the queued delivery keeps its record through the move into the window
+	ASSERT_NOT_NULL(outbound_dequeue(&w, 2, &dest, 0, true));
+	ASSERT_EQ(pending_after_reopen(), 1);
+
+	// the handle points into the closed mapping, forget it before clearing
+	w.slots[2 % OUTBOUND_WINDOW_SIZE].log_ref.segment = NULL;
+	outbound_window_clear(&w);
+
+	// clearing a window releases what its entries and queue hold
+	ASSERT_EQ(message_log_append("t/x", QOS_AT_LEAST_ONCE, "c", 1, &refs[0]), 0);
+	ASSERT_EQ(message_log_append("t/x", QOS_AT_LEAST_ONCE, "d", 1, &refs[1]), 0);
+	len = delivery(3, QOS_AT_LEAST_ONCE, buf, sizeof(buf));
+	ASSERT_EQ(outbound_track(&w, 3, QOS_AT_LEAST_ONCE, &dest, buf, len, 0, false, &refs[0]), 0);
+	ASSERT_EQ(outbound_enqueue(&w, QOS_AT_LEAST_ONCE, buf, len, &refs[1]), 0);
+	outbound_window_clear(&w);
+	ASSERT_EQ(pending_after_reopen(), 0);
+	message_log_close();
+}
+
+void test_low_offset_is_oldest_unacked() {
+	ASSERT_EQ(message_log_open(log_path), 0);
+	setup();
+	outbound_window_t w = { 0 };
+	uint8_t buf[64];
+	uint64_t low;
+
+	log_ref_t refs[3];
+	for (int i = 0; i < 3; ++i) {
+		ASSERT_EQ(message_log_append("t/x", QOS_AT_LEAST_ONCE, "r", 1, &refs[i]), 0);
+	}
+	uint64_t first = message_log_record_offset(&refs[0]);
+	ASSERT_TRUE(!outbound_low_offset(&w, &low));
+
+	for (uint32_t id = 1; id <= 2; ++id) {
+		size_t len = delivery(id, QOS_AT_LEAST_ONCE, buf, sizeof(buf));
+		ASSERT_EQ(outbound_track(&w, id, QOS_AT_LEAST_ONCE, &dest, buf, len, 0, true, &refs[id - 1]), 0);
+	}
+	size_t len = delivery(0, QOS_AT_LEAST_ONCE, buf, sizeof(buf));
+	ASSERT_EQ(outbound_enqueue(&w, QOS_AT_LEAST_ONCE, buf, len, &refs[2]), 0);
+
+	// an ACK out of order leaves the oldest record unacknowledged
+	ASSERT_TRUE(outbound_ack(&w, 2, NULL));
+	ASSERT_TRUE(outbound_low_offset(&w, &low));
+	ASSERT_EQ(low, first);
+
+	ASSERT_TRUE(outbound_ack(&w, 1, NULL));
+	ASSERT_TRUE(outbound_low_offset(&w, &low));
+	ASSERT_EQ(low, first + 2);					// still queued
+
+	// a delivery dropped without its ACK keeps holding the offset back
+	outbound_mark_lost(&w, &refs[1]);
+	outbound_window_clear(&w);
+	ASSERT_TRUE(outbound_low_offset(&w, &low));
+	ASSERT_EQ(low, first + 1);
+
+	// once the consumer is replayed past it, it holds nothing back any more
+	outbound_clear_lost(&w);
+	ASSERT_TRUE(!outbound_low_offset(&w, &low));
+
+	message_log_close();
+}
+
+void test_queue_capped_and_low_offset_tracked() {
+	ASSERT_EQ(message_log_open(log_path), 0);
+	setup();
+	outbound_window_t w = { 0 };
+	uint8_t buf[64];
+	size_t len = delivery(0, QOS_AT_LEAST_ONCE, buf, sizeof(buf));
+	uint64_t low;
+
+	log_ref_t refs[3];
+	for (int i = 0; i < 3; ++i) {
+		ASSERT_EQ(message_log_append("t/x", QOS_AT_LEAST_ONCE, "r", 1, &refs[i]), 0);
+	}
+	uint64_t first = message_log_record_offset(&refs[0]);
+
+	// an unlogged delivery, then records out of log order
+	ASSERT_EQ(outbound_enqueue(&w, QOS_AT_LEAST_ONCE, buf, len, NULL), 0);
+	ASSERT_EQ(outbound_enqueue(&w, QOS_AT_LEAST_ONCE, buf, len, &refs[2]), 0);
+	ASSERT_EQ(outbound_enqueue(&w, QOS_AT_LEAST_ONCE, buf, len, &refs[1]), 0);
+	while (w.queued < OUTBOUND_QUEUE_MAX) {
+		ASSERT_EQ(outbound_enqueue(&w, QOS_AT_LEAST_ONCE, buf, len, NULL), 0);
+	}
+	ASSERT_TRUE(outbound_low_offset(&w, &low));
+	ASSERT_EQ(low, first + 1);
+
+	// past the cap a logged delivery is dropped and noted as lost
+	ASSERT_EQ(outbound_enqueue(&w, QOS_AT_LEAST_ONCE, buf, len, &refs[0]), -1);
+	ASSERT_EQ(w.queued, OUTBOUND_QUEUE_MAX);
+	ASSERT_TRUE(outbound_low_offset(&w, &low));
+	ASSERT_EQ(low, first);
+	outbound_clear_lost(&w);
+
+	// the queue's low offset follows the entries leaving it
+	ASSERT_TRUE(outbound_dequeue(&w, 1, &dest, 0, false) != NULL);
+	ASSERT_TRUE(outbound_dequeue(&w, 2, &dest, 0, false) != NULL);
+	ASSERT_TRUE(outbound_low_offset(&w, &low));
+	ASSERT_EQ(low, first + 1);
+	ASSERT_TRUE(outbound_dequeue(&w, 3, &dest, 0, false) != NULL);
+	outbound_window_clear(&w);
+	ASSERT_TRUE(!outbound_low_offset(&w, &low));
+
+	ASSERT_TRUE(outbound_dequeue(&w, 4, &dest, 0, false) == NULL);
+	message_log_close();
+}
+
+int main() {
+	if (!mkdtemp(log_path)) return 1;
+
+	rx = init_socket("127.0.0.1", OUTBOUND_TEST_PORT, true);
+	tx = init_socket(NULL, 0, false);
+	if (rx < 0 || tx < 0) return 1;
+	dest = (struct sockaddr_in){ .sin_family = AF_INET, .sin_port = htons(OUTBOUND_TEST_PORT) };
+	inet_pton(AF_INET, "127.0.0.1", &dest.sin_addr);
+
+	RUN_TEST(test_ack_retires_entry);
+	RUN_TEST(test_retransmit_until_given_up);
+	RUN_TEST(test_qos2_handshake);
+	RUN_TEST(test_held_until_credit);
+	RUN_TEST(test_full_window_queues_in_order);
+	RUN_TEST(test_log_records_held_until_retired);
+	RUN_TEST(test_low_offset_is_oldest_unacked);
+	RUN_TEST(test_queue_capped_and_low_offset_tracked);
+
+	close(rx);
+	close(tx);
+
+	char cmd[64];
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", log_path);
+	return system(cmd);
+}
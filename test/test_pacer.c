@@ -0,0 +1,68 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "test_common.h"
+#include "../include/pacer.h"
+#include "../include/transport.h"
+
+#define PACER_TEST_PORT 9910
+
+static int count_received(int sockfd) {
+	uint8_t buf[64];
+	int n = 0;
+	while (recv(sockfd, buf, sizeof(buf), MSG_DONTWAIT) > 0) n++;
+	return n;
+}
+
+void test_bucket_spreads_a_burst() {
+	int rx = init_socket("127.0.0.1", PACER_TEST_PORT, true);
+	int tx = init_socket(NULL, 0, false);
+	ASSERT_TRUE(rx >= 0 && tx >= 0);
+	struct sockaddr_in dest = { .sin_family = AF_INET, .sin_port = htons(PACER_TEST_PORT) };
+	inet_pton(AF_INET, "127.0.0.1", &dest.sin_addr);
+
+	pacer_t p;
+	pacer_init(&p, 1000, 3, 0);						// one datagram per millisecond, three back to back
+	const uint8_t msg[] = "x";
+	for (int i = 0; i < 10; ++i) ASSERT_EQ(pacer_send(&p, tx, &dest, msg, sizeof(msg), 0), 0);
+	ASSERT_EQ(count_received(rx), 3);
+	ASSERT_EQ(p.queued, 7);
+	ASSERT_EQ(pacer_next_timeout_ms(&p, 0), 1);
+
+	// tokens accrue with time, the queue drains in order
+	ASSERT_EQ(pacer_drain(&p, tx, 500), 0);
+	ASSERT_EQ(pacer_next_timeout_ms(&p, 500), 1);
+	ASSERT_EQ(pacer_drain(&p, tx, 2000), 2);
+	ASSERT_EQ(count_received(rx), 2);
+
+	// a long pause earns no more than the burst
+	ASSERT_EQ(pacer_drain(&p, tx, 60000), 3);
+	ASSERT_EQ(pacer_drain(&p, tx, 70000), 2);
+	ASSERT_EQ(pacer_next_timeout_ms(&p, 70000), -1);
+	ASSERT_EQ(count_received(rx), 5);
+	ASSERT_EQ(p.delayed, 7);
+
+	for (int i = 0; i < 5; ++i) pacer_send(&p, tx, &dest, msg, sizeof(msg), 200000);
+	ASSERT_EQ(count_received(rx), 3);
+	ASSERT_EQ(p.queued, 2);
+	pacer_destroy(&p);
+	ASSERT_EQ(pacer_next_timeout_ms(&p, 200000), -1);
+
+	// nor less than a millisecond of tokens, the broker's poll() resolution
+	pacer_init(&p, 100000, 1, 0);
+	ASSERT_EQ(p.burst, 101);
+
+	// rate 0 leaves pacing off
+	pacer_init(&p, 0, 0, 0);
+	for (int i = 0; i < 4; ++i) pacer_send(&p, tx, &dest, msg, sizeof(msg), 0);
+	ASSERT_EQ(count_received(rx), 4);
+	ASSERT_EQ(pacer_next_timeout_ms(&p, 0), -1);
+
+	close(rx);
+	close(tx);
+}
+
+int main() {
+	RUN_TEST(test_bucket_spreads_a_burst);
+	return 0;
+}
@@ -0,0 +1,117 @@
+#include <string.h>
+#include <stdlib.h>
+#include "test_common.h"
+#include "../include/pending_table.h"
+
+void test_update_and_get() {
+	pending_table_init();
+	uint32_t a = 1, b = 2;
+
+	qos2_state_t state;
+	ASSERT_TRUE(!pending_table_get(a, 1, &state));
+
+	pending_table_update(a, 1, QOS2_STATE_RECEIVED);
+	pending_table_update(b, 1, QOS2_STATE_COMPLETED);
+	ASSERT_TRUE(pending_table_get(a, 1, &state));
+	ASSERT_EQ(state, QOS2_STATE_RECEIVED);
+	ASSERT_TRUE(pending_table_get(b, 1, &state));
+	ASSERT_EQ(state, QOS2_STATE_COMPLETED);
+
+	pending_table_update(a, 1, QOS2_STATE_RELEASED);
+	ASSERT_TRUE(pending_table_get(a, 1, &state));
+	ASSERT_EQ(state, QOS2_STATE_RELEASED);
+
+	pending_table_remove(a, 1);
+	ASSERT_TRUE(!pending_table_get(a, 1, &state));
+
+	// a forgotten session leaves nothing behind for the next owner of its id
+	pending_table_forget(b);
+	ASSERT_TRUE(!pending_table_get(b, 1, &state));
+	pending_table_destroy();
+}
+
+void test_window_slides() {
+	pending_table_init();
+	uint32_t a = 1;
+
+	for (uint32_t id = 1000; id < 1000 + 3 * PENDING_WINDOW_SIZE; ++id) {
+		pending_table_update(a, id, QOS2_STATE_COMPLETED);
+	}
+
+	qos2_state_t state;
+	uint32_t newest = 1000 + 3 * PENDING_WINDOW_SIZE - 1;
+	ASSERT_TRUE(pending_table_get(a, newest, &state));
+	ASSERT_EQ(state, QOS2_STATE_COMPLETED);
+
+	// msg_ids that just slid out of the window are reported as completed
+	ASSERT_TRUE(pending_table_get(a, newest - 2 * PENDING_WINDOW_SIZE + 1, &state));
+	ASSERT_EQ(state, QOS2_STATE_COMPLETED);
+
+	// slots reused by the window start out unknown
+	ASSERT_TRUE(!pending_table_get(a, newest + 1, &state));
+	pending_table_update(a, newest + 1, QOS2_STATE_RECEIVED);
+	ASSERT_TRUE(pending_table_get(a, newest + 1, &state));
+	ASSERT_EQ(state, QOS2_STATE_RECEIVED);
+	pending_table_destroy();
+}
+
+void test_window_restarts_far_behind() {
+	pending_table_init();
+	uint32_t a = 1;
+
+	for (uint32_t id = 5000; id < 5010; ++id) {
+		pending_table_update(a, id, QOS2_STATE_COMPLETED);
+	}
+
+	// late retransmits of ids just behind the window are completed
+	qos2_state_t state;
+	uint32_t base = 5000 - PENDING_WINDOW_SIZE / 2;
+	ASSERT_TRUE(pending_table_get(a, base - 1, &state));
+	ASSERT_EQ(state, QOS2_STATE_COMPLETED);
+	ASSERT_TRUE(pending_table_get(a, base - PENDING_WINDOW_SIZE, &state));
+
+	// a publisher numbering from 1 again is not mistaken for a duplicate
+	ASSERT_TRUE(!pending_table_get(a, 1, &state));
+	pending_table_update(a, 1, QOS2_STATE_RECEIVED);
+	ASSERT_TRUE(pending_table_get(a, 1, &state));
+	ASSERT_EQ(state, QOS2_STATE_RECEIVED);
+	ASSERT_TRUE(!pending_table_get(a, 2, &state));
+	pending_table_update(a, 2, QOS2_STATE_RECEIVED);
+	ASSERT_TRUE(pending_table_get(a, 1, &state));
+	ASSERT_EQ(state, QOS2_STATE_RECEIVED);
+	pending_table_destroy();
+}
+
+void test_snapshot_and_expiry() {
+	pending_table_init();
+	uint32_t a = 1;
+	pending_table_update(a, 7, QOS2_STATE_WAIT_RELEASE);
+
+	size_t len = pending_table_snapshot_write(NULL);
+	uint8_t* image = malloc(len);
+	ASSERT_EQ(pending_table_snapshot_write(image), len);
+	pending_table_destroy();
+
+	timer_wheel_t wheel;
+	timer_wheel_init(&wheel, 0);
+	pending_table_set_expiry(&wheel, 1000);
+
+	ASSERT_EQ(pending_table_snapshot_adopt(image, len), 0);
+	qos2_state_t state;
+	ASSERT_TRUE(pending_table_get(a, 7, &state));
+	ASSERT_EQ(state, QOS2_STATE_WAIT_RELEASE);
+	ASSERT_EQ(wheel.count, 1);
+
+	pending_table_destroy();
+	ASSERT_EQ(wheel.count, 0);
+	pending_table_set_expiry(NULL, 0);
+	free(image);
+}
+
+int main() {
+	RUN_TEST(test_update_and_get);
+	RUN_TEST(test_window_slides);
+	RUN_TEST(test_window_restarts_far_behind);
+	RUN_TEST(test_snapshot_and_expiry);
+	return 0;
+}
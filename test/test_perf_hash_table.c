@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "../include/hash_table.h"
+
+#define COUNT 50000
+#define CHAIN_BUCKETS 1024				// the fixed bucket count the tables used before
+
+/*
+ * Compares the shared open-addressing table against the fixed-size chained
+ * table it replaced, at COUNT live entries. Insert latency percentiles show
+ * that growing never pauses for a full rehash.
+ */
+
+typedef struct chain_entry {
+	uint64_t key;
+	uint64_t value;
+	struct chain_entry* next;
+} chain_entry_t;
+
+static chain_entry_t* chains[CHAIN_BUCKETS];
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void chain_put(uint64_t key, uint64_t value) {
+	chain_entry_t** head = &chains[key % CHAIN_BUCKETS];
+	for (chain_entry_t* e = *head; e; e = e->next) {
+		if (e->key == key) {
+			e->value = value;
+			return;
+		}
+	}
+	chain_entry_t* e = malloc(sizeof(*e));
+	e->key = key;
+	e->value = value;
+	e->next = *head;
+	*head = e;
+}
+
+static uint64_t* chain_find(uint64_t key) {
+	for (chain_entry_t* e = chains[key % CHAIN_BUCKETS]; e; e = e->next) {
+		if (e->key == key) return &e->value;
+	}
+	return NULL;
+}
+
+static void chain_remove(uint64_t key) {
+	chain_entry_t** link = &chains[key % CHAIN_BUCKETS];
+	while (*link && (*link)->key != key) link = &(*link)->next;
+	if (*link) {
+		chain_entry_t* e = *link;
+		*link = e->next;
+		free(e);
+	}
+}
+
+static int cmp_u64(const void* a, const void* b) {
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+static void report(const char* name, const char* op, uint64_t elapsed_ns) {
+	printf("%-10s %-7s %8.1f ns/op\n", name, op, (double)elapsed_ns / COUNT);
+}
+
+int main(void) {
+	static uint64_t keys[COUNT];
+	srand(1);
+	for (int i = 0; i < COUNT; ++i) {
+		// address-like keys: ip << 16 | port
+		keys[i] = ((uint64_t)(0x7f000001u + rand() % 64) << 16) | (uint64_t)(rand() & 0xffff);
+	}
+
+	volatile uint64_t sink = 0;
+	uint64_t start;
+
+	start = now_ns();
+	for (int i = 0; i < COUNT; ++i) chain_put(keys[i], i);
+	report("chained", "insert", now_ns() - start);
+
+	start = now_ns();
+	for (int i = 0; i < COUNT; ++i) {
+		uint64_t* v = chain_find(keys[i]);
+		if (v) sink += *v;
+	}
+	report("chained", "lookup", now_ns() - start);
+
+	start = now_ns();
+	for (int i = 0; i < COUNT; ++i) chain_remove(keys[i]);
+	report("chained", "remove", now_ns() - start);
+
+	hash_table_t t;
+	hash_table_init(&t, 0);		// start small so the run includes every resize
+	static uint64_t put_ns[COUNT];
+
+	start = now_ns();
+	for (int i = 0; i < COUNT; ++i) {
+		uint64_t op_start = now_ns();
+		hash_table_put(&t, keys[i], i);
+		put_ns[i] = now_ns() - op_start;
+	}
+	report("robinhood", "insert", now_ns() - start);
+
+	start = now_ns();
+	for (int i = 0; i < COUNT; ++i) {
+		uint64_t* v = hash_table_find(&t, keys[i]);
+		if (v) sink += *v;
+	}
+	report("robinhood", "lookup", now_ns() - start);
+
+	start = now_ns();
+	for (int i = 0; i < COUNT; ++i) hash_table_remove(&t, keys[i], NULL);
+	report("robinhood", "remove", now_ns() - start);
+
+	qsort(put_ns, COUNT, sizeof(put_ns[0]), cmp_u64);
+	printf("robinhood insert latency: p50 %llu ns, p99.9 %llu ns, max %llu ns\n",
+				 (unsigned long long)put_ns[COUNT / 2],
+				 (unsigned long long)put_ns[COUNT - COUNT / 1000],
+				 (unsigned long long)put_ns[COUNT - 1]);
+
+	hash_table_destroy(&t);
+	return sink == 0;
+}
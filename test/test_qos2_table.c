@@ -0,0 +1,73 @@
+#include <string.h>
+#include "test_common.h"
+#include "../include/qos2_table.h"
+
+void test_dedup_window_slides() {
+	qos2_dedup_window_t w;
+	qos2_dedup_init(&w);
+
+	ASSERT_TRUE(!qos2_dedup_is_duplicate(&w, 1));
+	qos2_dedup_mark(&w, 1);
+	ASSERT_TRUE(qos2_dedup_is_duplicate(&w, 1));
+
+	// out of order within the window
+	qos2_dedup_mark(&w, 5);
+	ASSERT_TRUE(!qos2_dedup_is_duplicate(&w, 3));
+	qos2_dedup_mark(&w, 3);
+	ASSERT_TRUE(qos2_dedup_is_duplicate(&w, 3));
+	ASSERT_TRUE(!qos2_dedup_is_duplicate(&w, 4));
+
+	// ids ahead slide the window; what slides out is finished
+	qos2_dedup_mark(&w, 200);
+	ASSERT_EQ(w.base, 200 - (QOS2_DEDUP_WINDOW - 1));
+	ASSERT_TRUE(qos2_dedup_is_duplicate(&w, 200));
+	ASSERT_TRUE(!qos2_dedup_is_duplicate(&w, 199));
+	ASSERT_TRUE(qos2_dedup_is_duplicate(&w, w.base - 1));
+	ASSERT_TRUE(qos2_dedup_is_duplicate(&w, w.base - QOS2_DEDUP_WINDOW));
+}
+
+void test_dedup_window_restarts_far_behind() {
+	qos2_dedup_window_t w;
+	qos2_dedup_init(&w);
+
+	for (uint32_t id = 1000; id < 1010; ++id) qos2_dedup_mark(&w, id);
+
+	// a broker numbering from scratch is far behind, its deliveries are new
+	uint32_t restart = 1000 - 10 * QOS2_DEDUP_WINDOW;
+	ASSERT_TRUE(!qos2_dedup_is_duplicate(&w, restart));
+	qos2_dedup_mark(&w, restart);
+	ASSERT_TRUE(qos2_dedup_is_duplicate(&w, restart));
+
+	// deliveries sent just before it may still arrive, and later ones are new too
+	ASSERT_TRUE(!qos2_dedup_is_duplicate(&w, restart - 1));
+	ASSERT_TRUE(!qos2_dedup_is_duplicate(&w, restart + 1));
+	ASSERT_TRUE(!qos2_dedup_is_duplicate(&w, 1005));
+
+	// the old numbering is far ahead now and starts over once more
+	qos2_dedup_mark(&w, restart + 1);
+	ASSERT_TRUE(qos2_dedup_is_duplicate(&w, restart + 1));
+	ASSERT_TRUE(qos2_dedup_is_duplicate(&w, restart));
+}
+
+void test_dedup_window_wraps() {
+	qos2_dedup_window_t w;
+	qos2_dedup_init(&w);
+
+	// the broker starts each session at a random id, anywhere in the 32-bit space
+	uint32_t first = UINT32_MAX - 2;
+	ASSERT_TRUE(!qos2_dedup_is_duplicate(&w, first));
+	qos2_dedup_mark(&w, first);
+	for (uint32_t i = 1; i < 6; ++i) {
+		ASSERT_TRUE(!qos2_dedup_is_duplicate(&w, first + i));
+		qos2_dedup_mark(&w, first + i);
+	}
+	for (uint32_t i = 0; i < 6; ++i) ASSERT_TRUE(qos2_dedup_is_duplicate(&w, first + i));
+	ASSERT_TRUE(!qos2_dedup_is_duplicate(&w, first + 6));
+}
+
+int main() {
+	RUN_TEST(test_dedup_window_slides);
+	RUN_TEST(test_dedup_window_restarts_far_behind);
+	RUN_TEST(test_dedup_window_wraps);
+	return 0;
+}
@@ -8,6 +8,7 @@
 #include "../include/slim_msg.h"
 #include "../include/transport.h"
 #include "../include/packet_handler.h"
+#include "../include/fec.h"
 #include "test_common.h"
 
 #define BROKER_PORT 9900
@@ -16,7 +17,7 @@
 volatile int mock_broker_ready = 0;
 
 void* mock_broker_thread(void* arg) {
-	int sockfd = init_udp_socket(BROKER_IP, BROKER_PORT);
+	int sockfd = init_socket(BROKER_IP, BROKER_PORT, true);
 	assert(sockfd >= 0);
 
 	mock_broker_ready = 1;
@@ -74,19 +75,1057 @@ void test_slimmq_client_publish_subscribe() {
 	int pub = slimmq_publish(client, "test/topic", "hello", strlen("hello"));
 	ASSERT_EQ(pub >= 0, true);
 
-	char recv_topic[128];
-	char recv_data[512];
-	int res = slimmq_receive(client, recv_topic, sizeof(recv_topic), recv_data, sizeof(recv_data));
-	ASSERT_EQ(res, 0);
-	ASSERT_EQ(strcmp(recv_topic, "test/topic"), 0);
-	ASSERT_EQ(strcmp(recv_data, "hello"), 0);
+	// the listener thread owns the socket, so the echo arrives through the event queue
+	slimmq_event_t evt;
+	ASSERT_EQ(slimmq_next_events(client, &evt, 1, 3000), 1);
+	ASSERT_EQ(strcmp(evt.topic, "test/topic"), 0);
+	ASSERT_EQ(evt.data_len, strlen("hello"));
+	ASSERT_EQ(memcmp(evt.data, "hello", evt.data_len), 0);
+	free(evt.data);
 
 	slimmq_close(client);
 	pthread_join(broker_thread, NULL);
 }
 
+#define QOS2_THREADS 8
+#define QOS2_IDS_PER_THREAD 500
+
+static void* complete_handshakes(void* arg) {
+	qos2_table_t* t = arg;
+	for (uint32_t id = 1; id <= QOS2_THREADS * QOS2_IDS_PER_THREAD; ++id) {
+		qos2_table_set(t, id, QOS2_CLIENT_STATE_WAIT_COMPLETE);
+	}
+	return NULL;
+}
+
+typedef struct {
+	qos2_table_t* table;
+	uint32_t first_id;
+	int reached;
+} qos2_waiter_t;
+
+static void* wait_handshakes(void* arg) {
+	qos2_waiter_t* w = arg;
+	for (uint32_t id = w->first_id; id < w->first_id + QOS2_IDS_PER_THREAD; ++id) {
+		if (qos2_table_wait_state(w->table, id, QOS2_CLIENT_STATE_WAIT_COMPLETE, 2000)) {
+			qos2_table_remove(w->table, id);
+			w->reached++;
+		}
+	}
+	return NULL;
+}
+
+void test_qos2_state_is_per_client() {
+	slimmq_client_t* a = slimmq_connect(BROKER_IP, BROKER_PORT);
+	slimmq_client_t* b = slimmq_connect(BROKER_IP, BROKER_PORT);
+	ASSERT_NOT_NULL(a);
+	ASSERT_NOT_NULL(b);
+	slimmq_set_qos(a, QOS_EXACTLY_ONCE);
+	slimmq_set_qos(b, QOS_EXACTLY_ONCE);
+
+	ASSERT_EQ(qos2_table_begin(&a->qos2_outbound, 7), 0);
+	ASSERT_TRUE(qos2_table_set(&a->qos2_outbound, 7, QOS2_CLIENT_STATE_COMPLETED));
+	ASSERT_EQ(qos2_table_get_state(&b->qos2_outbound, 7), QOS2_CLIENT_STATE_NONE);
+
+	// answers for a msg_id nobody publishes are not tracked
+	ASSERT_TRUE(!qos2_table_set(&b->qos2_outbound, 7, QOS2_CLIENT_STATE_WAIT_COMPLETE));
+	ASSERT_EQ(qos2_table_get_state(&b->qos2_outbound, 7), QOS2_CLIENT_STATE_NONE);
+
+	// closing one client must leave the other's handshakes intact
+	slimmq_close(a);
+	ASSERT_EQ(qos2_table_begin(&b->qos2_outbound, 7), 0);
+	ASSERT_TRUE(qos2_table_set(&b->qos2_outbound, 7, QOS2_CLIENT_STATE_WAIT_COMPLETE));
+	ASSERT_EQ(qos2_table_get_state(&b->qos2_outbound, 7), QOS2_CLIENT_STATE_WAIT_COMPLETE);
+	qos2_table_remove(&b->qos2_outbound, 7);
+
+	// publishers wait on their own msg_ids while the "listener" updates them
+	pthread_t listener;
+	pthread_t waiters[QOS2_THREADS];
+	qos2_waiter_t ctx[QOS2_THREADS];
+	for (uint32_t id = 1; id <= QOS2_THREADS * QOS2_IDS_PER_THREAD; ++id) {
+		ASSERT_EQ(qos2_table_begin(&b->qos2_outbound, id), 0);
+	}
+	for (int i = 0; i < QOS2_THREADS; ++i) {
+		ctx[i] = (qos2_waiter_t){ .table = &b->qos2_outbound, .first_id = 1 + i * QOS2_IDS_PER_THREAD };
+		pthread_create(&waiters[i], NULL, wait_handshakes, &ctx[i]);
+	}
+	pthread_create(&listener, NULL, complete_handshakes, &b->qos2_outbound);
+
+	pthread_join(listener, NULL);
+	for (int i = 0; i < QOS2_THREADS; ++i) {
+		pthread_join(waiters[i], NULL);
+		ASSERT_EQ(ctx[i].reached, QOS2_IDS_PER_THREAD);
+	}
+	ASSERT_EQ(hash_table_count(&b->qos2_outbound.entries), 0);
+
+	slimmq_close(b);
+}
+
+#define MP_BROKER_PORT 9901
+#define MP_THREADS 8
+#define MP_PUBLISHES_PER_THREAD 200
+
+static atomic_int mp_broker_ready = 0;
+static uint8_t mp_seen[MP_THREADS * MP_PUBLISHES_PER_THREAD + 1];
+static int mp_distinct = 0;
+static int mp_duplicates = 0;
+
+/*
+ * ACKs every QoS 1 publish and counts distinct msg_ids until the client
+ * falls silent.
+ */
+static void* mp_broker_thread(void* arg) {
+	(void)arg;
+	int sockfd = init_socket(BROKER_IP, MP_BROKER_PORT, true);
+	assert(sockfd >= 0);
+	struct timeval tv = { .tv_sec = 1 };
+	setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	mp_broker_ready = 1;
+
+	struct sockaddr_in from;
+	socklen_t fromlen = sizeof(from);
+	uint8_t buf[1024];
+	slim_msg_header_t header;
+	char topic[128];
+	char payload[512];
+
+	int len;
+	while ((len = recv_bytes(sockfd, buf, sizeof(buf), (struct sockaddr*)&from, &fromlen)) > 0) {
+		if (deserialize_message(buf, len, &header,
+														topic, sizeof(topic), payload, sizeof(payload)) != 0 ||
+				header.msg_type != MSG_PUBLISH) {
+			continue;
+		}
+
+		if (header.msg_id < sizeof(mp_seen) && !mp_seen[header.msg_id]) {
+			mp_seen[header.msg_id] = 1;
+			mp_distinct++;
+		} else {
+			mp_duplicates++;
+		}
+
+		slim_msg_header_t ack = header;
+		ack.msg_type = MSG_ACK;
+		ack.payload_length = 0;
+		send_bytes(sockfd, (struct sockaddr*)&from, fromlen, (const uint8_t*)&ack, sizeof(ack));
+
+		// and one for a publish that is not in flight, like a late ACK of a timed-out one
+		ack.msg_id |= 0x80000000u;
+		send_bytes(sockfd, (struct sockaddr*)&from, fromlen, (const uint8_t*)&ack, sizeof(ack));
+	}
+
+	close(sockfd);
+	return NULL;
+}
+
+static void* mp_publish(void* arg) {
+	slimmq_client_t* client = arg;
+	long failures = 0;
+	for (int i = 0; i < MP_PUBLISHES_PER_THREAD; ++i) {
+		if (slimmq_publish(client, "mp/topic", "x", 1) != 0) failures++;
+	}
+	return (void*)failures;
+}
+
+void test_concurrent_publishers_share_one_client() {
+	pthread_t broker_thread;
+	pthread_create(&broker_thread, NULL, mp_broker_thread, NULL);
+	while (!mp_broker_ready) usleep(10000);
+
+	slimmq_client_t* client = slimmq_connect(BROKER_IP, MP_BROKER_PORT);
+	ASSERT_NOT_NULL(client);
+	slimmq_set_qos(client, QOS_AT_LEAST_ONCE);
+	slimmq_set_retry_policy(client, 1000, 3);
+
+	pthread_t publishers[MP_THREADS];
+	for (int i = 0; i < MP_THREADS; ++i) {
+		pthread_create(&publishers[i], NULL, mp_publish, client);
+	}
+	for (int i = 0; i < MP_THREADS; ++i) {
+		void* failures;
+		pthread_join(publishers[i], &failures);
+		ASSERT_EQ((long)failures, 0);
+	}
+
+	// the stray ACKs are dropped, not handed to the application
+	for (int i = 0; i < 100 && slimmq_stray_acks(client) < MP_THREADS * MP_PUBLISHES_PER_THREAD; ++i) {
+		usleep(10000);
+	}
+	ASSERT_EQ(slimmq_stray_acks(client), MP_THREADS * MP_PUBLISHES_PER_THREAD);
+	slimmq_event_t evt;
+	ASSERT_EQ(slimmq_next_events(client, &evt, 1, 0), 0);
+
+	slimmq_close(client);
+	pthread_join(broker_thread, NULL);
+
+	// every publish got its own msg_id and was ACKed without a retransmit
+	ASSERT_EQ(mp_distinct, MP_THREADS * MP_PUBLISHES_PER_THREAD);
+	ASSERT_EQ(mp_duplicates, 0);
+}
+
+#define MUX_BROKER_PORT 9902
+
+static atomic_int mux_broker_ready = 0;
+static atomic_int mux_session_closed = 0;
+static uint32_t mux_subscribed[2];
+static uint32_t mux_acked_session = 0;
+static int mux_acks_after_close = 0;
+
+static void mux_deliver(int sockfd, const struct sockaddr_in* to, uint32_t session_id, uint32_t msg_id) {
+	slim_msg_header_t header = {
+		.version = 1,
+		.msg_type = MSG_PUBLISH,
+		.qos_level = QOS_AT_LEAST_ONCE,
+		.msg_id = msg_id,
+		.frag_total = 1,
+		.batch_size = 1,
+		.payload_length = 1 + strlen("mux/b") + 2,
+		.client_node_count = 1,
+		.session_id = session_id
+	};
+	uint8_t buf[256];
+	int len = serialize_message(&header, "mux/b", "hi", 2, buf, sizeof(buf));
+	send_bytes(sockfd, (const struct sockaddr*)to, sizeof(*to), buf, len);
+}
+
+/*
+ * Answers two CONNECTs with ids 70 and 71, records the sessions of two
+ * SUBSCRIBEs, delivers to the second one, then delivers again once the test
+ * closed that session.
+ */
+static void* mux_broker_thread(void* arg) {
+	(void)arg;
+	int sockfd = init_socket(BROKER_IP, MUX_BROKER_PORT, true);
+	assert(sockfd >= 0);
+	struct timeval tv = { .tv_sec = 1 };
+	setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	mux_broker_ready = 1;
+
+	struct sockaddr_in from;
+	socklen_t fromlen = sizeof(from);
+	uint8_t buf[1024];
+	slim_msg_header_t header;
+	char topic[128];
+	char payload[512];
+
+	for (uint32_t id = 70; id < 72; ++id) {
+		int len = recv_bytes(sockfd, buf, sizeof(buf), (struct sockaddr*)&from, &fromlen);
+		assert(len > (int)sizeof(header) && buf[sizeof(header)] == CONTROL_CONNECT);
+		memcpy(&header, buf, sizeof(header));
+		header.session_id = id;
+		int reply_len = serialize_control_message(&header, CONTROL_CONNECT, NULL, 0, buf, sizeof(buf));
+		send_bytes(sockfd, (struct sockaddr*)&from, sizeof(from), buf, reply_len);
+	}
+
+	for (int i = 0; i < 2; ++i) {
+		int len = recv_bytes(sockfd, buf, sizeof(buf), (struct sockaddr*)&from, &fromlen);
+		assert(len > 0);
+		deserialize_message(buf, len, &header, topic, sizeof(topic), payload, sizeof(payload));
+		mux_subscribed[i] = header.session_id;
+	}
+
+	mux_deliver(sockfd, &from, mux_subscribed[1], 100);
+	if (recv_bytes(sockfd, buf, sizeof(buf), (struct sockaddr*)&from, &fromlen) > 0) {
+		memcpy(&header, buf, sizeof(header));
+		if (header.msg_type == MSG_ACK && header.msg_id == 100) mux_acked_session = header.session_id;
+	}
+
+	while (!mux_session_closed) usleep(1000);
+	mux_deliver(sockfd, &from, mux_subscribed[1], 101);
+	if (recv_bytes(sockfd, buf, sizeof(buf), (struct sockaddr*)&from, &fromlen) > 0) mux_acks_after_close++;
+
+	close(sockfd);
+	return NULL;
+}
+
+void test_sessions_share_one_socket() {
+	pthread_t broker_thread;
+	pthread_create(&broker_thread, NULL, mux_broker_thread, NULL);
+	while (!mux_broker_ready) usleep(10000);
+
+	slimmq_client_t* client = slimmq_connect(BROKER_IP, MUX_BROKER_PORT);
+	ASSERT_NOT_NULL(client);
+
+	slimmq_session_t* a = slimmq_session_open(client);
+	slimmq_session_t* b = slimmq_session_open(client);
+	ASSERT_NOT_NULL(a);
+	ASSERT_NOT_NULL(b);
+	ASSERT_EQ(a->id, 70);		// ids are assigned by the broker
+	ASSERT_EQ(b->id, 71);
+
+	slimmq_session_set_qos(b, QOS_AT_LEAST_ONCE);
+	ASSERT_TRUE(slimmq_session_subscribe(a, "mux/a") > 0);
+	ASSERT_TRUE(slimmq_session_subscribe(b, "mux/b") > 0);
+
+	// the delivery is queued for session b and ACKed on its behalf
+	slimmq_event_t evt;
+	ASSERT_EQ(slimmq_next_events(client, &evt, 1, 3000), 1);
+	ASSERT_EQ(evt.session_id, b->id);
+	ASSERT_STR_EQ(evt.topic, "mux/b");
+	free(evt.data);
+
+	uint32_t closed_id = b->id;
+	slimmq_session_close(b);
+	mux_session_closed = 1;
+
+	pthread_join(broker_thread, NULL);
+	ASSERT_EQ(mux_subscribed[0], a->id);
+	ASSERT_EQ(mux_subscribed[1], closed_id);
+	ASSERT_EQ(mux_acked_session, closed_id);
+	ASSERT_EQ(mux_acks_after_close, 0);		// deliveries to a closed session are dropped
+	ASSERT_EQ(slimmq_next_events(client, &evt, 1, 0), 0);
+
+	slimmq_close(client);		// frees session a as well
+}
+
+#define MCAST_BROKER_PORT 9903
+#define MCAST_GROUP "239.1.2.3"
+#define MCAST_GROUP_PORT 9904
+
+static atomic_int mcast_broker_ready = 0;
+static int mcast_confirmed = 0;
+
+/*
+ * Offers a multicast group in reply to a SUBSCRIBE, waits for the client's
+ * confirmation, then publishes once to the group over loopback.
+ */
+static void* mcast_broker_thread(void* arg) {
+	(void)arg;
+	int sockfd = init_socket(BROKER_IP, MCAST_BROKER_PORT, true);
+	assert(sockfd >= 0);
+	struct timeval tv = { .tv_sec = 1 };
+	setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	struct in_addr lo = { .s_addr = inet_addr(BROKER_IP) };
+	assert(set_multicast_interface(sockfd, lo) == 0);
+	mcast_broker_ready = 1;
+
+	struct sockaddr_in from;
+	socklen_t fromlen = sizeof(from);
+	uint8_t buf[1024];
+	slim_msg_header_t header;
+	control_type_t ctrl_type;
+	char data[512];
+
+	int len = recv_bytes(sockfd, buf, sizeof(buf), (struct sockaddr*)&from, &fromlen);
+	assert(len > 0 && buf[1] == MSG_SUBSCRIBE);
+
+	struct sockaddr_in group = { .sin_family = AF_INET, .sin_port = htons(MCAST_GROUP_PORT) };
+	group.sin_addr.s_addr = inet_addr(MCAST_GROUP);
+	uint8_t spec[MULTICAST_SPEC_SIZE];
+	memcpy(spec, &group.sin_addr.s_addr, 4);
+	memcpy(spec + 4, &group.sin_port, 2);
+
+	header = (slim_msg_header_t){ .version = 1, .msg_type = MSG_CONTROL, .frag_total = 1, .batch_size = 1,
+																.payload_length = 1 + sizeof(spec), .client_node_count = 1 };
+	len = serialize_control_message(&header, CONTROL_MULTICAST, spec, sizeof(spec), buf, sizeof(buf));
+	send_bytes(sockfd, (struct sockaddr*)&from, sizeof(from), buf, len);
+
+	while ((len = recv_bytes(sockfd, buf, sizeof(buf), (struct sockaddr*)&from, &fromlen)) > 0) {
+		if (deserialize_control_message(buf, len, &header, &ctrl_type, data, sizeof(data)) == 0 &&
+				ctrl_type == CONTROL_MULTICAST && memcmp(data, spec, sizeof(spec)) == 0) {
+			mcast_confirmed = 1;
+			break;
+		}
+	}
+
+	header = (slim_msg_header_t){ .version = 1, .msg_type = MSG_PUBLISH, .frag_total = 1, .batch_size = 1,
+																.payload_length = 1 + strlen("hot/x") + 2, .client_node_count = 1 };
+	len = serialize_message(&header, "hot/x", "mc", 2, buf, sizeof(buf));
+	send_bytes(sockfd, (struct sockaddr*)&group, sizeof(group), buf, len);
+
+	close(sockfd);
+	return NULL;
+}
+
+void test_multicast_group_is_joined() {
+	pthread_t broker_thread;
+	pthread_create(&broker_thread, NULL, mcast_broker_thread, NULL);
+	while (!mcast_broker_ready) usleep(10000);
+
+	slimmq_client_t* client = slimmq_connect(BROKER_IP, MCAST_BROKER_PORT);
+	ASSERT_NOT_NULL(client);
+	ASSERT_TRUE(slimmq_subscribe(client, "hot/#") > 0);
+
+	// the delivery arrives on the group socket, not from the broker's unicast address
+	slimmq_event_t evt;
+	ASSERT_EQ(slimmq_next_events(client, &evt, 1, 3000), 1);
+	ASSERT_STR_EQ(evt.topic, "hot/x");
+	ASSERT_EQ(evt.data_len, 2);
+	free(evt.data);
+
+	pthread_join(broker_thread, NULL);
+	ASSERT_EQ(mcast_confirmed, 1);
+	slimmq_close(client);
+}
+
+#define SEQ_BROKER_PORT 9905
+#define SEQ_STREAM 7
+
+static atomic_int seq_broker_ready = 0;
+static int seq_requested = 0;
+static uint32_t seq_nack[3];								// stream, first, last of the first NACK
+static int seq_nacks = 0;
+static int seq_acks = 0;
+
+static void seq_deliver(int sockfd, const struct sockaddr_in* to, uint32_t seq) {
+	char payload[8];
+	snprintf(payload, sizeof(payload), "m%u", seq);
+	slim_msg_header_t header = { .version = 1, .msg_type = MSG_PUBLISH, .qos_level = QOS_AT_LEAST_ONCE,
+															 .topic_id = SEQ_STREAM, .msg_id = seq, .frag_total = 1, .batch_size = 1,
+															 .payload_length = 1 + strlen("seq/x") + strlen(payload),
+															 .client_node_count = 1 };
+	uint8_t buf[256];
+	int len = serialize_message(&header, "seq/x", payload, strlen(payload), buf, sizeof(buf));
+	send_bytes(sockfd, (const struct sockaddr*)to, sizeof(*to), buf, len);
+}
+
+/*
+ * Sends sequence numbers 1, 2 and 4 of one stream, repairs 3 when NACKed and
+ * replays 2, then counts what else the client sends.
+ */
+static void* seq_broker_thread(void* arg) {
+	(void)arg;
+	int sockfd = init_socket(BROKER_IP, SEQ_BROKER_PORT, true);
+	assert(sockfd >= 0);
+	struct timeval tv = { .tv_usec = 500000 };
+	setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	seq_broker_ready = 1;
+
+	struct sockaddr_in from;
+	socklen_t fromlen = sizeof(from);
+	uint8_t buf[1024];
+	slim_msg_header_t header;
+	control_type_t ctrl_type;
+	char data[512];
+
+	int len = recv_bytes(sockfd, buf, sizeof(buf), (struct sockaddr*)&from, &fromlen);
+	if (len > 0 && deserialize_control_message(buf, len, &header, &ctrl_type, data, sizeof(data)) == 0 &&
+			ctrl_type == CONTROL_SEQUENCED && data[0] == 1) {
+		seq_requested = 1;
+	}
+
+	seq_deliver(sockfd, &from, 1);
+	seq_deliver(sockfd, &from, 2);
+	seq_deliver(sockfd, &from, 4);
+
+	bool repaired = false;
+	while ((len = recv_bytes(sockfd, buf, sizeof(buf), (struct sockaddr*)&from, &fromlen)) > 0) {
+		if (buf[1] == MSG_ACK) {
+			seq_acks++;
+			continue;
+		}
+		if (deserialize_control_message(buf, len, &header, &ctrl_type, data, sizeof(data)) != 0 ||
+				ctrl_type != CONTROL_NACK) {
+			continue;
+		}
+		if (seq_nacks++ == 0) {
+			uint16_t stream;
+			memcpy(&stream, data, sizeof(stream));
+			seq_nack[0] = stream;
+			memcpy(&seq_nack[1], data + sizeof(stream), sizeof(uint32_t));
+			memcpy(&seq_nack[2], data + sizeof(stream) + sizeof(uint32_t), sizeof(uint32_t));
+		}
+		if (!repaired) {
+			seq_deliver(sockfd, &from, 3);
+			seq_deliver(sockfd, &from, 2);		// a duplicate the client must drop
+			repaired = true;
+		}
+	}
+
+	close(sockfd);
+	return NULL;
+}
+
+void test_sequenced_gaps_are_nacked() {
+	pthread_t broker_thread;
+	pthread_create(&broker_thread, NULL, seq_broker_thread, NULL);
+	while (!seq_broker_ready) usleep(10000);
+
+	slimmq_client_t* client = slimmq_connect(BROKER_IP, SEQ_BROKER_PORT);
+	ASSERT_NOT_NULL(client);
+	ASSERT_EQ(slimmq_set_sequenced(client, 1), 0);
+
+	const char* expected[] = { "m1", "m2", "m4", "m3" };
+	slimmq_event_t evt;
+	for (size_t i = 0; i < 4; ++i) {
+		ASSERT_EQ(slimmq_next_events(client, &evt, 1, 2000), 1);
+		ASSERT_EQ(evt.data_len, strlen(expected[i]));
+		ASSERT_TRUE(memcmp(evt.data, expected[i], evt.data_len) == 0);
+		free(evt.data);
+	}
+
+	pthread_join(broker_thread, NULL);
+	ASSERT_EQ(seq_requested, 1);
+	ASSERT_EQ(seq_nacks, 1);						// the repair closed the gap, no re-NACK
+	ASSERT_EQ(seq_nack[0], SEQ_STREAM);
+	ASSERT_EQ(seq_nack[1], 3);
+	ASSERT_EQ(seq_nack[2], 3);
+	ASSERT_EQ(seq_acks, 0);
+	ASSERT_EQ(slimmq_next_events(client, &evt, 1, 0), 0);	// the replayed 2 was dropped
+
+	slimmq_close(client);
+}
+
+#define FEC_BROKER_PORT 9906
+
+static atomic_int fec_broker_ready = 0;
+
+/*
+ * Encodes a block of three QoS 0 deliveries, loses the second one and sends
+ * the block's parity.
+ */
+static void* fec_broker_thread(void* arg) {
+	(void)arg;
+	int sockfd = init_socket(BROKER_IP, FEC_BROKER_PORT, true);
+	assert(sockfd >= 0);
+	fec_broker_ready = 1;
+
+	struct sockaddr_in from;
+	socklen_t fromlen = sizeof(from);
+	uint8_t buf[2048];
+	int len = recv_bytes(sockfd, buf, sizeof(buf), (struct sockaddr*)&from, &fromlen);
+	assert(len > 0 && buf[1] == MSG_SUBSCRIBE);
+
+	fec_encoder_t encoder;
+	fec_encoder_init(&encoder, 3, 1);
+	const char* payloads[] = { "first", "second", "third" };
+	for (uint32_t seq = 1; seq <= 3; ++seq) {
+		slim_msg_header_t header = { .version = 1, .msg_type = MSG_PUBLISH, .topic_id = 5, .msg_id = seq,
+																 .frag_total = 1, .batch_size = 1, .client_node_count = 1,
+																 .payload_length = 1 + strlen("fec/x") + strlen(payloads[seq - 1]) };
+		len = serialize_message(&header, "fec/x", payloads[seq - 1], strlen(payloads[seq - 1]), buf, sizeof(buf));
+		fec_encoder_add(&encoder, seq, buf + sizeof(header), len - sizeof(header));
+		if (seq != 2) send_bytes(sockfd, (struct sockaddr*)&from, sizeof(from), buf, len);
+	}
+
+	uint8_t parity[FEC_PARITY_HEADER_SIZE + FEC_MAX_BODY];
+	size_t parity_len = fec_encoder_parity(&encoder, 5, 0, parity, sizeof(parity));
+	slim_msg_header_t header = { .version = 1, .msg_type = MSG_CONTROL, .frag_total = 1, .batch_size = 1,
+															 .payload_length = 1 + parity_len, .client_node_count = 1 };
+	len = serialize_control_message(&header, CONTROL_FEC, parity, parity_len, buf, sizeof(buf));
+	send_bytes(sockfd, (struct sockaddr*)&from, sizeof(from), buf, len);
+
+	close(sockfd);
+	return NULL;
+}
+
+void test_fec_parity_rebuilds_lost_delivery() {
+	pthread_t broker_thread;
+	pthread_create(&broker_thread, NULL, fec_broker_thread, NULL);
+	while (!fec_broker_ready) usleep(10000);
+
+	slimmq_client_t* client = slimmq_connect(BROKER_IP, FEC_BROKER_PORT);
+	ASSERT_NOT_NULL(client);
+	ASSERT_TRUE(slimmq_subscribe(client, "fec/#") > 0);
+
+	const char* expected[] = { "first", "third", "second" };
+	slimmq_event_t evt;
+	for (size_t i = 0; i < 3; ++i) {
+		ASSERT_EQ(slimmq_next_events(client, &evt, 1, 2000), 1);
+		ASSERT_STR_EQ(evt.topic, "fec/x");
+		ASSERT_EQ(evt.data_len, strlen(expected[i]));
+		ASSERT_TRUE(memcmp(evt.data, expected[i], evt.data_len) == 0);
+		free(evt.data);
+	}
+	ASSERT_EQ(slimmq_fec_recovered(client), 1);
+
+	pthread_join(broker_thread, NULL);
+	slimmq_close(client);
+}
+
+#define SACK_BROKER_PORT 9907
+#define SACK_PUBLISHERS 4
+
+static atomic_int sack_broker_ready = 0;
+static int sack_requested = 0;
+static int sack_publishes = 0;
+
+/*
+ * Waits until every publisher sent its QoS 1 publish, then ACKs all of them
+ * with one CONTROL_SACK frame and counts retransmits.
+ */
+static void* sack_broker_thread(void* arg) {
+	(void)arg;
+	int sockfd = init_socket(BROKER_IP, SACK_BROKER_PORT, true);
+	assert(sockfd >= 0);
+	struct timeval tv = { .tv_usec = 500000 };
+	setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	sack_broker_ready = 1;
+
+	struct sockaddr_in from;
+	socklen_t fromlen = sizeof(from);
+	uint8_t buf[1024];
+	slim_msg_header_t header;
+	control_type_t ctrl_type;
+	char data[512];
+	uint32_t first = UINT32_MAX;
+	uint32_t ids[SACK_PUBLISHERS];
+	bool acked = false;
+
+	int len;
+	while ((len = recv_bytes(sockfd, buf, sizeof(buf), (struct sockaddr*)&from, &fromlen)) > 0) {
+		if (buf[1] == MSG_CONTROL) {
+			if (deserialize_control_message(buf, len, &header, &ctrl_type, data, sizeof(data)) == 0 &&
+					ctrl_type == CONTROL_SACK && data[0] == 1) {
+				sack_requested = 1;
+			}
+			continue;
+		}
+		if (buf[1] != MSG_PUBLISH) continue;
+
+		memcpy(&header, buf, sizeof(header));
+		if (sack_publishes < SACK_PUBLISHERS) ids[sack_publishes] = header.msg_id;
+		if (header.msg_id < first) first = header.msg_id;
+		if (++sack_publishes != SACK_PUBLISHERS || acked) continue;
+
+		uint8_t spec[SACK_SPEC_SIZE];
+		uint64_t bitmap = 0;
+		for (int i = 0; i < SACK_PUBLISHERS; ++i) {
+			if (ids[i] != first) bitmap |= 1ULL << (ids[i] - first - 1);
+		}
+		memcpy(spec, &first, sizeof(first));
+		memcpy(spec + 4, &bitmap, sizeof(bitmap));
+
+		slim_msg_header_t sack = { .version = 1, .msg_type = MSG_CONTROL, .qos_level = QOS_AT_LEAST_ONCE,
+															 .msg_id = first, .frag_total = 1, .batch_size = 1,
+															 .payload_length = 1 + SACK_SPEC_SIZE, .client_node_count = 1 };
+		len = serialize_control_message(&sack, CONTROL_SACK, spec, sizeof(spec), buf, sizeof(buf));
+		send_bytes(sockfd, (struct sockaddr*)&from, fromlen, buf, len);
+		acked = true;
+	}
+
+	close(sockfd);
+	return NULL;
+}
+
+static void* sack_publish(void* arg) {
+	return (void*)(long)slimmq_publish(arg, "sack/topic", "x", 1);
+}
+
+void test_sack_frame_retires_many_publishes() {
+	pthread_t broker_thread;
+	pthread_create(&broker_thread, NULL, sack_broker_thread, NULL);
+	while (!sack_broker_ready) usleep(10000);
+
+	slimmq_client_t* client = slimmq_connect(BROKER_IP, SACK_BROKER_PORT);
+	ASSERT_NOT_NULL(client);
+	slimmq_set_qos(client, QOS_AT_LEAST_ONCE);
+	slimmq_set_retry_policy(client, 2000, 1);
+	ASSERT_EQ(slimmq_set_ack_coalescing(client, 1), 0);
+
+	pthread_t publishers[SACK_PUBLISHERS];
+	for (int i = 0; i < SACK_PUBLISHERS; ++i) {
+		pthread_create(&publishers[i], NULL, sack_publish, client);
+	}
+	for (int i = 0; i < SACK_PUBLISHERS; ++i) {
+		void* result;
+		pthread_join(publishers[i], &result);
+		ASSERT_EQ((long)result, 0);
+	}
+
+	uint64_t frames, acks;
+	slimmq_sack_stats(client, &frames, &acks);
+	ASSERT_EQ(frames, 1);
+	ASSERT_EQ(acks, SACK_PUBLISHERS);
+
+	slimmq_close(client);
+	pthread_join(broker_thread, NULL);
+	ASSERT_EQ(sack_requested, 1);
+	ASSERT_EQ(sack_publishes, SACK_PUBLISHERS);		// one frame, no retransmits
+}
+
+#define QOS2_BROKER_PORT 9908
+
+static atomic_int qos2_broker_ready = 0;
+static uint32_t qos2_replies[8];						// (control type << 24 | msg_id) of each client reply
+static int qos2_reply_count = 0;
+
+static void qos2_send(int sockfd, const struct sockaddr_in* to, uint32_t msg_id, const char* payload) {
+	slim_msg_header_t header = { .version = 1, .msg_type = MSG_PUBLISH, .qos_level = QOS_EXACTLY_ONCE,
+															 .msg_id = msg_id, .frag_total = 1, .batch_size = 1,
+															 .payload_length = 1 + strlen("q2/x") + strlen(payload),
+															 .client_node_count = 1 };
+	uint8_t buf[256];
+	int len = serialize_message(&header, "q2/x", payload, strlen(payload), buf, sizeof(buf));
+	send_bytes(sockfd, (const struct sockaddr*)to, sizeof(*to), buf, len);
+}
+
+static void qos2_release(int sockfd, const struct sockaddr_in* to, uint32_t msg_id) {
+	slim_msg_header_t header = { .version = 1, .msg_type = MSG_CONTROL, .qos_level = QOS_EXACTLY_ONCE,
+															 .msg_id = msg_id, .frag_total = 1, .batch_size = 1,
+															 .payload_length = 1, .client_node_count = 1 };
+	uint8_t buf[64];
+	int len = serialize_control_message(&header, CONTROL_RELEASE, NULL, 0, buf, sizeof(buf));
+	send_bytes(sockfd, (const struct sockaddr*)to, sizeof(*to), buf, len);
+}
+
+/**
+ * qos2_reply - wait for the client's next handshake message
+ *
+ * Return: (control type << 24 | msg_id), or 0 on timeout
+ */
+static uint32_t qos2_reply(int sockfd) {
+	uint8_t buf[256];
+	slim_msg_header_t header;
+	control_type_t ctrl_type;
+	char data[64];
+
+	int len = recv_bytes(sockfd, buf, sizeof(buf), NULL, NULL);
+	if (len <= 0 || deserialize_control_message(buf, len, &header, &ctrl_type, data, sizeof(data)) != 0) {
+		return 0;
+	}
+	uint32_t reply = ((uint32_t)ctrl_type << 24) | (header.msg_id & 0xffffff);
+	if (qos2_reply_count < 8) qos2_replies[qos2_reply_count++] = reply;
+	return reply;
+}
+
+/*
+ * Runs the QoS 2 handshake for a delivery, repeats its PUBLISH after the
+ * handshake, then restarts numbering far below it like a restarted broker.
+ */
+static void* qos2_broker_thread(void* arg) {
+	(void)arg;
+	int sockfd = init_socket(BROKER_IP, QOS2_BROKER_PORT, true);
+	assert(sockfd >= 0);
+	struct timeval tv = { .tv_usec = 500000 };
+	setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	qos2_broker_ready = 1;
+
+	struct sockaddr_in from;
+	socklen_t fromlen = sizeof(from);
+	uint8_t buf[256];
+	if (recv_bytes(sockfd, buf, sizeof(buf), (struct sockaddr*)&from, &fromlen) <= 0 ||
+			buf[1] != MSG_SUBSCRIBE) {
+		close(sockfd);
+		return NULL;
+	}
+
+	qos2_send(sockfd, &from, 5000, "a");
+	qos2_reply(sockfd);
+	qos2_release(sockfd, &from, 5000);
+	qos2_reply(sockfd);
+
+	qos2_send(sockfd, &from, 5000, "a");		// a late duplicate, answered but not queued again
+	qos2_reply(sockfd);
+
+	qos2_send(sockfd, &from, 7, "b");
+	qos2_reply(sockfd);
+	qos2_release(sockfd, &from, 7);
+	qos2_reply(sockfd);
+
+	close(sockfd);
+	return NULL;
+}
+
+void test_qos2_delivery_handshake_and_restart() {
+	pthread_t broker_thread;
+	pthread_create(&broker_thread, NULL, qos2_broker_thread, NULL);
+	while (!qos2_broker_ready) usleep(10000);
+
+	slimmq_client_t* client = slimmq_connect(BROKER_IP, QOS2_BROKER_PORT);
+	ASSERT_NOT_NULL(client);
+	slimmq_set_qos(client, QOS_EXACTLY_ONCE);
+	ASSERT_TRUE(slimmq_subscribe(client, "q2/x") >= 0);
+
+	const char* expected[] = { "a", "b" };
+	slimmq_event_t evt;
+	for (size_t i = 0; i < 2; ++i) {
+		ASSERT_EQ(slimmq_next_events(client, &evt, 1, 2000), 1);
+		ASSERT_EQ(evt.data_len, 1);
+		ASSERT_TRUE(memcmp(evt.data, expected[i], 1) == 0);
+		free(evt.data);
+	}
+
+	pthread_join(broker_thread, NULL);
+	ASSERT_EQ(slimmq_next_events(client, &evt, 1, 0), 0);	// the repeated 5000 was dropped
+
+	uint32_t replies[] = {
+		(CONTROL_RECEIVED << 24) | 5000, (CONTROL_COMPLETE << 24) | 5000,
+		(CONTROL_RECEIVED << 24) | 5000,
+		(CONTROL_RECEIVED << 24) | 7, (CONTROL_COMPLETE << 24) | 7
+	};
+	ASSERT_EQ(qos2_reply_count, 5);
+	for (int i = 0; i < 5; ++i) ASSERT_EQ(qos2_replies[i], replies[i]);
+
+	slimmq_close(client);
+}
+
+#define CREDIT_BROKER_PORT 9909
+
+static atomic_int credit_broker_ready = 0;
+static atomic_int credit_throttled = 0;			// an advertisement counted the unread deliveries
+static atomic_int credit_restored = 0;			// an advertisement after the application read them
+static uint32_t credit_first = 0;
+
+static uint32_t credit_advertised(int sockfd, struct sockaddr_in* from) {
+	uint8_t buf[256];
+	slim_msg_header_t header;
+	control_type_t ctrl_type;
+	char data[64];
+	socklen_t fromlen = sizeof(*from);
+
+	for (int i = 0; i < 10; ++i) {
+		int len = recv_bytes(sockfd, buf, sizeof(buf), (struct sockaddr*)from, &fromlen);
+		if (len <= 0) break;
+		if (deserialize_control_message(buf, len, &header, &ctrl_type, data, sizeof(data)) == 0 &&
+				ctrl_type == CONTROL_CREDIT) {
+			uint32_t credits;
+			memcpy(&credits, data, sizeof(credits));
+			return credits;
+		}
+	}
+	return UINT32_MAX;
+}
+
+/*
+ * Sends three QoS 0 deliveries after the first credit advertisement, then
+ * watches the advertised credit shrink while they sit unread and grow back
+ * once the application takes them.
+ */
+static void* credit_broker_thread(void* arg) {
+	(void)arg;
+	int sockfd = init_socket(BROKER_IP, CREDIT_BROKER_PORT, true);
+	assert(sockfd >= 0);
+	struct timeval tv = { .tv_usec = 500000 };
+	setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	credit_broker_ready = 1;
+
+	struct sockaddr_in from;
+	credit_first = credit_advertised(sockfd, &from);
+
+	for (int i = 0; i < 3; ++i) {
+		slim_msg_header_t header = { .version = 1, .msg_type = MSG_PUBLISH, .qos_level = QOS_AT_MOST_ONCE,
+																 .frag_total = 1, .batch_size = 1,
+																 .payload_length = 1 + strlen("c/x") + 1, .client_node_count = 1 };
+		uint8_t buf[64];
+		int len = serialize_message(&header, "c/x", "d", 1, buf, sizeof(buf));
+		send_bytes(sockfd, (const struct sockaddr*)&from, sizeof(from), buf, len);
+	}
+
+	for (int i = 0; i < 40 && !credit_restored; ++i) {
+		uint32_t credits = credit_advertised(sockfd, &from);
+		if (credits == MAX_EVENT_QUEUE_SIZE - 3) credit_throttled = 1;
+		else if (credit_throttled && credits == MAX_EVENT_QUEUE_SIZE) credit_restored = 1;
+	}
+
+	close(sockfd);
+	return NULL;
+}
+
+void test_credit_tracks_unread_deliveries() {
+	pthread_t broker_thread;
+	pthread_create(&broker_thread, NULL, credit_broker_thread, NULL);
+	while (!credit_broker_ready) usleep(10000);
+
+	slimmq_client_t* client = slimmq_connect(BROKER_IP, CREDIT_BROKER_PORT);
+	ASSERT_NOT_NULL(client);
+	ASSERT_EQ(slimmq_set_flow_control(client, 20), 0);
+
+	for (int i = 0; i < 200 && !credit_throttled; ++i) usleep(10000);
+	ASSERT_TRUE(credit_throttled);
+
+	slimmq_event_t events[4];
+	ASSERT_EQ(slimmq_next_events(client, events, 4, 1000), 3);
+	for (int i = 0; i < 3; ++i) free(events[i].data);
+
+	pthread_join(broker_thread, NULL);
+	ASSERT_EQ(credit_first, MAX_EVENT_QUEUE_SIZE);
+	ASSERT_TRUE(credit_restored);
+
+	slimmq_close(client);
+}
+
+#define RECONNECT_BROKER_PORT 9912
+#define RECONNECT_OLD_ID 0x01000005u
+#define RECONNECT_NEW_ID 0x02000005u
+
+static atomic_int reconnect_broker_ready = 0;
+static uint32_t reconnect_named = 0;						// session id carried by the reconnecting CONNECT
+static char reconnect_token[SESSION_TOKEN_SIZE];	// its data
+static int reconnect_connects = 0;							// CONNECTs drawn by two reports of the unknown session
+static uint32_t reconnect_subscribed = 0;				// session of the SUBSCRIBE sent after reconnecting
+static char reconnect_topic[64];
+
+/**
+ * reconnect_recv - wait for the client's next datagram of @msg_type (and @ctrl_type for CONTROL)
+ *
+ * Return: true if one arrived, its header in @header, topic in @topic and
+ * payload (starting with the control type) in @data
+ */
+static bool reconnect_recv(int sockfd, uint8_t msg_type, control_type_t ctrl_type,
+														slim_msg_header_t* header, char* topic, size_t topic_len, char* data) {
+	uint8_t buf[256];
+
+	for (int i = 0; i < 10; ++i) {
+		int len = recv_bytes(sockfd, buf, sizeof(buf), NULL, NULL);
+		if (len <= 0) return false;
+		if (deserialize_message(buf, len, header, topic, topic_len, data, 128) != 0) continue;
+		if (header->msg_type != msg_type) continue;
+		if (msg_type != MSG_CONTROL || buf[sizeof(*header)] == ctrl_type) return true;
+	}
+	return false;
+}
+
+static void reconnect_deliver(int sockfd, const struct sockaddr_in* to, uint32_t session_id, const char* payload) {
+	slim_msg_header_t header = { .version = 1, .msg_type = MSG_PUBLISH, .qos_level = QOS_EXACTLY_ONCE,
+															 .msg_id = 500, .frag_total = 1, .batch_size = 1,
+															 .payload_length = 1 + strlen("re/x") + strlen(payload),
+															 .client_node_count = 1, .session_id = session_id };
+	uint8_t buf[256];
+	int len = serialize_message(&header, "re/x", payload, strlen(payload), buf, sizeof(buf));
+	send_bytes(sockfd, (const struct sockaddr*)to, sizeof(*to), buf, len);
+
+	slim_msg_header_t reply;
+	char topic[64], data[128];
+	reconnect_recv(sockfd, MSG_CONTROL, CONTROL_RECEIVED, &reply, topic, sizeof(topic), data);
+
+	header.msg_type = MSG_CONTROL;
+	header.payload_length = 1;
+	len = serialize_control_message(&header, CONTROL_RELEASE, NULL, 0, buf, sizeof(buf));
+	send_bytes(sockfd, (const struct sockaddr*)to, sizeof(*to), buf, len);
+	reconnect_recv(sockfd, MSG_CONTROL, CONTROL_COMPLETE, &reply, topic, sizeof(topic), data);
+}
+
+static void reconnect_control(int sockfd, const struct sockaddr_in* to, control_type_t type,
+															uint32_t msg_id, uint32_t session_id, const char* token) {
+	slim_msg_header_t header = { .version = 1, .msg_type = MSG_CONTROL, .msg_id = msg_id,
+															 .frag_total = 1, .batch_size = 1, .payload_length = 1,
+															 .client_node_count = 1, .session_id = session_id };
+	uint8_t buf[64];
+	int len = serialize_control_message(&header, type, token, token ? SESSION_TOKEN_SIZE : 0,
+																			buf, sizeof(buf));
+	send_bytes(sockfd, (const struct sockaddr*)to, sizeof(*to), buf, len);
+}
+
+/*
+ * Connects a session with token "tokenAAA", delivers QoS 2 msg_id 500 to it,
+ * then reports it unknown twice. With @resume the reconnecting CONNECT is
+ * answered with the same id, like a broker that still has the session and
+ * only saw it from another address; otherwise with a new id, like one that
+ * expired it. Then msg_id 500 is delivered again, which only the new session
+ * must take as new.
+ */
+static void* reconnect_broker_thread(void* arg) {
+	bool resume = arg != NULL;
+	int sockfd = init_socket(BROKER_IP, RECONNECT_BROKER_PORT, true);
+	assert(sockfd >= 0);
+	struct timeval tv = { .tv_usec = 300000 };
+	setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	reconnect_broker_ready = 1;
+
+	struct sockaddr_in from;
+	socklen_t fromlen = sizeof(from);
+	uint8_t buf[256];
+	slim_msg_header_t header;
+	char topic[64], data[128];
+
+	int len = recv_bytes(sockfd, buf, sizeof(buf), (struct sockaddr*)&from, &fromlen);
+	assert(len > (int)sizeof(header) && buf[sizeof(header)] == CONTROL_CONNECT);
+	memcpy(&header, buf, sizeof(header));
+	reconnect_control(sockfd, &from, CONTROL_CONNECT, header.msg_id, RECONNECT_OLD_ID, "tokenAAA");
+
+	if (!reconnect_recv(sockfd, MSG_SUBSCRIBE, 0, &header, topic, sizeof(topic), data)) goto out;
+	reconnect_deliver(sockfd, &from, RECONNECT_OLD_ID, "a");
+
+	reconnect_control(sockfd, &from, CONTROL_UNKNOWN_SESSION, 0, RECONNECT_OLD_ID, NULL);
+	reconnect_control(sockfd, &from, CONTROL_UNKNOWN_SESSION, 0, RECONNECT_OLD_ID, NULL);
+
+	uint32_t connect_msg_id = 0;
+	while (reconnect_recv(sockfd, MSG_CONTROL, CONTROL_CONNECT, &header, topic, sizeof(topic), data)) {
+		reconnect_named = header.session_id;
+		if (header.payload_length == 1 + SESSION_TOKEN_SIZE) memcpy(reconnect_token, data + 1, SESSION_TOKEN_SIZE);
+		connect_msg_id = header.msg_id;
+		reconnect_connects++;
+	}
+	if (reconnect_connects == 0) goto out;
+
+	uint32_t id = resume ? RECONNECT_OLD_ID : RECONNECT_NEW_ID;
+	reconnect_control(sockfd, &from, CONTROL_CONNECT, connect_msg_id, id, resume ? "tokenAAA" : "tokenBBB");
+
+	if (!resume) {
+		if (!reconnect_recv(sockfd, MSG_SUBSCRIBE, 0, &header, reconnect_topic, sizeof(reconnect_topic), data)) {
+			goto out;
+		}
+		reconnect_subscribed = header.session_id;
+	}
+	reconnect_deliver(sockfd, &from, id, "b");
+
+out:
+	close(sockfd);
+	return NULL;
+}
+
+static void run_reconnect(bool resume) {
+	reconnect_broker_ready = 0;
+	reconnect_named = 0;
+	reconnect_connects = 0;
+	reconnect_subscribed = 0;
+	memset(reconnect_token, 0, sizeof(reconnect_token));
+	memset(reconnect_topic, 0, sizeof(reconnect_topic));
+
+	pthread_t broker_thread;
+	pthread_create(&broker_thread, NULL, reconnect_broker_thread, resume ? (void*)1 : NULL);
+	while (!reconnect_broker_ready) usleep(10000);
+
+	slimmq_client_t* client = slimmq_connect(BROKER_IP, RECONNECT_BROKER_PORT);
+	ASSERT_NOT_NULL(client);
+	slimmq_session_t* session = slimmq_session_open(client);
+	ASSERT_NOT_NULL(session);
+	ASSERT_EQ(session->id, RECONNECT_OLD_ID);
+	slimmq_session_set_qos(session, QOS_EXACTLY_ONCE);
+	ASSERT_TRUE(slimmq_session_subscribe(session, "re/x") > 0);
+
+	slimmq_event_t evt;
+	ASSERT_EQ(slimmq_next_events(client, &evt, 1, 3000), 1);
+	ASSERT_EQ(evt.session_id, RECONNECT_OLD_ID);
+	ASSERT_TRUE(evt.data_len == 1 && memcmp(evt.data, "a", 1) == 0);
+	free(evt.data);
+
+	pthread_join(broker_thread, NULL);
+	ASSERT_EQ(reconnect_connects, 1);		// the second report waits for the pending CONNECT
+	ASSERT_EQ(reconnect_named, RECONNECT_OLD_ID);
+	ASSERT_TRUE(memcmp(reconnect_token, "tokenAAA", SESSION_TOKEN_SIZE) == 0);
+
+	if (resume) {
+		// the same session: no new subscription, and 500 again is a duplicate
+		ASSERT_EQ(session->id, RECONNECT_OLD_ID);
+		ASSERT_EQ(reconnect_subscribed, 0);
+		ASSERT_EQ(slimmq_next_events(client, &evt, 1, 200), 0);
+	} else {
+		ASSERT_EQ(session->id, RECONNECT_NEW_ID);
+		ASSERT_EQ(reconnect_subscribed, RECONNECT_NEW_ID);
+		ASSERT_STR_EQ(reconnect_topic, "re/x");
+		ASSERT_TRUE(memcmp(session->token, "tokenBBB", SESSION_TOKEN_SIZE) == 0);
+		ASSERT_EQ(slimmq_next_events(client, &evt, 1, 3000), 1);
+		ASSERT_EQ(evt.session_id, RECONNECT_NEW_ID);
+		ASSERT_TRUE(evt.data_len == 1 && memcmp(evt.data, "b", 1) == 0);
+		free(evt.data);
+	}
+
+	slimmq_close(client);
+}
+
+void test_unknown_session_reconnects() {
+	run_reconnect(false);
+}
+
+void test_moved_session_resumes_with_token() {
+	run_reconnect(true);
+}
+
 int main() {
 	RUN_TEST(test_slimmq_client_publish_subscribe);
+	RUN_TEST(test_qos2_state_is_per_client);
+	RUN_TEST(test_concurrent_publishers_share_one_client);
+	RUN_TEST(test_sessions_share_one_socket);
+	RUN_TEST(test_multicast_group_is_joined);
+	RUN_TEST(test_sequenced_gaps_are_nacked);
+	RUN_TEST(test_fec_parity_rebuilds_lost_delivery);
+	RUN_TEST(test_sack_frame_retires_many_publishes);
+	RUN_TEST(test_qos2_delivery_handshake_and_restart);
+	RUN_TEST(test_credit_tracks_unread_deliveries);
+	RUN_TEST(test_unknown_session_reconnects);
+	RUN_TEST(test_moved_session_resumes_with_token);
 	return 0;
 }
 
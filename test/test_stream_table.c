@@ -0,0 +1,93 @@
+#include <string.h>
+#include <stdlib.h>
+#include "test_common.h"
+#include "../include/stream_table.h"
+#include "../include/slim_msg.h"
+#include "../include/packet_handler.h"
+
+static int make_delivery(const char* topic, const char* payload, uint8_t* buf, size_t size) {
+	slim_msg_header_t header = { .version = 1, .msg_type = MSG_PUBLISH, .frag_total = 1, .batch_size = 1,
+															 .payload_length = 1 + strlen(topic) + strlen(payload),
+															 .client_node_count = 1, .session_id = 42 };
+	return serialize_message(&header, topic, payload, strlen(payload), buf, size);
+}
+
+static slim_msg_header_t header_of(const uint8_t* packet) {
+	slim_msg_header_t header;
+	memcpy(&header, packet, sizeof(header));
+	return header;
+}
+
+void test_topics_are_numbered_independently() {
+	stream_table_init();
+
+	uint8_t a[256], b[256];
+	int a_len = make_delivery("s/a", "one", a, sizeof(a));
+	int b_len = make_delivery("s/b", "two", b, sizeof(b));
+
+	ASSERT_EQ(stream_table_stamp("s/a", a, a_len), 0);
+	ASSERT_EQ(stream_table_stamp("s/b", b, b_len), 0);
+	slim_msg_header_t ha = header_of(a), hb = header_of(b);
+	ASSERT_EQ(ha.qos_level, QOS_AT_LEAST_ONCE);
+	ASSERT_EQ(ha.msg_id, 1);
+	ASSERT_EQ(hb.msg_id, 1);
+	ASSERT_TRUE(ha.topic_id != 0 && hb.topic_id != 0 && ha.topic_id != hb.topic_id);
+	ASSERT_EQ(ha.session_id, 0);
+
+	ASSERT_EQ(stream_table_stamp("s/a", a, a_len), 0);
+	ASSERT_EQ(header_of(a).msg_id, 2);
+	ASSERT_EQ(header_of(a).topic_id, ha.topic_id);
+	ASSERT_EQ(stream_table_count(), 2);
+
+	size_t len;
+	const uint8_t* kept = stream_table_lookup(ha.topic_id, 1, &len);
+	ASSERT_NOT_NULL(kept);
+	ASSERT_EQ(len, a_len);
+	ASSERT_EQ(header_of(kept).msg_id, 1);
+	ASSERT_TRUE(stream_table_lookup(ha.topic_id, 3, &len) == NULL);		// not sent yet
+	ASSERT_TRUE(stream_table_lookup(0, 1, &len) == NULL);
+
+	stream_table_destroy();
+}
+
+void test_ring_keeps_only_recent_deliveries() {
+	stream_table_init();
+
+	uint8_t buf[256];
+	int len = make_delivery("s/a", "x", buf, sizeof(buf));
+	for (int i = 0; i < STREAM_RING_SIZE + 10; ++i) {
+		ASSERT_EQ(stream_table_stamp("s/a", buf, len), 0);
+	}
+
+	uint16_t id = header_of(buf).topic_id;
+	size_t kept_len;
+	ASSERT_TRUE(stream_table_lookup(id, 10, &kept_len) == NULL);			// overwritten
+	ASSERT_NOT_NULL(stream_table_lookup(id, 11, &kept_len));
+	ASSERT_NOT_NULL(stream_table_lookup(id, STREAM_RING_SIZE + 10, &kept_len));
+
+	stream_table_destroy();
+}
+
+void test_table_full_falls_back() {
+	stream_table_init();
+
+	uint8_t buf[256];
+	char topic[32];
+	for (int i = 0; i < STREAM_MAX; ++i) {
+		snprintf(topic, sizeof(topic), "t/%d", i);
+		int len = make_delivery(topic, "x", buf, sizeof(buf));
+		ASSERT_EQ(stream_table_stamp(topic, buf, len), 0);
+	}
+	int len = make_delivery("t/extra", "x", buf, sizeof(buf));
+	ASSERT_EQ(stream_table_stamp("t/extra", buf, len), -1);
+	ASSERT_EQ(header_of(buf).topic_id, 0);		// left untouched for a normal delivery
+
+	stream_table_destroy();
+}
+
+int main() {
+	RUN_TEST(test_topics_are_numbered_independently);
+	RUN_TEST(test_ring_keeps_only_recent_deliveries);
+	RUN_TEST(test_table_full_falls_back);
+	return 0;
+}
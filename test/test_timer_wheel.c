@@ -0,0 +1,89 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include "test_common.h"
+#include "../include/timer_wheel.h"
+
+typedef struct {
+	timer_node_t timer;
+	uint64_t expires_ms;
+	uint64_t fired_ms;
+	int fired;
+} test_timer_t;
+
+static uint64_t clock_ms = 0;
+
+static void on_expire(timer_node_t* t) {
+	test_timer_t* tt = (test_timer_t*)((char*)t - offsetof(test_timer_t, timer));
+	tt->fired_ms = clock_ms;
+	tt->fired++;
+}
+
+void test_fires_in_order_and_on_time() {
+	timer_wheel_t w;
+	clock_ms = 12345;
+	timer_wheel_init(&w, clock_ms);
+
+	static test_timer_t timers[2000];
+	srand(7);
+	for (int i = 0; i < 2000; ++i) {
+		timers[i] = (test_timer_t){0};
+		// spread over all levels, up to ~20 minutes ahead
+		uint64_t delay = (uint64_t)rand() % (i % 4 == 0 ? 1200000 : 5000);
+		timers[i].expires_ms = clock_ms + delay;
+		timer_wheel_add(&w, &timers[i].timer, timers[i].expires_ms, on_expire);
+	}
+	ASSERT_EQ(w.count, 2000);
+
+	while (w.count > 0) {
+		int timeout = timer_wheel_next_timeout_ms(&w, clock_ms);
+		ASSERT_TRUE(timeout >= 0);
+		clock_ms += timeout > 0 ? (uint64_t)timeout : 1;
+		timer_wheel_advance(&w, clock_ms);
+	}
+
+	for (int i = 0; i < 2000; ++i) {
+		ASSERT_EQ(timers[i].fired, 1);
+		ASSERT_TRUE(timers[i].fired_ms >= timers[i].expires_ms);
+		ASSERT_TRUE(timers[i].fired_ms < timers[i].expires_ms + 2 * TIMER_WHEEL_TICK_MS);
+	}
+	ASSERT_EQ(timer_wheel_next_timeout_ms(&w, clock_ms), -1);
+}
+
+void test_cancel_and_rearm() {
+	timer_wheel_t w;
+	clock_ms = 0;
+	timer_wheel_init(&w, clock_ms);
+
+	test_timer_t a = {0}, b = {0};
+	timer_wheel_add(&w, &a.timer, 100, on_expire);
+	timer_wheel_add(&w, &b.timer, 100000, on_expire);
+	timer_wheel_cancel(&w, &b.timer);
+	timer_wheel_cancel(&w, &b.timer);
+	ASSERT_EQ(w.count, 1);
+
+	// re-arming moves the timer instead of duplicating it
+	timer_wheel_add(&w, &a.timer, 200, on_expire);
+	ASSERT_EQ(w.count, 1);
+
+	clock_ms = 150;
+	timer_wheel_advance(&w, clock_ms);
+	ASSERT_EQ(a.fired, 0);
+
+	clock_ms = 200;
+	timer_wheel_advance(&w, clock_ms);
+	ASSERT_EQ(a.fired, 1);
+	ASSERT_EQ(b.fired, 0);
+
+	// a timer added in the past fires on the next tick
+	timer_wheel_add(&w, &b.timer, 10, on_expire);
+	ASSERT_EQ(timer_wheel_next_timeout_ms(&w, clock_ms), TIMER_WHEEL_TICK_MS);
+	clock_ms += TIMER_WHEEL_TICK_MS;
+	timer_wheel_advance(&w, clock_ms);
+	ASSERT_EQ(b.fired, 1);
+}
+
+int main() {
+	RUN_TEST(test_fires_in_order_and_on_time);
+	RUN_TEST(test_cancel_and_rearm);
+	return 0;
+}
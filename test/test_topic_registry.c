@@ -0,0 +1,33 @@
+#include <string.h>
+#include "test_common.h"
+#include "../include/topic_registry.h"
+
+void test_topics_numbered_in_order() {
+	topic_registry_t r = { .max = 2 };
+	int a = 1, b = 2, c = 3;
+
+	ASSERT_TRUE(topic_registry_find(&r, "s/a") == NULL);
+	ASSERT_EQ(topic_registry_add(&r, "s/a", &a), 1);
+	ASSERT_EQ(topic_registry_add(&r, "s/b", &b), 2);
+	ASSERT_TRUE(topic_registry_find(&r, "s/a") == &a);
+	ASSERT_TRUE(topic_registry_find(&r, "s/b") == &b);
+	ASSERT_TRUE(topic_registry_get(&r, 2) == &b);
+	ASSERT_TRUE(topic_registry_get(&r, 0) == NULL);
+	ASSERT_TRUE(topic_registry_get(&r, 3) == NULL);
+
+	// a topic is registered once, and never past @max
+	ASSERT_EQ(topic_registry_add(&r, "s/a", &c), 0);
+	ASSERT_EQ(topic_registry_add(&r, "s/c", &c), 0);
+	ASSERT_TRUE(topic_registry_find(&r, "s/c") == NULL);
+	ASSERT_EQ(r.count, 2);
+
+	topic_registry_clear(&r);
+	ASSERT_TRUE(topic_registry_find(&r, "s/a") == NULL);
+	ASSERT_EQ(topic_registry_add(&r, "s/c", &c), 1);
+	topic_registry_clear(&r);
+}
+
+int main() {
+	RUN_TEST(test_topics_numbered_in_order);
+	return 0;
+}
@@ -1,25 +1,15 @@
 #include <string.h>
-#include <arpa/inet.h>
+#include <stdlib.h>
 #include "test_common.h"
 #include "../include/topic_table.h"
 
-void fill_addr(struct sockaddr_in* addr, const char* ip_str, int port) {
-  memset(addr, 0, sizeof(struct sockaddr_in));
-  addr->sin_family = AF_INET;
-  addr->sin_port = htons(port);
-  inet_pton(AF_INET, ip_str, &addr->sin_addr);
-}
-
 void test_basic_subscribe_and_match() {
 	init_topic_table();
-	struct sockaddr_in sub1, sub2, sub3;
-	fill_addr(&sub1, "127.0.0.1", 10001);
-	fill_addr(&sub2, "127.0.0.1", 10002);
-	fill_addr(&sub3, "127.0.0.1", 10003);
+	uint32_t sub1 = 1, sub2 = 2, sub3 = 3;
 
-	subscribe_topic("sensor/temperature/room1", &sub1);
-	subscribe_topic("sensor/temperature/+", &sub2);
-	subscribe_topic("sensor/#", &sub3);
+	subscribe_topic("sensor/temperature/room1", sub1);
+	subscribe_topic("sensor/temperature/+", sub2);
+	subscribe_topic("sensor/#", sub3);
 
 	SubscriberList* list = get_matching_subscribers("sensor/temperature/room1");
 	ASSERT_EQ(list->count, 3);
@@ -27,6 +17,7 @@ void test_basic_subscribe_and_match() {
 
 	list = get_matching_subscribers("sensor/humidity/room2");
 	ASSERT_EQ(list->count, 1);
+	ASSERT_EQ(list->items[0].session, sub3);
 
 	print_topic_tree();
 	free_subscriber_list(list);
@@ -35,25 +26,24 @@ void test_basic_subscribe_and_match() {
 
 void test_multi_topic_match_deduplication() {
 	init_topic_table();
-	struct sockaddr_in sub;
-	fill_addr(&sub, "127.0.0.1", 12345);
+	uint32_t sub = 12345;
 
-	subscribe_topic("sensor/#", &sub);
-	subscribe_topic("sensor/temp", &sub);
+	subscribe_topic("sensor/#", sub);
+	subscribe_topic("sensor/temp", sub);
 
 	SubscriberList* list = get_matching_subscribers("sensor/temp");
 	ASSERT_EQ(list->count, 1);
 	free_subscriber_list(list);
 
-	subscribe_topic("room/+/temp", &sub);
-	subscribe_topic("room/101/temp", &sub);
+	subscribe_topic("room/+/temp", sub);
+	subscribe_topic("room/101/temp", sub);
 
 	SubscriberList* list2 = get_matching_subscribers("room/101/temp");
 	ASSERT_EQ(list2->count, 1);
 	free_subscriber_list(list2);
 
-	subscribe_topic("building/#", &sub);
-	subscribe_topic("building/floor1/room1", &sub);
+	subscribe_topic("building/#", sub);
+	subscribe_topic("building/floor1/room1", sub);
 
 	SubscriberList* list3 = get_matching_subscribers("building/floor1/room1");
 	ASSERT_EQ(list3->count, 1);
@@ -63,10 +53,314 @@ void test_multi_topic_match_deduplication() {
 	free_topic_table();
 }
 
+static char replayed[4096];
+static int replay_count;
+
+static void collect_retained(const char* topic, uint8_t qos, const void* data, size_t len, void* ctx) {
+	(void)qos; (void)ctx;
+	replay_count++;
+	strcat(replayed, topic);
+	strcat(replayed, "=");
+	strncat(replayed, data, len);
+	strcat(replayed, ";");
+}
+
+static void replay(const char* filter) {
+	replayed[0] = '\0';
+	replay_count = 0;
+	topic_retain_replay(filter, collect_retained, NULL);
+}
+
+void test_filter_matching() {
+	ASSERT_TRUE(topic_matches_filter("sensor/+/temp", "sensor/room1/temp"));
+	ASSERT_TRUE(!topic_matches_filter("sensor/+/temp", "sensor/room1/hum"));
+	ASSERT_TRUE(!topic_matches_filter("sensor/+", "sensor/room1/temp"));
+	ASSERT_TRUE(topic_matches_filter("sensor/#", "sensor/room1/temp"));
+	ASSERT_TRUE(topic_matches_filter("sensor/#", "sensor"));
+	ASSERT_TRUE(topic_matches_filter("#", "anything/at/all"));
+	ASSERT_TRUE(!topic_matches_filter("sensor/temp", "sensor"));
+	ASSERT_TRUE(!topic_matches_filter("sensor", "sensor/temp"));
+
+	// coverage between filters, used to offer multicast routes
+	ASSERT_TRUE(topic_filter_covers("sensor/#", "sensor/+/temp"));
+	ASSERT_TRUE(topic_filter_covers("sensor/#", "sensor"));
+	ASSERT_TRUE(topic_filter_covers("sensor/+/temp", "sensor/room1/temp"));
+	ASSERT_TRUE(topic_filter_covers("hot/#", "hot/#"));
+	ASSERT_TRUE(!topic_filter_covers("sensor/+/temp", "sensor/#"));
+	ASSERT_TRUE(!topic_filter_covers("sensor/room1/temp", "sensor/+/temp"));
+	ASSERT_TRUE(!topic_filter_covers("sensor/+", "sensor/+/temp"));
+}
+
+void test_retained_history() {
+	init_topic_table();
+	topic_retain_configure("config/#", 1);
+	topic_retain_configure("state/+", 2);
+
+	topic_retain_store("config/a", 0, "1", 1);
+	topic_retain_store("config/a", 0, "2", 1);
+	topic_retain_store("config/b/c", 1, "3", 1);
+	topic_retain_store("state/x", 0, "4", 1);
+	topic_retain_store("state/x", 0, "5", 1);
+	topic_retain_store("state/x", 0, "6", 1);
+	topic_retain_store("other/y", 0, "7", 1);
+
+	replay("config/#");
+	ASSERT_EQ(replay_count, 2);
+	ASSERT_TRUE(strstr(replayed, "config/a=2;") != NULL);
+	ASSERT_TRUE(strstr(replayed, "config/b/c=3;") != NULL);
+
+	replay("state/+");
+	ASSERT_STR_EQ(replayed, "state/x=5;state/x=6;");
+
+	replay("other/y");
+	ASSERT_EQ(replay_count, 0);
+
+	// an empty payload clears the topic's history
+	topic_retain_store("state/x", 0, NULL, 0);
+	replay("#");
+	ASSERT_EQ(replay_count, 2);
+
+	free_topic_table();
+}
+
+void test_retained_budget() {
+	init_topic_table();
+	topic_retain_configure("#", 100);
+
+	char payload[100];
+	memset(payload, 'x', sizeof(payload));
+	for (int i = 0; i < 50; ++i) {
+		char topic[32];
+		snprintf(topic, sizeof(topic), "t/%d", i);
+		topic_retain_store(topic, 0, payload, sizeof(payload));
+	}
+
+	topic_retain_set_budget(1000);
+	replay("#");
+	ASSERT_TRUE(replay_count > 0 && replay_count < 10);
+	ASSERT_TRUE(strstr(replayed, "t/49=") != NULL);
+	ASSERT_TRUE(strstr(replayed, "t/0=") == NULL);
+
+	topic_retain_set_budget(RETAIN_DEFAULT_BUDGET);
+	free_topic_table();
+}
+
+void test_retained_topics_pruned() {
+	init_topic_table();
+	topic_retain_configure("#", 1);
+	subscribe_topic("dev/+/temp", 1);
+	size_t trie_len = topic_table_snapshot_write(NULL);
+
+	// every retained topic is distinct, its nodes count against the budget
+	topic_retain_set_budget(2000);
+	for (int i = 0; i < 500; ++i) {
+		char topic[64];
+		snprintf(topic, sizeof(topic), "dev/%d/unit/%d/temp", i, i);
+		topic_retain_store(topic, 0, "x", 1);
+		ASSERT_TRUE(topic_retain_usage() <= 2000);
+	}
+	replay("#");
+	ASSERT_TRUE(replay_count > 0 && replay_count < 20);
+	ASSERT_TRUE(strstr(replayed, "dev/499/unit/499/temp=x;") != NULL);
+
+	// retained topics never grow the subscription trie
+	ASSERT_EQ(topic_table_snapshot_write(NULL), trie_len);
+
+	// evicting or clearing the last message of a topic frees its nodes
+	topic_retain_set_budget(0);
+	ASSERT_EQ(topic_retain_usage(), 0);
+	topic_retain_set_budget(RETAIN_DEFAULT_BUDGET);
+	topic_retain_store("a/b/c", 0, "1", 1);
+	ASSERT_TRUE(topic_retain_usage() > 0);
+	topic_retain_store("a/b/c", 0, NULL, 0);
+	topic_retain_store("a/b/never", 0, NULL, 0);
+	ASSERT_EQ(topic_retain_usage(), 0);
+	replay("#");
+	ASSERT_EQ(replay_count, 0);
+
+	free_topic_table();
+}
+
+void test_snapshot_roundtrip() {
+	init_topic_table();
+	uint32_t sub1 = 1, sub2 = 2, sub3 = 3;
+
+	subscribe_topic_qos("sensor/temperature/room1", sub1, 1);
+	subscribe_topic("sensor/+/room1", sub2);
+
+	size_t len = topic_table_snapshot_write(NULL);
+	uint8_t* image = malloc(len);
+	ASSERT_EQ(topic_table_snapshot_write(image), len);
+	free_topic_table();
+
+	init_topic_table();
+	ASSERT_EQ(topic_table_snapshot_adopt(image, len), 0);
+
+	SubscriberList* list = get_matching_subscribers("sensor/temperature/room1");
+	ASSERT_EQ(list->count, 2);
+	for (size_t i = 0; i < list->count; ++i) {
+		if (list->items[i].session == sub1) ASSERT_EQ(list->items[i].qos, 1);
+	}
+	free_subscriber_list(list);
+
+	// growing a node that lives in the image copies its child array out
+	subscribe_topic("sensor/humidity/room1", sub3);
+	list = get_matching_subscribers("sensor/humidity/room1");
+	ASSERT_EQ(list->count, 2);
+	free_subscriber_list(list);
+
+	// so does adding a subscriber to a node whose subscriber array is in the image
+	subscribe_topic("sensor/+/room1", sub3);
+	list = get_matching_subscribers("sensor/temperature/room1");
+	ASSERT_EQ(list->count, 3);
+	free_subscriber_list(list);
+
+	free_topic_table();
+	free(image);
+}
+
+void test_many_subscribers_one_filter() {
+	init_topic_table();
+
+	for (uint32_t id = 1; id <= 1000; ++id) {
+		ASSERT_EQ(subscribe_topic_qos("fanout/+", id, id % 3), 0);
+	}
+	subscribe_topic_qos("fanout/+", 500, 2);		// resubscribing updates the QoS only
+
+	SubscriberList* list = get_matching_subscribers("fanout/x");
+	ASSERT_EQ(list->count, 1000);
+	for (size_t i = 0; i < list->count; ++i) {
+		uint32_t id = list->items[i].session;
+		ASSERT_EQ(list->items[i].qos, id == 500 ? 2 : id % 3);
+	}
+	free_subscriber_list(list);
+
+	free_topic_table();
+}
+
+static bool is_odd(uint32_t session, void* ctx) {
+	(void)ctx;
+	return session % 2 == 1;
+}
+
+void test_remove_sessions() {
+	init_topic_table();
+
+	for (uint32_t id = 1; id <= 10; ++id) {
+		subscribe_topic_qos("a/b", id, 1);
+		subscribe_topic_qos("a/#", id, 0);
+	}
+	subscribe_topic("c", 3);
+
+	// one walk removes every subscription of the selected sessions
+	ASSERT_EQ(topic_table_remove_sessions(is_odd, NULL), 11);
+
+	SubscriberList* list = get_matching_subscribers("a/b");
+	ASSERT_EQ(list->count, 5);
+	for (size_t i = 0; i < list->count; ++i) {
+		ASSERT_EQ(list->items[i].session % 2, 0);
+		ASSERT_EQ(list->items[i].qos, 1);
+	}
+	free_subscriber_list(list);
+
+	list = get_matching_subscribers("c");
+	ASSERT_EQ(list->count, 0);
+	free_subscriber_list(list);
+
+	// emptied filters accept new subscribers
+	ASSERT_EQ(subscribe_topic("c", 4), 0);
+	list = get_matching_subscribers("c");
+	ASSERT_EQ(list->count, 1);
+	free_subscriber_list(list);
+
+	free_topic_table();
+}
+
+static size_t fake_load(uint32_t session, void* ctx) {
+	(void)ctx;
+	return session == 32 ? 0 : 5;
+}
+
+static bool is_twelve(uint32_t session, void* ctx) {
+	(void)ctx;
+	return session == 12;
+}
+
+void test_shared_groups() {
+	init_topic_table();
+	topic_share_configure("sticky", SHARE_KEY_HASH);
+	topic_share_configure("idle", SHARE_LEAST_LOADED);
+	topic_share_set_load_probe(fake_load, NULL);
+
+	for (uint32_t id = 10; id < 13; ++id) {
+		ASSERT_EQ(subscribe_topic_qos("$share/workers/jobs/#", id, 1), 0);
+		ASSERT_EQ(subscribe_topic("$share/sticky/jobs/#", id + 10), 0);
+		ASSERT_EQ(subscribe_topic("$share/idle/jobs/#", id + 20), 0);
+	}
+	subscribe_topic("jobs/audit", 99);
+	ASSERT_EQ(subscribe_topic("$share/nofilter", 1), -1);
+	ASSERT_EQ(subscribe_topic("$share//jobs", 1), -1);
+
+	// one member of each group per message, plus the plain subscriber
+	size_t per_member[3] = {0};
+	uint32_t sticky = 0;
+	for (int n = 0; n < 30; ++n) {
+		SubscriberList* list = get_matching_subscribers("jobs/audit");
+		ASSERT_EQ(list->count, 4);
+		for (size_t i = 0; i < list->count; ++i) {
+			uint32_t id = list->items[i].session;
+			if (id >= 10 && id < 13) {
+				per_member[id - 10]++;
+				ASSERT_EQ(list->items[i].qos, 1);
+			} else if (id >= 20 && id < 23) {
+				if (sticky == 0) sticky = id;
+				ASSERT_EQ(id, sticky);							// a topic stays on one member
+			} else if (id >= 30 && id < 33) {
+				ASSERT_EQ(id, 32);									// the only idle member
+			} else {
+				ASSERT_EQ(id, 99);
+			}
+		}
+		free_subscriber_list(list);
+	}
+	for (int i = 0; i < 3; ++i) ASSERT_EQ(per_member[i], 10);	// round-robin
+
+	// the shared group survives a snapshot
+	size_t len = topic_table_snapshot_write(NULL);
+	uint8_t* image = malloc(len);
+	ASSERT_EQ(topic_table_snapshot_write(image), len);
+	free_topic_table();
+
+	init_topic_table();
+	ASSERT_EQ(topic_table_snapshot_adopt(image, len), 0);
+	SubscriberList* list = get_matching_subscribers("jobs/x");
+	ASSERT_EQ(list->count, 3);
+	free_subscriber_list(list);
+
+	// removing members leaves the rest of the group serving
+	ASSERT_EQ(topic_table_remove_sessions(is_twelve, NULL), 1);
+	for (int n = 0; n < 4; ++n) {
+		list = get_matching_subscribers("jobs/x");
+		for (size_t i = 0; i < list->count; ++i) ASSERT_TRUE(list->items[i].session != 12);
+		free_subscriber_list(list);
+	}
+
+	free_topic_table();
+	free(image);
+}
+
 int main() {
 
   RUN_TEST(test_basic_subscribe_and_match);
 	RUN_TEST(test_multi_topic_match_deduplication);
+	RUN_TEST(test_filter_matching);
+	RUN_TEST(test_retained_history);
+	RUN_TEST(test_retained_budget);
+	RUN_TEST(test_retained_topics_pruned);
+	RUN_TEST(test_snapshot_roundtrip);
+	RUN_TEST(test_many_subscribers_one_filter);
+	RUN_TEST(test_remove_sessions);
+	RUN_TEST(test_shared_groups);
 
 
   return 0;